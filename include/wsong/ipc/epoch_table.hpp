@@ -0,0 +1,385 @@
+#pragma once
+
+/**
+ * @file    epoch_table.hpp
+ * @brief   Epoch-based publication of large read-mostly tables in shared memory.
+ *
+ * Reference data of tens of megabytes changes a few times a day, but is read by many processes on every message. The
+ * epoch table keeps a few versions of such a table in a shared data segment. A writer builds the next version in a
+ * free version slot off to the side with `prepare()`, and `publish()` switches the current version atomically. The
+ * readers never block: `read_lock()` returns the current version, which stays valid until `read_unlock()`, even if a
+ * newer version is published meanwhile. A retired version is reclaimed once every reader that might still see it has
+ * left its read section.
+ *
+ * A reader announces a read section in its own cacheline by moving its sequence number to odd, and back to even when
+ * it leaves, so `read_lock()` costs a store to that cacheline and one load of the current version, with no atomic
+ * read-modify-write and no fence. The store-load ordering the protocol needs is provided on the writer side instead:
+ * after switching the version, `publish()` issues a global `membarrier(2)`, so that every reader either has its odd
+ * sequence number visible to the writer, or loads the new version. The writer records the sequence numbers, and the
+ * retired version is free again when each reader that was odd has moved on. On kernels without
+ * `MEMBARRIER_CMD_GLOBAL`, or once a writer is denied the system call, e.g. by a seccomp policy, the readers fall back
+ * to a full fence in `read_lock()`.
+ *
+ * An instance is one client: use an instance per reading thread. The read sections of an instance nest. Publishing
+ * is serialized by a robust mutex, and a dead client is reclaimed like in the `ObjectStore`, so a reader or a writer
+ * crashing does not pin a version forever.
+ *
+ * The table consists of two sys-V shared memory segments. The metadata segment, found by the key, is laid out as:
+ * | EpochTableHeader (4KB) | client table | version slot table | sequence number snapshots per slot and client |
+ * and the data segment is an array of `num_slots` version slots of `slot_size` bytes.
+ */
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <pthread.h>
+#include <cinttypes>
+#include <chrono>
+#include <memory>
+#include <atomic>
+
+#include <wsong/common.h>
+#include <wsong/exceptions.hpp>
+
+/**
+ * @def WS_EPOCH_TABLE_MAX_SLOTS
+ * @brief   The maximum number of version slots in an epoch table.
+ */
+#define WS_EPOCH_TABLE_MAX_SLOTS        (256)
+/**
+ * @def WS_EPOCH_TABLE_MAX_CLIENTS
+ * @brief   The maximum number of clients attached to an epoch table at the same time.
+ */
+#define WS_EPOCH_TABLE_MAX_CLIENTS      (4096)
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @struct epoch_table_attr_t epoch_table.hpp <wsong/ipc/epoch_table.hpp>
+ */
+struct epoch_table_attr_t {
+    /**
+     * The key of the metadata sys-V shared memory, also used as the key of the epoch table.
+     */
+    key_t       key;
+    /**
+     * The id of the metadata sys-V shared memory.
+     */
+    int         id;
+    /**
+     * The id of the data sys-V shared memory.
+     */
+    int         data_id;
+    /**
+     * The size of the page of the data segment.
+     */
+    uint32_t    page_size;
+    /**
+     * The capacity of a version slot in bytes, rounded up to the page size.
+     */
+    uint64_t    slot_size;
+    /**
+     * The number of version slots, at least 2 and no more than `WS_EPOCH_TABLE_MAX_SLOTS`: the current version, the
+     * one being prepared, and the retired ones still read.
+     */
+    uint32_t    num_slots;
+    /**
+     * The maximum number of clients, no more than `WS_EPOCH_TABLE_MAX_CLIENTS`.
+     */
+    uint32_t    max_clients;
+    /**
+     * Description of the epoch table.
+     */
+    char        description[256];
+};
+
+/**
+ * @typedef struct epoch_table_attr_t EpochTableAttribute
+ */
+using EpochTableAttribute = struct epoch_table_attr_t;
+
+/**
+ * union epoch_table_header_t epoch_table.hpp <wsong/ipc/epoch_table.hpp>
+ */
+union epoch_table_header_t {
+    /**
+     * The epoch table information;
+     */
+    struct {
+        EpochTableAttribute     attribute WS_CL_ALIGNED;
+        /**
+         * The current version in the higher 56 bits and its slot in the lower 8 bits. Version 0 means none.
+         */
+        std::atomic<uint64_t>   current WS_CL_ALIGNED;
+        /**
+         * The readers need a full fence, because the kernel does not support `MEMBARRIER_CMD_GLOBAL`, or a writer was
+         * denied it. It shares the cacheline with `current`, so checking it costs no extra cache miss.
+         */
+        std::atomic<uint32_t>   reader_fence;
+        /**
+         * The number of versions published.
+         */
+        std::atomic<uint64_t>   published WS_CL_ALIGNED;
+        /**
+         * The number of retired versions reclaimed.
+         */
+        std::atomic<uint64_t>   reclaimed;
+        /**
+         * The robust process-shared mutex serializing the writers, the client registration, and `reclaim()`.
+         */
+        pthread_mutex_t         mutex WS_CL_ALIGNED;
+    }   info WS_CL_ALIGNED;
+    /**
+     * The placeholder for 4K alignment.
+     */
+    uint8_t __bytes__[4096];
+};
+
+/**
+ * @typedef union epoch_table_header_t EpochTableHeader
+ */
+using EpochTableHeader = union epoch_table_header_t;
+
+/**
+ * @struct epoch_table_version_t epoch_table.hpp <wsong/ipc/epoch_table.hpp>
+ * @brief A version of the table, valid until `read_unlock()`.
+ */
+struct epoch_table_version_t {
+    /**
+     * The content, or nullptr if no version has been published.
+     */
+    const void* data;
+    /**
+     * The size of the content in bytes.
+     */
+    uint64_t    size;
+    /**
+     * The version number, starting from 1.
+     */
+    uint64_t    version;
+};
+
+/**
+ * @typedef struct epoch_table_version_t EpochTableVersion
+ */
+using EpochTableVersion = struct epoch_table_version_t;
+
+/**
+ * @struct epoch_table_stats_t epoch_table.hpp <wsong/ipc/epoch_table.hpp>
+ */
+struct epoch_table_stats_t {
+    /**
+     * The current version, 0 if none.
+     */
+    uint64_t    version;
+    /**
+     * The size of the current version.
+     */
+    uint64_t    size;
+    /**
+     * The number of versions published.
+     */
+    uint64_t    published;
+    /**
+     * The number of retired versions reclaimed.
+     */
+    uint64_t    reclaimed;
+    /**
+     * The number of free version slots.
+     */
+    uint32_t    free_slots;
+    /**
+     * The number of version slots being prepared.
+     */
+    uint32_t    preparing_slots;
+    /**
+     * The number of retired version slots waiting for their readers.
+     */
+    uint32_t    retired_slots;
+    /**
+     * The number of attached clients.
+     */
+    uint32_t    clients;
+    /**
+     * The number of clients in a read section.
+     */
+    uint32_t    reading_clients;
+};
+
+/**
+ * @typedef struct epoch_table_stats_t EpochTableStats
+ */
+using EpochTableStats = struct epoch_table_stats_t;
+
+/**
+ * @class EpochTable epoch_table.hpp <wsong/ipc/epoch_table.hpp>
+ * @brief The epoch table IPC. An instance is used by a single thread.
+ */
+class EpochTable {
+private:
+    /**
+     * The pointer to the epoch table header.
+     */
+    const EpochTableHeader* const   info_ptr;
+    /**
+     * The pointer to the data segment.
+     */
+    void* const                     data_ptr;
+    /**
+     * The data segment is attached read-only.
+     */
+    const bool                      read_only;
+    /**
+     * The client slot of this instance.
+     */
+    uint32_t                        client;
+    /**
+     * The sequence number of this client, odd in a read section.
+     */
+    uint64_t                        sequence;
+    /**
+     * The depth of the nested read sections.
+     */
+    uint32_t                        nesting;
+    /**
+     * The version returned by the outermost `read_lock()`.
+     */
+    EpochTableVersion               reading;
+    /**
+     * The version slot being prepared by this instance, `num_slots` if none.
+     */
+    uint32_t                        preparing;
+
+    /**
+     * @fn void lock()
+     * @brief   Lock the mutex, and recover it if the owner died.
+     */
+    WS_DLL_PRIVATE void lock();
+    /**
+     * @fn void unlock()
+     * @brief   Unlock the mutex.
+     */
+    WS_DLL_PRIVATE void unlock();
+    /**
+     * @fn bool barrier()
+     * @brief   Order the switch of the current version before the reads of the reader sequence numbers, on all cpus.
+     * If `membarrier(2)` fails, the readers are switched to fencing on their side instead.
+     * @return  False if the readers already in `read_lock()` may not be ordered, because the switch just happened.
+     */
+    WS_DLL_PRIVATE bool barrier();
+    /**
+     * @fn uint32_t reclaim_slots()
+     * @brief   Free the retired version slots whose readers have all moved on. Called with the mutex held.
+     * @return  The number of slots freed.
+     */
+    WS_DLL_PRIVATE uint32_t reclaim_slots();
+    /**
+     * @fn void reclaim_client(uint32_t client)
+     * @brief   Leave the read section of a client, free the slots it was preparing, and free the client slot. Called
+     * with the mutex held.
+     * @param[in]   client      The client slot.
+     */
+    WS_DLL_PRIVATE void reclaim_client(uint32_t client);
+
+public:
+    /**
+     * @fn EpochTable(void* mem_ptr, void* data_ptr, bool read_only)
+     * @brief   Constructor. It reclaims the dead clients and registers a client slot.
+     * @param[in]   mem_ptr     The pointer to the metadata shared memory.
+     * @param[in]   data_ptr    The pointer to the data shared memory.
+     * @param[in]   read_only   The data segment is attached read-only.
+     */
+    WS_DLL_PRIVATE EpochTable(void* mem_ptr, void* data_ptr, bool read_only);
+    /**
+     * @fn virtual ~EpochTable()
+     * @brief   destructor. It leaves the read section and drops the version being prepared.
+     */
+    WS_DLL_PUBLIC virtual ~EpochTable();
+    /**
+     * @fn EpochTableAttribute attribute()
+     * @brief   Get attribute
+     * @return  An attribute object of type `EpochTableAttribute`.
+     */
+    WS_DLL_PUBLIC EpochTableAttribute attribute();
+    /**
+     * @fn EpochTableStats stats()
+     * @brief   Get the statistics.
+     * @return  The statistics.
+     */
+    WS_DLL_PUBLIC EpochTableStats stats();
+    /**
+     * @fn EpochTableVersion read_lock()
+     * @brief   Enter a read section and get the current version. It never blocks.
+     * @return  The current version, valid until the matching `read_unlock()`. A nested call returns the same version.
+     */
+    WS_DLL_PUBLIC EpochTableVersion read_lock();
+    /**
+     * @fn void read_unlock()
+     * @brief   Leave a read section.
+     */
+    WS_DLL_PUBLIC void read_unlock();
+    /**
+     * @fn void* prepare(uint64_t size, uint64_t timeout_ns)
+     * @brief   Take a free version slot to build the next version in. While none is free, it reclaims the dead clients
+     * and waits for the readers of the retired versions to move on.
+     * @param[in]   size        The size of the next version, no more than `slot_size`.
+     * @param[in]   timeout_ns  Timeout in nanoseconds, if specified with 0, it returns immediately or
+     *                          throw an exception on failure.
+     * @return  The writable address of the version slot.
+     */
+    WS_DLL_PUBLIC void* prepare(uint64_t size, uint64_t timeout_ns);
+    /**
+     * @fn uint64_t publish()
+     * @brief   Make the prepared version the current one, and retire the previous one.
+     * @return  The new version number.
+     */
+    WS_DLL_PUBLIC uint64_t publish();
+    /**
+     * @fn void abandon()
+     * @brief   Drop the prepared version without publishing it.
+     */
+    WS_DLL_PUBLIC void abandon();
+    /**
+     * @fn uint32_t reclaim()
+     * @brief   Reclaim the clients whose process is gone, and the retired versions no reader is in.
+     * @return  The number of retired versions reclaimed.
+     */
+    WS_DLL_PUBLIC uint32_t reclaim();
+    /**
+     * @fn template <class Rep, class Period> void* prepare(uint64_t size, const std::chrono::duration<Rep, Period>& timeout)
+     * @brief   Take a free version slot. This is a wrapper function for easy timeout settings.
+     * @tparam      Rep         An arthmetic type representing the number of ticks.
+     * @tparam      Period      An std::ratio type representing the tick period.
+     * @param[in]   size        The size of the next version.
+     * @param[in]   timeout     Timeout
+     * @return  The writable address of the version slot.
+     */
+    template <class Rep, class Period>
+    void* prepare(uint64_t size, const std::chrono::duration<Rep, Period>& timeout) {
+        return this->prepare(size,std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count());
+    }
+    /**
+     *  @fn static key_t create_epoch_table(const EpochTableAttribute& attribute)
+     *  @brief  Create a new epoch table. Like `RingBuffer::create_ring_buffer`, the memory is allocated and pinned.
+     *  @param[in]  attribute       The attribute of the epoch table.
+     *  @return     The key of a successfully created epoch table.
+     */
+    WS_DLL_PUBLIC static key_t create_epoch_table(const EpochTableAttribute& attribute);
+    /**
+     * @fn static void delete_epoch_table(const key_t key)
+     * @brief   Delete an epoch table with both segments. Caution: we do NOT detect active users.
+     * @param[in]   key         The key of the epoch table to remove.
+     */
+    WS_DLL_PUBLIC static void delete_epoch_table(const key_t key);
+    /**
+     * @fn static std::unique_ptr<EpochTable> get_epoch_table(const key_t key, bool read_only)
+     * @brief   Attach to an epoch table using the key.
+     * @param[in]   key         The key of the epoch table to get.
+     * @param[in]   read_only   Attach the data segment read-only. Such a client cannot publish.
+     * @return      A unique pointer to the epoch table.
+     */
+    WS_DLL_PUBLIC static std::unique_ptr<EpochTable> get_epoch_table(const key_t key, bool read_only = false);
+};
+
+}
+}
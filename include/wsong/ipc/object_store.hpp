@@ -0,0 +1,342 @@
+#pragma once
+
+/**
+ * @file    object_store.hpp
+ * @brief   Shared-memory object store with reference counted immutable buffers passed by handle.
+ *
+ * Payloads of hundreds of kilobytes to megabytes do not fit in ring buffer entries, and copying them between processes
+ * dominates the CPU. The object store keeps them in a shared data segment instead: a producer creates an object,
+ * fills it in place, seals it, and passes the 8-byte `ObjectHandle` to the consumers, e.g. through a `RingBuffer`. The
+ * consumers read the object in place, with the data segment attached read-only if they like.
+ *
+ * Objects are reference counted. A handle stands for one reference, held by the client (an attached `ObjectStore`
+ * instance) encoded in it. `acquire()` makes a new reference, `release()` drops one, and `adopt()` moves the reference
+ * of a received handle to the caller. The object is freed when the last reference is dropped. The store also knows
+ * how many references each client holds, so `reclaim()` can drop the references of the clients whose process is
+ * gone. A reference in flight, i.e. in a ring buffer but not yet adopted, belongs to the sender until it is adopted.
+ *
+ * The store consists of two sys-V shared memory segments. The metadata segment, found by the key, is laid out as:
+ * | ObjectStoreHeader (4KB) | client table | object table | reference counts per client | block bitmap |
+ * and the data segment is an array of `num_blocks` blocks of `block_size` bytes. Objects take contiguous blocks.
+ */
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <pthread.h>
+#include <cinttypes>
+#include <memory>
+#include <atomic>
+
+#include <wsong/common.h>
+#include <wsong/exceptions.hpp>
+
+/**
+ * @def WS_OBJECT_STORE_MAX_CLIENTS
+ * @brief   The maximum number of clients attached to an object store at the same time.
+ */
+#define WS_OBJECT_STORE_MAX_CLIENTS     (256)
+/**
+ * @def WS_OBJECT_STORE_MAX_OBJECTS
+ * @brief   The maximum number of objects in an object store.
+ */
+#define WS_OBJECT_STORE_MAX_OBJECTS     (1u<<24)
+/**
+ * @def WS_OBJECT_STORE_INVALID_HANDLE
+ * @brief   The invalid object handle.
+ */
+#define WS_OBJECT_STORE_INVALID_HANDLE  (0ull)
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @struct object_store_attr_t object_store.hpp <wsong/ipc/object_store.hpp>
+ */
+struct object_store_attr_t {
+    /**
+     * The key of the metadata sys-V shared memory, also used as the key of the object store.
+     */
+    key_t       key;
+    /**
+     * The id of the metadata sys-V shared memory.
+     */
+    int         id;
+    /**
+     * The id of the data sys-V shared memory.
+     */
+    int         data_id;
+    /**
+     * The size of the page of the data segment.
+     */
+    uint32_t    page_size;
+    /**
+     * The allocation unit in bytes, must be power-of-two and a multiple of the cacheline size.
+     */
+    uint32_t    block_size;
+    /**
+     * The number of blocks in the data segment.
+     */
+    uint32_t    num_blocks;
+    /**
+     * The maximum number of objects.
+     */
+    uint32_t    max_objects;
+    /**
+     * The maximum number of clients, no more than `WS_OBJECT_STORE_MAX_CLIENTS`.
+     */
+    uint32_t    max_clients;
+    /**
+     * Description of the object store.
+     */
+    char        description[256];
+};
+
+/**
+ * @typedef struct object_store_attr_t ObjectStoreAttribute
+ */
+using ObjectStoreAttribute = struct object_store_attr_t;
+
+/**
+ * union object_store_header_t object_store.hpp <wsong/ipc/object_store.hpp>
+ */
+union object_store_header_t {
+    /**
+     * The object store information;
+     */
+    struct {
+        ObjectStoreAttribute    attribute WS_CL_ALIGNED;
+        /**
+         * The robust process-shared mutex protecting the allocation of object slots and blocks.
+         */
+        pthread_mutex_t         mutex WS_CL_ALIGNED;
+        /**
+         * The number of live objects.
+         */
+        std::atomic<uint32_t>   objects;
+        /**
+         * The number of allocated blocks.
+         */
+        std::atomic<uint32_t>   used_blocks;
+        /**
+         * Where the next block search starts.
+         */
+        uint32_t                next_block;
+        /**
+         * Where the next object slot search starts.
+         */
+        uint32_t                next_object;
+    }   info WS_CL_ALIGNED;
+    /**
+     * The placeholder for 4K alignment.
+     */
+    uint8_t __bytes__[4096];
+};
+
+/**
+ * @typedef union object_store_header_t ObjectStoreHeader
+ */
+using ObjectStoreHeader = union object_store_header_t;
+
+/**
+ * @typedef ObjectHandle
+ * @brief   A reference to an object: the object slot in the lower 24 bits, the client holding the reference in the
+ *          next 8 bits, and the generation of the slot in the higher 32 bits. The generation is never 0, so 0 is
+ *          never a valid handle.
+ */
+using ObjectHandle = uint64_t;
+
+/**
+ * @struct object_store_stats_t object_store.hpp <wsong/ipc/object_store.hpp>
+ */
+struct object_store_stats_t {
+    /**
+     * The number of live objects.
+     */
+    uint32_t    objects;
+    /**
+     * The number of allocated blocks.
+     */
+    uint32_t    used_blocks;
+    /**
+     * The number of attached clients.
+     */
+    uint32_t    clients;
+};
+
+/**
+ * @typedef struct object_store_stats_t ObjectStoreStats
+ */
+using ObjectStoreStats = struct object_store_stats_t;
+
+/**
+ * @class ObjectStore object_store.hpp <wsong/ipc/object_store.hpp>
+ * @brief The object store IPC. All methods are thread-safe.
+ */
+class ObjectStore {
+private:
+    /**
+     * The pointer to the object store header.
+     */
+    const ObjectStoreHeader* const  info_ptr;
+    /**
+     * The pointer to the data segment.
+     */
+    void* const                     data_ptr;
+    /**
+     * The data segment is attached read-only.
+     */
+    const bool                      read_only;
+    /**
+     * The client slot of this instance.
+     */
+    uint32_t                        client;
+
+    /**
+     * @fn void lock()
+     * @brief   Lock the allocation mutex, and recover it if the owner died.
+     */
+    WS_DLL_PRIVATE void lock();
+    /**
+     * @fn void unlock()
+     * @brief   Unlock the allocation mutex.
+     */
+    WS_DLL_PRIVATE void unlock();
+    /**
+     * @fn void free_object(uint32_t object)
+     * @brief   Return the blocks and the slot of an object whose last reference is dropped.
+     * @param[in]   object      The object slot.
+     */
+    WS_DLL_PRIVATE void free_object(uint32_t object);
+    /**
+     * @fn void drop_references(uint32_t object, uint32_t count)
+     * @brief   Drop references to an object, and free it when none is left.
+     * @param[in]   object      The object slot.
+     * @param[in]   count       The number of references to drop.
+     */
+    WS_DLL_PRIVATE void drop_references(uint32_t object, uint32_t count);
+    /**
+     * @fn void reclaim_client(uint32_t client)
+     * @brief   Drop all references held by a client and free the client slot.
+     * @param[in]   client      The client slot.
+     */
+    WS_DLL_PRIVATE void reclaim_client(uint32_t client);
+    /**
+     * @fn uint32_t validate(ObjectHandle handle)
+     * @brief   Check that the handle refers to a live object.
+     * @param[in]   handle      The handle.
+     * @return  The object slot.
+     */
+    WS_DLL_PRIVATE uint32_t validate(ObjectHandle handle);
+
+public:
+    /**
+     * @fn ObjectStore(void* mem_ptr, void* data_ptr, bool read_only)
+     * @brief   Constructor. It reclaims the dead clients and registers a client slot.
+     * @param[in]   mem_ptr     The pointer to the metadata shared memory.
+     * @param[in]   data_ptr    The pointer to the data shared memory.
+     * @param[in]   read_only   The data segment is attached read-only.
+     */
+    WS_DLL_PRIVATE ObjectStore(void* mem_ptr, void* data_ptr, bool read_only);
+    /**
+     * @fn virtual ~ObjectStore()
+     * @brief   destructor. It drops the references still held by this client.
+     */
+    WS_DLL_PUBLIC virtual ~ObjectStore();
+    /**
+     * @fn ObjectStoreAttribute attribute()
+     * @brief   Get attribute
+     * @return  An attribute object of type `ObjectStoreAttribute`.
+     */
+    WS_DLL_PUBLIC ObjectStoreAttribute attribute();
+    /**
+     * @fn ObjectStoreStats stats()
+     * @brief   Get the usage statistics.
+     * @return  The statistics.
+     */
+    WS_DLL_PUBLIC ObjectStoreStats stats();
+    /**
+     * @fn ObjectHandle create(uint64_t size)
+     * @brief   Create a writable object. The caller holds the only reference.
+     * @param[in]   size        The size of the object in bytes.
+     * @return  The handle of the object.
+     */
+    WS_DLL_PUBLIC ObjectHandle create(uint64_t size);
+    /**
+     * @fn void* data(ObjectHandle handle)
+     * @brief   Get the writable address of an object before it is sealed.
+     * @param[in]   handle      The handle.
+     * @return  The address of the object in the data segment.
+     */
+    WS_DLL_PUBLIC void* data(ObjectHandle handle);
+    /**
+     * @fn void seal(ObjectHandle handle)
+     * @brief   Seal an object. It is immutable since then and readable through `get()`.
+     * @param[in]   handle      The handle.
+     */
+    WS_DLL_PUBLIC void seal(ObjectHandle handle);
+    /**
+     * @fn const void* get(ObjectHandle handle)
+     * @brief   Get the address of a sealed object. It is valid until the reference is released.
+     * @param[in]   handle      The handle.
+     * @return  The address of the object in the data segment.
+     */
+    WS_DLL_PUBLIC const void* get(ObjectHandle handle);
+    /**
+     * @fn uint64_t size(ObjectHandle handle)
+     * @brief   Get the size of an object.
+     * @param[in]   handle      The handle.
+     * @return  The size in bytes.
+     */
+    WS_DLL_PUBLIC uint64_t size(ObjectHandle handle);
+    /**
+     * @fn ObjectHandle acquire(ObjectHandle handle)
+     * @brief   Make a new reference to the object, held by the caller.
+     * @param[in]   handle      A live reference to the object.
+     * @return  The new reference.
+     */
+    WS_DLL_PUBLIC ObjectHandle acquire(ObjectHandle handle);
+    /**
+     * @fn ObjectHandle adopt(ObjectHandle handle)
+     * @brief   Move a reference, typically received from another process, to the caller. It throws if the reference
+     *          has been reclaimed since the sender died.
+     * @param[in]   handle      The received reference.
+     * @return  The same reference, now held by the caller.
+     */
+    WS_DLL_PUBLIC ObjectHandle adopt(ObjectHandle handle);
+    /**
+     * @fn void release(ObjectHandle handle)
+     * @brief   Drop a reference. The object is freed with its last reference.
+     * @param[in]   handle      The reference.
+     */
+    WS_DLL_PUBLIC void release(ObjectHandle handle);
+    /**
+     * @fn uint32_t reclaim()
+     * @brief   Drop the references held by clients whose process is gone. It is also called on attach.
+     * @return  The number of clients reclaimed.
+     */
+    WS_DLL_PUBLIC uint32_t reclaim();
+    /**
+     *  @fn static key_t create_object_store(const ObjectStoreAttribute& attribute)
+     *  @brief  Create a new object store. Like `RingBuffer::create_ring_buffer`, the memory is allocated and pinned.
+     *  @param[in]  attribute       The attribute of the object store.
+     *  @return     The key of a successfully created object store.
+     */
+    WS_DLL_PUBLIC static key_t create_object_store(const ObjectStoreAttribute& attribute);
+    /**
+     * @fn static void delete_object_store(const key_t key)
+     * @brief   Delete an object store with both segments. Caution: we do NOT detect active users.
+     * @param[in]   key         The key of the object store to remove.
+     */
+    WS_DLL_PUBLIC static void delete_object_store(const key_t key);
+    /**
+     * @fn static std::unique_ptr<ObjectStore> get_object_store(const key_t key, bool read_only)
+     * @brief   Attach to an object store using the key.
+     * @param[in]   key         The key of the object store to get.
+     * @param[in]   read_only   Attach the data segment read-only. Such a client cannot create objects.
+     * @return      A unique pointer to the object store.
+     */
+    WS_DLL_PUBLIC static std::unique_ptr<ObjectStore> get_object_store(const key_t key, bool read_only = false);
+};
+
+}
+}
@@ -0,0 +1,279 @@
+#pragma once
+
+/**
+ * @file    priority_ring.hpp
+ * @brief   A ring buffer with multiple priority lanes in one shared memory segment.
+ *
+ * Control messages (cancels, risk kills) should never wait behind thousands of bulk entries in the same ring buffer.
+ * The priority ring hosts several lanes, each of which is a ring buffer of its own, in one segment. Lane 0 has the
+ * highest priority. The producers pick the lane of each message; the consumer drains the lanes either by strict
+ * priority or by weighted round-robin. A summary word in the header keeps one bit per non-empty lane, so the consumer
+ * finds the next lane to serve with a single load instead of polling every lane.
+ *
+ * Segment layout:
+ * | PriorityRingHeader (4KB) | lane 0 | lane 1 | ... |
+ * and each lane is:
+ * | head cacheline | tail cacheline | lock cacheline | capacity * entry_size bytes |
+ */
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <cinttypes>
+#include <chrono>
+#include <memory>
+#include <atomic>
+
+#include <wsong/common.h>
+#include <wsong/exceptions.hpp>
+
+/**
+ * @def WS_PRIORITY_RING_MAX_LANES
+ * @brief   The maximum number of lanes in a priority ring, limited by the width of the summary word.
+ */
+#define WS_PRIORITY_RING_MAX_LANES      (64)
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @enum drain_policy_t
+ * @brief   How the consumer picks the next lane to serve.
+ */
+enum drain_policy_t : uint32_t {
+    /**
+     * Always serve the highest priority (lowest numbered) non-empty lane.
+     */
+    WS_DRAIN_STRICT = 0,
+    /**
+     * Serve the non-empty lanes in turn, up to `weights[lane]` entries per turn. Lanes with weight 0 are served by
+     * strict priority before any weighted lane, which is useful for a small urgent lane on top of weighted bulk lanes.
+     */
+    WS_DRAIN_WEIGHTED = 1,
+};
+
+/**
+ * @typedef enum drain_policy_t DrainPolicy
+ */
+using DrainPolicy = enum drain_policy_t;
+
+/**
+ * @struct priority_ring_attr_t priority_ring.hpp <wsong/ipc/priority_ring.hpp>
+ */
+struct priority_ring_attr_t {
+    /**
+     * The key of the underlying sys-V shared memory, also used as the key of the priority ring.
+     */
+    key_t       key;
+    /**
+     * The id of the underlying sys-V shared memory
+     */
+    int         id;
+    /**
+     * The size of the page of the shared memory for the priority ring.
+     */
+    uint32_t    page_size;
+    /**
+     * The number of lanes, no more than `WS_PRIORITY_RING_MAX_LANES`.
+     */
+    uint32_t    num_lanes;
+    /**
+     * Capacity is the number of entries in each lane. The maximum number of entries allowed is `capacity` - 1.
+     */
+    uint32_t    capacity;
+    /**
+     * The size of entry in the lanes.
+     */
+    uint16_t    entry_size;
+    /**
+     * Support multiple producers per lane. The consumer is always single.
+     */
+    bool        multiple_producer;
+    /**
+     * The drain policy.
+     */
+    DrainPolicy drain_policy;
+    /**
+     * The weight of each lane for `WS_DRAIN_WEIGHTED`, ignored by `WS_DRAIN_STRICT`.
+     */
+    uint32_t    weights[WS_PRIORITY_RING_MAX_LANES];
+    /**
+     * Description of the priority ring.
+     */
+    char        description[256];
+};
+
+/**
+ * @typedef struct priority_ring_attr_t PriorityRingAttribute
+ */
+using PriorityRingAttribute = struct priority_ring_attr_t;
+
+/**
+ * union priority_ring_header_t priority_ring.hpp <wsong/ipc/priority_ring.hpp>
+ */
+union priority_ring_header_t {
+    /**
+     * The priority ring information;
+     */
+    struct {
+        PriorityRingAttribute   attribute WS_CL_ALIGNED;
+        /**
+         * One bit per lane, set when the lane may be non-empty. A lane refilled while the consumer clears its bit
+         * may show clear until the consumer's next `consume()` re-checks it.
+         */
+        std::atomic<uint64_t>   nonempty WS_CL_ALIGNED;
+    }   info WS_CL_ALIGNED;
+    /**
+     * The placeholder for 4K alignment.
+     */
+    uint8_t __bytes__[4096];
+};
+
+/**
+ * @typedef union priority_ring_header_t PriorityRingHeader
+ */
+using PriorityRingHeader = union priority_ring_header_t;
+
+/**
+ * @class PriorityRing priority_ring.hpp <wsong/ipc/priority_ring.hpp>
+ * @brief The priority ring IPC. Each lane supports one or multiple producers; the ring supports one consumer.
+ */
+class PriorityRing {
+private:
+    /**
+     * The pointer to the priority ring header.
+     */
+    const PriorityRingHeader* const info_ptr;
+    /**
+     * The consumer's current lane for `WS_DRAIN_WEIGHTED`.
+     */
+    uint32_t                        current_lane;
+    /**
+     * The entries left in the current lane's turn for `WS_DRAIN_WEIGHTED`.
+     */
+    uint32_t                        credits;
+    /**
+     * The lanes with weight 0, served by strict priority in `WS_DRAIN_WEIGHTED`.
+     */
+    uint64_t                        strict_lanes;
+    /**
+     * The lanes whose bits the consumer cleared and has not seen set since; it re-checks their tails.
+     */
+    uint64_t                        cleared;
+
+    /**
+     * @fn uint32_t pick_lane(uint64_t nonempty)
+     * @brief   Pick the lane to serve next according to the drain policy.
+     * @param[in]   nonempty    A non-zero snapshot of the summary word.
+     * @return  The lane to serve.
+     */
+    WS_DLL_PRIVATE uint32_t pick_lane(uint64_t nonempty);
+
+public:
+    /**
+     * @fn PriorityRing(void* mem_ptr)
+     * @brief   Constructor
+     * @param[in]   mem_ptr     The pointer to the shared memory.
+     */
+    WS_DLL_PRIVATE PriorityRing(void* mem_ptr);
+    /**
+     * @fn virtual ~PriorityRing()
+     * @brief   destructor
+     */
+    WS_DLL_PUBLIC virtual ~PriorityRing();
+    /**
+     * @fn PriorityRingAttribute attribute()
+     * @brief   Get attribute
+     * @return  An attribute object of type `PriorityRingAttribute`.
+     */
+    WS_DLL_PUBLIC PriorityRingAttribute attribute();
+    /**
+     * @fn void produce(uint32_t lane, const void* buffer, uint16_t size, uint64_t timeout_ns)
+     * @brief   Produce a buffer to a lane.
+     * @param[in]   lane        The lane, 0 is the highest priority.
+     * @param[in]   buffer      Pointer to the buffer to send.
+     * @param[in]   size        Size of the data in the buffer.
+     * @param[in]   timeout_ns  Timeout in nanoseconds, if specified with 0, it returns immediately or
+     *                          throw an exception on failure.
+     */
+    WS_DLL_PUBLIC void produce(uint32_t lane, const void* buffer, uint16_t size, uint64_t timeout_ns);
+    /**
+     * @fn uint32_t consume(void* buffer, uint16_t size, uint64_t timeout_ns)
+     * @brief   Consume a buffer from the lane picked by the drain policy.
+     * @param[in]   buffer      Pointer to the buffer to accept the data.
+     * @param[in]   size        Size of the buffer.
+     * @param[in]   timeout_ns  Timeout in nanoseconds, if specified with 0, it returns immediately or
+     *                          throw an exception on failure.
+     * @return  The lane the buffer was consumed from.
+     */
+    WS_DLL_PUBLIC uint32_t consume(void* buffer, uint16_t size, uint64_t timeout_ns);
+    /**
+     * @fn template <class Rep, class Period> void produce(uint32_t lane, const void* buffer, uint16_t size, const std::chrono::duration<Rep, Period>& timeout)
+     * @brief   Produce a buffer. This is a wrapper function for easy timeout settings.
+     * @tparam      Rep         An arthmetic type representing the number of ticks.
+     * @tparam      Period      An std::ratio type representing the tick period.
+     * @param[in]   lane        The lane, 0 is the highest priority.
+     * @param[in]   buffer      Pointer to the buffer to send.
+     * @param[in]   size        Size of the data in the buffer.
+     * @param[in]   timeout     Timeout
+     */
+    template <class Rep, class Period>
+    void produce(uint32_t lane, const void* buffer, uint16_t size, const std::chrono::duration<Rep, Period>& timeout) {
+        this->produce(lane,buffer,size,std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count());
+    }
+    /**
+     * @fn template <class Rep, class Period> uint32_t consume(void* buffer, uint16_t size, const std::chrono::duration<Rep, Period>& timeout)
+     * @brief   Consume a buffer. This is a wrapper function for easy timeout settings.
+     * @tparam      Rep         An arthmetic type representing the number of ticks.
+     * @tparam      Period      An std::ratio type representing the tick period.
+     * @param[in]   buffer      Pointer to the receiving buffer.
+     * @param[in]   size        Size of the buffer.
+     * @param[in]   timeout     Timeout
+     * @return  The lane the buffer was consumed from.
+     */
+    template <class Rep, class Period>
+    uint32_t consume(void* buffer, uint16_t size, const std::chrono::duration<Rep, Period>& timeout) {
+        return this->consume(buffer,size,std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count());
+    }
+    /**
+     * @fn uint64_t nonempty_lanes()
+     * @brief   Get the summary word: bit `i` is set when lane `i` may be non-empty.
+     * @return  The summary word.
+     */
+    WS_DLL_PUBLIC uint64_t nonempty_lanes();
+    /**
+     * @fn uint32_t size(uint32_t lane)
+     * @brief   Get the number of entries in a lane. This is not reliable due to the lockless design.
+     * @param[in]   lane        The lane.
+     * @return  The number of the entries.
+     */
+    WS_DLL_PUBLIC uint32_t size(uint32_t lane);
+    /**
+     * @fn bool empty()
+     * @brief   Test weather all lanes are empty or not. This is not reliable due to the lockless design.
+     * @return  True for empty, otherwise false.
+     */
+    WS_DLL_PUBLIC bool empty();
+    /**
+     *  @fn static key_t create_priority_ring(const PriorityRingAttribute& attribute)
+     *  @brief  Create a new priority ring. Like `RingBuffer::create_ring_buffer`, the memory is allocated and pinned.
+     *  @param[in]  attribute       The attribute of the priority ring.
+     *  @return     The key of a successfully created priority ring.
+     */
+    WS_DLL_PUBLIC static key_t create_priority_ring(const PriorityRingAttribute& attribute);
+    /**
+     * @fn static void delete_priority_ring(const key_t key)
+     * @brief   Delete a priority ring. Caution: we do NOT detect active users.
+     * @param[in]   key         The key of the priority ring to remove.
+     */
+    WS_DLL_PUBLIC static void delete_priority_ring(const key_t key);
+    /**
+     * @fn static std::unique_ptr<PriorityRing> get_priority_ring(const key_t key)
+     * @brief   Get a priority ring using the key.
+     * @param[in]   key         The key of the priority ring to get.
+     * @return      A unique pointer to the priority ring.
+     */
+    WS_DLL_PUBLIC static std::unique_ptr<PriorityRing> get_priority_ring(const key_t key);
+};
+
+}
+}
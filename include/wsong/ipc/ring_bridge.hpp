@@ -0,0 +1,379 @@
+#pragma once
+
+/**
+ * @file    ring_bridge.hpp
+ * @brief   Forward ring buffer traffic to a ring buffer on another host over TCP or UDP.
+ *
+ * The bridge has two halves. `RingBridgeSender` is the one and only consumer of a local ring buffer: it drains the
+ * entries in batches and sends them as framed messages, with one `writev()` per batch over TCP or one `sendmmsg()`
+ * per batch over UDP. The entries are sent straight from the ring buffer slots. `RingBridgeReceiver` is the one and
+ * only producer of a local ring buffer: it receives the frames and republishes the entries, reading TCP frames
+ * straight into the ring buffer slots.
+ *
+ * The sender batches adaptively under a latency budget. It tracks the arrival rate of the source ring buffer and
+ * waits for as many entries as are expected to arrive within the budget, but never holds an entry longer than the
+ * budget. Under a light load every entry is sent on its own right away; under a heavy load the batches grow to
+ * `max_batch`.
+ *
+ * Every frame carries the time its oldest entry was seen by the sender and the time it was sent, so the receiver can
+ * tell the two hops apart: ring to wire (batching delay) and wire to ring. The timestamps are taken from
+ * `CLOCK_REALTIME`, so the clocks of the two hosts must be synchronized for the wire-to-ring latency to make sense.
+ * The frames are in host byte order: both hosts must have the same endianness.
+ *
+ * A frame is a `RingBridgeFrame` header followed by `count` entries of `entry_size` bytes. TCP is lossless with back-pressure: the receiver stops reading when the target ring buffer is full. UDP is lossy:
+ * the receiver counts the gaps in the sequence numbers as lost entries.
+ */
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <cinttypes>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <vector>
+
+#include <wsong/common.h>
+#include <wsong/exceptions.hpp>
+#include <wsong/ipc/ring_buffer.hpp>
+
+/**
+ * @def WS_BRIDGE_HISTOGRAM_BUCKETS
+ * @brief   The number of buckets of a bridge latency histogram. The buckets are log-linear with 16 linear
+ *          sub-buckets in each power-of-two range.
+ */
+#define WS_BRIDGE_HISTOGRAM_BUCKETS     (976)
+/**
+ * @def WS_BRIDGE_FRAME_MAGIC
+ * @brief   The magic number of a bridge frame, "WSBR".
+ */
+#define WS_BRIDGE_FRAME_MAGIC           (0x57534252)
+/**
+ * @def WS_BRIDGE_MAX_DATAGRAM
+ * @brief   The largest UDP payload.
+ */
+#define WS_BRIDGE_MAX_DATAGRAM          (65507)
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @enum BridgeProtocol
+ * @brief The transport of a ring bridge.
+ */
+enum BridgeProtocol {
+    WS_BRIDGE_TCP = 0,  /**< Lossless and back-pressured, one `writev()` per batch. */
+    WS_BRIDGE_UDP = 1,  /**< Lossy, one `sendmmsg()` per batch of datagrams. */
+};
+
+/**
+ * @struct ring_bridge_attr_t ring_bridge.hpp <wsong/ipc/ring_bridge.hpp>
+ */
+struct ring_bridge_attr_t {
+    /**
+     * The transport.
+     */
+    BridgeProtocol  protocol;
+    /**
+     * The host to send to, or the address to listen on for a receiver. An empty string means any address for a
+     * receiver.
+     */
+    char            address[64];
+    /**
+     * The port to send to or to listen on.
+     */
+    uint16_t        port;
+    /**
+     * The maximum number of entries sent in a batch, no more than 65535.
+     */
+    uint32_t        max_batch;
+    /**
+     * The latency budget in nanoseconds: how long the sender may hold an entry to build a batch. Zero disables
+     * batching beyond what is already in the ring buffer.
+     */
+    uint64_t        latency_budget_ns;
+    /**
+     * The maximum UDP datagram size in bytes. Use 1472 or less to avoid IP fragmentation on a 1500-byte MTU link.
+     */
+    uint32_t        max_datagram;
+};
+
+/**
+ * @typedef struct ring_bridge_attr_t RingBridgeAttribute
+ */
+using RingBridgeAttribute = struct ring_bridge_attr_t;
+
+/**
+ * @struct ring_bridge_frame_t ring_bridge.hpp <wsong/ipc/ring_bridge.hpp>
+ * @brief The header of a frame on the wire.
+ */
+struct ring_bridge_frame_t {
+    /**
+     * `WS_BRIDGE_FRAME_MAGIC`.
+     */
+    uint32_t    magic;
+    /**
+     * The size of each entry.
+     */
+    uint16_t    entry_size;
+    /**
+     * The number of entries following the header.
+     */
+    uint16_t    count;
+    /**
+     * The sequence number of the first entry, counting from 0 since the sender started.
+     */
+    uint64_t    sequence;
+    /**
+     * When the sender saw the oldest entry, in nanoseconds of `CLOCK_REALTIME`.
+     */
+    uint64_t    oldest_ns;
+    /**
+     * When the sender sent the frame, in nanoseconds of `CLOCK_REALTIME`.
+     */
+    uint64_t    send_ns;
+} __attribute__((packed));
+
+/**
+ * @typedef struct ring_bridge_frame_t RingBridgeFrame
+ */
+using RingBridgeFrame = struct ring_bridge_frame_t;
+
+/**
+ * @struct ring_bridge_latency_t ring_bridge.hpp <wsong/ipc/ring_bridge.hpp>
+ * @brief The latency of a hop, per batch and measured on the oldest entry in the batch.
+ */
+struct ring_bridge_latency_t {
+    uint64_t    p50_ns; /**< The median. */
+    uint64_t    p99_ns; /**< The 99th percentile. */
+    uint64_t    max_ns; /**< The maximum. */
+};
+
+/**
+ * @typedef struct ring_bridge_latency_t RingBridgeLatency
+ */
+using RingBridgeLatency = struct ring_bridge_latency_t;
+
+/**
+ * @struct ring_bridge_stats_t ring_bridge.hpp <wsong/ipc/ring_bridge.hpp>
+ * @brief The statistics of one side of a ring bridge.
+ */
+struct ring_bridge_stats_t {
+    /**
+     * The number of entries sent or received.
+     */
+    uint64_t            messages;
+    /**
+     * The number of batches sent or received.
+     */
+    uint64_t            batches;
+    /**
+     * The number of bytes sent or received, including the frame headers.
+     */
+    uint64_t            bytes;
+    /**
+     * The number of entries lost, as seen by a UDP receiver.
+     */
+    uint64_t            lost;
+    /**
+     * The current batch size target of the sender.
+     */
+    uint32_t            batch_target;
+    /**
+     * Ring to wire: from the oldest entry of a batch seen by the sender until the batch is sent.
+     */
+    RingBridgeLatency   ring_to_wire;
+    /**
+     * Wire to ring: from a batch is sent until it is published in the target ring buffer. Receiver only.
+     */
+    RingBridgeLatency   wire_to_ring;
+    /**
+     * End to end: from the oldest entry of a batch seen by the sender until it is published in the target ring
+     * buffer. Receiver only.
+     */
+    RingBridgeLatency   end_to_end;
+};
+
+/**
+ * @typedef struct ring_bridge_stats_t RingBridgeStats
+ */
+using RingBridgeStats = struct ring_bridge_stats_t;
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+class RingBridgeHistogram {
+private:
+    std::atomic<uint64_t>   buckets[WS_BRIDGE_HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t>   max;
+public:
+    RingBridgeHistogram();
+    void record(uint64_t value);
+    RingBridgeLatency summary();
+};
+
+class RingBridgeBase {
+protected:
+    const RingBridgeAttribute       attribute;
+    std::unique_ptr<RingBuffer>     ring;
+    int                             sock;
+    std::atomic<bool>               stopped;
+    std::atomic<uint64_t>           messages;
+    std::atomic<uint64_t>           batches;
+    std::atomic<uint64_t>           bytes;
+    std::atomic<uint64_t>           lost;
+    std::atomic<uint32_t>           batch_target;
+    RingBridgeHistogram             ring_to_wire;
+    RingBridgeHistogram             wire_to_ring;
+    RingBridgeHistogram             end_to_end;
+    std::thread                     thread;
+    std::mutex                      error_mutex;
+    std::string                     error_message;
+
+    RingBridgeBase(const key_t key, const RingBridgeAttribute& attribute);
+    void fail(const std::string& message);
+public:
+    virtual ~RingBridgeBase();
+    /**
+     * @fn void stop()
+     * @brief   Stop the bridge thread and close the socket.
+     */
+    WS_DLL_PUBLIC void stop();
+    /**
+     * @fn bool running()
+     * @brief   Test if the bridge thread is running. It stops on a socket error, see `error()`.
+     * @return  True if running, otherwise false.
+     */
+    WS_DLL_PUBLIC bool running();
+    /**
+     * @fn std::string error()
+     * @brief   Get the error that stopped the bridge thread.
+     * @return  The error message, or an empty string.
+     */
+    WS_DLL_PUBLIC std::string error();
+    /**
+     * @fn RingBridgeStats stats()
+     * @brief   Get the statistics.
+     * @return  The statistics.
+     */
+    WS_DLL_PUBLIC RingBridgeStats stats();
+};
+/**
+ * @endcond
+ */
+
+/**
+ * @class RingBridgeSender ring_bridge.hpp <wsong/ipc/ring_bridge.hpp>
+ * @brief The sending half of a ring bridge.
+ */
+class RingBridgeSender : public RingBridgeBase {
+private:
+    /**
+     * The frame headers of a batch.
+     */
+    std::vector<RingBridgeFrame>                frames;
+    /**
+     * The iovecs of each frame of a batch.
+     */
+    std::vector<std::vector<struct iovec>>      iovs;
+    /**
+     * The messages of a UDP batch.
+     */
+    std::vector<struct mmsghdr>                 msgs;
+
+    /**
+     * @fn void run()
+     * @brief   The sender thread body.
+     */
+    WS_DLL_PRIVATE void run();
+    /**
+     * @fn void send_batch(uint32_t head, uint32_t count, uint64_t oldest_ns, uint64_t& sequence)
+     * @brief   Send a batch of entries from the source ring buffer.
+     * @param[in]   head        The position of the first entry.
+     * @param[in]   count       The number of entries.
+     * @param[in]   oldest_ns   When the oldest entry was seen.
+     * @param[in,out]   sequence    The sequence number of the first entry, advanced by `count`.
+     */
+    WS_DLL_PRIVATE void send_batch(uint32_t head, uint32_t count, uint64_t oldest_ns, uint64_t& sequence);
+
+public:
+    /**
+     * @fn RingBridgeSender(const key_t source_key, const RingBridgeAttribute& attribute)
+     * @brief   Constructor. It connects to the receiver and starts the sender thread.
+     * @param[in]   source_key  The key of the source ring buffer. The sender must be its only consumer.
+     * @param[in]   attribute   The bridge attribute.
+     */
+    WS_DLL_PUBLIC RingBridgeSender(const key_t source_key, const RingBridgeAttribute& attribute);
+    /**
+     * @fn virtual ~RingBridgeSender()
+     * @brief   Destructor. It stops the sender thread.
+     */
+    WS_DLL_PUBLIC virtual ~RingBridgeSender();
+};
+
+/**
+ * @class RingBridgeReceiver ring_bridge.hpp <wsong/ipc/ring_bridge.hpp>
+ * @brief The receiving half of a ring bridge.
+ */
+class RingBridgeReceiver : public RingBridgeBase {
+private:
+    /**
+     * The port the socket is bound to.
+     */
+    uint16_t    bound_port;
+
+    /**
+     * @fn void run()
+     * @brief   The receiver thread body.
+     */
+    WS_DLL_PRIVATE void run();
+    /**
+     * @fn void run_tcp()
+     * @brief   Accept TCP connections one at a time and republish their frames.
+     */
+    WS_DLL_PRIVATE void run_tcp();
+    /**
+     * @fn void run_udp()
+     * @brief   Receive UDP datagrams in batches and republish their frames.
+     */
+    WS_DLL_PRIVATE void run_udp();
+    /**
+     * @fn bool wait_for_space(uint32_t tail, uint32_t count)
+     * @brief   Wait until the target ring buffer has room for `count` entries after `tail`.
+     * @param[in]   tail        The tail position.
+     * @param[in]   count       The number of entries, no more than `capacity - 1`.
+     * @return  False if the receiver is stopped meanwhile.
+     */
+    WS_DLL_PRIVATE bool wait_for_space(uint32_t tail, uint32_t count);
+    /**
+     * @fn void published(uint32_t count, uint64_t oldest_ns, uint64_t send_ns, uint64_t frame_bytes)
+     * @brief   Account for a published frame.
+     */
+    WS_DLL_PRIVATE void published(uint32_t count, uint64_t oldest_ns, uint64_t send_ns, uint64_t frame_bytes);
+
+public:
+    /**
+     * @fn RingBridgeReceiver(const key_t target_key, const RingBridgeAttribute& attribute)
+     * @brief   Constructor. It binds the socket, so a sender can connect once it returns, and starts the receiver
+     * thread.
+     * @param[in]   target_key  The key of the target ring buffer. The receiver must be its only producer, and its
+     *                          entry size must be no smaller than the sender's.
+     * @param[in]   attribute   The bridge attribute. A zero port picks an ephemeral one, see `port()`.
+     */
+    WS_DLL_PUBLIC RingBridgeReceiver(const key_t target_key, const RingBridgeAttribute& attribute);
+    /**
+     * @fn virtual ~RingBridgeReceiver()
+     * @brief   Destructor. It stops the receiver thread.
+     */
+    WS_DLL_PUBLIC virtual ~RingBridgeReceiver();
+    /**
+     * @fn uint16_t port()
+     * @brief   Get the port the receiver is bound to.
+     * @return  The port.
+     */
+    WS_DLL_PUBLIC uint16_t port();
+};
+
+}
+}
@@ -12,6 +12,13 @@
  * 2 - The producers and consumers are all using polling mode to avoid interrupts / context switches.
  * 
  * Since the ring buffer is an os-level existence, you need to create / get a ring buffer before using it (see `create_ring_buffer`).
+ *
+ * A ring buffer can be resized online with `resize_ring_buffer`. The new ring buffer is a successor segment linked from
+ * the old header: producers find the link in the tail cacheline and forward their entries, and consumers drain the old
+ * ring buffer before they follow it, so the order of the entries is kept and the attached handles stay valid. The old
+ * segment stays as the anchor of the key. Only `produce()`, `consume()`, and `consume_filtered()` follow a resize, so
+ * a ring buffer used through the zero-copy position API cannot be resized: `resize_ring_buffer` refuses a ring buffer
+ * once a writable handle has used a position, and the position API throws on a resized one.
  */
 
 #include <sys/ipc.h>
@@ -20,6 +27,8 @@
 #include <chrono>
 #include <memory>
 #include <atomic>
+#include <functional>
+#include <vector>
 
 #include <wsong/common.h>
 #include <wsong/exceptions.hpp>
@@ -63,6 +72,11 @@ struct ring_buffer_attr_t {
      * Multiple producers are allowed if true.
      */
     bool        multiple_producer;
+    /**
+     * Every entry starts with a `TraceContext` if true. It is filled by `produce()` and read by `consume()`, which
+     * also log linked timing events. The payload follows it, so it is at most `entry_size - sizeof(TraceContext)`.
+     */
+    bool        trace_context;
     /**
      * Description of the ring buffer.
      */
@@ -79,19 +93,40 @@ using RingBufferAttribute = struct ring_buffer_attr_t;
  * @brief The data structure for dynamic ring buffer management state.
  */
 struct ring_buffer_state_t {
-    union {
+    // Every member is cacheline aligned, so each of them occupies whole cachelines.
+    struct {
         /**
          * The ring buffer's head position.
          */
         std::atomic<uint32_t>   head;
-        uint8_t                 cacheline[CACHELINE_SIZE];
+        /**
+         * The number of consume calls finding the ring buffer empty, only updated on that slow path.
+         */
+        std::atomic<uint64_t>   empty_stalls;
     } head_cl WS_CL_ALIGNED;
-    union {
+    struct {
         /**
          * The ring buffer's tail position.
          */
         std::atomic<uint32_t>   tail;
-        uint8_t                 cacheline[CACHELINE_SIZE];
+        /**
+         * The number of produce calls finding the ring buffer full, only updated on that slow path.
+         */
+        std::atomic<uint64_t>   full_stalls;
+        /**
+         * The shmid of the successor ring buffer plus one after a resize, 0 before. It shares the cacheline with the
+         * tail, so the producers check it at no extra cost.
+         */
+        std::atomic<int32_t>    successor;
+        /**
+         * No entry is produced to a resized ring buffer any more: its tail is final. With multiple producers, the
+         * resize sets it under the producer lock; otherwise the producer sets it on its next `produce()` call.
+         */
+        std::atomic<bool>       sealed;
+        /**
+         * 0 while the ring buffer can be resized, 1 once a handle uses the position API, and 2 once it is resized.
+         */
+        std::atomic<uint8_t>    resize_state;
     } tail_cl WS_CL_ALIGNED;
     union {
         /**
@@ -122,6 +157,10 @@ union ring_buffer_header_t {
      * The ring buffer information;
      */
     struct {
+        /**
+         * The magic number identifying a ring buffer segment.
+         */
+        uint64_t            magic;
         RingBufferAttribute attribute WS_CL_ALIGNED;
         RingBufferState     state     WS_CL_ALIGNED;
     }   info WS_CL_ALIGNED;
@@ -136,6 +175,123 @@ union ring_buffer_header_t {
  */
 using RingBufferHeader = union ring_buffer_header_t;
 
+/**
+ * @struct ring_buffer_stats_t ring_buffer.hpp <wsong/ipc/ring_buffer.hpp>
+ * @brief A sample of the ring buffer's dynamic state.
+ */
+struct ring_buffer_stats_t {
+    /**
+     * The head position.
+     */
+    uint32_t    head;
+    /**
+     * The tail position.
+     */
+    uint32_t    tail;
+    /**
+     * The number of consume calls finding the ring buffer empty.
+     */
+    uint64_t    empty_stalls;
+    /**
+     * The number of produce calls finding the ring buffer full.
+     */
+    uint64_t    full_stalls;
+    /**
+     * The shmid of the successor ring buffer after a resize, -1 if the ring buffer is not resized.
+     */
+    int         successor_id;
+    /**
+     * The ring buffer is resized and takes no more entries.
+     */
+    bool        sealed;
+};
+
+/**
+ * @typedef struct ring_buffer_stats_t RingBufferStats
+ */
+using RingBufferStats = struct ring_buffer_stats_t;
+
+/**
+ * @struct ring_trace_context_t ring_buffer.hpp <wsong/ipc/ring_buffer.hpp>
+ * @brief The slot header following a message through a chain of ring buffers and processes.
+ */
+struct ring_trace_context_t {
+    /**
+     * The message id, assigned by the first ring buffer the message is produced to. 0 means no trace.
+     */
+    uint64_t    trace_id;
+    /**
+     * When the entry was produced, in nanoseconds of `CLOCK_REALTIME` like the timing events. It is the start of the
+     * span the consumer links to.
+     */
+    uint64_t    parent_ns;
+    /**
+     * The number of ring buffers the message has passed before this one.
+     */
+    uint32_t    hop;
+    /**
+     * The key of the ring buffer the entry was produced to.
+     */
+    key_t       ring;
+};
+
+/**
+ * @typedef struct ring_trace_context_t TraceContext
+ */
+using TraceContext = struct ring_trace_context_t;
+
+/**
+ * @def WS_RING_TRACE_PRODUCE_TAG
+ * @brief   The tag of the timing event logged by `produce()` on a traced ring buffer, with user data: trace id, ring
+ * key, hop, and the `parent_ns` of the entry consumed last by the thread (0 for the first hop).
+ */
+#define WS_RING_TRACE_PRODUCE_TAG   (0x5753545250000001ull)
+/**
+ * @def WS_RING_TRACE_CONSUME_TAG
+ * @brief   The tag of the timing event logged by `consume()` on a traced ring buffer, with user data: trace id, ring
+ * key, hop, and `parent_ns`.
+ */
+#define WS_RING_TRACE_CONSUME_TAG   (0x5753545250000002ull)
+
+/**
+ * @def WS_RING_FILTER_MAX_IDS
+ * @brief   The maximum number of ids in a ring filter.
+ */
+#define WS_RING_FILTER_MAX_IDS  (8)
+
+/**
+ * @struct ring_filter_t ring_buffer.hpp <wsong/ipc/ring_buffer.hpp>
+ * @brief A filter on a header field of the entries: an entry matches if `(field & mask)` is one of `ids`. A mask
+ * match is a filter with a single id.
+ */
+struct ring_filter_t {
+    /**
+     * The byte offset of the field in an entry, counted after the trace context on a traced ring buffer.
+     */
+    uint16_t    offset;
+    /**
+     * The width of the field in bytes: 1, 2, or 4. The field is read in host byte order.
+     */
+    uint8_t     width;
+    /**
+     * The number of ids, from 1 to `WS_RING_FILTER_MAX_IDS`.
+     */
+    uint8_t     num_ids;
+    /**
+     * The mask applied to the field before the comparison.
+     */
+    uint32_t    mask;
+    /**
+     * The ids to match.
+     */
+    uint32_t    ids[WS_RING_FILTER_MAX_IDS];
+};
+
+/**
+ * @typedef struct ring_filter_t RingFilter
+ */
+using RingFilter = struct ring_filter_t;
+
 /**
  * @class RingBuffer ring_buffer.hpp <wsong/ipc/ring_buffer.hpp>
  * @brief The RingBuffer IPC.
@@ -146,14 +302,54 @@ private:
      * The pointer to the ring buffer info struct.
      */
     const RingBufferHeader* const   info_ptr;
+    /**
+     * The producer's process-local copy of the head position, only reloaded when the ring buffer looks full.
+     */
+    uint32_t                        cached_head;
+    /**
+     * The consumer's process-local copy of the tail position, only reloaded when the ring buffer looks empty.
+     */
+    uint32_t                        cached_tail;
+    /**
+     * The handle of the successor ring buffer, attached on the first call following a resize.
+     */
+    std::unique_ptr<RingBuffer>     successor;
+    /**
+     * The consumer has drained the resized ring buffer, and consumes from the successor.
+     */
+    bool                            drained;
+    /**
+     * The last ring buffer of the successor chain known to the producer, once it has sealed this one.
+     */
+    RingBuffer*                     forward;
+    /**
+     * The handle is attached read-only.
+     */
+    const bool                      read_only;
+    /**
+     * The handle has claimed the position API, which keeps the ring buffer from being resized.
+     */
+    bool                            positioned;
+    /**
+     * @fn RingBuffer* successor_ring()
+     * @brief   Get the handle of the successor ring buffer, attaching it if needed.
+     * @return  The successor handle.
+     */
+    WS_DLL_PRIVATE RingBuffer* successor_ring() ;
+    /**
+     * @fn void claim_positions()
+     * @brief   Keep the ring buffer from being resized on the first use of the position API, or throw if it is resized.
+     */
+    WS_DLL_PRIVATE void claim_positions() ;
 
 public:
     /**
-     * @fn RingBuffer(void* mem_ptr)
+     * @fn RingBuffer(void* mem_ptr, bool read_only)
      * @brief   Constructor
      * @param[in]   mem_ptr     The pointer to the shared memory.
+     * @param[in]   read_only   The shared memory is attached read-only.
      */
-    WS_DLL_PRIVATE RingBuffer(void* mem_ptr) ;
+    WS_DLL_PRIVATE RingBuffer(void* mem_ptr, bool read_only = false) ;
     /**
      * @fn virtual ~RingBuffer()
      * @brief   destructor
@@ -161,28 +357,93 @@ public:
     WS_DLL_PUBLIC virtual ~RingBuffer() ;
     /**
      * @fn void produce(const void* buffer, uint16_t size, uint64_t timeout_ns)
-     * @brief   Produce a buffer.
+     * @brief   Produce a buffer. On a traced ring buffer, it continues the current trace of the calling thread, or
+     * starts a new one.
      * @param[in]   buffer      Pointer to the buffer to send.
      * @param[in]   size        Size of the data in the buffer.
      * @param[in]   timeout_ns  Timeout in nanoseconds, if specified with 0, it returns immediately or
      *                          throw an exception on failure.
      */
     WS_DLL_PUBLIC void produce(const void* buffer, uint16_t size, uint64_t timeout_ns) ;
+    /**
+     * @fn bool try_produce(const void* buffer, uint16_t size, uint64_t timeout_ns)
+     * @brief   Produce a buffer like `produce()`, but report a full ring buffer by the return value instead of an
+     * exception, for producers that drop entries under overload.
+     * @param[in]   buffer      Pointer to the buffer to send.
+     * @param[in]   size        Size of the data in the buffer.
+     * @param[in]   timeout_ns  Timeout in nanoseconds, 0 to return immediately.
+     * @return  True if the buffer is produced, false if the ring buffer stays full until the timeout.
+     */
+    WS_DLL_PUBLIC bool try_produce(const void* buffer, uint16_t size, uint64_t timeout_ns) ;
     /**
      * @fn void consume(void* buffer, uint16_t size, uint16_t timeout_ns) 
-     * @brief   Consume a buffer
+     * @brief   Consume a buffer. On a traced ring buffer, the trace context of the entry becomes the current one of the
+     * calling thread, so the next `produce()` of the thread continues the trace.
      * @param[in]   buffer      Pointer to the buffer to accept the data.
      * @param[in]   size        Size of the buffer.
      * @param[in]   timeout_ns  Timeout in nanoseconds, if specified with 0, it returns immediately or
      *                          throw an exception on failure.
      */
     WS_DLL_PUBLIC void consume(void* buffer, uint16_t size, uint64_t timeout_ns) ;
+    /**
+     * @typedef FilterHandler
+     * @brief   The callback receiving a matching entry in place, after its trace context on a traced ring buffer. The
+     * entry is valid until the callback returns.
+     */
+    using FilterHandler = std::function<void(const void* entry)>;
+    /**
+     * @fn uint32_t consume_filtered(const RingFilter& filter, void* buffer, uint32_t max_entries)
+     * @brief   Consume the matching entries available now, and drop the others. The slots are scanned in batches,
+     * with AVX2 if the cpu supports it. The head moves past all scanned entries in one step, so that a sparse
+     * subscriber pays little for the entries it does not want. It returns immediately.
+     *
+     * The dropped entries are gone for all consumers. With multiple consumers, use a `RingRelay` fan-out to give
+     * every filtering subscriber its own ring buffer.
+     * @param[in]   filter      The filter.
+     * @param[out]  buffer      The buffer receiving the matching entries, `entry_size` bytes each, less the trace
+     *                          context on a traced ring buffer, like `consume()`.
+     * @param[in]   max_entries The maximum number of entries to copy out. The scan stops after the last one.
+     * @return  The number of entries copied out.
+     */
+    WS_DLL_PUBLIC uint32_t consume_filtered(const RingFilter& filter, void* buffer, uint32_t max_entries) ;
+    /**
+     * @fn uint32_t consume_filtered(const RingFilter& filter, const FilterHandler& handler, uint32_t max_entries)
+     * @brief   The zero-copy counterpart: the matching entries are handed over in place, before their slots are
+     * released to the producers.
+     * @param[in]   filter      The filter.
+     * @param[in]   handler     The callback receiving the matching entries.
+     * @param[in]   max_entries The maximum number of entries to hand over. The scan stops after the last one.
+     * @return  The number of entries handed over.
+     */
+    WS_DLL_PUBLIC uint32_t consume_filtered(const RingFilter& filter, const FilterHandler& handler,
+                                            uint32_t max_entries = UINT32_MAX) ;
+    /**
+     * @fn static const TraceContext& current_trace()
+     * @brief   Get the trace context of the calling thread: the one of the entry it consumed last from a traced ring
+     * buffer, or the one set by `set_current_trace()`.
+     * @return  The trace context, with `trace_id` 0 if there is none.
+     */
+    WS_DLL_PUBLIC static const TraceContext& current_trace() ;
+    /**
+     * @fn static void set_current_trace(const TraceContext& context)
+     * @brief   Set the trace context of the calling thread, e.g. to continue a trace received by other means. Set a
+     * context with `trace_id` 0 to start a new trace on the next `produce()`.
+     * @param[in]   context     The trace context.
+     */
+    WS_DLL_PUBLIC static void set_current_trace(const TraceContext& context) ;
     /**
      * @fn RingBufferAttribute attribute();
      * @brief   Get attribute
      * @return  An attribute object of type `RingBufferAttribute`.
      */
     WS_DLL_PUBLIC RingBufferAttribute attribute() ;
+    /**
+     * @fn RingBufferStats stats();
+     * @brief   Sample the dynamic state. It only reads the shared memory, so it is safe on a read-only ring buffer
+     * and does not disturb the producers and consumers beyond cacheline sharing.
+     * @return  A stats object of type `RingBufferStats`.
+     */
+    WS_DLL_PUBLIC RingBufferStats stats() ;
     /**
      * @fn template <class Rep, class Period> void produce(const void* buffer, uint16_t size,const std::chrono::duration<Rep, Period>& timeout)
      * @brief   Produce a buffer. This is a wrapper function for easy timeout settings.
@@ -221,6 +482,41 @@ public:
      * return   True for empty, otherwise false.
      */
     WS_DLL_PUBLIC bool          empty() ;
+    /**
+     * @fn uint32_t      head_position();
+     * @brief   Get the current head position. Positions are free running counters, use `slot()` to locate the entry.
+     * @return  The head position.
+     */
+    WS_DLL_PUBLIC uint32_t      head_position() ;
+    /**
+     * @fn uint32_t      tail_position();
+     * @brief   Get the current tail position. Entries in [head_position(), tail_position()) are readable.
+     * @return  The tail position.
+     */
+    WS_DLL_PUBLIC uint32_t      tail_position() ;
+    /**
+     * @fn void*         slot(uint32_t position);
+     * @brief   Get the address of the entry at a position, for zero-copy access. On a traced ring buffer, the entry
+     * starts with its `TraceContext`.
+     * @param[in]   position    The free running position.
+     * @return  The address of the entry inside the shared memory.
+     */
+    WS_DLL_PUBLIC void*         slot(uint32_t position) ;
+    /**
+     * @fn void          advance_head(uint32_t position);
+     * @brief   Release all entries before `position` to the producers. This is the zero-copy counterpart of
+     * `consume()`. It is only safe when the caller is the one and only consumer of the ring buffer.
+     * @param[in]   position    The new head position, which must be in [head_position(), tail_position()].
+     */
+    WS_DLL_PUBLIC void          advance_head(uint32_t position) ;
+    /**
+     * @fn void          advance_tail(uint32_t position);
+     * @brief   Publish all entries before `position` to the consumers. This is the zero-copy counterpart of
+     * `produce()`. It is only safe when the caller is the one and only producer of the ring buffer.
+     * @param[in]   position    The new tail position, which must not make the ring buffer exceed `capacity - 1`
+     *                          entries.
+     */
+    WS_DLL_PUBLIC void          advance_tail(uint32_t position) ;
     /**
      *  @fn static key_t  create_ring_buffer(const RingBufferAttribute& attribute);
      *  @brief  Create a new IPC ring buffer.
@@ -237,18 +533,56 @@ public:
     WS_DLL_PUBLIC static key_t  create_ring_buffer(const RingBufferAttribute& attribute) ;
     /**
      * @fn static void   delete_ring_buffer(const key_t key);
-     * @brief   Delete an IPC ring buffer. Caution: we do NOT detect active users. Caller is responsible for removing
-     * them.
+     * @brief   Delete an IPC ring buffer, with its successors if it is resized. Caution: we do NOT detect active users.
+     * Caller is responsible for removing them.
      * @param[in]   key         The key of the IPC ring buffer to remove.
      */
     WS_DLL_PUBLIC static void   delete_ring_buffer(const key_t key) ;
     /**
-     * @fn static std::unique_ptr<RingBuffer> get_ring_buffer(const key_t key);
+     * @fn static bool   resize_ring_buffer(const key_t key, uint32_t capacity, uint64_t timeout_ns);
+     * @brief   Resize an IPC ring buffer without stopping its producers and consumers. It creates a successor ring
+     * buffer with the new capacity and the same other attributes, links it from the last ring buffer of the chain, and
+     * seals that one for the producers. Then it waits for the consumers to drain the sealed ring buffer, and releases
+     * its entry memory.
+     *
+     * With a single producer, the ring buffer is sealed by the producer on its next `produce()` call, so it is only
+     * drained after that. A ring buffer used through the position API cannot be resized, and it throws.
+     * @param[in]   key         The key of the IPC ring buffer to resize.
+     * @param[in]   capacity    The new capacity, a power of two.
+     * @param[in]   timeout_ns  How long to wait for the old ring buffer to be drained.
+     * @return  True if the old ring buffer is drained and its memory released, false if it is still draining; its
+     *          memory is then released by `delete_ring_buffer`.
+     */
+    WS_DLL_PUBLIC static bool   resize_ring_buffer(const key_t key, uint32_t capacity, uint64_t timeout_ns) ;
+    /**
+     * @fn template <class Rep, class Period> static bool resize_ring_buffer(const key_t key, uint32_t capacity, const std::chrono::duration<Rep, Period>& timeout)
+     * @brief   Resize an IPC ring buffer. This is a wrapper function for easy timeout settings.
+     * @tparam      Rep         An arthmetic type representing the number of ticks.
+     * @tparam      Period      An std::ratio type representing the tick period.
+     * @param[in]   key         The key of the IPC ring buffer to resize.
+     * @param[in]   capacity    The new capacity, a power of two.
+     * @param[in]   timeout     How long to wait for the old ring buffer to be drained.
+     * @return  True if the old ring buffer is drained and its memory released.
+     */
+    template <class Rep, class Period>
+    static bool resize_ring_buffer(const key_t key, uint32_t capacity, const std::chrono::duration<Rep, Period>& timeout) {
+        return resize_ring_buffer(key,capacity,std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count());
+    }
+    /**
+     * @fn static std::unique_ptr<RingBuffer> get_ring_buffer(const key_t key, bool read_only);
      * @brief   Get an IPC ring buffer using the key.
      * @param[in]   key         The key of the IPC ring buffer to get.
+     * @param[in]   read_only   Attach the shared memory read-only. Only `attribute()`, `stats()`, `size()`, and
+     *                          `empty()` are allowed on a read-only ring buffer.
      * @return      A unique pointer to the ring buffer.
      */
-    WS_DLL_PUBLIC static std::unique_ptr<RingBuffer> get_ring_buffer(const key_t key);
+    WS_DLL_PUBLIC static std::unique_ptr<RingBuffer> get_ring_buffer(const key_t key, bool read_only = false);
+    /**
+     * @fn static std::vector<key_t> list_ring_buffers();
+     * @brief   List the keys of all ring buffers in the system, as found in /proc/sysvipc/shm.
+     * @return      The keys of the ring buffers.
+     */
+    WS_DLL_PUBLIC static std::vector<key_t> list_ring_buffers();
 };
 
 }
@@ -0,0 +1,497 @@
+#pragma once
+
+/**
+ * @file    ring_logger.hpp
+ * @brief   Asynchronous binary logger over the shared-memory ring buffer.
+ *
+ * `fprintf`-style logging on a hot thread costs microseconds: most of it is formatting and the write system call. The
+ * ring logger defers both. A log call only copies a format id and the raw argument bytes into a ring buffer slot; a
+ * `RingLogReader` in another thread or process formats the records and writes them out in batches.
+ *
+ * Format strings are registered at compile time. Each `WS_LOG` call site defines a `constexpr` `LogFormat` descriptor
+ * with an id hashed from the format string, the source location and the argument types deduced from the call. The
+ * number of arguments is checked against the format string with a `static_assert`. A registrar instantiated from the
+ * descriptor adds it to the process-wide format table during static initialization, before `main()`, including the
+ * call sites in inline functions and templates which are never executed; the log call itself never checks or
+ * registers anything. When a `RingLogger` attaches to a ring buffer, it publishes the format table as definition
+ * records, so a reader can format the records of any producer process.
+ *
+ * Example:
+ * @code
+ * wsong::ipc::RingLogger logger(key);
+ * WS_LOG_INFO(logger, "order %lu filled at %.2f by %s", order_id, price, venue);
+ * @endcode
+ *
+ * Record layout in a ring buffer slot:
+ * | LogRecordHeader (16 bytes) | argument 0 | argument 1 | ... |
+ * Integers, floating point numbers and pointers take 8 bytes; strings take a 2-byte length and the bytes, truncated to
+ * the slot.
+ */
+
+#include <sys/ipc.h>
+#include <cinttypes>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <ostream>
+
+#include <wsong/common.h>
+#include <wsong/exceptions.hpp>
+#include <wsong/ipc/ring_buffer.hpp>
+
+/**
+ * @def WS_LOG_MAX_ARGS
+ * @brief   The maximum number of arguments of a log call.
+ */
+#define WS_LOG_MAX_ARGS             (8)
+/**
+ * @def WS_LOG_MAX_RECORD_SIZE
+ * @brief   The maximum size of a log record. A record is further limited by the entry size of the ring buffer.
+ */
+#define WS_LOG_MAX_RECORD_SIZE      (1024)
+/**
+ * @def WS_LOG_DEFINITION_ID
+ * @brief   The reserved format id of the records carrying format definitions.
+ */
+#define WS_LOG_DEFINITION_ID        (0)
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @enum log_level_t
+ * @brief   The log levels.
+ */
+enum log_level_t : uint8_t {
+    WS_LOG_LEVEL_DEBUG  = 0,
+    WS_LOG_LEVEL_INFO   = 1,
+    WS_LOG_LEVEL_WARN   = 2,
+    WS_LOG_LEVEL_ERROR  = 3,
+};
+
+/**
+ * @typedef enum log_level_t LogLevel
+ */
+using LogLevel = enum log_level_t;
+
+/**
+ * @struct log_format_t ring_logger.hpp <wsong/ipc/ring_logger.hpp>
+ * @brief   The compile-time descriptor of a log call site.
+ */
+struct log_format_t {
+    /**
+     * The format id, hashed from the format string and the source location.
+     */
+    uint32_t    id;
+    /**
+     * The source line.
+     */
+    uint32_t    line;
+    /**
+     * The log level.
+     */
+    uint8_t     level;
+    /**
+     * The number of arguments.
+     */
+    uint8_t     num_args;
+    /**
+     * The argument types: 'i' for signed integers, 'u' for unsigned integers, 'd' for floating point numbers, 'p' for
+     * pointers, and 's' for strings.
+     */
+    char        arg_types[WS_LOG_MAX_ARGS];
+    /**
+     * The source file.
+     */
+    const char* file;
+    /**
+     * The printf-style format string.
+     */
+    const char* format;
+};
+
+/**
+ * @typedef struct log_format_t LogFormat
+ */
+using LogFormat = struct log_format_t;
+
+/**
+ * @struct log_record_header_t ring_logger.hpp <wsong/ipc/ring_logger.hpp>
+ * @brief   The header of a log record.
+ */
+struct log_record_header_t {
+    /**
+     * The format id, or `WS_LOG_DEFINITION_ID` for a chunk of a format definition.
+     */
+    uint32_t    format_id;
+    /**
+     * The size of the record including this header.
+     */
+    uint16_t    size;
+    /**
+     * The offset of the chunk in the definition, only for definition records.
+     */
+    uint16_t    offset;
+    /**
+     * The realtime timestamp in nanoseconds. For definition records, the format id in the higher 32 bits and the
+     * size of the definition in the lower 32 bits.
+     */
+    uint64_t    timestamp;
+};
+
+/**
+ * @typedef struct log_record_header_t LogRecordHeader
+ */
+using LogRecordHeader = struct log_record_header_t;
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+template <typename T>
+constexpr char log_arg_type() {
+    using D = std::decay_t<T>;
+    if constexpr (std::is_same_v<D,const char*> || std::is_same_v<D,char*> ||
+                  std::is_same_v<D,std::string> || std::is_same_v<D,std::string_view>) {
+        return 's';
+    } else if constexpr (std::is_floating_point_v<D>) {
+        return 'd';
+    } else if constexpr (std::is_pointer_v<D> || std::is_null_pointer_v<D>) {
+        return 'p';
+    } else if constexpr (std::is_integral_v<D> || std::is_enum_v<D>) {
+        return std::is_signed_v<D> ? 'i' : 'u';
+    } else {
+        static_assert(sizeof(D) == 0, "Unsupported log argument type.");
+        return '\0';
+    }
+}
+
+template <typename... Args>
+struct log_arg_traits {
+    static constexpr uint8_t num_args = sizeof...(Args);
+    static_assert(sizeof...(Args) <= WS_LOG_MAX_ARGS, "Too many log arguments.");
+};
+
+template <typename... Args>
+log_arg_traits<std::decay_t<Args>...> log_traits_of(Args&&...);
+
+constexpr uint32_t log_hash(uint32_t h, const char* s) {
+    while (*s) {
+        h = (h ^ static_cast<uint8_t>(*s++)) * 16777619u;
+    }
+    return h;
+}
+
+constexpr uint32_t log_format_id(const char* format, const char* file, uint32_t line, const char* arg_types) {
+    // the argument types tell apart the instantiations of a call site in a template.
+    uint32_t h = log_hash(log_hash(2166136261u, format), file);
+    for (int i = 0; i < 4; i++) {
+        h = (h ^ ((line >> (i*8)) & 0xff)) * 16777619u;
+    }
+    for (int i = 0; i < WS_LOG_MAX_ARGS; i++) {
+        h = (h ^ static_cast<uint8_t>(arg_types[i])) * 16777619u;
+    }
+    return (h == WS_LOG_DEFINITION_ID) ? 1 : h;
+}
+
+constexpr uint32_t log_count_specs(const char* format) {
+    uint32_t count = 0;
+    while (*format) {
+        if (*format++ == '%') {
+            if (*format == '%') {
+                format ++;
+            } else {
+                count ++;
+            }
+        }
+    }
+    return count;
+}
+
+/**
+ * @endcond
+ */
+
+/**
+ * @fn void log_register_format(const LogFormat* format)
+ * @brief   Add a format descriptor to the process-wide format table. The `WS_LOG` macros call it during static
+ *          initialization.
+ * @param[in]   format      The format descriptor, which must outlive the process.
+ */
+WS_DLL_PUBLIC void log_register_format(const LogFormat* format);
+
+/**
+ * @fn std::vector<const LogFormat*> log_registered_formats()
+ * @brief   Get the process-wide format table.
+ * @return  The registered format descriptors.
+ */
+WS_DLL_PUBLIC std::vector<const LogFormat*> log_registered_formats();
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+template <const LogFormat& F>
+struct log_format_registrar {
+    log_format_registrar() {
+        log_register_format(&F);
+    }
+};
+
+template <const LogFormat& F>
+inline log_format_registrar<F> log_format_registrar_v{};
+
+template <typename... Args>
+constexpr LogFormat make_log_format(log_arg_traits<Args...>, const char* format, const char* file, uint32_t line,
+                                    LogLevel level) {
+    LogFormat f{0, line, level, sizeof...(Args), {'\0'}, file, format};
+    [[maybe_unused]] uint32_t i = 0;
+    ((f.arg_types[i++] = log_arg_type<Args>()), ...);
+    f.id = log_format_id(format,file,line,f.arg_types);
+    return f;
+}
+/**
+ * @endcond
+ */
+
+/**
+ * @class RingLogger ring_logger.hpp <wsong/ipc/ring_logger.hpp>
+ * @brief The producer side of the ring logger. Use it with the `WS_LOG` macros.
+ */
+class RingLogger {
+private:
+    /**
+     * The ring buffer.
+     */
+    std::unique_ptr<RingBuffer>     ring_buffer;
+    /**
+     * The record size limit.
+     */
+    const uint16_t                  max_record_size;
+    /**
+     * How long a log call waits for space in a full ring buffer.
+     */
+    const uint64_t                  timeout_ns;
+    /**
+     * The minimum level to log.
+     */
+    std::atomic<uint8_t>            min_level;
+    /**
+     * The number of records dropped because the ring buffer was full.
+     */
+    std::atomic<uint64_t>           dropped_records;
+
+    /**
+     * @cond    DoxygenSuppressed
+     */
+    template <typename T>
+    static inline void encode(uint8_t* record, uint16_t& pos, uint16_t& reserve, uint16_t limit, const T& arg) {
+        constexpr char type = log_arg_type<T>();
+        // `reserve` is the space of the fixed-size parts of the following arguments, which long strings must not take.
+        reserve -= (type == 's') ? sizeof(uint16_t) : sizeof(uint64_t);
+        if constexpr (type == 's') {
+            std::string_view sv;
+            if constexpr (std::is_same_v<std::decay_t<T>,std::string> ||
+                          std::is_same_v<std::decay_t<T>,std::string_view>) {
+                sv = arg;
+            } else {
+                sv = (arg == nullptr) ? "" : arg;
+            }
+            if (pos + sizeof(uint16_t) <= limit) {
+                const size_t room = limit - pos - sizeof(uint16_t);
+                const uint16_t len = static_cast<uint16_t>(std::min<size_t>(sv.size(),
+                                                                            room > reserve ? room - reserve : 0));
+                std::memcpy(record + pos,&len,sizeof(uint16_t));
+                std::memcpy(record + pos + sizeof(uint16_t),sv.data(),len);
+                pos += sizeof(uint16_t) + len;
+            }
+        } else if (pos + sizeof(uint64_t) <= limit) {
+            uint64_t value;
+            if constexpr (type == 'd') {
+                double d = static_cast<double>(arg);
+                std::memcpy(&value,&d,sizeof(double));
+            } else if constexpr (std::is_null_pointer_v<T>) {
+                value = 0;
+            } else if constexpr (type == 'p') {
+                value = reinterpret_cast<uintptr_t>(arg);
+            } else if constexpr (type == 'i') {
+                value = static_cast<uint64_t>(static_cast<int64_t>(arg));
+            } else {
+                value = static_cast<uint64_t>(arg);
+            }
+            std::memcpy(record + pos,&value,sizeof(uint64_t));
+            pos += sizeof(uint64_t);
+        }
+    }
+    /**
+     * @endcond
+     */
+
+public:
+    /**
+     * @fn RingLogger(key_t key, uint64_t timeout_ns = 0)
+     * @brief   Attach a logger to a ring buffer, and publish the format table.
+     * @param[in]   key         The key of the ring buffer. Its entry size must be at least 64 bytes.
+     * @param[in]   timeout_ns  How long a log call waits for space in a full ring buffer before the record is
+     *                          dropped. Defaulted to 0: a hot thread never blocks on logging.
+     */
+    WS_DLL_PUBLIC RingLogger(key_t key, uint64_t timeout_ns = 0);
+    /**
+     * @fn virtual ~RingLogger()
+     * @brief   destructor
+     */
+    WS_DLL_PUBLIC virtual ~RingLogger();
+    /**
+     * @fn void publish_formats()
+     * @brief   Publish the format table as definition records. The constructor does it; call it again after loading
+     *          a shared object with more call sites.
+     */
+    WS_DLL_PUBLIC void publish_formats();
+    /**
+     * @fn void set_level(LogLevel level)
+     * @brief   Set the minimum level to log.
+     * @param[in]   level       The level.
+     */
+    WS_DLL_PUBLIC void set_level(LogLevel level);
+    /**
+     * @fn bool enabled(LogLevel level)
+     * @brief   Test if a level is logged.
+     * @param[in]   level       The level.
+     * @return  True if the level is logged.
+     */
+    inline bool enabled(LogLevel level) {
+        return level >= this->min_level.load(std::memory_order_relaxed);
+    }
+    /**
+     * @fn uint64_t dropped()
+     * @brief   Get the number of records dropped because the ring buffer was full.
+     * @return  The number of dropped records.
+     */
+    WS_DLL_PUBLIC uint64_t dropped();
+    /**
+     * @fn template <typename... Args> void log(uint32_t format_id, const Args&... args)
+     * @brief   Log a record. Use the `WS_LOG` macros instead, which define the format descriptor.
+     * @tparam      Args        The argument types.
+     * @param[in]   format_id   The format id.
+     * @param[in]   args        The arguments.
+     */
+    template <typename... Args>
+    void log(uint32_t format_id, const Args&... args) {
+        uint8_t record[WS_LOG_MAX_RECORD_SIZE] __attribute__ (( aligned(CACHELINE_SIZE) ));
+        uint16_t pos = sizeof(LogRecordHeader);
+        [[maybe_unused]] uint16_t reserve = (0 + ... + (log_arg_type<Args>() == 's' ? sizeof(uint16_t) : sizeof(uint64_t)));
+        (encode(record,pos,reserve,this->max_record_size,args), ...);
+        LogRecordHeader* header = reinterpret_cast<LogRecordHeader*>(record);
+        header->format_id   = format_id;
+        header->size        = pos;
+        header->offset      = 0;
+        header->timestamp   = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::system_clock::now().time_since_epoch()).count();
+        if (!this->ring_buffer->try_produce(record,pos,this->timeout_ns)) {
+            this->dropped_records.fetch_add(1,std::memory_order_relaxed);
+        }
+    }
+};
+
+/**
+ * @class RingLogReader ring_logger.hpp <wsong/ipc/ring_logger.hpp>
+ * @brief The consumer side of the ring logger. It formats the records in batches in a separate thread or process.
+ *        A ring buffer has only one reader.
+ */
+class RingLogReader {
+private:
+    /**
+     * The ring buffer.
+     */
+    std::unique_ptr<RingBuffer>     ring_buffer;
+    /**
+     * The known format descriptors by id. The strings point into `definitions`.
+     */
+    std::unordered_map<uint32_t,LogFormat>      formats;
+    /**
+     * The format definitions received and in assembly, by id.
+     */
+    std::unordered_map<uint32_t,std::string>    definitions;
+
+    /**
+     * @fn void define(const LogRecordHeader* header)
+     * @brief   Handle a chunk of a format definition.
+     * @param[in]   header      The definition record.
+     */
+    WS_DLL_PRIVATE void define(const LogRecordHeader* header);
+
+public:
+    /**
+     * @fn RingLogReader(key_t key)
+     * @brief   Constructor
+     * @param[in]   key         The key of the ring buffer.
+     */
+    WS_DLL_PUBLIC RingLogReader(key_t key);
+    /**
+     * @fn virtual ~RingLogReader()
+     * @brief   destructor
+     */
+    WS_DLL_PUBLIC virtual ~RingLogReader();
+    /**
+     * @fn size_t poll(std::ostream& out, size_t max_records)
+     * @brief   Format up to `max_records` available records and write them to `out` in one batch. It does not wait.
+     * @param[in]   out         The output stream.
+     * @param[in]   max_records The maximum number of records to process.
+     * @return  The number of records processed, including format definitions.
+     */
+    WS_DLL_PUBLIC size_t poll(std::ostream& out, size_t max_records = 1024);
+    /**
+     * @fn std::string format(const void* record)
+     * @brief   Format a single log record into one line.
+     * @param[in]   record      The record.
+     * @return  The formatted line, with a newline.
+     */
+    WS_DLL_PUBLIC std::string format(const void* record);
+};
+
+}
+}
+
+/**
+ * @def WS_LOG(logger, level, fmt, ...)
+ * @brief   Log a record with a printf-style format string literal. Only the format id and the raw arguments are
+ *          copied to the ring buffer; the formatting is deferred to the `RingLogReader`.
+ */
+#define WS_LOG(logger, level, fmt, ...) \
+    do { \
+        using __ws_log_traits = decltype(::wsong::ipc::log_traits_of(__VA_ARGS__)); \
+        static_assert(::wsong::ipc::log_count_specs(fmt) == __ws_log_traits::num_args, \
+                      "The number of log arguments does not match the format string."); \
+        static constexpr ::wsong::ipc::LogFormat __ws_log_format = \
+            ::wsong::ipc::make_log_format(__ws_log_traits{}, fmt, __FILE__, __LINE__, level); \
+        (void)&::wsong::ipc::log_format_registrar_v<__ws_log_format>; \
+        if ((logger).enabled(level)) { \
+            (logger).log(__ws_log_format.id __VA_OPT__(,) __VA_ARGS__); \
+        } \
+    } while (0)
+
+/**
+ * @def WS_LOG_DEBUG(logger, fmt, ...)
+ * @brief   Log at debug level.
+ */
+#define WS_LOG_DEBUG(logger, fmt, ...)  WS_LOG(logger, ::wsong::ipc::WS_LOG_LEVEL_DEBUG, fmt __VA_OPT__(,) __VA_ARGS__)
+/**
+ * @def WS_LOG_INFO(logger, fmt, ...)
+ * @brief   Log at info level.
+ */
+#define WS_LOG_INFO(logger, fmt, ...)   WS_LOG(logger, ::wsong::ipc::WS_LOG_LEVEL_INFO, fmt __VA_OPT__(,) __VA_ARGS__)
+/**
+ * @def WS_LOG_WARN(logger, fmt, ...)
+ * @brief   Log at warning level.
+ */
+#define WS_LOG_WARN(logger, fmt, ...)   WS_LOG(logger, ::wsong::ipc::WS_LOG_LEVEL_WARN, fmt __VA_OPT__(,) __VA_ARGS__)
+/**
+ * @def WS_LOG_ERROR(logger, fmt, ...)
+ * @brief   Log at error level.
+ */
+#define WS_LOG_ERROR(logger, fmt, ...)  WS_LOG(logger, ::wsong::ipc::WS_LOG_LEVEL_ERROR, fmt __VA_OPT__(,) __VA_ARGS__)
@@ -0,0 +1,157 @@
+#pragma once
+
+/**
+ * @file    ring_merger.hpp
+ * @brief   Ordered k-way merge consumer across multiple ring buffers.
+ *
+ * When several producers publish to separate ring buffers, the merger peeks the head entry of every ring buffer in
+ * place (zero-copy), keeps them in a small min-heap ordered by a 64-bit key, e.g. a sequence number or an event
+ * timestamp, and hands the entries to the caller in key order.
+ *
+ * A strict merge can only emit an entry when every ring buffer has a head entry, so one idle producer stalls the
+ * stream. The lateness window relaxes that: the smallest head entry is emitted anyway once the largest key published
+ * (the watermark) is at least `lateness` ahead of it. The watermark is taken from the newest entry of every ring
+ * buffer, not only the head entries, so a busy ring buffer keeps flowing while the others are idle. An entry arriving
+ * with a key smaller than one already emitted is still delivered, and counted as late.
+ */
+
+#include <cinttypes>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <wsong/common.h>
+#include <wsong/exceptions.hpp>
+#include <wsong/ipc/ring_buffer.hpp>
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @def WS_MERGE_STRICT
+ * @brief The lateness window for strict ordering: wait for all ring buffers.
+ */
+#define WS_MERGE_STRICT     (UINT64_MAX)
+
+/**
+ * @struct ring_merger_stats_t ring_merger.hpp <wsong/ipc/ring_merger.hpp>
+ * @brief The statistics of a merger.
+ */
+struct ring_merger_stats_t {
+    /**
+     * The number of entries emitted.
+     */
+    uint64_t    emitted;
+    /**
+     * The number of entries emitted with a key smaller than a previously emitted one.
+     */
+    uint64_t    late;
+    /**
+     * The largest key observed, in the head or the newest entry of a ring buffer.
+     */
+    uint64_t    watermark;
+};
+
+/**
+ * @typedef struct ring_merger_stats_t RingMergerStats
+ */
+using RingMergerStats = struct ring_merger_stats_t;
+
+/**
+ * @class RingMerger ring_merger.hpp <wsong/ipc/ring_merger.hpp>
+ * @brief The k-way merge consumer. The merger must be the only consumer of its ring buffers.
+ */
+class RingMerger {
+public:
+    /**
+     * @typedef Handler
+     * @brief The entry handler. `entry` points into the ring buffer and is only valid during the call. `ring_index`
+     * is the position of the ring buffer in the keys passed to the constructor.
+     */
+    using Handler = std::function<void(const void* entry, uint64_t key, uint32_t ring_index)>;
+
+private:
+    /**
+     * @cond    DoxygenSuppressed
+     */
+    struct HeapEntry {
+        uint64_t    key;
+        uint32_t    ring_index;
+    };
+    /**
+     * @endcond
+     */
+
+    /**
+     * The input ring buffers.
+     */
+    std::vector<std::unique_ptr<RingBuffer>>    rings;
+    /**
+     * Whether a ring buffer's head entry is in the heap.
+     */
+    std::vector<bool>                           in_heap;
+    /**
+     * The min-heap of the head entries.
+     */
+    std::vector<HeapEntry>                      heap;
+    /**
+     * The byte offset of the 64-bit key in the entries.
+     */
+    const uint16_t                              key_offset;
+    /**
+     * The lateness window.
+     */
+    const uint64_t                              lateness;
+    /**
+     * The largest key emitted.
+     */
+    uint64_t                                    last_emitted;
+    /**
+     * The statistics.
+     */
+    RingMergerStats                             statistics;
+
+    /**
+     * @fn void peek(uint32_t ring_index)
+     * @brief   Push the head entry of a ring buffer into the heap if there is one.
+     * @param[in]   ring_index  The index of the ring buffer.
+     */
+    WS_DLL_PRIVATE void peek(uint32_t ring_index);
+    /**
+     * @fn void advance_watermark()
+     * @brief   Raise the watermark to the key of the newest entry of every ring buffer.
+     */
+    WS_DLL_PRIVATE void advance_watermark();
+
+public:
+    /**
+     * @fn RingMerger(const std::vector<key_t>& keys, uint16_t key_offset, uint64_t lateness)
+     * @brief   Constructor
+     * @param[in]   keys        The keys of the ring buffers to merge.
+     * @param[in]   key_offset  The byte offset of the 64-bit merge key (sequence or timestamp) in the entries.
+     * @param[in]   lateness    The lateness window in key units, use `WS_MERGE_STRICT` for strict ordering.
+     */
+    WS_DLL_PUBLIC RingMerger(const std::vector<key_t>& keys, uint16_t key_offset, uint64_t lateness);
+    /**
+     * @fn virtual ~RingMerger()
+     * @brief   Destructor
+     */
+    WS_DLL_PUBLIC virtual ~RingMerger();
+    /**
+     * @fn size_t poll(const Handler& handler, size_t max_entries)
+     * @brief   Emit the entries ready to go in key order. It does not wait.
+     * @param[in]   handler     The entry handler.
+     * @param[in]   max_entries The maximum number of entries to emit.
+     * @return  The number of entries emitted.
+     */
+    WS_DLL_PUBLIC size_t poll(const Handler& handler, size_t max_entries = SIZE_MAX);
+    /**
+     * @fn RingMergerStats stats()
+     * @brief   Get the statistics.
+     * @return  The statistics.
+     */
+    WS_DLL_PUBLIC RingMergerStats stats();
+};
+
+}
+}
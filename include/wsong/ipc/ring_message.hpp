@@ -0,0 +1,620 @@
+#pragma once
+
+/**
+ * @file    ring_message.hpp
+ * @brief   Zero-copy messages in ring buffer slots, with the layout declared at compile time.
+ *
+ * A producer usually fills a struct and `produce()`s it, which copies the struct into the slot, and the consumer
+ * copies it out again. A message schema declares the layout of the slot instead: each field has a `constexpr` offset
+ * following the previous field, and the message may end with a variable-length tail. A `MessageBuilder` writes the
+ * fields in place into a slot reserved at the tail of the ring buffer, and a `MessageView` reads them in place from
+ * the slot at the head, so neither side copies or parses the message.
+ *
+ * Example:
+ * @code
+ * struct Quote {
+ *     static constexpr const char* name    = "quote";
+ *     static constexpr uint16_t    version = 1;
+ *     using symbol    = wsong::ipc::MessageField<char[8]>;
+ *     using price     = wsong::ipc::MessageField<double,symbol>;
+ *     using quantity  = wsong::ipc::MessageField<uint32_t,price>;
+ *     using venues    = wsong::ipc::MessageTail<uint16_t,quantity>;
+ *     using last      = venues;
+ * };
+ *
+ * wsong::ipc::MessageRing<Quote> ring(key);
+ * auto builder = ring.reserve(1ms);
+ * builder.set<Quote::price>(101.25);
+ * uint16_t* venues = builder.tail<Quote::venues>(2);
+ * venues[0] = 3; venues[1] = 7;
+ * ring.publish(builder);
+ *
+ * auto view = ring.next(1ms);
+ * double price = view.get<Quote::price>();
+ * for (uint16_t venue : view.tail<Quote::venues>()) { ... }
+ * ring.release(view);
+ * @endcode
+ *
+ * Slot layout, after the `TraceContext` on a traced ring buffer:
+ * | MessageHeader (8 bytes) | fields at their offsets | tail |
+ *
+ * The ring buffer carries the wire format version: `MessageRing<S>::describe()` stamps `schema=<name>/<version>` into
+ * the attribute of a ring buffer to create, and attaching a `MessageRing<S>` throws if the ring buffer is stamped with
+ * another schema or version, or if its entries are too small or misaligned for the layout. `MessageRing` is built on
+ * the position API of the ring buffer, so it is single-producer and single-consumer, and the ring buffer cannot be
+ * resized.
+ */
+
+#include <sys/ipc.h>
+#include <cinttypes>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <concepts>
+#include <memory>
+#include <span>
+#include <string>
+#include <type_traits>
+
+#include <wsong/common.h>
+#include <wsong/exceptions.hpp>
+#include <wsong/ipc/ring_buffer.hpp>
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @struct message_header_t ring_message.hpp <wsong/ipc/ring_message.hpp>
+ * @brief   The header of a message in a slot.
+ */
+struct message_header_t {
+    /**
+     * The hash of the schema name.
+     */
+    uint32_t    schema_id;
+    /**
+     * The schema version.
+     */
+    uint16_t    version;
+    /**
+     * The size of the message including this header and the tail.
+     */
+    uint16_t    size;
+};
+
+/**
+ * @typedef struct message_header_t MessageHeader
+ */
+using MessageHeader = struct message_header_t;
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+constexpr size_t message_align(size_t offset, size_t alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+constexpr uint32_t message_hash(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h = (h ^ static_cast<uint8_t>(*s++)) * 16777619u;
+    }
+    return h;
+}
+
+template <typename Prev>
+struct message_prev {
+    static_assert(!Prev::is_tail, "A message tail must be the last field.");
+    static constexpr size_t end         = Prev::end;
+    static constexpr size_t alignment   = Prev::alignment;
+};
+
+template <>
+struct message_prev<void> {
+    static constexpr size_t end         = sizeof(MessageHeader);
+    static constexpr size_t alignment   = alignof(MessageHeader);
+};
+/**
+ * @endcond
+ */
+
+/**
+ * @struct MessageField ring_message.hpp <wsong/ipc/ring_message.hpp>
+ * @brief   A fixed field of a message, placed after the previous field with the alignment of its type.
+ * @tparam  T       The field type, trivially copyable. An array type, like `char[8]`, is a fixed-size array field.
+ * @tparam  Prev    The previous field, or `void` for the first field.
+ */
+template <typename T, typename Prev = void>
+struct MessageField {
+    static_assert(std::is_trivially_copyable_v<T>, "A message field must be trivially copyable.");
+    /**
+     * The field type.
+     */
+    using type = T;
+    /**
+     * A fixed field is not a tail.
+     */
+    static constexpr bool   is_tail     = false;
+    /**
+     * The offset of the field in the message.
+     */
+    static constexpr size_t offset      = message_align(message_prev<Prev>::end,alignof(T));
+    /**
+     * The offset following the field.
+     */
+    static constexpr size_t end         = offset + sizeof(T);
+    /**
+     * The alignment the message needs up to this field.
+     */
+    static constexpr size_t alignment   = std::max(message_prev<Prev>::alignment,alignof(T));
+};
+
+/**
+ * @struct MessageTail ring_message.hpp <wsong/ipc/ring_message.hpp>
+ * @brief   The variable-length tail of a message: an array of elements filling the rest of the message. It must be
+ *          the last field.
+ * @tparam  T       The element type, trivially copyable.
+ * @tparam  Prev    The previous field, or `void` for a message of only a tail.
+ */
+template <typename T, typename Prev = void>
+struct MessageTail {
+    static_assert(std::is_trivially_copyable_v<T>, "A message tail must be trivially copyable.");
+    /**
+     * The element type.
+     */
+    using type = T;
+    /**
+     * It is the tail.
+     */
+    static constexpr bool   is_tail     = true;
+    /**
+     * The offset of the first element in the message.
+     */
+    static constexpr size_t offset      = message_align(message_prev<Prev>::end,alignof(T));
+    /**
+     * The fixed part of the message ends at the tail.
+     */
+    static constexpr size_t end         = offset;
+    /**
+     * The alignment the message needs.
+     */
+    static constexpr size_t alignment   = std::max(message_prev<Prev>::alignment,alignof(T));
+};
+
+/**
+ * @concept MessageSchema
+ * @brief   A message schema: a type with a `name`, a `version`, and its last field as `last`, declaring the fields as
+ *          member types.
+ */
+template <typename S>
+concept MessageSchema = requires {
+    { S::name } -> std::convertible_to<const char*>;
+    { S::version } -> std::convertible_to<uint16_t>;
+    typename S::last;
+    { S::last::end } -> std::convertible_to<size_t>;
+};
+
+/**
+ * @struct MessageLayout ring_message.hpp <wsong/ipc/ring_message.hpp>
+ * @brief   The layout of a message schema, computed at compile time.
+ */
+template <MessageSchema S>
+struct MessageLayout {
+    /**
+     * The schema id in the message headers.
+     */
+    static constexpr uint32_t   id          = message_hash(S::name);
+    /**
+     * The size of the fixed part of a message, including the header.
+     */
+    static constexpr size_t     fixed_size  = S::last::end;
+    /**
+     * The alignment a slot needs.
+     */
+    static constexpr size_t     alignment   = S::last::alignment;
+    /**
+     * The message ends with a variable-length tail.
+     */
+    static constexpr bool       has_tail    = S::last::is_tail;
+    static_assert(fixed_size <= UINT16_MAX, "The message is too large for a ring buffer slot.");
+};
+
+/**
+ * @fn void message_schema_describe(RingBufferAttribute& attribute, const char* name, uint16_t version)
+ * @brief   Stamp a message schema into the description of a ring buffer attribute. Use `MessageRing<S>::describe()`.
+ * @param[in,out]   attribute   The attribute of the ring buffer to create.
+ * @param[in]       name        The schema name.
+ * @param[in]       version     The schema version.
+ * @throws      ws_invalid_argument_exp if the description is already stamped, or has no room for the stamp.
+ */
+WS_DLL_PUBLIC void message_schema_describe(RingBufferAttribute& attribute, const char* name, uint16_t version);
+
+/**
+ * @fn void message_schema_check(const RingBufferAttribute& attribute, const char* name, uint16_t version, size_t fixed_size, size_t alignment)
+ * @brief   Check a ring buffer against a message schema. `MessageRing<S>` does it when it attaches.
+ * @param[in]   attribute   The attribute of the ring buffer.
+ * @param[in]   name        The schema name.
+ * @param[in]   version     The schema version.
+ * @param[in]   fixed_size  The size of the fixed part of a message.
+ * @param[in]   alignment   The alignment of a message.
+ * @throws      ws_invalid_argument_exp if the ring buffer is not stamped with the schema and version, or its entries
+ *              cannot hold the messages.
+ */
+WS_DLL_PUBLIC void message_schema_check(const RingBufferAttribute& attribute, const char* name, uint16_t version,
+                                        size_t fixed_size, size_t alignment);
+
+template <MessageSchema S>
+class MessageRing;
+
+/**
+ * @class MessageBuilder ring_message.hpp <wsong/ipc/ring_message.hpp>
+ * @brief   A message under construction in a reserved slot. Get it from `MessageRing<S>::reserve()`.
+ */
+template <MessageSchema S>
+class MessageBuilder {
+    friend class MessageRing<S>;
+    using Layout = MessageLayout<S>;
+private:
+    /**
+     * The message in the slot.
+     */
+    uint8_t* const  message;
+    /**
+     * The position of the slot.
+     */
+    const uint32_t  position;
+    /**
+     * The number of bytes in the slot for the message.
+     */
+    const uint16_t  room;
+
+    /**
+     * @fn MessageBuilder(void* message, uint32_t position, uint16_t room)
+     * @brief   Constructor, writing the header of a message without tail.
+     */
+    MessageBuilder(void* message, uint32_t position, uint16_t room):
+        message(reinterpret_cast<uint8_t*>(message)), position(position), room(room) {
+        MessageHeader* header = reinterpret_cast<MessageHeader*>(this->message);
+        header->schema_id   = Layout::id;
+        header->version     = S::version;
+        header->size        = static_cast<uint16_t>(Layout::fixed_size);
+    }
+
+public:
+    /**
+     * @fn template <typename F> typename F::type& field()
+     * @brief   Get a fixed field in the slot, to write it in place.
+     * @tparam  F       The field of the schema.
+     * @return  The reference to the field.
+     */
+    template <typename F>
+    typename F::type& field() {
+        static_assert(!F::is_tail && F::end <= Layout::fixed_size, "Not a fixed field of the schema.");
+        return *reinterpret_cast<typename F::type*>(this->message + F::offset);
+    }
+    /**
+     * @fn template <typename F> void set(const typename F::type& value)
+     * @brief   Write a fixed field.
+     * @tparam  F       The field of the schema.
+     * @param[in]   value   The value.
+     */
+    template <typename F>
+    void set(const typename F::type& value) {
+        static_assert(!F::is_tail && F::end <= Layout::fixed_size, "Not a fixed field of the schema.");
+        std::memcpy(this->message + F::offset,&value,sizeof(typename F::type));
+    }
+    /**
+     * @fn template <typename F> size_t tail_capacity() const
+     * @brief   Get the maximum number of tail elements the slot holds.
+     * @tparam  F       The tail of the schema.
+     * @return  The number of elements.
+     */
+    template <typename F>
+    size_t tail_capacity() const {
+        static_assert(F::is_tail && F::offset == Layout::fixed_size, "Not the tail of the schema.");
+        return (this->room - F::offset) / sizeof(typename F::type);
+    }
+    /**
+     * @fn template <typename F> typename F::type* tail(size_t count)
+     * @brief   Size the tail, and get it to write it in place.
+     * @tparam  F       The tail of the schema.
+     * @param[in]   count   The number of elements.
+     * @return  The first element of the tail.
+     * @throws  ws_invalid_argument_exp if the slot cannot hold `count` elements.
+     */
+    template <typename F>
+    typename F::type* tail(size_t count) {
+        if (count > this->tail_capacity<F>()) {
+            throw ws_invalid_argument_exp("The tail of " + std::to_string(count) + " elements exceeds the slot of " +
+                                          std::to_string(this->room) + " bytes.");
+        }
+        reinterpret_cast<MessageHeader*>(this->message)->size =
+                static_cast<uint16_t>(F::offset + count * sizeof(typename F::type));
+        return reinterpret_cast<typename F::type*>(this->message + F::offset);
+    }
+    /**
+     * @fn uint8_t* data()
+     * @brief   Get the raw message, starting with its header.
+     * @return  The message in the slot.
+     */
+    uint8_t* data() {
+        return this->message;
+    }
+};
+
+/**
+ * @class MessageView ring_message.hpp <wsong/ipc/ring_message.hpp>
+ * @brief   A typed view of a message in a slot. Get it from `MessageRing<S>::next()`; it is valid until released.
+ */
+template <MessageSchema S>
+class MessageView {
+    friend class MessageRing<S>;
+    using Layout = MessageLayout<S>;
+private:
+    /**
+     * The message in the slot.
+     */
+    const uint8_t*  message;
+    /**
+     * The position of the slot.
+     */
+    uint32_t        position;
+    /**
+     * The bytes of the slot available to the message.
+     */
+    uint16_t        room;
+
+    /**
+     * @fn MessageView(const void* message, uint32_t position, uint16_t room)
+     * @brief   Constructor
+     */
+    MessageView(const void* message, uint32_t position, uint16_t room):
+        message(reinterpret_cast<const uint8_t*>(message)), position(position), room(room) {}
+
+public:
+    /**
+     * @fn const MessageHeader& header() const
+     * @brief   Get the message header.
+     * @return  The header.
+     */
+    const MessageHeader& header() const {
+        return *reinterpret_cast<const MessageHeader*>(this->message);
+    }
+    /**
+     * @fn template <typename F> const typename F::type& get() const
+     * @brief   Read a fixed field in place.
+     * @tparam  F       The field of the schema.
+     * @return  The reference to the field in the slot.
+     */
+    template <typename F>
+    const typename F::type& get() const {
+        static_assert(!F::is_tail && F::end <= Layout::fixed_size, "Not a fixed field of the schema.");
+        return *reinterpret_cast<const typename F::type*>(this->message + F::offset);
+    }
+    /**
+     * @fn template <typename F> std::span<const typename F::type> tail() const
+     * @brief   Read the tail in place.
+     * @tparam  F       The tail of the schema.
+     * @return  The elements of the tail, or an empty span if the size in the header does not fit the slot.
+     */
+    template <typename F>
+    std::span<const typename F::type> tail() const {
+        static_assert(F::is_tail && F::offset == Layout::fixed_size, "Not the tail of the schema.");
+        const uint16_t size = this->header().size;
+        if (size < F::offset || size > this->room) {
+            return {};
+        }
+        return {reinterpret_cast<const typename F::type*>(this->message + F::offset),
+                (size - F::offset) / sizeof(typename F::type)};
+    }
+    /**
+     * @fn const uint8_t* data() const
+     * @brief   Get the raw message, starting with its header.
+     * @return  The message in the slot.
+     */
+    const uint8_t* data() const {
+        return this->message;
+    }
+};
+
+/**
+ * @class MessageRing ring_message.hpp <wsong/ipc/ring_message.hpp>
+ * @brief   A ring buffer carrying the messages of a schema, built and read in place.
+ *
+ * Several builders may be reserved before they are published, and several views taken before they are released;
+ * publishing a builder also publishes the builders reserved before it, and releasing a view also releases the views
+ * taken before it.
+ */
+template <MessageSchema S>
+class MessageRing {
+    using Layout = MessageLayout<S>;
+private:
+    /**
+     * The ring buffer.
+     */
+    std::unique_ptr<RingBuffer>     ring_buffer;
+    /**
+     * The offset of the message in a slot: after the trace context on a traced ring buffer.
+     */
+    uint16_t                        message_offset;
+    /**
+     * The number of bytes in a slot for the message.
+     */
+    uint16_t                        room;
+    /**
+     * The capacity of the ring buffer.
+     */
+    uint32_t                        capacity;
+    /**
+     * The producer's next position to reserve.
+     */
+    uint32_t                        next_tail;
+    /**
+     * The producer's process-local copy of the head position, only reloaded when the ring buffer looks full.
+     */
+    uint32_t                        cached_head;
+    /**
+     * The consumer's next position to view.
+     */
+    uint32_t                        next_head;
+    /**
+     * The consumer's process-local copy of the tail position, only reloaded when the ring buffer looks empty.
+     */
+    uint32_t                        cached_tail;
+
+    /**
+     * @cond    DoxygenSuppressed
+     */
+    template <typename Ready>
+    static bool wait(const Ready& ready, uint64_t timeout_ns) {
+        if (ready()) {
+            return true;
+        }
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds(timeout_ns);
+        while (!ready()) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+        }
+        return true;
+    }
+    /**
+     * @endcond
+     */
+
+public:
+    /**
+     * @fn MessageRing(key_t key)
+     * @brief   Attach to a ring buffer, and check it against the schema.
+     * @param[in]   key     The key of a ring buffer created with an attribute stamped by `describe()`.
+     * @throws      ws_invalid_argument_exp if the ring buffer is stamped with another schema or version, or its
+     *              entries cannot hold the messages.
+     */
+    MessageRing(key_t key): ring_buffer(RingBuffer::get_ring_buffer(key)) {
+        const RingBufferAttribute attribute = this->ring_buffer->attribute();
+        this->message_offset    = attribute.trace_context ? sizeof(TraceContext) : 0;
+        message_schema_check(attribute,S::name,S::version,Layout::fixed_size + this->message_offset,Layout::alignment);
+        if (this->message_offset % Layout::alignment != 0) {
+            throw ws_invalid_argument_exp("The trace context misaligns the messages of schema " +
+                                          std::string(S::name) + ".");
+        }
+        this->room          = attribute.entry_size - this->message_offset;
+        this->capacity      = attribute.capacity;
+        this->next_tail     = this->ring_buffer->tail_position();
+        this->cached_head   = this->ring_buffer->head_position();
+        this->next_head     = this->cached_head;
+        this->cached_tail   = this->next_tail;
+    }
+    /**
+     * @fn static void describe(RingBufferAttribute& attribute)
+     * @brief   Prepare the attribute of a ring buffer to create for the schema: stamp the schema into the
+     * description, and raise the entry size to hold the fixed part of a message.
+     * @param[in,out]   attribute   The attribute to pass to `RingBuffer::create_ring_buffer()`.
+     * @throws      ws_invalid_argument_exp if the raised entry size exceeds `UINT16_MAX`.
+     */
+    static void describe(RingBufferAttribute& attribute) {
+        const size_t needed = Layout::fixed_size + (attribute.trace_context ? sizeof(TraceContext) : 0);
+        // doubled in a wider type, a uint16_t would wrap around.
+        uint32_t entry_size = attribute.entry_size;
+        while (entry_size < needed) {
+            entry_size = entry_size ? entry_size * 2 : 1;
+        }
+        if (entry_size > UINT16_MAX) {
+            throw ws_invalid_argument_exp("The entry size of " + std::to_string(entry_size) +
+                                          " bytes for schema " + std::string(S::name) + " exceeds UINT16_MAX.");
+        }
+        message_schema_describe(attribute,S::name,S::version);
+        attribute.entry_size = static_cast<uint16_t>(entry_size);
+    }
+    /**
+     * @fn MessageBuilder<S> reserve(uint64_t timeout_ns)
+     * @brief   Reserve the next slot, and start a message in it. It is the zero-copy counterpart of `produce()`.
+     * @param[in]   timeout_ns  How long to wait for a free slot.
+     * @return  The builder of the message.
+     * @throws      ws_timeout_exp if the ring buffer stays full.
+     */
+    MessageBuilder<S> reserve(uint64_t timeout_ns) {
+        const uint32_t tail = this->next_tail;
+        if (!wait([&]() {
+                if (tail - this->cached_head < this->capacity - 1) {
+                    return true;
+                }
+                this->cached_head = this->ring_buffer->head_position();
+                return tail - this->cached_head < this->capacity - 1;
+            },timeout_ns)) {
+            throw ws_timeout_exp("MessageRing reserve() timed out on a full ring buffer.");
+        }
+        uint8_t* slot = reinterpret_cast<uint8_t*>(this->ring_buffer->slot(tail));
+        if (this->message_offset != 0) {
+            // no trace
+            std::memset(slot,0,this->message_offset);
+        }
+        this->next_tail ++;
+        return MessageBuilder<S>(slot + this->message_offset,tail,this->room);
+    }
+    /**
+     * @fn void publish(const MessageBuilder<S>& builder)
+     * @brief   Publish a message, and the messages reserved before it, to the consumer.
+     * @param[in]   builder     The builder of the message.
+     */
+    void publish(const MessageBuilder<S>& builder) {
+        this->ring_buffer->advance_tail(builder.position + 1);
+    }
+    /**
+     * @fn MessageView<S> next(uint64_t timeout_ns)
+     * @brief   View the next message. It is the zero-copy counterpart of `consume()`.
+     * @param[in]   timeout_ns  How long to wait for a message.
+     * @return  The view of the message.
+     * @throws      ws_timeout_exp if the ring buffer stays empty.
+     */
+    MessageView<S> next(uint64_t timeout_ns) {
+        const uint32_t head = this->next_head;
+        if (!wait([&]() {
+                if (this->cached_tail != head) {
+                    return true;
+                }
+                this->cached_tail = this->ring_buffer->tail_position();
+                return this->cached_tail != head;
+            },timeout_ns)) {
+            throw ws_timeout_exp("MessageRing next() timed out on an empty ring buffer.");
+        }
+        this->next_head ++;
+        return MessageView<S>(reinterpret_cast<uint8_t*>(this->ring_buffer->slot(head)) + this->message_offset,head,
+                              this->room);
+    }
+    /**
+     * @fn void release(const MessageView<S>& view)
+     * @brief   Release a message, and the messages viewed before it, to the producer.
+     * @param[in]   view        The view of the message.
+     */
+    void release(const MessageView<S>& view) {
+        this->ring_buffer->advance_head(view.position + 1);
+    }
+    /**
+     * @fn template <class Rep, class Period> MessageBuilder<S> reserve(const std::chrono::duration<Rep, Period>& timeout)
+     * @brief   The `std::chrono` version of `reserve()`.
+     */
+    template <class Rep, class Period>
+    MessageBuilder<S> reserve(const std::chrono::duration<Rep, Period>& timeout) {
+        return this->reserve(std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count());
+    }
+    /**
+     * @fn template <class Rep, class Period> MessageView<S> next(const std::chrono::duration<Rep, Period>& timeout)
+     * @brief   The `std::chrono` version of `next()`.
+     */
+    template <class Rep, class Period>
+    MessageView<S> next(const std::chrono::duration<Rep, Period>& timeout) {
+        return this->next(std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count());
+    }
+    /**
+     * @fn RingBuffer& ring()
+     * @brief   Get the underlying ring buffer.
+     * @return  The ring buffer.
+     */
+    RingBuffer& ring() {
+        return *this->ring_buffer;
+    }
+};
+
+}
+}
@@ -0,0 +1,236 @@
+#pragma once
+
+/**
+ * @file    ring_pool.hpp
+ * @brief   Many small ring buffers packed into one shared memory segment.
+ *
+ * Each `RingBuffer` costs a sys-V shared memory segment, a 4KB header, and at least one (huge) page of pinned memory.
+ * That does not scale to thousands of tiny per-session ring buffers: we hit the `shmmni` limit and waste TLB entries.
+ * The ring pool hosts many small single-producer/single-consumer ring buffers in one (hugepage-backed) segment. Every
+ * pooled ring buffer has a compact two-cacheline header, and is allocated and freed dynamically and addressed by a
+ * small handle.
+ *
+ * Segment layout:
+ * | RingPoolHeader (4KB) | allocation bitmap | ring 0 | ring 1 | ... |
+ * and each ring is:
+ * | head cacheline | tail cacheline | capacity * entry_size bytes |
+ */
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <cinttypes>
+#include <chrono>
+#include <memory>
+#include <atomic>
+
+#include <wsong/common.h>
+#include <wsong/exceptions.hpp>
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @struct ring_pool_attr_t ring_pool.hpp <wsong/ipc/ring_pool.hpp>
+ */
+struct ring_pool_attr_t {
+    /**
+     * The key of the underlying sys-V shared memory, also used as the key of the ring pool.
+     */
+    key_t       key;
+    /**
+     * The id of the underlying sys-V shared memory
+     */
+    int         id;
+    /**
+     * The size of the page of the shared memory for the ring pool.
+     */
+    uint32_t    page_size;
+    /**
+     * The number of ring buffers in the pool.
+     */
+    uint32_t    num_rings;
+    /**
+     * Capacity is the number of entries in each ring buffer. The maximum number of entries allowed is `capacity` - 1.
+     */
+    uint32_t    capacity;
+    /**
+     * The size of entry in the ring buffers.
+     */
+    uint16_t    entry_size;
+    /**
+     * Description of the ring pool.
+     */
+    char        description[256];
+};
+
+/**
+ * @typedef struct ring_pool_attr_t RingPoolAttribute
+ */
+using RingPoolAttribute = struct ring_pool_attr_t;
+
+/**
+ * union ring_pool_header_t ring_pool.hpp <wsong/ipc/ring_pool.hpp>
+ */
+union ring_pool_header_t {
+    /**
+     * The ring pool information;
+     */
+    struct {
+        RingPoolAttribute       attribute WS_CL_ALIGNED;
+        /**
+         * The number of allocated ring buffers.
+         */
+        std::atomic<uint32_t>   allocated WS_CL_ALIGNED;
+    }   info WS_CL_ALIGNED;
+    /**
+     * The placeholder for 4K alignment.
+     */
+    uint8_t __bytes__[4096];
+};
+
+/**
+ * @typedef union ring_pool_header_t RingPoolHeader
+ */
+using RingPoolHeader = union ring_pool_header_t;
+
+/**
+ * @typedef RingPoolHandle
+ * @brief The handle of a ring buffer in a pool.
+ */
+using RingPoolHandle = uint32_t;
+
+/**
+ * @class RingPool ring_pool.hpp <wsong/ipc/ring_pool.hpp>
+ * @brief The ring pool IPC. Each pooled ring buffer supports one producer and one consumer.
+ */
+class RingPool {
+private:
+    /**
+     * The pointer to the ring pool header.
+     */
+    const RingPoolHeader* const     info_ptr;
+
+public:
+    /**
+     * @fn RingPool(void* mem_ptr)
+     * @brief   Constructor
+     * @param[in]   mem_ptr     The pointer to the shared memory.
+     */
+    WS_DLL_PRIVATE RingPool(void* mem_ptr);
+    /**
+     * @fn virtual ~RingPool()
+     * @brief   destructor
+     */
+    WS_DLL_PUBLIC virtual ~RingPool();
+    /**
+     * @fn RingPoolAttribute attribute()
+     * @brief   Get attribute
+     * @return  An attribute object of type `RingPoolAttribute`.
+     */
+    WS_DLL_PUBLIC RingPoolAttribute attribute();
+    /**
+     * @fn uint32_t allocated()
+     * @brief   Get the number of allocated ring buffers.
+     * @return  The number of allocated ring buffers.
+     */
+    WS_DLL_PUBLIC uint32_t allocated();
+    /**
+     * @fn RingPoolHandle allocate()
+     * @brief   Allocate an empty ring buffer from the pool. It is lock-free and can be called by any process.
+     * @return  The handle of the ring buffer. Pass it to the peer process to share the ring buffer.
+     */
+    WS_DLL_PUBLIC RingPoolHandle allocate();
+    /**
+     * @fn void release(RingPoolHandle handle)
+     * @brief   Return a ring buffer to the pool. Caution: we do NOT detect active users.
+     * @param[in]   handle      The handle of the ring buffer.
+     */
+    WS_DLL_PUBLIC void release(RingPoolHandle handle);
+    /**
+     * @fn void produce(RingPoolHandle handle, const void* buffer, uint16_t size, uint64_t timeout_ns)
+     * @brief   Produce a buffer to a pooled ring buffer.
+     * @param[in]   handle      The handle of the ring buffer.
+     * @param[in]   buffer      Pointer to the buffer to send.
+     * @param[in]   size        Size of the data in the buffer.
+     * @param[in]   timeout_ns  Timeout in nanoseconds, if specified with 0, it returns immediately or
+     *                          throw an exception on failure.
+     */
+    WS_DLL_PUBLIC void produce(RingPoolHandle handle, const void* buffer, uint16_t size, uint64_t timeout_ns);
+    /**
+     * @fn void consume(RingPoolHandle handle, void* buffer, uint16_t size, uint64_t timeout_ns)
+     * @brief   Consume a buffer from a pooled ring buffer.
+     * @param[in]   handle      The handle of the ring buffer.
+     * @param[in]   buffer      Pointer to the buffer to accept the data.
+     * @param[in]   size        Size of the buffer.
+     * @param[in]   timeout_ns  Timeout in nanoseconds, if specified with 0, it returns immediately or
+     *                          throw an exception on failure.
+     */
+    WS_DLL_PUBLIC void consume(RingPoolHandle handle, void* buffer, uint16_t size, uint64_t timeout_ns);
+    /**
+     * @fn template <class Rep, class Period> void produce(RingPoolHandle handle, const void* buffer, uint16_t size, const std::chrono::duration<Rep, Period>& timeout)
+     * @brief   Produce a buffer. This is a wrapper function for easy timeout settings.
+     * @tparam      Rep         An arthmetic type representing the number of ticks.
+     * @tparam      Period      An std::ratio type representing the tick period.
+     * @param[in]   handle      The handle of the ring buffer.
+     * @param[in]   buffer      Pointer to the buffer to send.
+     * @param[in]   size        Size of the data in the buffer.
+     * @param[in]   timeout     Timeout
+     */
+    template <class Rep, class Period>
+    void produce(RingPoolHandle handle, const void* buffer, uint16_t size,
+                 const std::chrono::duration<Rep, Period>& timeout) {
+        this->produce(handle,buffer,size,std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count());
+    }
+    /**
+     * @fn template <class Rep, class Period> void consume(RingPoolHandle handle, void* buffer, uint16_t size, const std::chrono::duration<Rep, Period>& timeout)
+     * @brief   Consume a buffer. This is a wrapper function for easy timeout settings.
+     * @tparam      Rep         An arthmetic type representing the number of ticks.
+     * @tparam      Period      An std::ratio type representing the tick period.
+     * @param[in]   handle      The handle of the ring buffer.
+     * @param[in]   buffer      Pointer to the receiving buffer.
+     * @param[in]   size        Size of the buffer.
+     * @param[in]   timeout     Timeout
+     */
+    template <class Rep, class Period>
+    void consume(RingPoolHandle handle, void* buffer, uint16_t size,
+                 const std::chrono::duration<Rep, Period>& timeout) {
+        this->consume(handle,buffer,size,std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count());
+    }
+    /**
+     * @fn uint32_t size(RingPoolHandle handle)
+     * @brief   Get the number of entries in a pooled ring buffer. This is not reliable due to the lockless design.
+     * @param[in]   handle      The handle of the ring buffer.
+     * @return  The number of the entries.
+     */
+    WS_DLL_PUBLIC uint32_t size(RingPoolHandle handle);
+    /**
+     * @fn bool empty(RingPoolHandle handle)
+     * @brief   Test weather a pooled ring buffer is empty or not. This is not reliable due to the lockless design.
+     * @param[in]   handle      The handle of the ring buffer.
+     * @return  True for empty, otherwise false.
+     */
+    WS_DLL_PUBLIC bool empty(RingPoolHandle handle);
+    /**
+     *  @fn static key_t create_ring_pool(const RingPoolAttribute& attribute)
+     *  @brief  Create a new ring pool. Like `RingBuffer::create_ring_buffer`, the memory is allocated and pinned.
+     *  @param[in]  attribute       The attribute of the ring pool.
+     *  @return     The key of a successfully created ring pool.
+     */
+    WS_DLL_PUBLIC static key_t create_ring_pool(const RingPoolAttribute& attribute);
+    /**
+     * @fn static void delete_ring_pool(const key_t key)
+     * @brief   Delete a ring pool. Caution: we do NOT detect active users.
+     * @param[in]   key         The key of the ring pool to remove.
+     */
+    WS_DLL_PUBLIC static void delete_ring_pool(const key_t key);
+    /**
+     * @fn static std::unique_ptr<RingPool> get_ring_pool(const key_t key)
+     * @brief   Get a ring pool using the key.
+     * @param[in]   key         The key of the ring pool to get.
+     * @return      A unique pointer to the ring pool.
+     */
+    WS_DLL_PUBLIC static std::unique_ptr<RingPool> get_ring_pool(const key_t key);
+};
+
+}
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+/**
+ * @file    ring_relay.hpp
+ * @brief   Replicate a ring buffer to NUMA node-local copies.
+ *
+ * A consumer on a remote NUMA node pays the remote memory latency for every entry it reads from a ring buffer
+ * allocated on the producer's node. The relay fixes that by running one pinned thread on each remote node. The thread
+ * drains the source ring buffer in batches and republishes the entries into a node-local ring buffer, so that the
+ * remote consumers only touch local memory.
+ *
+ * The relay is the one and only consumer of the source ring buffer. With multiple targets (fan-out), every relay
+ * thread reads the source with its own cursor and the source head only moves past an entry after all targets have
+ * copied it.
+ */
+
+#include <cinttypes>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <wsong/common.h>
+#include <wsong/exceptions.hpp>
+#include <wsong/ipc/ring_buffer.hpp>
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @struct ring_relay_target_t ring_relay.hpp <wsong/ipc/ring_relay.hpp>
+ * @brief The specification of a relay target.
+ */
+struct ring_relay_target_t {
+    /**
+     * The NUMA node where the relay thread runs and the target ring buffer is allocated.
+     */
+    int         numa_node;
+    /**
+     * The key of the target ring buffer. If it is zero, a random key is chosen.
+     */
+    key_t       key;
+};
+
+/**
+ * @typedef struct ring_relay_target_t RingRelayTarget
+ */
+using RingRelayTarget = struct ring_relay_target_t;
+
+/**
+ * @struct ring_relay_stats_t ring_relay.hpp <wsong/ipc/ring_relay.hpp>
+ * @brief The statistics of a relay target.
+ */
+struct ring_relay_stats_t {
+    /**
+     * The NUMA node of the target.
+     */
+    int         numa_node;
+    /**
+     * The key of the target ring buffer.
+     */
+    key_t       key;
+    /**
+     * The number of entries relayed.
+     */
+    uint64_t    relayed;
+    /**
+     * The number of batches relayed.
+     */
+    uint64_t    batches;
+    /**
+     * The relay lag: the number of entries in the source ring buffer not yet copied to the target.
+     */
+    uint32_t    lag;
+};
+
+/**
+ * @typedef struct ring_relay_stats_t RingRelayStats
+ */
+using RingRelayStats = struct ring_relay_stats_t;
+
+/**
+ * @class RingRelay ring_relay.hpp <wsong/ipc/ring_relay.hpp>
+ * @brief The cross-NUMA ring buffer relay.
+ */
+class RingRelay {
+private:
+    /**
+     * @cond    DoxygenSuppressed
+     */
+    struct alignas(CACHELINE_SIZE) Lane {
+        RingRelayTarget             target;
+        std::unique_ptr<RingBuffer> ring;
+        std::atomic<uint32_t>       cursor;
+        std::atomic<uint64_t>       relayed;
+        std::atomic<uint64_t>       batches;
+        std::thread                 thread;
+        bool                        created;
+    };
+    /**
+     * @endcond
+     */
+
+    /**
+     * The source ring buffer.
+     */
+    std::unique_ptr<RingBuffer>         source;
+    /**
+     * The relay lanes, one for each target.
+     */
+    std::vector<std::unique_ptr<Lane>>  lanes;
+    /**
+     * The maximum number of entries relayed in a batch.
+     */
+    const uint32_t                      batch_size;
+    /**
+     * The stop flag.
+     */
+    std::atomic<bool>                   stopped;
+
+    /**
+     * @fn void relay(Lane& lane, bool releaser)
+     * @brief   The relay thread body.
+     * @param[in]   lane        The lane of this thread.
+     * @param[in]   releaser    If true, this thread moves the source head to the slowest cursor.
+     */
+    WS_DLL_PRIVATE void relay(Lane& lane, bool releaser);
+
+public:
+    /**
+     * @fn RingRelay(const key_t source_key, const std::vector<RingRelayTarget>& targets, uint32_t batch_size)
+     * @brief   Constructor. It creates the target ring buffers with the source ring buffer's attributes on the
+     * corresponding NUMA nodes and starts the relay threads.
+     * @param[in]   source_key  The key of the source ring buffer. The relay must be its only consumer.
+     * @param[in]   targets     The relay targets, at least one.
+     * @param[in]   batch_size  The maximum number of entries relayed in a batch.
+     */
+    WS_DLL_PUBLIC RingRelay(const key_t source_key, const std::vector<RingRelayTarget>& targets,
+                            uint32_t batch_size = 64);
+    /**
+     * @fn virtual ~RingRelay()
+     * @brief   Destructor. It stops the relay threads. The target ring buffers are NOT deleted.
+     */
+    WS_DLL_PUBLIC virtual ~RingRelay();
+    /**
+     * @fn void stop()
+     * @brief   Stop the relay threads.
+     */
+    WS_DLL_PUBLIC void stop();
+    /**
+     * @fn std::vector<RingRelayStats> stats()
+     * @brief   Get the statistics of all targets.
+     * @return  The statistics, in the order of the targets.
+     */
+    WS_DLL_PUBLIC std::vector<RingRelayStats> stats();
+};
+
+}
+}
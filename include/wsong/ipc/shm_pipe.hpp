@@ -0,0 +1,413 @@
+#pragma once
+
+/**
+ * @file    shm_pipe.hpp
+ * @brief   A shared-memory byte-stream pipe with read/write semantics.
+ *
+ * Some components speak byte streams rather than messages. The `ShmPipe` is a single-producer single-consumer byte
+ * ring in sys-V shared memory with the semantics of a pipe: `read()` returns whatever is available, at least one byte,
+ * and `write()` writes everything, waiting for the reader to make room. `readv()` and `writev()` scatter and gather,
+ * and `splice_from()` / `splice_to()` move bytes between the pipe and a file descriptor with `readv(2)` / `writev(2)`
+ * on the ring memory itself, with no intermediate buffer.
+ *
+ * The layout follows the ring buffer: a 4KB header with the head and the tail in their own cachelines, followed by
+ * `capacity` bytes of data. The positions are free running 64-bit byte counters. Each side keeps a process-local copy
+ * of the peer position, and only reloads it when the pipe looks empty (reader) or full (writer).
+ *
+ * A pipe is polling by default, like the ring buffer. A blocking pipe spins for a few microseconds, then sleeps on a
+ * futex in the cacheline of the peer position. The peer checks for a sleeper after each `read()` or `write()`, at the
+ * cost of a full fence, and wakes it up.
+ *
+ * The writer closes its end with `close_writer()`: the reader then gets 0 bytes, the end of stream, once it has read
+ * everything. The reader closes its end with `close_reader()`, which breaks the pipe for the writer: its writes fail
+ * once they need room from the reader, since the writer only looks at the reader's cacheline then.
+ */
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/uio.h>
+#include <cinttypes>
+#include <chrono>
+#include <memory>
+#include <atomic>
+
+#include <wsong/common.h>
+#include <wsong/exceptions.hpp>
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @struct shm_pipe_attr_t shm_pipe.hpp <wsong/ipc/shm_pipe.hpp>
+ */
+struct shm_pipe_attr_t {
+    /**
+     * The key of the underlying sys-V shared memory, also used as the key of the pipe.
+     */
+    key_t       key;
+    /**
+     * The id of the underlying sys-V shared memory.
+     */
+    int         id;
+    /**
+     * The size of the page of the shared memory.
+     */
+    uint32_t    page_size;
+    /**
+     * The capacity of the pipe in bytes, must be power-of-two.
+     */
+    uint64_t    capacity;
+    /**
+     * The readers and writers sleep on a futex, instead of polling, after a short spin.
+     */
+    bool        blocking;
+    /**
+     * The permission bits of the underlying sys-V shared memory, like `0600`; 0 for the default `0644`. A process that
+     * can read the segment can read every byte written to the pipe.
+     */
+    uint32_t    mode;
+    /**
+     * Description of the pipe.
+     */
+    char        description[256];
+};
+
+/**
+ * @typedef struct shm_pipe_attr_t ShmPipeAttribute
+ */
+using ShmPipeAttribute = struct shm_pipe_attr_t;
+
+/**
+ * @struct shm_pipe_state_t shm_pipe.hpp <wsong/ipc/shm_pipe.hpp>
+ * @brief The dynamic state of a pipe.
+ */
+struct shm_pipe_state_t {
+    // Every member is cacheline aligned. The reader owns the first one, and the writer the second one.
+    struct {
+        /**
+         * The pipe's head position in bytes.
+         */
+        std::atomic<uint64_t>   head;
+        /**
+         * The number of read calls finding the pipe empty, only updated on that slow path.
+         */
+        std::atomic<uint64_t>   empty_stalls;
+        /**
+         * The futex the writer sleeps on, bumped by the reader to wake it up.
+         */
+        std::atomic<uint32_t>   space_futex;
+        /**
+         * The writer is sleeping on `space_futex`.
+         */
+        std::atomic<uint32_t>   writer_sleeping;
+        /**
+         * The reader has closed its end.
+         */
+        std::atomic<bool>       reader_closed;
+    } head_cl WS_CL_ALIGNED;
+    struct {
+        /**
+         * The pipe's tail position in bytes.
+         */
+        std::atomic<uint64_t>   tail;
+        /**
+         * The number of write calls finding the pipe full, only updated on that slow path.
+         */
+        std::atomic<uint64_t>   full_stalls;
+        /**
+         * The futex the reader sleeps on, bumped by the writer to wake it up.
+         */
+        std::atomic<uint32_t>   data_futex;
+        /**
+         * The reader is sleeping on `data_futex`.
+         */
+        std::atomic<uint32_t>   reader_sleeping;
+        /**
+         * The writer has closed its end.
+         */
+        std::atomic<bool>       writer_closed;
+    } tail_cl WS_CL_ALIGNED;
+};
+
+/**
+ * @typedef struct shm_pipe_state_t ShmPipeState
+ */
+using ShmPipeState = struct shm_pipe_state_t;
+
+/**
+ * union shm_pipe_header_t shm_pipe.hpp <wsong/ipc/shm_pipe.hpp>
+ */
+union shm_pipe_header_t {
+    /**
+     * The pipe information;
+     */
+    struct {
+        /**
+         * The magic number identifying a pipe segment.
+         */
+        uint64_t            magic;
+        ShmPipeAttribute    attribute WS_CL_ALIGNED;
+        ShmPipeState        state     WS_CL_ALIGNED;
+    }   info WS_CL_ALIGNED;
+    /**
+     * The placeholder for 4K alignment.
+     */
+    uint8_t __bytes__[4096];
+};
+
+/**
+ * @typedef union shm_pipe_header_t ShmPipeHeader
+ */
+using ShmPipeHeader = union shm_pipe_header_t;
+
+/**
+ * @struct shm_pipe_stats_t shm_pipe.hpp <wsong/ipc/shm_pipe.hpp>
+ * @brief A sample of the pipe's dynamic state.
+ */
+struct shm_pipe_stats_t {
+    /**
+     * The number of bytes read.
+     */
+    uint64_t    head;
+    /**
+     * The number of bytes written.
+     */
+    uint64_t    tail;
+    /**
+     * The number of read calls finding the pipe empty.
+     */
+    uint64_t    empty_stalls;
+    /**
+     * The number of write calls finding the pipe full.
+     */
+    uint64_t    full_stalls;
+    /**
+     * The writer has closed its end.
+     */
+    bool        writer_closed;
+    /**
+     * The reader has closed its end.
+     */
+    bool        reader_closed;
+};
+
+/**
+ * @typedef struct shm_pipe_stats_t ShmPipeStats
+ */
+using ShmPipeStats = struct shm_pipe_stats_t;
+
+/**
+ * @class ShmPipe shm_pipe.hpp <wsong/ipc/shm_pipe.hpp>
+ * @brief The shared-memory pipe IPC, with one reader and one writer.
+ */
+class ShmPipe {
+private:
+    /**
+     * The pointer to the pipe header.
+     */
+    const ShmPipeHeader* const  info_ptr;
+    /**
+     * The writer's process-local copy of the head position, only reloaded when the pipe looks full.
+     */
+    uint64_t                    cached_head;
+    /**
+     * The reader's process-local copy of the tail position, only reloaded when the pipe looks empty.
+     */
+    uint64_t                    cached_tail;
+    /**
+     * @fn uint64_t readable(uint64_t timeout_ns)
+     * @brief   Wait for bytes to read.
+     * @param[in]   timeout_ns  Timeout in nanoseconds.
+     * @return  The number of readable bytes, 0 at the end of stream.
+     */
+    WS_DLL_PRIVATE uint64_t readable(uint64_t timeout_ns) ;
+    /**
+     * @fn void consumed(uint64_t head)
+     * @brief   Release the bytes before `head` to the writer, and wake it up.
+     * @param[in]   head        The new head position.
+     */
+    WS_DLL_PRIVATE void consumed(uint64_t head) ;
+    /**
+     * @fn uint64_t writable(uint64_t tail, uint64_t timeout_ns)
+     * @brief   Wait for room to write at `tail`.
+     * @param[in]   tail        The position to write at.
+     * @param[in]   timeout_ns  Timeout in nanoseconds.
+     * @return  The number of bytes of free room, 0 on timeout.
+     */
+    WS_DLL_PRIVATE uint64_t writable(uint64_t tail, uint64_t timeout_ns) ;
+    /**
+     * @fn void produced(uint64_t tail)
+     * @brief   Publish the bytes before `tail` to the reader, and wake it up.
+     * @param[in]   tail        The new tail position.
+     */
+    WS_DLL_PRIVATE void produced(uint64_t tail) ;
+
+public:
+    /**
+     * @fn ShmPipe(void* mem_ptr)
+     * @brief   Constructor
+     * @param[in]   mem_ptr     The pointer to the shared memory.
+     */
+    WS_DLL_PRIVATE ShmPipe(void* mem_ptr) ;
+    /**
+     * @fn virtual ~ShmPipe()
+     * @brief   destructor
+     */
+    WS_DLL_PUBLIC virtual ~ShmPipe() ;
+    /**
+     * @fn size_t read(void* buffer, size_t size, uint64_t timeout_ns)
+     * @brief   Read what is available, up to `size` bytes.
+     * @param[out]  buffer      The buffer receiving the bytes.
+     * @param[in]   size        The size of the buffer.
+     * @param[in]   timeout_ns  Timeout in nanoseconds for the first byte. If specified with 0, it returns
+     *                          immediately or throws an exception on failure.
+     * @return  The number of bytes read, at least 1, or 0 at the end of stream.
+     */
+    WS_DLL_PUBLIC size_t read(void* buffer, size_t size, uint64_t timeout_ns) ;
+    /**
+     * @fn size_t readv(const struct iovec* iov, int iovcnt, uint64_t timeout_ns)
+     * @brief   Read what is available into the buffers, filling them in order.
+     * @param[in]   iov         The buffers.
+     * @param[in]   iovcnt      The number of buffers.
+     * @param[in]   timeout_ns  Timeout in nanoseconds for the first byte.
+     * @return  The number of bytes read, at least 1, or 0 at the end of stream.
+     */
+    WS_DLL_PUBLIC size_t readv(const struct iovec* iov, int iovcnt, uint64_t timeout_ns) ;
+    /**
+     * @fn size_t write(const void* buffer, size_t size, uint64_t timeout_ns)
+     * @brief   Write all bytes, waiting for the reader to make room as needed.
+     * @param[in]   buffer      The bytes to write.
+     * @param[in]   size        The number of bytes.
+     * @param[in]   timeout_ns  Timeout in nanoseconds for the whole write.
+     * @return  The number of bytes written, less than `size` only if the timeout expires after a partial write. It
+     *          throws `ws_timeout_exp` if no byte is written.
+     */
+    WS_DLL_PUBLIC size_t write(const void* buffer, size_t size, uint64_t timeout_ns) ;
+    /**
+     * @fn size_t writev(const struct iovec* iov, int iovcnt, uint64_t timeout_ns)
+     * @brief   Write all bytes of the buffers, in order.
+     * @param[in]   iov         The buffers.
+     * @param[in]   iovcnt      The number of buffers.
+     * @param[in]   timeout_ns  Timeout in nanoseconds for the whole write.
+     * @return  The number of bytes written, less than the total only if the timeout expires after a partial write.
+     */
+    WS_DLL_PUBLIC size_t writev(const struct iovec* iov, int iovcnt, uint64_t timeout_ns) ;
+    /**
+     * @fn size_t splice_from(int fd, size_t size, uint64_t timeout_ns)
+     * @brief   Read up to `size` bytes from a file descriptor into the pipe, with one `readv(2)` call on the free
+     * room of the ring.
+     * @param[in]   fd          The file descriptor to read from.
+     * @param[in]   size        The maximum number of bytes to move.
+     * @param[in]   timeout_ns  Timeout in nanoseconds waiting for room in the pipe.
+     * @return  The number of bytes moved, 0 at the end of file.
+     */
+    WS_DLL_PUBLIC size_t splice_from(int fd, size_t size, uint64_t timeout_ns) ;
+    /**
+     * @fn size_t splice_to(int fd, size_t size, uint64_t timeout_ns)
+     * @brief   Write up to `size` bytes from the pipe to a file descriptor, with one `writev(2)` call on the readable
+     * bytes of the ring.
+     * @param[in]   fd          The file descriptor to write to.
+     * @param[in]   size        The maximum number of bytes to move.
+     * @param[in]   timeout_ns  Timeout in nanoseconds waiting for bytes in the pipe.
+     * @return  The number of bytes moved, 0 at the end of stream.
+     */
+    WS_DLL_PUBLIC size_t splice_to(int fd, size_t size, uint64_t timeout_ns) ;
+    /**
+     * @fn void close_writer()
+     * @brief   Close the writer's end. The reader gets the end of stream after the remaining bytes.
+     */
+    WS_DLL_PUBLIC void close_writer() ;
+    /**
+     * @fn void close_reader()
+     * @brief   Close the reader's end. The writes fail from then on.
+     */
+    WS_DLL_PUBLIC void close_reader() ;
+    /**
+     * @fn bool arm_reader()
+     * @brief   Announce that the reader is going to wait for the bytes outside of the pipe, e.g. in `poll(2)` on a
+     * file descriptor the writer can notify. It is the event-loop counterpart of the futex of a blocking pipe, so it
+     * is only allowed on a polling pipe.
+     * @return  True if the pipe is empty: the next write finds the reader armed. False if there are bytes to read, or
+     *          the end of stream; the reader stays armed anyway.
+     */
+    WS_DLL_PUBLIC bool arm_reader() ;
+    /**
+     * @fn bool disarm_reader()
+     * @brief   Called by the writer after a write: tell if the reader is armed, and disarm it. The writer notifies the
+     * reader if so.
+     * @return  True if the reader was armed.
+     */
+    WS_DLL_PUBLIC bool disarm_reader() ;
+    /**
+     * @fn template <class Rep, class Period> size_t read(void* buffer, size_t size, const std::chrono::duration<Rep, Period>& timeout)
+     * @brief   Read what is available. This is a wrapper function for easy timeout settings.
+     * @tparam      Rep         An arthmetic type representing the number of ticks.
+     * @tparam      Period      An std::ratio type representing the tick period.
+     * @param[out]  buffer      The buffer receiving the bytes.
+     * @param[in]   size        The size of the buffer.
+     * @param[in]   timeout     Timeout
+     * @return  The number of bytes read, or 0 at the end of stream.
+     */
+    template <class Rep, class Period>
+    size_t read(void* buffer, size_t size, const std::chrono::duration<Rep, Period>& timeout) {
+        return this->read(buffer,size,std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count());
+    }
+    /**
+     * @fn template <class Rep, class Period> size_t write(const void* buffer, size_t size, const std::chrono::duration<Rep, Period>& timeout)
+     * @brief   Write all bytes. This is a wrapper function for easy timeout settings.
+     * @tparam      Rep         An arthmetic type representing the number of ticks.
+     * @tparam      Period      An std::ratio type representing the tick period.
+     * @param[in]   buffer      The bytes to write.
+     * @param[in]   size        The number of bytes.
+     * @param[in]   timeout     Timeout
+     * @return  The number of bytes written.
+     */
+    template <class Rep, class Period>
+    size_t write(const void* buffer, size_t size, const std::chrono::duration<Rep, Period>& timeout) {
+        return this->write(buffer,size,std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count());
+    }
+    /**
+     * @fn ShmPipeAttribute attribute()
+     * @brief   Get attribute
+     * @return  An attribute object of type `ShmPipeAttribute`.
+     */
+    WS_DLL_PUBLIC ShmPipeAttribute attribute() ;
+    /**
+     * @fn ShmPipeStats stats()
+     * @brief   Sample the dynamic state. It only reads the shared memory, so it is safe on a read-only pipe.
+     * @return  A stats object of type `ShmPipeStats`.
+     */
+    WS_DLL_PUBLIC ShmPipeStats stats() ;
+    /**
+     * @fn uint64_t size()
+     * @brief   Get the number of bytes in the pipe. This is not reliable due to the lockless design.
+     * @return  The number of bytes.
+     */
+    WS_DLL_PUBLIC uint64_t size() ;
+    /**
+     *  @fn static key_t  create_shm_pipe(const ShmPipeAttribute& attribute);
+     *  @brief  Create a new pipe. The memory is pinned like the ring buffer's.
+     *  @param[in]  attribute       The attribute of the pipe. If `attribute.key` is not specified, a random key will
+     *                              be chosen on a successful call.
+     *  @return     The key of a successfully created pipe.
+     */
+    WS_DLL_PUBLIC static key_t  create_shm_pipe(const ShmPipeAttribute& attribute) ;
+    /**
+     * @fn static void   delete_shm_pipe(const key_t key);
+     * @brief   Delete a pipe. Caution: we do NOT detect active users. Caller is responsible for removing them.
+     * @param[in]   key         The key of the pipe to remove.
+     */
+    WS_DLL_PUBLIC static void   delete_shm_pipe(const key_t key) ;
+    /**
+     * @fn static std::unique_ptr<ShmPipe> get_shm_pipe(const key_t key, bool read_only);
+     * @brief   Get a pipe using the key.
+     * @param[in]   key         The key of the pipe to get.
+     * @param[in]   read_only   Attach the shared memory read-only. Only `attribute()`, `stats()`, and `size()` are
+     *                          allowed on a read-only pipe.
+     * @return      A unique pointer to the pipe.
+     */
+    WS_DLL_PUBLIC static std::unique_ptr<ShmPipe> get_shm_pipe(const key_t key, bool read_only = false);
+};
+
+}
+}
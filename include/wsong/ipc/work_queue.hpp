@@ -0,0 +1,365 @@
+#pragma once
+
+/**
+ * @file    work_queue.hpp
+ * @brief   A shared-memory work queue with leases, acknowledgements, and redelivery.
+ *
+ * A `RingBuffer` with multiple consumers removes an entry the moment it is copied out, so a worker crashing in the
+ * middle of a job loses it. The work queue gives at-least-once delivery instead. A worker leases an entry, works on
+ * it, and acknowledges it. Until then the entry stays in the worker's lease slot in the shared memory, and if the
+ * worker dies, or holds the lease longer than `lease_timeout_ns`, the entry is redelivered to another worker.
+ *
+ * The queue is a bounded MPMC ring with a sequence number in each slot: producers and consumers claim positions with
+ * a compare-and-swap on the tail and the head, with no lock on the normal path. A consumer records the position it is
+ * claiming in its lease slot before claiming it, moves the entry into the lease slot, and only then releases the
+ * ring slot, so that a crash at any point leaves enough behind for `reclaim()` to recover the entry. Redelivered
+ * entries are served before new ones.
+ *
+ * The memory is laid out as:
+ * | WorkQueueHeader (4KB) | consumer table | ring slots | lease slots, `max_leases` per consumer |
+ * where each ring slot and lease slot is rounded up to whole cachelines.
+ */
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <pthread.h>
+#include <cinttypes>
+#include <chrono>
+#include <memory>
+#include <atomic>
+#include <vector>
+
+#include <wsong/common.h>
+#include <wsong/exceptions.hpp>
+
+/**
+ * @def WS_WORK_QUEUE_MAX_CONSUMERS
+ * @brief   The maximum number of consumers of a work queue.
+ */
+#define WS_WORK_QUEUE_MAX_CONSUMERS     (255)
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @struct work_queue_attr_t work_queue.hpp <wsong/ipc/work_queue.hpp>
+ */
+struct work_queue_attr_t {
+    /**
+     * The key of the underlying sys-V shared memory, also used as the key of the work queue.
+     */
+    key_t       key;
+    /**
+     * The id of the underlying sys-V shared memory.
+     */
+    int         id;
+    /**
+     * The size of the page of the shared memory.
+     */
+    uint32_t    page_size;
+    /**
+     * The number of ring slots, must be power-of-two.
+     */
+    uint32_t    capacity;
+    /**
+     * The size of an entry.
+     */
+    uint16_t    entry_size;
+    /**
+     * The maximum number of consumers, no more than `WS_WORK_QUEUE_MAX_CONSUMERS`.
+     */
+    uint32_t    max_consumers;
+    /**
+     * The maximum number of leases a consumer holds at the same time.
+     */
+    uint32_t    max_leases;
+    /**
+     * A lease held longer than this is redelivered, even if the consumer is alive. Zero means never.
+     */
+    uint64_t    lease_timeout_ns;
+    /**
+     * Description of the work queue.
+     */
+    char        description[256];
+};
+
+/**
+ * @typedef struct work_queue_attr_t WorkQueueAttribute
+ */
+using WorkQueueAttribute = struct work_queue_attr_t;
+
+/**
+ * union work_queue_header_t work_queue.hpp <wsong/ipc/work_queue.hpp>
+ */
+union work_queue_header_t {
+    /**
+     * The work queue information;
+     */
+    struct {
+        WorkQueueAttribute      attribute WS_CL_ALIGNED;
+        /**
+         * The position producers claim next.
+         */
+        std::atomic<uint64_t>   tail WS_CL_ALIGNED;
+        /**
+         * The position consumers claim next.
+         */
+        std::atomic<uint64_t>   head WS_CL_ALIGNED;
+        /**
+         * The number of orphaned leases waiting for redelivery.
+         */
+        std::atomic<uint32_t>   orphans WS_CL_ALIGNED;
+        /**
+         * The number of entries redelivered.
+         */
+        std::atomic<uint64_t>   redelivered;
+        /**
+         * The number of leases expired by `lease_timeout_ns`.
+         */
+        std::atomic<uint64_t>   expired;
+        /**
+         * When `reclaim()` last ran, in nanoseconds of the steady clock.
+         */
+        std::atomic<uint64_t>   last_reclaim_ns;
+        /**
+         * The robust process-shared mutex serializing the consumer registration and `reclaim()`.
+         */
+        pthread_mutex_t         mutex WS_CL_ALIGNED;
+    }   info WS_CL_ALIGNED;
+    /**
+     * The placeholder for 4K alignment.
+     */
+    uint8_t __bytes__[4096];
+};
+
+/**
+ * @typedef union work_queue_header_t WorkQueueHeader
+ */
+using WorkQueueHeader = union work_queue_header_t;
+
+/**
+ * @struct work_lease_t work_queue.hpp <wsong/ipc/work_queue.hpp>
+ * @brief A leased entry.
+ */
+struct work_lease_t {
+    /**
+     * The lease slot.
+     */
+    uint32_t    slot;
+    /**
+     * The generation of the lease slot, telling this lease from later ones in the same slot.
+     */
+    uint32_t    generation;
+    /**
+     * The number of times the entry has been delivered, 1 for the first delivery.
+     */
+    uint32_t    deliveries;
+    /**
+     * The entry in the lease slot, valid until the lease is acknowledged or returned.
+     */
+    const void* data;
+};
+
+/**
+ * @typedef struct work_lease_t WorkLease
+ */
+using WorkLease = struct work_lease_t;
+
+/**
+ * @struct work_queue_stats_t work_queue.hpp <wsong/ipc/work_queue.hpp>
+ */
+struct work_queue_stats_t {
+    /**
+     * The number of entries waiting in the ring slots.
+     */
+    uint64_t    queued;
+    /**
+     * The number of leases held by the consumers.
+     */
+    uint64_t    leased;
+    /**
+     * The number of orphaned leases waiting for redelivery.
+     */
+    uint64_t    orphans;
+    /**
+     * The number of entries redelivered.
+     */
+    uint64_t    redelivered;
+    /**
+     * The number of leases expired.
+     */
+    uint64_t    expired;
+    /**
+     * The number of registered consumers.
+     */
+    uint32_t    consumers;
+};
+
+/**
+ * @typedef struct work_queue_stats_t WorkQueueStats
+ */
+using WorkQueueStats = struct work_queue_stats_t;
+
+/**
+ * @class WorkQueue work_queue.hpp <wsong/ipc/work_queue.hpp>
+ * @brief The work queue IPC. An instance is either used by a single thread, or only for `produce()`.
+ */
+class WorkQueue {
+private:
+    /**
+     * The pointer to the work queue header.
+     */
+    const WorkQueueHeader* const    info_ptr;
+    /**
+     * The consumer slot of this instance, `max_consumers` before the first `lease()`.
+     */
+    uint32_t                        consumer;
+    /**
+     * Where the search for a free lease slot starts.
+     */
+    uint32_t                        next_lease;
+
+    /**
+     * @fn void lock()
+     * @brief   Lock the mutex, and recover it if the owner died.
+     */
+    WS_DLL_PRIVATE void lock();
+    /**
+     * @fn void unlock()
+     * @brief   Unlock the mutex.
+     */
+    WS_DLL_PRIVATE void unlock();
+    /**
+     * @fn void register_consumer()
+     * @brief   Take a consumer slot for this instance.
+     */
+    WS_DLL_PRIVATE void register_consumer();
+    /**
+     * @fn bool take_orphan(WorkLease& lease)
+     * @brief   Take over an orphaned lease.
+     * @param[out]  lease       The lease taken over.
+     * @return  False if there is none.
+     */
+    WS_DLL_PRIVATE bool take_orphan(WorkLease& lease);
+    /**
+     * @fn bool reclaim_consumer(uint32_t consumer, const std::vector<bool>& dead, uint32_t& orphaned)
+     * @brief   Orphan the leases of a consumer. If the consumer is dead, its unfinished claims are recovered too.
+     * @param[in]   consumer    The consumer slot.
+     * @param[in]   dead        Which consumers are dead.
+     * @param[out]  orphaned    Incremented by the number of leases orphaned.
+     * @return  False if a claim cannot be resolved yet, so the consumer slot must be kept for a later try.
+     */
+    WS_DLL_PRIVATE bool reclaim_consumer(uint32_t consumer, const std::vector<bool>& dead, uint32_t& orphaned);
+
+public:
+    /**
+     * @fn WorkQueue(void* mem_ptr)
+     * @brief   Constructor
+     * @param[in]   mem_ptr     The pointer to the shared memory.
+     */
+    WS_DLL_PRIVATE WorkQueue(void* mem_ptr);
+    /**
+     * @fn virtual ~WorkQueue()
+     * @brief   destructor. The leases still held are returned for redelivery.
+     */
+    WS_DLL_PUBLIC virtual ~WorkQueue();
+    /**
+     * @fn WorkQueueAttribute attribute()
+     * @brief   Get attribute
+     * @return  An attribute object of type `WorkQueueAttribute`.
+     */
+    WS_DLL_PUBLIC WorkQueueAttribute attribute();
+    /**
+     * @fn WorkQueueStats stats()
+     * @brief   Get the statistics. It scans the lease slots.
+     * @return  The statistics.
+     */
+    WS_DLL_PUBLIC WorkQueueStats stats();
+    /**
+     * @fn void produce(const void* buffer, uint16_t size, uint64_t timeout_ns)
+     * @brief   Produce an entry.
+     * @param[in]   buffer      Pointer to the entry.
+     * @param[in]   size        Size of the entry, no more than `entry_size`.
+     * @param[in]   timeout_ns  Timeout in nanoseconds, if specified with 0, it returns immediately or
+     *                          throw an exception on failure.
+     */
+    WS_DLL_PUBLIC void produce(const void* buffer, uint16_t size, uint64_t timeout_ns);
+    /**
+     * @fn WorkLease lease(uint64_t timeout_ns)
+     * @brief   Lease an entry. Orphaned entries are redelivered first. While the queue is empty, it runs `reclaim()`
+     * once in a while.
+     * @param[in]   timeout_ns  Timeout in nanoseconds, if specified with 0, it returns immediately or
+     *                          throw an exception on failure.
+     * @return  The lease.
+     */
+    WS_DLL_PUBLIC WorkLease lease(uint64_t timeout_ns);
+    /**
+     * @fn bool ack(const WorkLease& lease)
+     * @brief   Acknowledge a lease: the entry is done and its lease slot is freed.
+     * @param[in]   lease       The lease.
+     * @return  False if the lease has expired meanwhile, in which case the entry is redelivered.
+     */
+    WS_DLL_PUBLIC bool ack(const WorkLease& lease);
+    /**
+     * @fn bool nack(const WorkLease& lease)
+     * @brief   Give up a lease: the entry is redelivered.
+     * @param[in]   lease       The lease.
+     * @return  False if the lease has expired meanwhile.
+     */
+    WS_DLL_PUBLIC bool nack(const WorkLease& lease);
+    /**
+     * @fn uint32_t reclaim()
+     * @brief   Orphan the leases of the consumers whose process is gone, and the leases held beyond
+     * `lease_timeout_ns`, for redelivery.
+     * @return  The number of leases orphaned.
+     */
+    WS_DLL_PUBLIC uint32_t reclaim();
+    /**
+     * @fn template <class Rep, class Period> void produce(const void* buffer, uint16_t size,const std::chrono::duration<Rep, Period>& timeout)
+     * @brief   Produce an entry. This is a wrapper function for easy timeout settings.
+     * @tparam      Rep         An arthmetic type representing the number of ticks.
+     * @tparam      Period      An std::ratio type representing the tick period.
+     * @param[in]   buffer      Pointer to the entry.
+     * @param[in]   size        Size of the entry.
+     * @param[in]   timeout     Timeout
+     */
+    template <class Rep, class Period>
+    void produce(const void* buffer, uint16_t size, const std::chrono::duration<Rep, Period>& timeout) {
+        this->produce(buffer,size,std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count());
+    }
+    /**
+     * @fn template <class Rep, class Period> WorkLease lease(const std::chrono::duration<Rep, Period>& timeout)
+     * @brief   Lease an entry. This is a wrapper function for easy timeout settings.
+     * @tparam      Rep         An arthmetic type representing the number of ticks.
+     * @tparam      Period      An std::ratio type representing the tick period.
+     * @param[in]   timeout     Timeout
+     * @return  The lease.
+     */
+    template <class Rep, class Period>
+    WorkLease lease(const std::chrono::duration<Rep, Period>& timeout) {
+        return this->lease(std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count());
+    }
+    /**
+     *  @fn static key_t create_work_queue(const WorkQueueAttribute& attribute)
+     *  @brief  Create a new work queue. Like `RingBuffer::create_ring_buffer`, the memory is allocated and pinned.
+     *  @param[in]  attribute       The attribute of the work queue.
+     *  @return     The key of a successfully created work queue.
+     */
+    WS_DLL_PUBLIC static key_t create_work_queue(const WorkQueueAttribute& attribute);
+    /**
+     * @fn static void delete_work_queue(const key_t key)
+     * @brief   Delete a work queue. Caution: we do NOT detect active users.
+     * @param[in]   key         The key of the work queue to remove.
+     */
+    WS_DLL_PUBLIC static void delete_work_queue(const key_t key);
+    /**
+     * @fn static std::unique_ptr<WorkQueue> get_work_queue(const key_t key)
+     * @brief   Attach to a work queue using the key.
+     * @param[in]   key         The key of the work queue to get.
+     * @return      A unique pointer to the work queue.
+     */
+    WS_DLL_PUBLIC static std::unique_ptr<WorkQueue> get_work_queue(const key_t key);
+};
+
+}
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+/**
+ * @file    alloc.hpp
+ * @brief   Per-thread allocation counters, to find the allocations on the hot paths.
+ *
+ * The counters are fed by the allocation hooks in libwsongalloc, which interposes the malloc family of the C library.
+ * Link it into the program with `-Wl,--no-as-needed -lwsongalloc`, since nothing references it, or preload it with
+ * `LD_PRELOAD=libwsongalloc.so`, to turn the counting on. Without the hooks, `alloc_hooks_installed()` is false and the
+ * counters stay zero. `operator new` goes through `malloc()`, so the C++ allocations are counted as well.
+ *
+ * The allocations are attributed to the calling thread, and to the spans open on it (see `span.hpp`): each path of the
+ * span call tree counts the allocations made while its spans were open.
+ *
+ * `WS_ASSERT_NO_ALLOCATION("name")` forbids the allocations in the rest of the scope. An allocation in such a scope
+ * prints the scope name and aborts the process in the allocation call, so that the core dump or the debugger shows the
+ * allocating stack. It is meant for tests; it does nothing without the hooks.
+ */
+
+#include <cinttypes>
+#include <cstddef>
+
+#include <wsong/common.h>
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+#define WS_ALLOC_CONCAT_(a,b)   a##b
+#define WS_ALLOC_CONCAT(a,b)    WS_ALLOC_CONCAT_(a,b)
+/**
+ * @endcond
+ */
+
+/**
+ * @def WS_ASSERT_NO_ALLOCATION(name)
+ * @brief   Abort on any allocation of the calling thread till the end of the enclosing scope.
+ */
+#define WS_ASSERT_NO_ALLOCATION(name) \
+    wsong::perf::NoAllocationScope WS_ALLOC_CONCAT(ws_no_allocation_,__LINE__)(name)
+
+namespace wsong {
+namespace perf {
+
+/**
+ * @struct alloc_counters_t alloc.hpp <wsong/perf/alloc.hpp>
+ * @brief The allocation counters of a thread.
+ */
+struct alloc_counters_t {
+    /**
+     * The number of allocations, including the reallocations.
+     */
+    uint64_t    allocations;
+    /**
+     * The number of bytes requested by the allocations.
+     */
+    uint64_t    allocated_bytes;
+    /**
+     * The number of frees.
+     */
+    uint64_t    frees;
+    /**
+     * The number of open `NoAllocationScope`s.
+     */
+    uint32_t    forbidden;
+    /**
+     * The name of the innermost open `NoAllocationScope`.
+     */
+    const char* forbidden_scope;
+};
+
+/**
+ * @typedef struct alloc_counters_t AllocCounters
+ */
+using AllocCounters = struct alloc_counters_t;
+
+/**
+ * @brief   The counters of the calling thread. Take a copy before and after a piece of code to count its allocations.
+ * It is constant-initialized, so the hooks access it without a thread-local wrapper call.
+ */
+inline thread_local AllocCounters alloc_thread_counters = {0,0,0,0,nullptr};
+
+/**
+ * @fn bool alloc_hooks_installed()
+ * @brief   Tell if libwsongalloc is loaded and its hooks count the allocations.
+ * @return  True if the hooks are installed.
+ */
+WS_DLL_PUBLIC bool alloc_hooks_installed();
+
+/**
+ * @fn void alloc_hooks_install()
+ * @brief   Called by libwsongalloc when it is loaded.
+ */
+WS_DLL_PUBLIC void alloc_hooks_install();
+
+/**
+ * @fn void alloc_forbidden(size_t size)
+ * @brief   Report an allocation in a `NoAllocationScope` and abort the process.
+ * @param[in]   size        The size of the allocation.
+ */
+[[noreturn]] WS_DLL_PUBLIC void alloc_forbidden(size_t size);
+
+/**
+ * @fn void alloc_record(size_t size)
+ * @brief   Count an allocation of the calling thread. It is called by the hooks.
+ * @param[in]   size        The size of the allocation.
+ */
+inline void alloc_record(size_t size) {
+    AllocCounters& counters = alloc_thread_counters;
+    counters.allocations ++;
+    counters.allocated_bytes += size;
+    if (__builtin_expect(counters.forbidden > 0,0)) {
+        alloc_forbidden(size);
+    }
+}
+
+/**
+ * @fn void alloc_record_free()
+ * @brief   Count a free of the calling thread. It is called by the hooks.
+ */
+inline void alloc_record_free() {
+    alloc_thread_counters.frees ++;
+}
+
+/**
+ * @class NoAllocationScope alloc.hpp <wsong/perf/alloc.hpp>
+ * @brief Forbid the allocations of the calling thread for the lifetime of the object. The scopes nest.
+ */
+class NoAllocationScope {
+    const char* outer_scope;
+public:
+    /**
+     * @fn NoAllocationScope(const char* name)
+     * @brief   Open the scope.
+     * @param[in]   name        The scope name, printed when an allocation aborts the process.
+     */
+    explicit NoAllocationScope(const char* name) {
+        outer_scope = alloc_thread_counters.forbidden_scope;
+        alloc_thread_counters.forbidden_scope = name;
+        alloc_thread_counters.forbidden ++;
+    }
+    /**
+     * @fn ~NoAllocationScope()
+     * @brief   Close the scope.
+     */
+    ~NoAllocationScope() {
+        alloc_thread_counters.forbidden --;
+        alloc_thread_counters.forbidden_scope = outer_scope;
+    }
+    NoAllocationScope(const NoAllocationScope&) = delete;
+    NoAllocationScope& operator=(const NoAllocationScope&) = delete;
+};
+
+}
+}
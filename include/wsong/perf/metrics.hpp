@@ -0,0 +1,477 @@
+#pragma once
+
+/**
+ * @file    metrics.hpp
+ * @brief   Shared memory metrics registry.
+ *
+ * The registry lives in a named POSIX shared memory segment, so that a sidecar process can scrape it without any RPC
+ * into the service (see `metrics_cli`). It supports counters, gauges, and log-linear histograms.
+ *
+ * Every metric has one cell (or one histogram) in each per-thread slab. A thread claims a slab of a registry when it
+ * first records to it, from a counter in the segment, so the recording threads of all the processes sharing the
+ * registry get distinct slabs, and the slabs are cacheline aligned so those threads never share a cacheline. Adding
+ * to a counter or a gauge is a single relaxed atomic add on the calling thread's slab; recording a histogram value is
+ * two, on the bucket and on the sum. Slabs are not given back when a thread exits: once `max_threads` slabs have been
+ * claimed, new threads share slabs with earlier ones, which is still correct but may be slower. The readers sum up
+ * all slabs.
+ *
+ * Segment layout:
+ * | MetricsHeader (4KB) | MetricDescriptor[max_metrics] | slab 0 | slab 1 | ... | slab max_threads-1 |
+ */
+
+#include <cinttypes>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <wsong/common.h>
+#include <wsong/exceptions.hpp>
+
+namespace wsong {
+/**
+ * @namespace Performance tools
+ * @brief Performance measurement implementation goes here.
+ */
+namespace perf {
+
+/**
+ * @def WS_METRICS_SUB_BUCKET_BITS
+ * @brief The number of bits for the linear sub-buckets in each power-of-two range of a histogram.
+ */
+#define WS_METRICS_SUB_BUCKET_BITS  (2)
+/**
+ * @def WS_METRICS_SUB_BUCKETS
+ * @brief The number of linear sub-buckets in each power-of-two range of a histogram.
+ */
+#define WS_METRICS_SUB_BUCKETS      (1u<<WS_METRICS_SUB_BUCKET_BITS)
+/**
+ * @def WS_METRICS_HISTOGRAM_BUCKETS
+ * @brief The number of buckets in a histogram, covering the whole uint64_t range.
+ */
+#define WS_METRICS_HISTOGRAM_BUCKETS \
+                                    (WS_METRICS_SUB_BUCKETS*(65-WS_METRICS_SUB_BUCKET_BITS))
+/**
+ * @def WS_METRICS_NAME_LENGTH
+ * @brief The maximum length of a metric name, including the trailing zero.
+ */
+#define WS_METRICS_NAME_LENGTH      (64)
+/**
+ * @def WS_METRICS_HELP_LENGTH
+ * @brief The maximum length of a metric help string, including the trailing zero.
+ */
+#define WS_METRICS_HELP_LENGTH      (192)
+/**
+ * @def WS_METRICS_SLAB_CACHE
+ * @brief The number of registries a thread remembers its slab of. A thread recording to more registries claims a new
+ * slab when it comes back to a forgotten one.
+ */
+#define WS_METRICS_SLAB_CACHE       (4)
+
+/**
+ * @enum metric_type_t
+ * @brief The metric types.
+ */
+enum metric_type_t : uint32_t {
+    WS_METRIC_COUNTER   = 1,    /**< A monotonic counter. */
+    WS_METRIC_GAUGE     = 2,    /**< A gauge, the sum of the changes made by all threads. */
+    WS_METRIC_HISTOGRAM = 3,    /**< A log-linear histogram. */
+};
+
+/**
+ * @typedef enum metric_type_t MetricType
+ */
+using MetricType = enum metric_type_t;
+
+/**
+ * @struct metrics_attr_t metrics.hpp <wsong/perf/metrics.hpp>
+ * @brief The attribute of a metrics registry.
+ */
+struct metrics_attr_t {
+    /**
+     * The maximum number of metrics.
+     */
+    uint32_t    max_metrics;
+    /**
+     * The number of per-thread slabs.
+     */
+    uint32_t    max_threads;
+    /**
+     * The number of 64-bit cells in a per-thread slab. A counter or a gauge takes one cell, and a histogram takes
+     * `WS_METRICS_HISTOGRAM_BUCKETS + 1` cells.
+     */
+    uint32_t    cells_per_thread;
+};
+
+/**
+ * @typedef struct metrics_attr_t MetricsAttribute
+ */
+using MetricsAttribute = struct metrics_attr_t;
+
+/**
+ * @struct metric_descriptor_t metrics.hpp <wsong/perf/metrics.hpp>
+ * @brief The descriptor of a metric in the registry.
+ */
+struct metric_descriptor_t {
+    /**
+     * The metric name.
+     */
+    char        name[WS_METRICS_NAME_LENGTH];
+    /**
+     * The help string.
+     */
+    char        help[WS_METRICS_HELP_LENGTH];
+    /**
+     * The metric type.
+     */
+    MetricType  type;
+    /**
+     * The offset of the first cell in the per-thread slabs.
+     */
+    uint32_t    cell;
+};
+
+/**
+ * @typedef struct metric_descriptor_t MetricDescriptor
+ */
+using MetricDescriptor = struct metric_descriptor_t;
+
+/**
+ * union metrics_header_t metrics.hpp <wsong/perf/metrics.hpp>
+ */
+union metrics_header_t {
+    /**
+     * The registry information.
+     */
+    struct {
+        /**
+         * The magic number to identify a metrics registry.
+         */
+        uint64_t                magic;
+        /**
+         * The registry attribute.
+         */
+        MetricsAttribute        attribute;
+        /**
+         * The number of 64-bit cells between two slabs.
+         */
+        uint32_t                slab_stride;
+        /**
+         * The number of registered metrics.
+         */
+        std::atomic<uint32_t>   num_metrics WS_CL_ALIGNED;
+        /**
+         * The number of cells used in each slab.
+         */
+        uint32_t                used_cells;
+        /**
+         * The registration lock.
+         */
+        std::atomic<bool>       lock;
+        /**
+         * The number of slabs claimed by the recording threads so far, modulo `max_threads` for the next slab.
+         */
+        std::atomic<uint32_t>   next_slab;
+    }   info WS_CL_ALIGNED;
+    /**
+     * The placeholder for 4K alignment.
+     */
+    uint8_t __bytes__[4096];
+};
+
+/**
+ * @typedef union metrics_header_t MetricsHeader
+ */
+using MetricsHeader = union metrics_header_t;
+
+/**
+ * @fn inline uint32_t metrics_slab(std::atomic<uint32_t>* next_slab, uint32_t num_slabs)
+ * @brief   Get the calling thread's slab of a registry, claiming one on first use.
+ * @param[in]   next_slab   The slab counter in the registry segment, which also identifies the registry.
+ * @param[in]   num_slabs   The number of slabs.
+ * @return  The slab index.
+ */
+inline uint32_t metrics_slab(std::atomic<uint32_t>* next_slab, uint32_t num_slabs) {
+    static thread_local struct {
+        std::atomic<uint32_t>*  registry;
+        uint32_t                claimed;
+    }   cache[WS_METRICS_SLAB_CACHE] = {};
+    static thread_local uint32_t victim = 0;
+    for (const auto& entry : cache) {
+        if (entry.registry == next_slab) {
+            // a registry mapped where a removed one was gets the old claim, which only risks sharing a slab.
+            return entry.claimed % num_slabs;
+        }
+    }
+    auto& entry = cache[victim++ % WS_METRICS_SLAB_CACHE];
+    entry.registry  = next_slab;
+    entry.claimed   = next_slab->fetch_add(1,std::memory_order_relaxed);
+    return entry.claimed % num_slabs;
+}
+
+/**
+ * @fn inline uint32_t metrics_histogram_bucket(uint64_t value)
+ * @brief   Get the log-linear histogram bucket of a value.
+ * @param[in]   value       The value.
+ * @return  The bucket index.
+ */
+inline uint32_t metrics_histogram_bucket(uint64_t value) {
+    if (value < WS_METRICS_SUB_BUCKETS) {
+        return static_cast<uint32_t>(value);
+    }
+    const uint32_t exponent = 63 - __builtin_clzll(value);
+    const uint32_t shift    = exponent - WS_METRICS_SUB_BUCKET_BITS;
+    return ((shift + 1) << WS_METRICS_SUB_BUCKET_BITS) + static_cast<uint32_t>((value >> shift) & (WS_METRICS_SUB_BUCKETS - 1));
+}
+
+/**
+ * @fn uint64_t metrics_histogram_upper_bound(uint32_t bucket)
+ * @brief   Get the largest value falling into a histogram bucket.
+ * @param[in]   bucket      The bucket index.
+ * @return  The upper bound, inclusive.
+ */
+WS_DLL_PUBLIC uint64_t metrics_histogram_upper_bound(uint32_t bucket);
+
+/**
+ * @class MetricCell metrics.hpp <wsong/perf/metrics.hpp>
+ * @brief The common part of the metric handles: locating the calling thread's cells.
+ */
+class MetricCell {
+protected:
+    /**
+     * The first cell of the metric in slab 0.
+     */
+    std::atomic<uint64_t>*  base;
+    /**
+     * The number of cells between two slabs.
+     */
+    uint32_t                slab_stride;
+    /**
+     * The number of slabs.
+     */
+    uint32_t                num_slabs;
+    /**
+     * The slab counter in the registry segment.
+     */
+    std::atomic<uint32_t>*  next_slab;
+
+    /**
+     * @fn std::atomic<uint64_t>* cells()
+     * @brief   Get the calling thread's cells of this metric.
+     * @return  The pointer to the cells.
+     */
+    inline std::atomic<uint64_t>* cells() const {
+        return base + static_cast<size_t>(metrics_slab(next_slab,num_slabs)) * slab_stride;
+    }
+
+public:
+    /**
+     * @fn MetricCell(std::atomic<uint64_t>* base, uint32_t slab_stride, uint32_t num_slabs,
+     *                std::atomic<uint32_t>* next_slab)
+     * @brief   Constructor
+     * @param[in]   base        The first cell of the metric in slab 0.
+     * @param[in]   slab_stride The number of cells between two slabs.
+     * @param[in]   num_slabs   The number of slabs.
+     * @param[in]   next_slab   The slab counter in the registry segment.
+     */
+    MetricCell(std::atomic<uint64_t>* base, uint32_t slab_stride, uint32_t num_slabs,
+               std::atomic<uint32_t>* next_slab):
+        base(base), slab_stride(slab_stride), num_slabs(num_slabs), next_slab(next_slab) {}
+};
+
+/**
+ * @class Counter metrics.hpp <wsong/perf/metrics.hpp>
+ * @brief A counter handle. It is cheap to copy and valid as long as the registry is.
+ */
+class Counter : public MetricCell {
+public:
+    using MetricCell::MetricCell;
+    /**
+     * @fn void add(uint64_t delta)
+     * @brief   Increase the counter.
+     * @param[in]   delta       The increment.
+     */
+    inline void add(uint64_t delta = 1) const {
+        cells()->fetch_add(delta,std::memory_order_relaxed);
+    }
+};
+
+/**
+ * @class Gauge metrics.hpp <wsong/perf/metrics.hpp>
+ * @brief A gauge handle. The gauge value is the sum of the changes made by all threads. A gauge only changes by
+ * deltas: a thread's cell may be in a slab shared with other threads, so it cannot be set.
+ */
+class Gauge : public MetricCell {
+public:
+    using MetricCell::MetricCell;
+    /**
+     * @fn void add(int64_t delta)
+     * @brief   Change the gauge by `delta`.
+     * @param[in]   delta       The change, can be negative.
+     */
+    inline void add(int64_t delta) const {
+        cells()->fetch_add(static_cast<uint64_t>(delta),std::memory_order_relaxed);
+    }
+};
+
+/**
+ * @class Histogram metrics.hpp <wsong/perf/metrics.hpp>
+ * @brief A log-linear histogram handle. The cells are the buckets followed by the sum.
+ */
+class Histogram : public MetricCell {
+public:
+    using MetricCell::MetricCell;
+    /**
+     * @fn void record(uint64_t value)
+     * @brief   Record a value: one relaxed atomic add on its bucket, and one on the sum.
+     * @param[in]   value       The value.
+     */
+    inline void record(uint64_t value) const {
+        std::atomic<uint64_t>* c = cells();
+        c[metrics_histogram_bucket(value)].fetch_add(1,std::memory_order_relaxed);
+        c[WS_METRICS_HISTOGRAM_BUCKETS].fetch_add(value,std::memory_order_relaxed);
+    }
+};
+
+/**
+ * @struct metric_value_t metrics.hpp <wsong/perf/metrics.hpp>
+ * @brief The snapshot of a metric.
+ */
+struct metric_value_t {
+    /**
+     * The metric name.
+     */
+    std::string             name;
+    /**
+     * The help string.
+     */
+    std::string             help;
+    /**
+     * The metric type.
+     */
+    MetricType              type;
+    /**
+     * The value of a counter or a gauge, or the sum of a histogram.
+     */
+    int64_t                 value;
+    /**
+     * The number of values recorded in a histogram.
+     */
+    uint64_t                count;
+    /**
+     * The histogram buckets, empty for counters and gauges.
+     */
+    std::vector<uint64_t>   buckets;
+};
+
+/**
+ * @typedef struct metric_value_t MetricValue
+ */
+using MetricValue = struct metric_value_t;
+
+/**
+ * @class MetricsRegistry metrics.hpp <wsong/perf/metrics.hpp>
+ * @brief The shared memory metrics registry.
+ */
+class MetricsRegistry {
+private:
+    /**
+     * The pointer to the mapped segment.
+     */
+    MetricsHeader*  header;
+    /**
+     * The size of the mapped segment.
+     */
+    size_t          mapped_size;
+    /**
+     * Whether the segment is mapped writable.
+     */
+    const bool      writable;
+
+    /**
+     * @fn MetricsRegistry(void* mem_ptr, size_t mapped_size, bool writable)
+     * @brief   Constructor
+     */
+    WS_DLL_PRIVATE MetricsRegistry(void* mem_ptr, size_t mapped_size, bool writable);
+    /**
+     * @fn std::atomic<uint64_t>* register_metric(const std::string& name, const std::string& help, MetricType type)
+     * @brief   Register a metric, or find it if a metric with the same name and type exists.
+     * @return  The metric's first cell in slab 0.
+     */
+    WS_DLL_PRIVATE std::atomic<uint64_t>* register_metric(const std::string& name, const std::string& help,
+                                                          MetricType type);
+
+public:
+    /**
+     * @fn virtual ~MetricsRegistry()
+     * @brief   Destructor. It unmaps the segment, which stays until `remove()` is called.
+     */
+    WS_DLL_PUBLIC virtual ~MetricsRegistry();
+    /**
+     * @fn MetricsAttribute attribute()
+     * @brief   Get the attribute.
+     * @return  The attribute of the registry.
+     */
+    WS_DLL_PUBLIC MetricsAttribute attribute();
+    /**
+     * @fn Counter counter(const std::string& name, const std::string& help)
+     * @brief   Get a counter, registering it on first use. Registration is slow, keep the handle.
+     * @param[in]   name        The metric name, following the prometheus naming rules.
+     * @param[in]   help        The help string.
+     * @return  The counter handle.
+     */
+    WS_DLL_PUBLIC Counter counter(const std::string& name, const std::string& help = "");
+    /**
+     * @fn Gauge gauge(const std::string& name, const std::string& help)
+     * @brief   Get a gauge, registering it on first use.
+     * @param[in]   name        The metric name.
+     * @param[in]   help        The help string.
+     * @return  The gauge handle.
+     */
+    WS_DLL_PUBLIC Gauge gauge(const std::string& name, const std::string& help = "");
+    /**
+     * @fn Histogram histogram(const std::string& name, const std::string& help)
+     * @brief   Get a histogram, registering it on first use.
+     * @param[in]   name        The metric name.
+     * @param[in]   help        The help string.
+     * @return  The histogram handle.
+     */
+    WS_DLL_PUBLIC Histogram histogram(const std::string& name, const std::string& help = "");
+    /**
+     * @fn std::vector<MetricValue> snapshot()
+     * @brief   Take a snapshot by summing up all slabs. It does not write to the segment.
+     * @return  The values of all metrics.
+     */
+    WS_DLL_PUBLIC std::vector<MetricValue> snapshot();
+    /**
+     * @fn std::string prometheus()
+     * @brief   Take a snapshot in the prometheus text exposition format.
+     * @return  The text.
+     */
+    WS_DLL_PUBLIC std::string prometheus();
+    /**
+     * @fn static std::unique_ptr<MetricsRegistry> create(const std::string& name, const MetricsAttribute& attribute)
+     * @brief   Create a registry, or attach to it if it already exists.
+     * @param[in]   name        The name of the shared memory segment, as in `shm_open()`.
+     * @param[in]   attribute   The attribute for a new registry.
+     * @return  The registry.
+     */
+    WS_DLL_PUBLIC static std::unique_ptr<MetricsRegistry> create(const std::string& name,
+                                                                 const MetricsAttribute& attribute);
+    /**
+     * @fn static std::unique_ptr<MetricsRegistry> open(const std::string& name)
+     * @brief   Attach to an existing registry read-only, for scrapers.
+     * @param[in]   name        The name of the shared memory segment.
+     * @return  The registry.
+     */
+    WS_DLL_PUBLIC static std::unique_ptr<MetricsRegistry> open(const std::string& name);
+    /**
+     * @fn static void remove(const std::string& name)
+     * @brief   Remove a registry.
+     * @param[in]   name        The name of the shared memory segment.
+     */
+    WS_DLL_PUBLIC static void remove(const std::string& name);
+};
+
+}
+}
@@ -0,0 +1,363 @@
+#pragma once
+
+/**
+ * @file    span.hpp
+ * @brief   Hierarchical span profiler.
+ *
+ * A span is a scoped interval, opened by `WS_SPAN("name")` or a `Span` object and closed at the end of the scope.
+ * Spans nest, and each thread aggregates them into a call tree: a node per distinct path from the thread's outermost
+ * span, with the count, the inclusive time, the time of the child spans, and a log-linear histogram of the inclusive
+ * time. Opening a span looks up the child of the current node, and closing it adds to the node's counters, so the
+ * collection costs a per-thread stack push and pop plus two clock reads. A node is only allocated the first time its
+ * path is seen.
+ *
+ * `SpanProfiler` merges the trees of all threads by path, and reports them as an indented call tree with inclusive and
+ * exclusive time, or as collapsed stacks (`a;b;c <exclusive ns>`) for flamegraph tools.
+ *
+ * With the allocation hooks of libwsongalloc loaded (see `alloc.hpp`), each path also counts the allocations made
+ * while its spans were open.
+ *
+ * Span names are compared by address on the hot path, so pass string literals or other strings with static storage.
+ * Different addresses with the same text are merged in the reports.
+ */
+
+#include <time.h>
+#include <cinttypes>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <wsong/common.h>
+#include <wsong/perf/alloc.hpp>
+#include <wsong/perf/metrics.hpp>
+
+/**
+ * @def WS_SPAN_MAX_DEPTH
+ * @brief   The maximum nesting depth of spans per thread. Deeper spans are not recorded.
+ */
+#define WS_SPAN_MAX_DEPTH   (64)
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+#define WS_SPAN_CONCAT_(a,b)    a##b
+#define WS_SPAN_CONCAT(a,b)     WS_SPAN_CONCAT_(a,b)
+/**
+ * @endcond
+ */
+
+/**
+ * @def WS_SPAN(name)
+ * @brief   Open a span till the end of the enclosing scope.
+ */
+#define WS_SPAN(name)       wsong::perf::Span WS_SPAN_CONCAT(ws_span_,__LINE__)(name)
+
+namespace wsong {
+namespace perf {
+
+/**
+ * @struct span_node_t span.hpp <wsong/perf/span.hpp>
+ * @brief A node of a thread's call tree. The counters are only written by the owner thread.
+ */
+struct span_node_t {
+    /**
+     * The span name.
+     */
+    const char*             name;
+    /**
+     * The parent node, the first child, and the next sibling. Node 0 is the root, so 0 also means none.
+     */
+    uint32_t                parent;
+    uint32_t                first_child;
+    uint32_t                next_sibling;
+    /**
+     * The number of spans closed.
+     */
+    std::atomic<uint64_t>   count;
+    /**
+     * The total inclusive time in nanoseconds.
+     */
+    std::atomic<uint64_t>   inclusive_ns;
+    /**
+     * The total inclusive time of the child spans, the rest is exclusive.
+     */
+    std::atomic<uint64_t>   children_ns;
+    /**
+     * The longest inclusive time.
+     */
+    std::atomic<uint64_t>   max_ns;
+    /**
+     * The inclusive number of allocations and allocated bytes, counted by the allocation hooks.
+     */
+    std::atomic<uint64_t>   allocations;
+    std::atomic<uint64_t>   allocated_bytes;
+    /**
+     * The histogram of the inclusive time, with the buckets of `metrics_histogram_bucket()`.
+     */
+    std::atomic<uint32_t>   histogram[WS_METRICS_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * @typedef struct span_node_t SpanNode
+ */
+using SpanNode = struct span_node_t;
+
+/**
+ * @struct span_frame_t span.hpp <wsong/perf/span.hpp>
+ * @brief An open span.
+ */
+struct span_frame_t {
+    /**
+     * The node of the span.
+     */
+    uint32_t    node;
+    /**
+     * When it was opened.
+     */
+    uint64_t    start_ns;
+    /**
+     * The allocation counters of the thread when it was opened.
+     */
+    uint64_t    start_allocations;
+    uint64_t    start_allocated_bytes;
+};
+
+/**
+ * @typedef struct span_frame_t SpanFrame
+ */
+using SpanFrame = struct span_frame_t;
+
+/**
+ * @struct span_thread_t span.hpp <wsong/perf/span.hpp>
+ * @brief The call tree and the span stack of a thread.
+ */
+struct span_thread_t {
+    /**
+     * The nodes, with stable addresses. Node 0 is the root.
+     */
+    std::deque<SpanNode>    nodes;
+    /**
+     * Protects the growth of `nodes` and the links against the readers. The owner only takes it to add a node.
+     */
+    std::mutex              mutex;
+    /**
+     * The open spans.
+     */
+    SpanFrame               stack[WS_SPAN_MAX_DEPTH];
+    /**
+     * The number of open spans, including those beyond `WS_SPAN_MAX_DEPTH`.
+     */
+    uint32_t                depth;
+    /**
+     * The number of spans not recorded because they were too deep.
+     */
+    std::atomic<uint64_t>   overflows;
+};
+
+/**
+ * @typedef struct span_thread_t SpanThread
+ */
+using SpanThread = struct span_thread_t;
+
+/**
+ * @fn SpanThread* span_thread()
+ * @brief   Get the span state of the calling thread, and allocate it on the first call. The allocation is not forbidden
+ * by a `NoAllocationScope`.
+ * @return  The state.
+ */
+WS_DLL_PUBLIC SpanThread* span_thread();
+
+/**
+ * @fn uint32_t span_add_child(SpanThread* thread, uint32_t parent, const char* name)
+ * @brief   Add a node to a thread's call tree. It is called by the owner thread on the first span of a path. Its own
+ * allocations are neither counted in the open spans nor forbidden by a `NoAllocationScope`.
+ * @param[in]   thread      The thread.
+ * @param[in]   parent      The parent node.
+ * @param[in]   name        The span name.
+ * @return  The new node.
+ */
+WS_DLL_PUBLIC uint32_t span_add_child(SpanThread* thread, uint32_t parent, const char* name);
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+// The calling thread's state, cached where the spans are inlined.
+inline thread_local SpanThread* span_thread_cache = nullptr;
+
+inline uint64_t span_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+// Only the owner thread writes the counters, so a plain load and store is enough.
+inline void span_add(std::atomic<uint64_t>& counter, uint64_t delta) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta,std::memory_order_relaxed);
+}
+/**
+ * @endcond
+ */
+
+/**
+ * @fn void span_enter(const char* name)
+ * @brief   Open a span on the calling thread. Prefer `WS_SPAN` or `Span`, which always close it.
+ * @param[in]   name        The span name, with static storage.
+ */
+inline void span_enter(const char* name) {
+    SpanThread* thread = span_thread_cache;
+    if (__builtin_expect(thread == nullptr,0)) {
+        thread = span_thread_cache = span_thread();
+    }
+    if (__builtin_expect(thread->depth >= WS_SPAN_MAX_DEPTH,0)) {
+        thread->depth ++;
+        span_add(thread->overflows,1);
+        return;
+    }
+    const uint32_t parent = (thread->depth > 0) ? thread->stack[thread->depth - 1].node : 0;
+    uint32_t node = thread->nodes[parent].first_child;
+    while (node != 0 && thread->nodes[node].name != name) {
+        node = thread->nodes[node].next_sibling;
+    }
+    if (__builtin_expect(node == 0,0)) {
+        node = span_add_child(thread,parent,name);
+    }
+    const AllocCounters& allocs = alloc_thread_counters;
+    thread->stack[thread->depth ++] = {node,span_now_ns(),allocs.allocations,allocs.allocated_bytes};
+}
+
+/**
+ * @fn void span_exit()
+ * @brief   Close the innermost span of the calling thread.
+ */
+inline void span_exit() {
+    const uint64_t now = span_now_ns();
+    SpanThread* thread = span_thread_cache;
+    if (__builtin_expect(thread->depth > WS_SPAN_MAX_DEPTH,0)) {
+        thread->depth --;
+        return;
+    }
+    const SpanFrame& frame = thread->stack[-- thread->depth];
+    const uint64_t duration = now - frame.start_ns;
+    SpanNode& node = thread->nodes[frame.node];
+    span_add(node.count,1);
+    span_add(node.inclusive_ns,duration);
+    span_add(node.allocations,alloc_thread_counters.allocations - frame.start_allocations);
+    span_add(node.allocated_bytes,alloc_thread_counters.allocated_bytes - frame.start_allocated_bytes);
+    if (duration > node.max_ns.load(std::memory_order_relaxed)) {
+        node.max_ns.store(duration,std::memory_order_relaxed);
+    }
+    std::atomic<uint32_t>& bucket = node.histogram[metrics_histogram_bucket(duration)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
+    if (thread->depth > 0) {
+        span_add(thread->nodes[thread->stack[thread->depth - 1].node].children_ns,duration);
+    }
+}
+
+/**
+ * @class Span span.hpp <wsong/perf/span.hpp>
+ * @brief A span open for the lifetime of the object.
+ */
+class Span {
+public:
+    /**
+     * @fn Span(const char* name)
+     * @brief   Open a span.
+     * @param[in]   name        The span name, with static storage.
+     */
+    explicit Span(const char* name) {
+        span_enter(name);
+    }
+    /**
+     * @fn ~Span()
+     * @brief   Close the span.
+     */
+    ~Span() {
+        span_exit();
+    }
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+};
+
+/**
+ * @struct span_stats_t span.hpp <wsong/perf/span.hpp>
+ * @brief The statistics of a path, merged across threads.
+ */
+struct span_stats_t {
+    /**
+     * The span names from the outermost one, separated by ';'.
+     */
+    std::string path;
+    /**
+     * The nesting depth, 0 for an outermost span.
+     */
+    uint32_t    depth;
+    /**
+     * The number of spans.
+     */
+    uint64_t    count;
+    /**
+     * The total inclusive time in nanoseconds.
+     */
+    uint64_t    inclusive_ns;
+    /**
+     * The total exclusive time: the inclusive time less that of the child spans.
+     */
+    uint64_t    exclusive_ns;
+    /**
+     * The percentiles of the inclusive time, as histogram bucket upper bounds capped to `max_ns`.
+     */
+    uint64_t    p50_ns;
+    uint64_t    p99_ns;
+    /**
+     * The longest inclusive time.
+     */
+    uint64_t    max_ns;
+    /**
+     * The inclusive number of allocations and allocated bytes.
+     */
+    uint64_t    allocations;
+    uint64_t    allocated_bytes;
+};
+
+/**
+ * @typedef struct span_stats_t SpanStats
+ */
+using SpanStats = struct span_stats_t;
+
+/**
+ * @class SpanProfiler span.hpp <wsong/perf/span.hpp>
+ * @brief The reports over the call trees of all threads. The methods are thread-safe and run concurrently with the
+ * spans, whose counters may be a few updates behind.
+ */
+class SpanProfiler {
+public:
+    /**
+     * @fn static std::vector<SpanStats> snapshot()
+     * @brief   Merge the call trees of all threads, live or exited, by path.
+     * @return  The paths in depth-first order, with the children of a node by decreasing inclusive time. The paths
+     *          without a closed span since the last `reset()` are left out.
+     */
+    WS_DLL_PUBLIC static std::vector<SpanStats> snapshot();
+    /**
+     * @fn static std::string report()
+     * @brief   Format the snapshot as an indented call tree.
+     * @return  The report.
+     */
+    WS_DLL_PUBLIC static std::string report();
+    /**
+     * @fn static std::string collapsed()
+     * @brief   Format the snapshot as collapsed stacks, one `path exclusive_ns` line per path, for flamegraph tools.
+     * @return  The collapsed stacks.
+     */
+    WS_DLL_PUBLIC static std::string collapsed();
+    /**
+     * @fn static void reset()
+     * @brief   Zero the counters of all threads. Call it while no span closes, or the concurrent updates may survive.
+     */
+    WS_DLL_PUBLIC static void reset();
+};
+
+}
+}
@@ -11,6 +11,11 @@
 
 #include <wsong/common.h>
 
+/**
+ * @def WS_TIMING_DEFAULT_CAPACITY
+ * @brief   The number of events kept per thread, 64MB of log. Set the environment variable `WSONG_TIMING_CAPACITY` to
+ * another power of two to change it.
+ */
 #define WS_TIMING_DEFAULT_CAPACITY  (1ull<<20)
 
 #ifdef __cplusplus
@@ -18,8 +23,9 @@ extern "C" {
 #endif
 /**
  * @brief log timestamp
- * Log timestamp in a global in-memory buffer. You can log more timestamp than WS_TIMING_DEFAULT_CAPACITY. The earliest
- * logs will be overwritten.
+ * Log timestamp in the calling thread's in-memory buffer. You can log more timestamp than WS_TIMING_DEFAULT_CAPACITY.
+ * The earliest logs will be overwritten. C++ callers can use the inline `wsong::perf::timing_punch()` in
+ * <wsong/perf/timing.hpp> instead.
  *
  * @param[in]   tag         Event tag, a.k.a event identifier.
  * @param[in]   user_data1  User data, defined by callers.
@@ -31,7 +37,7 @@ WS_DLL_PUBLIC void ws_timing_punch(const uint64_t tag, const uint64_t user_data1
 
 /**
  * @brief save timestamp
- * Flush timestmap to a file.
+ * Flush timestmap of all threads to a file, merged by time, and clear them.
  *
  * @param[in]   filename    Log filename.
  */
@@ -43,6 +49,13 @@ WS_DLL_PUBLIC void ws_timing_save(const char* filename);
  */
 WS_DLL_PUBLIC void ws_timing_clear();
 
+/**
+ * @brief prepare the calling thread's log.
+ * Allocate and prefault the calling thread's in-memory buffer, on huge pages if available and on the thread's NUMA
+ * node, so that its first punch does not. Call it when the thread starts.
+ */
+WS_DLL_PUBLIC void ws_timing_prepare();
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,142 @@
+#pragma once
+
+/**
+ * @file    timing.hpp
+ * @brief   The inline C++ punch path of the timing log.
+ *
+ * `ws_timing_punch()` is an out-of-line call into libwsongperf. `timing_punch()` is its inline counterpart: it writes
+ * the event straight into the calling thread's buffer, so a punch costs the clock read and a few stores. The template
+ * takes 0 to 4 user data values, and the unused ones are neither passed nor stored.
+ *
+ * Both paths log into the same per-thread buffers, of `WS_TIMING_DEFAULT_CAPACITY` events each unless
+ * `WSONG_TIMING_CAPACITY` says otherwise. A thread's buffer is allocated and prefaulted on its first punch, which is
+ * the only out-of-line step; call `timing_prepare()` when the thread starts to take it off the hot path. The buffer is
+ * mapped on huge pages when the hugetlb pool has enough free 1GB or 2MB pages, and on the NUMA node of the thread, so
+ * a punch takes neither a page fault nor a remote store. When the thread exits, its buffer passes to the next new
+ * thread with its events.
+ * `ws_timing_save()` merges the buffers of all threads by time. Save while the punching threads are quiescent, or the
+ * events being written at that time may be torn.
+ */
+
+#include <time.h>
+#include <cinttypes>
+#include <atomic>
+#include <type_traits>
+
+#include <wsong/common.h>
+#include <wsong/perf/timing.h>
+
+namespace wsong {
+namespace perf {
+
+/**
+ * @def WS_TIMING_EVENT_WORDS
+ * @brief   The size of an event in 64-bit words: tag, timestamp, 4 user data values, the number of user data values,
+ * and a padding word, so that an event fills a 64-byte cacheline.
+ */
+#define WS_TIMING_EVENT_WORDS   (8)
+
+/**
+ * @struct timing_buffer_t timing.hpp <wsong/perf/timing.hpp>
+ * @brief The timing log of a thread.
+ */
+struct timing_buffer_t {
+    /**
+     * The events, `WS_TIMING_EVENT_WORDS` words each.
+     */
+    uint64_t*               log;
+    /**
+     * The capacity in events minus one. The capacity is a power of two.
+     */
+    uint64_t                mask;
+    /**
+     * The number of events logged. It is only written by the owner thread.
+     */
+    std::atomic<uint64_t>   position;
+    /**
+     * The position of the first event to save, moved by `ws_timing_clear()`.
+     */
+    uint64_t                start;
+    /**
+     * The owner thread has exited.
+     */
+    std::atomic<bool>       retired;
+    /**
+     * The NUMA node the log is placed on, -1 if unknown.
+     */
+    int                     numa_node;
+    /**
+     * The size of the pages backing the log.
+     */
+    uint32_t                page_size;
+};
+
+/**
+ * @typedef struct timing_buffer_t TimingBuffer
+ */
+using TimingBuffer = struct timing_buffer_t;
+
+/**
+ * @fn TimingBuffer* timing_thread_buffer()
+ * @brief   Get the timing buffer of the calling thread, and allocate it on the first call.
+ * @return  The buffer.
+ */
+WS_DLL_PUBLIC TimingBuffer* timing_thread_buffer();
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+// The calling thread's buffer, cached where the punch is inlined. It is constant-initialized, so an access needs no
+// thread-local wrapper call.
+inline thread_local TimingBuffer* timing_buffer_cache = nullptr;
+/**
+ * @endcond
+ */
+
+/**
+ * @fn void timing_prepare()
+ * @brief   Allocate and prefault the calling thread's buffer now, instead of on its first punch.
+ */
+inline void timing_prepare() {
+    timing_buffer_cache = timing_thread_buffer();
+}
+
+/**
+ * @fn uint64_t timing_now_ns()
+ * @brief   The timestamp of the events: `CLOCK_REALTIME` in nanoseconds, comparable across processes.
+ * @return  The timestamp.
+ */
+inline uint64_t timing_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME,&ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @fn template <typename... UserData> void timing_punch(uint64_t tag, UserData... user_data)
+ * @brief   Log an event in the calling thread's buffer. The earliest events are overwritten when it is full.
+ * @tparam      UserData    0 to 4 types convertible to `uint64_t`.
+ * @param[in]   tag         Event tag, a.k.a event identifier.
+ * @param[in]   user_data   User data, defined by callers.
+ */
+template <typename... UserData>
+inline void timing_punch(uint64_t tag, UserData... user_data) {
+    static_assert(sizeof...(UserData) <= 4, "timing_punch() takes up to 4 user data values.");
+    static_assert((std::is_convertible_v<UserData,uint64_t> && ...), "User data must be convertible to uint64_t.");
+    const uint64_t ts_ns = timing_now_ns();
+    TimingBuffer* buffer = timing_buffer_cache;
+    if (__builtin_expect(buffer == nullptr,0)) {
+        buffer = timing_buffer_cache = timing_thread_buffer();
+    }
+    const uint64_t position = buffer->position.load(std::memory_order_relaxed);
+    uint64_t* event = buffer->log + (position & buffer->mask) * WS_TIMING_EVENT_WORDS;
+    event[0] = tag;
+    event[1] = ts_ns;
+    [[maybe_unused]] uint64_t* data = event + 2;
+    ((*data++ = static_cast<uint64_t>(user_data)), ...);
+    event[6] = sizeof...(UserData);
+    buffer->position.store(position + 1,std::memory_order_release);
+}
+
+}
+}
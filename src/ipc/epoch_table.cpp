@@ -0,0 +1,521 @@
+/**
+ * @file    epoch_table.cpp
+ * @brief   Epoch table implementation.
+ */
+
+#include <wsong/ipc/epoch_table.hpp>
+
+#include "process.hpp"
+
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <asm-generic/hugetlb_encode.h>
+#include <linux/membarrier.h>
+#endif
+
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <thread>
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+struct epoch_table_client_t {
+    // odd in a read section. It only grows, so a reused client slot never repeats a snapshot.
+    std::atomic<uint64_t>   sequence;
+    std::atomic<int32_t>    pid;
+    uint64_t                start_time;
+} WS_CL_ALIGNED;
+
+enum epoch_slot_state_t : uint32_t {
+    ET_FREE         = 0,
+    ET_PREPARING    = 1,
+    ET_CURRENT      = 2,
+    ET_RETIRED      = 3,
+};
+
+struct epoch_table_slot_t {
+    std::atomic<uint32_t>   state;
+    // the client preparing it.
+    uint32_t                writer;
+    uint64_t                size;
+    uint64_t                version;
+} WS_CL_ALIGNED;
+
+#define ET_ROUND_UP(x,a)        ((((x) + (a) - 1) / (a)) * (a))
+#define ET_CLIENTS_BYTES(attr)  (static_cast<size_t>((attr).max_clients) * sizeof(epoch_table_client_t))
+#define ET_SLOTS_BYTES(attr)    (static_cast<size_t>((attr).num_slots) * sizeof(epoch_table_slot_t))
+#define ET_SNAPSHOTS_BYTES(attr) \
+                                (static_cast<size_t>((attr).num_slots) * (attr).max_clients * sizeof(uint64_t))
+#define ET_METADATA_BYTES(attr) (sizeof(EpochTableHeader) + ET_CLIENTS_BYTES(attr) + ET_SLOTS_BYTES(attr) + \
+                                    ET_SNAPSHOTS_BYTES(attr))
+
+#define ET_HEADER               const_cast<EpochTableHeader*>(this->info_ptr)
+#define ET_ATTRIBUTE            (this->info_ptr->info.attribute)
+#define ET_CLIENTS              reinterpret_cast<epoch_table_client_t*>( \
+                                    reinterpret_cast<uintptr_t>(this->info_ptr) + sizeof(EpochTableHeader))
+#define ET_SLOTS                reinterpret_cast<epoch_table_slot_t*>( \
+                                    reinterpret_cast<uintptr_t>(ET_CLIENTS) + ET_CLIENTS_BYTES(ET_ATTRIBUTE))
+#define ET_SNAPSHOT(s,c)        (reinterpret_cast<uint64_t*>( \
+                                    reinterpret_cast<uintptr_t>(ET_SLOTS) + ET_SLOTS_BYTES(ET_ATTRIBUTE)) \
+                                    [static_cast<size_t>(s) * ET_ATTRIBUTE.max_clients + (c)])
+#define ET_SLOT_ADDRESS(s)      reinterpret_cast<void*>( \
+                                    reinterpret_cast<uintptr_t>(this->data_ptr) + \
+                                    static_cast<size_t>(s) * ET_ATTRIBUTE.slot_size)
+
+#define ET_CURRENT(version,slot)    ((static_cast<uint64_t>(version) << 8) | (slot))
+#define ET_CURRENT_VERSION(c)   ((c) >> 8)
+#define ET_CURRENT_SLOT(c)      static_cast<uint32_t>((c) & 0xff)
+
+// Tell if the kernel runs a global memory barrier on all cpus for us.
+static bool global_membarrier_supported() {
+#if defined(__linux__) && defined(__NR_membarrier)
+    const long commands = syscall(__NR_membarrier,MEMBARRIER_CMD_QUERY,0);
+    return commands > 0 && (commands & MEMBARRIER_CMD_GLOBAL);
+#else
+    return false;
+#endif
+}
+/**
+ * @endcond
+ */
+
+EpochTable::EpochTable(void* mem_ptr, void* data_ptr, bool read_only) :
+    info_ptr(reinterpret_cast<const EpochTableHeader*>(mem_ptr)),
+    data_ptr(data_ptr),
+    read_only(read_only),
+    client(ET_ATTRIBUTE.max_clients),
+    sequence(0),
+    nesting(0),
+    reading{nullptr,0,0},
+    preparing(ET_ATTRIBUTE.num_slots) {
+    const pid_t pid = getpid();
+    const uint64_t start_time = process_start_time(pid);
+    // free the slots of dead clients first.
+    reclaim();
+    lock();
+    for (this->client = 0; this->client < ET_ATTRIBUTE.max_clients; this->client++) {
+        if (ET_CLIENTS[this->client].pid.load(std::memory_order_relaxed) == 0) {
+            this->sequence = ET_CLIENTS[this->client].sequence.load(std::memory_order_relaxed);
+            ET_CLIENTS[this->client].start_time = start_time;
+            ET_CLIENTS[this->client].pid.store(pid,std::memory_order_release);
+            break;
+        }
+    }
+    unlock();
+    if (this->client == ET_ATTRIBUTE.max_clients) {
+        shmdt(this->data_ptr);
+        shmdt(this->info_ptr);
+        throw ws_exp("Epoch table is full: all " + std::to_string(ET_ATTRIBUTE.max_clients) +
+                     " client slots are in use.");
+    }
+}
+
+EpochTable::~EpochTable() {
+    lock();
+    reclaim_client(this->client);
+    unlock();
+    shmdt(this->data_ptr);
+    shmdt(this->info_ptr);
+}
+
+void EpochTable::lock() {
+    int ret = pthread_mutex_lock(&ET_HEADER->info.mutex);
+    if (ret == EOWNERDEAD) {
+        // The owner died in the critical section. The protected updates are short, so we take over the state as is.
+        pthread_mutex_consistent(&ET_HEADER->info.mutex);
+    } else if (ret != 0) {
+        throw ws_exp(std::string("pthread_mutex_lock failed with error:") + std::strerror(ret));
+    }
+}
+
+void EpochTable::unlock() {
+    pthread_mutex_unlock(&ET_HEADER->info.mutex);
+}
+
+bool EpochTable::barrier() {
+    bool ordered = true;
+    if (this->info_ptr->info.reader_fence.load(std::memory_order_relaxed) == 0) {
+#if defined(__linux__) && defined(__NR_membarrier)
+        if (syscall(__NR_membarrier,MEMBARRIER_CMD_GLOBAL,0) == 0) {
+            return true;
+        }
+#endif
+        // supported by the creator's kernel, but denied to us: the readers fence on their side from now on. We hold
+        // the mutex, so throwing here would leave the table locked.
+        ET_HEADER->info.reader_fence.store(1,std::memory_order_relaxed);
+        ordered = false;
+    }
+    // the readers fence on their side.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return ordered;
+}
+
+EpochTableAttribute EpochTable::attribute() {
+    return ET_ATTRIBUTE;
+}
+
+EpochTableStats EpochTable::stats() {
+    EpochTableStats stats = {0,0,0,0,0,0,0,0,0};
+    const uint64_t current = ET_HEADER->info.current.load(std::memory_order_acquire);
+    stats.version   = ET_CURRENT_VERSION(current);
+    if (stats.version != 0) {
+        stats.size  = ET_SLOTS[ET_CURRENT_SLOT(current)].size;
+    }
+    stats.published = ET_HEADER->info.published.load(std::memory_order_relaxed);
+    stats.reclaimed = ET_HEADER->info.reclaimed.load(std::memory_order_relaxed);
+    for (uint32_t s = 0; s < ET_ATTRIBUTE.num_slots; s++) {
+        switch (ET_SLOTS[s].state.load(std::memory_order_relaxed)) {
+        case ET_FREE:
+            stats.free_slots ++;
+            break;
+        case ET_PREPARING:
+            stats.preparing_slots ++;
+            break;
+        case ET_RETIRED:
+            stats.retired_slots ++;
+            break;
+        default:
+            break;
+        }
+    }
+    for (uint32_t c = 0; c < ET_ATTRIBUTE.max_clients; c++) {
+        if (ET_CLIENTS[c].pid.load(std::memory_order_relaxed) != 0) {
+            stats.clients ++;
+            if (ET_CLIENTS[c].sequence.load(std::memory_order_relaxed) & 1) {
+                stats.reading_clients ++;
+            }
+        }
+    }
+    return stats;
+}
+
+EpochTableVersion EpochTable::read_lock() {
+    if (this->nesting ++ > 0) {
+        return this->reading;
+    }
+    // announce the read section in our own cacheline.
+    this->sequence ++;
+    ET_CLIENTS[this->client].sequence.store(this->sequence,std::memory_order_relaxed);
+    if (__builtin_expect(this->info_ptr->info.reader_fence.load(std::memory_order_relaxed),0)) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    } else {
+        // the writer's membarrier orders the store before the load below.
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+    const uint64_t current = this->info_ptr->info.current.load(std::memory_order_acquire);
+    if (ET_CURRENT_VERSION(current) == 0) {
+        this->reading = {nullptr,0,0};
+    } else {
+        const uint32_t slot = ET_CURRENT_SLOT(current);
+        this->reading = {ET_SLOT_ADDRESS(slot),ET_SLOTS[slot].size,ET_CURRENT_VERSION(current)};
+    }
+    return this->reading;
+}
+
+void EpochTable::read_unlock() {
+    if (this->nesting == 0) {
+        throw ws_exp("Epoch table read_unlock() without read_lock().");
+    }
+    if (-- this->nesting > 0) {
+        return;
+    }
+    this->sequence ++;
+    // release: the reads of the version are done before the writer sees us leave.
+    ET_CLIENTS[this->client].sequence.store(this->sequence,std::memory_order_release);
+}
+
+void* EpochTable::prepare(uint64_t size, uint64_t timeout_ns) {
+    if (this->read_only) {
+        throw ws_exp("Cannot publish in a read-only epoch table.");
+    }
+    if (size == 0 || size > ET_ATTRIBUTE.slot_size) {
+        throw ws_invalid_argument_exp("Invalid version size:" + std::to_string(size) + ", slot_size is " +
+                                      std::to_string(ET_ATTRIBUTE.slot_size));
+    }
+    if (this->preparing != ET_ATTRIBUTE.num_slots) {
+        throw ws_exp("A version is being prepared already. Publish or abandon it first.");
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds(timeout_ns);
+    while (true) {
+        lock();
+        reclaim_slots();
+        for (uint32_t s = 0; s < ET_ATTRIBUTE.num_slots; s++) {
+            if (ET_SLOTS[s].state.load(std::memory_order_relaxed) == ET_FREE) {
+                ET_SLOTS[s].writer  = this->client;
+                ET_SLOTS[s].size    = size;
+                ET_SLOTS[s].version = 0;
+                ET_SLOTS[s].state.store(ET_PREPARING,std::memory_order_relaxed);
+                this->preparing = s;
+                break;
+            }
+        }
+        unlock();
+        if (this->preparing != ET_ATTRIBUTE.num_slots) {
+            return ET_SLOT_ADDRESS(this->preparing);
+        }
+        // a dead reader may be pinning a retired version.
+        if (reclaim() > 0) {
+            continue;
+        }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            throw ws_timeout_exp("Epoch table prepare call timeout.");
+        }
+        // the readers of the retired versions leave soon, versions are published rarely.
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+uint64_t EpochTable::publish() {
+    if (this->preparing == ET_ATTRIBUTE.num_slots) {
+        throw ws_exp("No version is being prepared.");
+    }
+    lock();
+    if (ET_SLOTS[this->preparing].state.load(std::memory_order_relaxed) != ET_PREPARING ||
+        ET_SLOTS[this->preparing].writer != this->client) {
+        // reclaimed by someone who took us for dead.
+        unlock();
+        this->preparing = ET_ATTRIBUTE.num_slots;
+        throw ws_exp("The prepared version has been reclaimed.");
+    }
+    const uint64_t previous = ET_HEADER->info.current.load(std::memory_order_relaxed);
+    const uint64_t version = ET_CURRENT_VERSION(previous) + 1;
+    ET_SLOTS[this->preparing].version = version;
+    ET_SLOTS[this->preparing].state.store(ET_CURRENT,std::memory_order_relaxed);
+    // release: the content is visible to whoever loads the new version.
+    ET_HEADER->info.current.store(ET_CURRENT(version,this->preparing),std::memory_order_release);
+    this->preparing = ET_ATTRIBUTE.num_slots;
+    if (ET_CURRENT_VERSION(previous) != 0) {
+        // every reader now either shows its read section, or reads the new version.
+        const bool ordered = barrier();
+        const uint32_t retired = ET_CURRENT_SLOT(previous);
+        for (uint32_t c = 0; c < ET_ATTRIBUTE.max_clients; c++) {
+            uint64_t sequence = ET_CLIENTS[c].sequence.load(std::memory_order_acquire);
+            if (!ordered && (sequence & 1) == 0) {
+                // the reader may be in a read section we do not see yet: wait for it to leave, if it entered.
+                sequence ++;
+            }
+            ET_SNAPSHOT(retired,c) = sequence;
+        }
+        ET_SLOTS[retired].state.store(ET_RETIRED,std::memory_order_relaxed);
+    }
+    ET_HEADER->info.published.fetch_add(1,std::memory_order_relaxed);
+    reclaim_slots();
+    unlock();
+    return version;
+}
+
+void EpochTable::abandon() {
+    if (this->preparing == ET_ATTRIBUTE.num_slots) {
+        return;
+    }
+    lock();
+    if (ET_SLOTS[this->preparing].state.load(std::memory_order_relaxed) == ET_PREPARING &&
+        ET_SLOTS[this->preparing].writer == this->client) {
+        ET_SLOTS[this->preparing].state.store(ET_FREE,std::memory_order_relaxed);
+    }
+    unlock();
+    this->preparing = ET_ATTRIBUTE.num_slots;
+}
+
+uint32_t EpochTable::reclaim_slots() {
+    uint32_t freed = 0;
+    for (uint32_t s = 0; s < ET_ATTRIBUTE.num_slots; s++) {
+        if (ET_SLOTS[s].state.load(std::memory_order_relaxed) != ET_RETIRED) {
+            continue;
+        }
+        bool in_use = false;
+        for (uint32_t c = 0; c < ET_ATTRIBUTE.max_clients && !in_use; c++) {
+            const uint64_t snapshot = ET_SNAPSHOT(s,c);
+            // acquire: pairs with read_unlock(), the reader is done with the slot before we reuse it.
+            in_use = (snapshot & 1) && ET_CLIENTS[c].sequence.load(std::memory_order_acquire) == snapshot;
+        }
+        if (!in_use) {
+            ET_SLOTS[s].state.store(ET_FREE,std::memory_order_relaxed);
+            ET_HEADER->info.reclaimed.fetch_add(1,std::memory_order_relaxed);
+            freed ++;
+        }
+    }
+    return freed;
+}
+
+void EpochTable::reclaim_client(uint32_t client) {
+    epoch_table_client_t& entry = ET_CLIENTS[client];
+    const uint64_t sequence = entry.sequence.load(std::memory_order_relaxed);
+    if (sequence & 1) {
+        entry.sequence.store(sequence + 1,std::memory_order_release);
+    }
+    for (uint32_t s = 0; s < ET_ATTRIBUTE.num_slots; s++) {
+        if (ET_SLOTS[s].state.load(std::memory_order_relaxed) == ET_PREPARING && ET_SLOTS[s].writer == client) {
+            ET_SLOTS[s].state.store(ET_FREE,std::memory_order_relaxed);
+        }
+    }
+    entry.pid.store(0,std::memory_order_release);
+}
+
+uint32_t EpochTable::reclaim() {
+    lock();
+    for (uint32_t c = 0; c < ET_ATTRIBUTE.max_clients; c++) {
+        const pid_t pid = ET_CLIENTS[c].pid.load(std::memory_order_acquire);
+        if (pid == 0 || c == this->client) {
+            continue;
+        }
+        if (process_start_time(pid) != ET_CLIENTS[c].start_time) {
+            reclaim_client(c);
+        }
+    }
+    const uint32_t freed = reclaim_slots();
+    unlock();
+    return freed;
+}
+
+key_t EpochTable::create_epoch_table(const EpochTableAttribute& attribute) {
+    // validate check
+    if (attribute.num_slots < 2 || attribute.num_slots > WS_EPOCH_TABLE_MAX_SLOTS) {
+        throw ws_invalid_argument_exp("Invalid num_slots:" + std::to_string(attribute.num_slots));
+    }
+    if (attribute.max_clients == 0 || attribute.max_clients > WS_EPOCH_TABLE_MAX_CLIENTS) {
+        throw ws_invalid_argument_exp("Invalid max_clients:" + std::to_string(attribute.max_clients));
+    }
+    if (attribute.slot_size == 0) {
+        throw ws_invalid_argument_exp("Invalid slot_size:0");
+    }
+
+    int data_shmflg = IPC_CREAT | IPC_EXCL | 0644; // the default permission
+    switch (attribute.page_size) {
+    case 1<<12:
+        break;
+#if defined(__linux__)
+    case 1<<21:
+        data_shmflg |= (SHM_HUGETLB | (HUGETLB_FLAG_ENCODE_2MB));
+        break;
+    case 1<<30:
+        data_shmflg |= (SHM_HUGETLB | (HUGETLB_FLAG_ENCODE_1GB));
+        break;
+#endif
+    default:
+        throw ws_invalid_argument_exp("Invalid page_size:" + std::to_string(attribute.page_size));
+    }
+    const uint64_t slot_size = ET_ROUND_UP(attribute.slot_size,static_cast<uint64_t>(attribute.page_size));
+
+    // create the metadata segment
+    int shmid = shmget(attribute.key,ET_ROUND_UP(ET_METADATA_BYTES(attribute),4096ul),IPC_CREAT | IPC_EXCL | 0644);
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") +
+                     std::strerror(errno));
+    }
+
+    // create the data segment, which is only known by its id.
+    int data_shmid = shmget(IPC_PRIVATE,slot_size * attribute.num_slots,data_shmflg);
+    if (data_shmid == -1) {
+        int err = errno;
+        shmctl(shmid,IPC_RMID,nullptr);
+        throw ws_exp(std::string("shmget for data failed with error:") +
+                     std::strerror(err));
+    }
+
+    // lock memory
+    if (shmctl(shmid,SHM_LOCK,nullptr) == -1 || shmctl(data_shmid,SHM_LOCK,nullptr) == -1) {
+        int err = errno;
+        shmctl(shmid,IPC_RMID,nullptr);
+        shmctl(data_shmid,IPC_RMID,nullptr);
+        throw ws_exp(std::string("pinning pages: shmctl failed with error:") +
+                     std::strerror(err));
+    }
+
+    // get key
+    struct shmid_ds buf;
+    if (shmctl(shmid,IPC_STAT,&buf) == -1) {
+        throw ws_exp(std::string("get stat: shmctl failed with error:") +
+                     std::strerror(errno));
+    }
+
+    // attach to memory region
+    void* ptr = shmat(shmid,nullptr,0);
+    if (ptr == (void*)-1) {
+        throw ws_exp(std::string("attach: shmat failed with error:") +
+                     std::strerror(errno));
+    }
+
+    // initialize, the shared memory is zero-filled so all slots are free, no version is current, and all clients
+    // are out of the read sections.
+    EpochTableHeader* eth           = reinterpret_cast<EpochTableHeader*>(ptr);
+    eth->info.attribute             = attribute;
+    eth->info.attribute.id          = shmid;
+    eth->info.attribute.data_id     = data_shmid;
+    eth->info.attribute.key         = buf.shm_perm.__key;
+    eth->info.attribute.slot_size   = slot_size;
+    eth->info.reader_fence.store(global_membarrier_supported() ? 0 : 1,std::memory_order_relaxed);
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr,PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex_attr,PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&eth->info.mutex,&mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+
+    // detach memory region
+    if (shmdt(ptr) == -1) {
+        throw ws_exp(std::string("detach: shmdt failed with error:") +
+                     std::strerror(errno));
+    }
+
+    return buf.shm_perm.__key;
+}
+
+void EpochTable::delete_epoch_table(const key_t key) {
+    int shmid = shmget(key,0,0);
+
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") +
+                     std::strerror(errno));
+    }
+
+    void* ptr = shmat(shmid,nullptr,SHM_RDONLY);
+    if (ptr == (void*)-1) {
+        throw ws_exp(std::string("attach: shmat failed with error:") +
+                     std::strerror(errno));
+    }
+    const int data_shmid = reinterpret_cast<EpochTableHeader*>(ptr)->info.attribute.data_id;
+    shmdt(ptr);
+
+    if (shmctl(data_shmid,IPC_RMID,nullptr) == -1 || shmctl(shmid,IPC_RMID,nullptr) == -1) {
+        throw ws_exp(std::string("delete shared memory: shmctl failed with error:") +
+                     std::strerror(errno));
+    }
+}
+
+std::unique_ptr<EpochTable> EpochTable::get_epoch_table(const key_t key, bool read_only) {
+    int shmid = shmget(key,0,0);
+
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") +
+                     std::strerror(errno));
+    }
+
+    void* mem_ptr = shmat(shmid,nullptr,0);
+    if (mem_ptr == (void*)-1) {
+        throw ws_exp(std::string("Memory attach failed: shmat failed with error:") +
+                     std::strerror(errno));
+    }
+
+    void* data_ptr = shmat(reinterpret_cast<EpochTableHeader*>(mem_ptr)->info.attribute.data_id,nullptr,
+                           read_only ? SHM_RDONLY : 0);
+    if (data_ptr == (void*)-1) {
+        int err = errno;
+        shmdt(mem_ptr);
+        throw ws_exp(std::string("Data attach failed: shmat failed with error:") +
+                     std::strerror(err));
+    }
+
+    return std::unique_ptr<EpochTable>(new EpochTable(mem_ptr,data_ptr,read_only));
+}
+
+}
+}
@@ -1,11 +1,25 @@
 #include <getopt.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <cstring>
 #include <chrono>
 #include <cstdlib>
+#include <algorithm>
+#include <bit>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <map>
+#include <random>
+#include <sstream>
 #include <string>
+#include <tuple>
 #include <atomic>
 #include <unordered_map>
 #include <vector>
@@ -13,16 +27,34 @@
 #include <thread>
 
 #include <wsong/ipc/ring_buffer.hpp>
+#include <wsong/ipc/ring_relay.hpp>
+#include <wsong/ipc/ring_merger.hpp>
+#include <wsong/ipc/ring_pool.hpp>
+#include <wsong/ipc/priority_ring.hpp>
+#include <wsong/ipc/ring_logger.hpp>
+#include <wsong/ipc/ring_message.hpp>
+#include <wsong/ipc/object_store.hpp>
+#include <wsong/ipc/ring_bridge.hpp>
+#include <wsong/ipc/work_queue.hpp>
+#include <wsong/ipc/epoch_table.hpp>
+#include <wsong/ipc/shm_pipe.hpp>
+#include <wsong/perf/timing.h>
 
 using namespace std::chrono;
 
 const std::unordered_map<std::string,std::string> cli_aliases = {
-    {"rb_cli","ringbuffer"}
+    {"rb_cli","ringbuffer"},
+    {"rp_cli","ringpool"},
+    {"pr_cli","priorityring"},
+    {"os_cli","objectstore"},
+    {"wq_cli","workqueue"},
+    {"et_cli","epochtable"},
+    {"sp_cli","shmpipe"}
 };
 
 const char* help_string_args = 
 "--(c)md <command>      specifies the command to execute. (mandatory)\n"
-"                       command:=more|show|create|delete|perf|...\n"
+"                       command:=more|show|create|delete|perf|stress|sweep|scale|relay|merge|monitor|logcat|bridge|trace|...\n"
 "--(p)roperty <p=val>   specify a property for the command. Multiple --prop entries are alloed.\n"
 "                       use --(h)elp to show the corresponding properties.\n"
 "--(h)elp               print this information.\n";
@@ -71,6 +103,304 @@ static struct option long_options[] = {
 using Properties = std::unordered_map<std::string,std::string>;
 #define PCONTAINS(p,k) (p.find(k)!=p.cend())
 
+/**
+ * split a comma separated property value.
+ */
+static std::vector<std::string> split_list(const std::string& value) {
+    std::vector<std::string> items;
+    size_t pos = 0;
+    while (pos <= value.size()) {
+        size_t end = value.find(',',pos);
+        if (end == std::string::npos) {
+            end = value.size();
+        }
+        if (end > pos) {
+            items.emplace_back(value.substr(pos,end-pos));
+        }
+        pos = end + 1;
+    }
+    return items;
+}
+
+/**
+ * parse a page size property value: 4K|2M|1G.
+ */
+static uint32_t parse_page_size(const std::string& pss) {
+    if (pss == "4K") {
+        return 1<<12;
+    } else if (pss == "2M") {
+        return 1<<21;
+    } else if (pss == "1G") {
+        return 1<<30;
+    }
+    throw wsong::ws_exp("Unknown page size:" + pss);
+}
+
+/**
+ * check if there are free huge pages of the given size.
+ */
+static bool page_size_available(uint32_t page_size) {
+    if (page_size == (1<<12)) {
+        return true;
+    }
+    std::ifstream free_pages("/sys/kernel/mm/hugepages/hugepages-" + std::to_string(page_size >> 10) + "kB/free_hugepages");
+    uint64_t n = 0;
+    return (free_pages >> n) && n > 0;
+}
+
+/**
+ * @struct trial_result
+ */
+struct trial_result {
+    double      throughput; // messages per second
+    uint64_t    p50_ns;
+    uint64_t    p99_ns;
+    uint64_t    p999_ns;
+    uint64_t    max_ns;
+};
+
+/**
+ * Run one producer process and one consumer process against a ring buffer. The producer offers `load` messages per
+ * second, or as many as possible if `load` is zero. The consumer measures the end-to-end latency using the send
+ * timestamp in the message.
+ */
+static trial_result run_trial(key_t key, uint16_t message_size, uint64_t load, uint64_t count) {
+    auto* latencies = reinterpret_cast<uint64_t*>(mmap(nullptr,count*sizeof(uint64_t),PROT_READ|PROT_WRITE,
+                                                       MAP_SHARED|MAP_ANONYMOUS,-1,0));
+    if (latencies == MAP_FAILED) {
+        throw wsong::ws_exp(std::string("mmap failed with error:") + std::strerror(errno));
+    }
+
+    auto start = steady_clock::now();
+    pid_t consumer = fork();
+    if (consumer == 0) {
+        auto rb = wsong::ipc::RingBuffer::get_ring_buffer(key);
+        std::vector<uint8_t> msg(message_size);
+        for (uint64_t i = 0; i < count; i++) {
+            rb->consume(msg.data(),message_size,1min);
+            latencies[i] = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count()
+                         - *reinterpret_cast<uint64_t*>(msg.data());
+        }
+        _exit(0);
+    }
+    {
+        auto rb = wsong::ipc::RingBuffer::get_ring_buffer(key);
+        std::vector<uint8_t> msg(message_size,0);
+        const nanoseconds gap(load > 0 ? 1000000000ull/load : 0);
+        auto next = steady_clock::now();
+        for (uint64_t i = 0; i < count; i++) {
+            if (load > 0) {
+                while (steady_clock::now() < next);
+                next += gap;
+            }
+            *reinterpret_cast<uint64_t*>(msg.data()) =
+                duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+            rb->produce(msg.data(),message_size,1min);
+        }
+    }
+    int status = 0;
+    waitpid(consumer,&status,0);
+    const double seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1e9;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        munmap(latencies,count*sizeof(uint64_t));
+        throw wsong::ws_exp("The consumer process failed.");
+    }
+
+    std::sort(latencies,latencies + count);
+    trial_result result {
+        .throughput = count / seconds,
+        .p50_ns     = latencies[count/2],
+        .p99_ns     = latencies[count*99/100],
+        .p999_ns    = latencies[count*999/1000],
+        .max_ns     = latencies[count-1],
+    };
+    munmap(latencies,count*sizeof(uint64_t));
+    return result;
+}
+
+/**
+ * parse a cpu list like "0-3,8-11".
+ */
+static std::vector<int> parse_cpu_list(const std::string& cpulist) {
+    std::vector<int> cpus;
+    for (auto& range: split_list(cpulist)) {
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0,dash));
+        int last  = (dash == std::string::npos) ? first : std::stoi(range.substr(dash+1));
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+/**
+ * @struct cpu_topology
+ */
+struct cpu_topology {
+    int cpu;
+    int package;
+    int l3;
+    int core;
+};
+
+/**
+ * read the topology of the online cpus from sysfs.
+ */
+static std::vector<cpu_topology> read_cpu_topology() {
+    auto read_int = [](const std::string& path, int fallback) {
+        std::ifstream file(path);
+        int value;
+        return (file >> value) ? value : fallback;
+    };
+    std::ifstream online("/sys/devices/system/cpu/online");
+    std::string cpulist;
+    std::getline(online,cpulist);
+    std::vector<cpu_topology> topology;
+    for (int cpu: parse_cpu_list(cpulist)) {
+        const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+        const int package = read_int(dir + "/topology/physical_package_id",0);
+        topology.push_back({
+            .cpu        = cpu,
+            .package    = package,
+            .l3         = read_int(dir + "/cache/index3/id",package),
+            .core       = read_int(dir + "/topology/core_id",cpu),
+        });
+    }
+    return topology;
+}
+
+/**
+ * Assign cpus to producers and consumers according to a placement policy:
+ * - smt:   producer i and consumer i share a physical core (SMT siblings) when possible.
+ * - l3:    all processes share an L3 cache, one process per physical core.
+ * - cross: producers on the first socket and consumers on the second.
+ * - none:  no pinning, -1 for all processes.
+ * Processes wrap around when there are not enough cpus.
+ */
+static void assign_cpus(const std::string& placement, uint32_t producers, uint32_t consumers,
+                        std::vector<int>& producer_cpus, std::vector<int>& consumer_cpus) {
+    producer_cpus.assign(producers,-1);
+    consumer_cpus.assign(consumers,-1);
+    if (placement == "none") {
+        return;
+    }
+    auto topology = read_cpu_topology();
+    std::sort(topology.begin(),topology.end(),[](const cpu_topology& a, const cpu_topology& b) {
+        return std::tie(a.package,a.l3,a.core,a.cpu) < std::tie(b.package,b.l3,b.core,b.cpu);
+    });
+    // one cpu per physical core
+    std::vector<cpu_topology> cores;
+    for (auto& t: topology) {
+        if (cores.empty() || cores.back().package != t.package || cores.back().core != t.core) {
+            cores.push_back(t);
+        }
+    }
+    if (placement == "smt") {
+        // siblings are adjacent in the sorted list, so interleaving producers and consumers pairs them up.
+        size_t next = 0;
+        for (uint32_t i = 0; i < std::max(producers,consumers); i++) {
+            if (i < producers) {
+                producer_cpus[i] = topology[next++ % topology.size()].cpu;
+            }
+            if (i < consumers) {
+                consumer_cpus[i] = topology[next++ % topology.size()].cpu;
+            }
+        }
+    } else if (placement == "l3") {
+        std::vector<int> domain;
+        for (auto& c: cores) {
+            if (c.package == cores.front().package && c.l3 == cores.front().l3) {
+                domain.push_back(c.cpu);
+            }
+        }
+        if (domain.size() < producers + consumers) {
+            std::cerr << "Warning: only " << domain.size() << " cores share the first L3 cache." << std::endl;
+        }
+        size_t next = 0;
+        for (auto& cpu: producer_cpus) {
+            cpu = domain[next++ % domain.size()];
+        }
+        for (auto& cpu: consumer_cpus) {
+            cpu = domain[next++ % domain.size()];
+        }
+    } else if (placement == "cross") {
+        std::vector<int> socket0, socket1;
+        int second_package = -1;
+        for (auto& c: cores) {
+            if (c.package == cores.front().package) {
+                socket0.push_back(c.cpu);
+            } else if (second_package == -1 || c.package == second_package) {
+                second_package = c.package;
+                socket1.push_back(c.cpu);
+            }
+        }
+        if (socket1.empty()) {
+            std::cerr << "Warning: single socket system, cross placement falls back to one socket." << std::endl;
+            socket1 = socket0;
+        }
+        for (uint32_t i = 0; i < producers; i++) {
+            producer_cpus[i] = socket0[i % socket0.size()];
+        }
+        for (uint32_t i = 0; i < consumers; i++) {
+            consumer_cpus[i] = socket1[(socket1 == socket0 ? producers + i : i) % socket1.size()];
+        }
+    } else {
+        throw wsong::ws_exp("Unknown placement:" + placement);
+    }
+}
+
+/**
+ * pin the calling process to a cpu, -1 for no pinning.
+ */
+static void pin_to_cpu(int cpu) {
+    if (cpu < 0) {
+        return;
+    }
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu,&cpuset);
+    if (sched_setaffinity(0,sizeof(cpuset),&cpuset) == -1) {
+        throw wsong::ws_exp(std::string("sched_setaffinity failed with error:") + std::strerror(errno));
+    }
+}
+
+/**
+ * Jain's fairness index: 1 for perfectly fair, 1/n for the most unfair.
+ */
+static double jain_fairness(const std::vector<double>& x) {
+    double sum = 0, sum_sq = 0;
+    for (auto v: x) {
+        sum += v;
+        sum_sq += v*v;
+    }
+    return (sum_sq == 0) ? 1.0 : (sum*sum) / (x.size()*sum_sq);
+}
+
+/**
+ * The message schema of "ringbuffer message".
+ */
+struct cli_quote {
+    static constexpr const char*    name    = "cli.quote";
+    static constexpr uint16_t       version = 1;
+    using seq       = wsong::ipc::MessageField<uint64_t>;
+    using symbol    = wsong::ipc::MessageField<char[8],seq>;
+    using price     = wsong::ipc::MessageField<double,symbol>;
+    using quantity  = wsong::ipc::MessageField<uint32_t,price>;
+    using venues    = wsong::ipc::MessageTail<uint16_t,quantity>;
+    using last      = venues;
+};
+
+/**
+ * The next version of the schema, which must not attach to a ring buffer of the first one.
+ */
+struct cli_quote_v2 {
+    static constexpr const char*    name    = "cli.quote";
+    static constexpr uint16_t       version = 2;
+    using seq       = wsong::ipc::MessageField<uint64_t>;
+    using last      = seq;
+};
+
 /**
  * @struct ipc_command
  */
@@ -94,7 +424,8 @@ struct ipc_command ipc_commands[] = {
             std::string more_string;
             if (command == "more") {
                 more_string =   "Properties:\n"
-                                "command:=more|show|create|delete|perf [more]\n";
+                                "command:=more|show|create|delete|resize|perf|stress|sweep|scale|relay|merge|mergecheck|monitor|logcat|bridge|trace|\n"
+                                "         message [more]\n";
             } else if (command == "show" || command == "delete") {
                 more_string =   "Properties:\n"
                                 "key:=<ring buffer key>\n";
@@ -106,7 +437,13 @@ struct ipc_command ipc_commands[] = {
                                 "entry_size:=<size in bytes>, must be power-of-two and smaller than 64KB [64]\n"
                                 "multiple_producers:=1|0, support multiple producer [0]\n"
                                 "multiple_consumers:=1|0, support for multiple consumer [0]\n"
+                                "trace_context:=1|0, prefix each entry with a trace context [0]\n"
                                 "description:=<desc string>, less than 255 characters [""]\n";
+            } else if (command == "resize") {
+                more_string =   "Properties:\n"
+                                "key:=<ring buffer key>\n"
+                                "capacity:=<new capacity as # of entries>, must be power-of-two\n"
+                                "timeout:=<time to wait for the old ring buffer to drain in ms> [10000]\n";
             } else if (command == "perf") {
                 more_string =   "Properties:\n"
                                 "key:=<ring buffer key>\n"
@@ -114,6 +451,87 @@ struct ipc_command ipc_commands[] = {
                                 "size:=<message size>   [ring buffer entry size]\n"
                                 "wcount:=<# of warmup messages to send> [1000]\n"
                                 "rcount:=<# of test run messages to send> [10000]\n";
+            } else if (command == "stress") {
+                more_string =   "Properties:\n"
+                                "key:=<ring buffer key>, entry_size must be at least 16 bytes\n"
+                                "producers:=<# of producer processes> [1]\n"
+                                "consumers:=<# of consumer processes> [1]\n"
+                                "count:=<# of messages per producer> [1000000]\n";
+            } else if (command == "sweep") {
+                more_string =   "Properties:\n"
+                                "entry_sizes:=<comma separated entry sizes, 8 to 65535 bytes> [64,256,1024]\n"
+                                "capacities:=<comma separated capacities> [1024,4096]\n"
+                                "page_sizes:=<comma separated 4K|2M|1G> [4K,2M,1G if available]\n"
+                                "modes:=<comma separated spsc|mp|mc|mpmc> [spsc,mp,mc,mpmc]\n"
+                                "loads:=<comma separated offered loads in msgs/sec, 0 for max> [0,100000]\n"
+                                "count:=<# of messages per trial> [100000]\n"
+                                "output:=<csv file> [stdout]\n";
+            } else if (command == "scale") {
+                more_string =   "Properties:\n"
+                                "key:=<ring buffer key> [a new ring buffer for each run]\n"
+                                "producers:=<comma separated # of producer processes> [1,2,4]\n"
+                                "consumers:=<comma separated # of consumer processes> [1,2,4]\n"
+                                "placement:=none|smt|l3|cross [none]\n"
+                                "capacity:=<capacity of new ring buffers> [4096]\n"
+                                "entry_size:=<entry size of new ring buffers> [64]\n"
+                                "count:=<# of messages per producer> [100000]\n";
+            } else if (command == "relay") {
+                more_string =   "Properties:\n"
+                                "key:=<source ring buffer key>\n"
+                                "nodes:=<comma separated NUMA nodes to relay to>\n"
+                                "keys:=<comma separated target ring buffer keys> [random]\n"
+                                "batch:=<max # of entries relayed in a batch> [64]\n"
+                                "interval:=<stats report interval in ms> [1000]\n";
+            } else if (command == "merge") {
+                more_string =   "Properties:\n"
+                                "keys:=<comma separated ring buffer keys>\n"
+                                "offset:=<byte offset of the 64-bit merge key in entries> [0]\n"
+                                "lateness:=<lateness window in key units>|strict [strict]\n";
+            } else if (command == "mergecheck") {
+                more_string =   "Merge two private ring buffers, one of them idle, and check the emitted entries.\n"
+                                "Properties:\n"
+                                "count:=<# of entries in the busy ring buffer> [10]\n"
+                                "lateness:=<lateness window in key units> [3]\n";
+            } else if (command == "monitor") {
+                more_string =   "Properties:\n"
+                                "keys:=<comma separated ring buffer keys>|all [all]\n"
+                                "interval:=<sampling interval in ms> [1000]\n"
+                                "format:=top|csv [top]\n"
+                                "count:=<# of samples, 0 for infinite> [0]\n";
+            } else if (command == "logcat") {
+                more_string =   "Properties:\n"
+                                "key:=<key of the ring buffer a RingLogger writes to>\n"
+                                "output:=<log file> [stdout]\n"
+                                "batch:=<max # of records formatted and written per batch> [1024]\n"
+                                "interval:=<polling interval in us when the ring buffer is empty> [1000]\n";
+            } else if (command == "bridge") {
+                more_string =   "Properties:\n"
+                                "role:=send|receive|loopback [loopback]\n"
+                                "key:=<source ring buffer key to send, or target ring buffer key to receive into>\n"
+                                "protocol:=tcp|udp [tcp]\n"
+                                "address:=<host to send to, or address to listen on> [127.0.0.1 to send, any to receive]\n"
+                                "port:=<port> [9000, ephemeral for loopback]\n"
+                                "batch:=<max # of entries sent in a batch> [256]\n"
+                                "budget:=<latency budget for batching in us> [50]\n"
+                                "datagram:=<max UDP datagram size in bytes> [1472]\n"
+                                "interval:=<stats report interval in ms> [1000]\n"
+                                "For loopback, which bridges two temporary ring buffers over the local host:\n"
+                                "capacity:=<capacity of the ring buffers> [4096]\n"
+                                "entry_size:=<entry size in bytes, at least 8> [64]\n"
+                                "count:=<# of messages> [1000000]\n"
+                                "rate:=<offered load in messages per second, 0 for flat out> [0]\n";
+            } else if (command == "trace") {
+                more_string =   "Properties:\n"
+                                "files:=<comma separated timing logs saved by ws_timing_save() in the processes>\n"
+                                "paths:=<# of message paths to print> [0]\n";
+            } else if (command == "message") {
+                more_string =   "Compare copying a struct with produce()/consume() to building and viewing the messages in\n"
+                                "place with MessageRing, on a new ring buffer.\n"
+                                "Properties:\n"
+                                "capacity:=<capacity of the ring buffer> [4096]\n"
+                                "entry_size:=<entry size of the ring buffer> [64]\n"
+                                "venues:=<# of elements in the variable-length tail> [4]\n"
+                                "count:=<# of messages> [10000000]\n";
             } else {
                 more_string =   "Unknown command:" + command + "\n";
             }
@@ -130,6 +548,7 @@ struct ipc_command ipc_commands[] = {
                 .entry_size = 64,
                 .multiple_consumer  = false,
                 .multiple_producer  = false,
+                .trace_context      = false,
                 .description    = {'\0'},
             };
             if (PCONTAINS(props,"key")) {
@@ -179,6 +598,13 @@ struct ipc_command ipc_commands[] = {
                     throw wsong::ws_exp("Unknow multiple_consumers setting:" + props.at("multiple_consumers"));
                 }
             }
+            if (PCONTAINS(props,"trace_context")) {
+                if (props.at("trace_context") == "1") {
+                    attribute.trace_context = true;
+                } else if (props.at("trace_context") != "0") {
+                    throw wsong::ws_exp("Unknow trace_context setting:" + props.at("trace_context"));
+                }
+            }
             if (PCONTAINS(props,"description")) {
                 auto desc = props.at("description");
                 if (desc.size() <= 255) {
@@ -199,7 +625,7 @@ struct ipc_command ipc_commands[] = {
                 throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
             }
             const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
-            auto ring_buffer_ptr = wsong::ipc::RingBuffer::get_ring_buffer(key);
+            auto ring_buffer_ptr = wsong::ipc::RingBuffer::get_ring_buffer(key,true);
             auto attribute = ring_buffer_ptr->attribute();
             std::cout << "key:          0x" << std::hex << attribute.key << std::dec << std::endl;
             std::cout << "id:           "   << attribute.id << std::endl;
@@ -208,8 +634,16 @@ struct ipc_command ipc_commands[] = {
             std::cout << "entry_size:   "   << attribute.entry_size << " Bytes" << std::endl;
             std::cout << "multiple_producer:    "   << attribute.multiple_producer << std::endl;
             std::cout << "multiple_consumer:    "   << attribute.multiple_consumer << std::endl;
+            std::cout << "trace_context:        "   << attribute.trace_context << std::endl;
             std::cout << "description:  "   << attribute.description << std::endl;
             std::cout << "current size: "   << ring_buffer_ptr->size() <<std::endl;
+            auto stats = ring_buffer_ptr->stats();
+            std::cout << "full stalls:  "   << stats.full_stalls << std::endl;
+            std::cout << "empty stalls: "   << stats.empty_stalls << std::endl;
+            if (stats.successor_id != -1) {
+                std::cout << "resized to:   id " << stats.successor_id
+                          << (stats.sealed ? ", sealed" : ", not sealed yet") << std::endl;
+            }
         }
     },
     {"ringbuffer","delete",
@@ -222,6 +656,36 @@ struct ipc_command ipc_commands[] = {
             std::cout << "RingBuffer with key=0x" << std::hex << key << std::dec << " is deleted." << std::endl;
         }
     },
+    {"ringbuffer","resize",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key") || !PCONTAINS(props,"capacity")) {
+                throw wsong::ws_exp("Mandatory key or capacity property is not found. "
+                                    "Please specify them using '-p key=<key> -p capacity=<capacity>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            const uint32_t capacity = std::stoul(props.at("capacity"),nullptr,0);
+            if ((capacity&(capacity-1)) || capacity == 0) {
+                throw wsong::ws_exp("Invalid capacity:" + props.at("capacity")
+                                     + ". Capacity must be non-zero and power-of-two.");
+            }
+            uint64_t timeout_ms = 10000;
+            if (PCONTAINS(props,"timeout")) {
+                timeout_ms = std::stoull(props.at("timeout"),nullptr,0);
+            }
+            auto start = steady_clock::now();
+            const bool drained = wsong::ipc::RingBuffer::resize_ring_buffer(key,capacity,milliseconds(timeout_ms));
+            std::cout << "RingBuffer with key=0x" << std::hex << key << std::dec << " is resized to " << capacity
+                      << " entries." << std::endl;
+            if (drained) {
+                std::cout << "The old ring buffer is drained in "
+                          << duration_cast<microseconds>(steady_clock::now() - start).count()
+                          << " us, and its memory is released." << std::endl;
+            } else {
+                std::cout << "The old ring buffer is not drained yet. A single producer seals it on its next "
+                             "produce() call." << std::endl;
+            }
+        }
+    },
     {"ringbuffer","perf",
         [](const Properties& props) {
             if (!PCONTAINS(props,"key")) {
@@ -317,6 +781,2522 @@ struct ipc_command ipc_commands[] = {
             }
         }
     },
+    {"ringbuffer","stress",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory 'key' property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+
+            uint32_t producers = 1;
+            if (PCONTAINS(props,"producers")) {
+                producers = std::stoul(props.at("producers"),nullptr,0);
+            }
+            uint32_t consumers = 1;
+            if (PCONTAINS(props,"consumers")) {
+                consumers = std::stoul(props.at("consumers"),nullptr,0);
+            }
+            uint64_t count = 1000000;
+            if (PCONTAINS(props,"count")) {
+                count = std::stoul(props.at("count"),nullptr,0);
+            }
+
+            auto attr = wsong::ipc::RingBuffer::get_ring_buffer(key)->attribute();
+            if (attr.entry_size < 16) {
+                throw wsong::ws_exp("stress needs entry_size >= 16, but it is " + std::to_string(attr.entry_size));
+            }
+            if ((producers > 1 && !attr.multiple_producer) || (consumers > 1 && !attr.multiple_consumer)) {
+                throw wsong::ws_exp("The ring buffer does not support multiple producers/consumers.");
+            }
+            if (producers == 0 || consumers == 0) {
+                throw wsong::ws_exp("producers and consumers must be non-zero.");
+            }
+
+            // Each message carries the producer id, a per-producer sequence number, and a payload derived from
+            // them. Consumers check the payload and that each producer's sequence numbers arrive in order.
+            auto fill = [](uint8_t* msg, uint16_t size, uint32_t producer, uint64_t seq) {
+                *reinterpret_cast<uint32_t*>(msg) = producer;
+                *reinterpret_cast<uint64_t*>(msg + 8) = seq;
+                for (uint16_t i = 16; i < size; i++) {
+                    msg[i] = static_cast<uint8_t>(seq * 31 + producer + i);
+                }
+            };
+
+            struct stress_state {
+                std::atomic<uint64_t>   received;
+                std::atomic<uint64_t>   errors;
+            };
+            auto* state = reinterpret_cast<stress_state*>(mmap(nullptr,sizeof(stress_state),PROT_READ|PROT_WRITE,
+                                                               MAP_SHARED|MAP_ANONYMOUS,-1,0));
+            if (state == MAP_FAILED) {
+                throw wsong::ws_exp(std::string("mmap failed with error:") + std::strerror(errno));
+            }
+            new (state) stress_state{{0},{0}};
+            const uint64_t total = count * producers;
+
+            auto start = steady_clock::now();
+            std::vector<pid_t> children;
+            for (uint32_t c = 0; c < consumers; c++) {
+                pid_t pid = fork();
+                if (pid == 0) {
+                    auto rb = wsong::ipc::RingBuffer::get_ring_buffer(key);
+                    std::vector<uint8_t> msg(attr.entry_size), expected(attr.entry_size);
+                    std::vector<uint64_t> next_seq(producers,0);
+                    auto last_receive = steady_clock::now();
+                    while (state->received.load(std::memory_order_relaxed) < total) {
+                        try {
+                            rb->consume(msg.data(),attr.entry_size,10ms);
+                        } catch (const wsong::ws_timeout_exp&) {
+                            if (steady_clock::now() - last_receive > 5s) {
+                                break;
+                            }
+                            continue;
+                        }
+                        last_receive = steady_clock::now();
+                        const uint32_t producer = *reinterpret_cast<uint32_t*>(msg.data());
+                        const uint64_t seq = *reinterpret_cast<uint64_t*>(msg.data() + 8);
+                        bool ok = (producer < producers && seq >= next_seq[producer] && seq < count);
+                        if (ok) {
+                            fill(expected.data(),attr.entry_size,producer,seq);
+                            ok = (std::memcmp(msg.data(),expected.data(),attr.entry_size) == 0);
+                            next_seq[producer] = seq + 1;
+                        }
+                        if (!ok) {
+                            state->errors.fetch_add(1);
+                        }
+                        state->received.fetch_add(1);
+                    }
+                    _exit(0);
+                }
+                children.push_back(pid);
+            }
+            for (uint32_t p = 0; p < producers; p++) {
+                pid_t pid = fork();
+                if (pid == 0) {
+                    auto rb = wsong::ipc::RingBuffer::get_ring_buffer(key);
+                    std::vector<uint8_t> msg(attr.entry_size);
+                    for (uint64_t seq = 0; seq < count; seq++) {
+                        fill(msg.data(),attr.entry_size,p,seq);
+                        rb->produce(msg.data(),attr.entry_size,1min);
+                    }
+                    _exit(0);
+                }
+                children.push_back(pid);
+            }
+            for (auto pid: children) {
+                waitpid(pid,nullptr,0);
+            }
+            const double seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1e9;
+
+            const uint64_t received = state->received.load();
+            const uint64_t errors   = state->errors.load();
+            munmap(state,sizeof(stress_state));
+            std::cout << "sent:      " << total << std::endl;
+            std::cout << "received:  " << received << std::endl;
+            std::cout << "errors:    " << errors << std::endl;
+            std::cout << "seconds:   " << seconds << std::endl;
+            std::cout << "msgs/sec:  " << static_cast<uint64_t>(received / seconds) << std::endl;
+            if (received != total || errors != 0) {
+                throw wsong::ws_exp("Stress test FAILED.");
+            }
+            std::cout << "Stress test PASSED." << std::endl;
+        }
+    },
+    {"ringbuffer","sweep",
+        [](const Properties& props) {
+            auto to_numbers = [](const std::string& list) {
+                std::vector<uint64_t> numbers;
+                for (auto& item: split_list(list)) {
+                    numbers.push_back(std::stoull(item,nullptr,0));
+                }
+                return numbers;
+            };
+            std::vector<uint64_t> entry_sizes = to_numbers(PCONTAINS(props,"entry_sizes") ?
+                                                           props.at("entry_sizes") : "64,256,1024");
+            for (auto entry_size: entry_sizes) {
+                // each message carries its send timestamp.
+                if (entry_size < sizeof(uint64_t) || entry_size > UINT16_MAX) {
+                    throw wsong::ws_invalid_argument_exp("Invalid entry size " + std::to_string(entry_size) +
+                                                         ", it must be between 8 and 65535.");
+                }
+            }
+            std::vector<uint64_t> capacities  = to_numbers(PCONTAINS(props,"capacities") ?
+                                                           props.at("capacities") : "1024,4096");
+            std::vector<uint64_t> loads       = to_numbers(PCONTAINS(props,"loads") ?
+                                                           props.at("loads") : "0,100000");
+            std::vector<uint32_t> page_sizes;
+            for (auto& pss: split_list(PCONTAINS(props,"page_sizes") ? props.at("page_sizes") : "4K,2M,1G")) {
+                uint32_t page_size = parse_page_size(pss);
+                if (page_size_available(page_size)) {
+                    page_sizes.push_back(page_size);
+                } else {
+                    std::cerr << "Skipping page size " << pss << ": no free huge pages." << std::endl;
+                }
+            }
+            std::vector<std::string> modes = split_list(PCONTAINS(props,"modes") ?
+                                                        props.at("modes") : "spsc,mp,mc,mpmc");
+            uint64_t count = 100000;
+            if (PCONTAINS(props,"count")) {
+                count = std::stoull(props.at("count"),nullptr,0);
+            }
+            std::ofstream outfile;
+            if (PCONTAINS(props,"output")) {
+                outfile.open(props.at("output"));
+            }
+            std::ostream& csv = PCONTAINS(props,"output") ? outfile : std::cout;
+
+            // best configurations per message size: by max throughput, and by p99 latency under offered load.
+            struct best_config {
+                std::string config;
+                double      value;
+            };
+            std::map<uint64_t,best_config> best_throughput, best_p99;
+
+            csv << "entry_size,capacity,page_size,mode,load,throughput,p50_ns,p99_ns,p999_ns,max_ns" << std::endl;
+            std::random_device rd;
+            for (auto entry_size: entry_sizes)
+            for (auto capacity: capacities)
+            for (auto page_size: page_sizes)
+            for (auto& mode: modes)
+            for (auto load: loads) {
+                if (mode != "spsc" && mode != "mp" && mode != "mc" && mode != "mpmc") {
+                    throw wsong::ws_exp("Unknown mode:" + mode);
+                }
+                wsong::ipc::RingBufferAttribute attribute = {
+                    .key        = static_cast<key_t>(rd() & 0x7fffffff),
+                    .id         = 0,
+                    .page_size  = page_size,
+                    .capacity   = static_cast<uint32_t>(capacity),
+                    .entry_size = static_cast<uint16_t>(entry_size),
+                    .multiple_consumer  = (mode == "mc" || mode == "mpmc"),
+                    .multiple_producer  = (mode == "mp" || mode == "mpmc"),
+                    .trace_context      = false,
+                    .description    = "ipc_cli sweep",
+                };
+                std::ostringstream config;
+                config << "entry_size=" << entry_size << " capacity=" << capacity
+                       << " page_size=" << (page_size >> 10) << "K mode=" << mode;
+                key_t key;
+                try {
+                    key = wsong::ipc::RingBuffer::create_ring_buffer(attribute);
+                } catch (const wsong::ws_exp& ex) {
+                    std::cerr << "Skipping " << config.str() << ": " << ex.what() << std::endl;
+                    continue;
+                }
+                trial_result result;
+                try {
+                    result = run_trial(key,entry_size,load,count);
+                } catch (...) {
+                    wsong::ipc::RingBuffer::delete_ring_buffer(key);
+                    throw;
+                }
+                wsong::ipc::RingBuffer::delete_ring_buffer(key);
+
+                csv << entry_size << "," << capacity << "," << (page_size >> 10) << "K," << mode << "," << load << ","
+                    << static_cast<uint64_t>(result.throughput) << "," << result.p50_ns << "," << result.p99_ns << ","
+                    << result.p999_ns << "," << result.max_ns << std::endl;
+
+                if (load == 0) {
+                    if (!best_throughput.contains(entry_size) || result.throughput > best_throughput[entry_size].value) {
+                        best_throughput[entry_size] = {config.str(),result.throughput};
+                    }
+                } else {
+                    std::string loaded = config.str() + " load=" + std::to_string(load);
+                    if (!best_p99.contains(entry_size) || result.p99_ns < best_p99[entry_size].value) {
+                        best_p99[entry_size] = {loaded,static_cast<double>(result.p99_ns)};
+                    }
+                }
+            }
+
+            std::cerr << "Summary" << std::endl;
+            std::cerr << "=======" << std::endl;
+            for (auto entry_size: entry_sizes) {
+                if (best_throughput.contains(entry_size)) {
+                    std::cerr << entry_size << " bytes, best throughput " << static_cast<uint64_t>(best_throughput[entry_size].value)
+                              << " msgs/sec: " << best_throughput[entry_size].config << std::endl;
+                }
+                if (best_p99.contains(entry_size)) {
+                    std::cerr << entry_size << " bytes, best p99 latency " << static_cast<uint64_t>(best_p99[entry_size].value)
+                              << " ns: " << best_p99[entry_size].config << std::endl;
+                }
+            }
+        }
+    },
+    {"ringbuffer","scale",
+        [](const Properties& props) {
+            auto to_numbers = [](const std::string& list) {
+                std::vector<uint32_t> numbers;
+                for (auto& item: split_list(list)) {
+                    numbers.push_back(std::stoul(item,nullptr,0));
+                }
+                return numbers;
+            };
+            std::vector<uint32_t> producer_counts = to_numbers(PCONTAINS(props,"producers") ?
+                                                               props.at("producers") : "1,2,4");
+            std::vector<uint32_t> consumer_counts = to_numbers(PCONTAINS(props,"consumers") ?
+                                                               props.at("consumers") : "1,2,4");
+            std::string placement = PCONTAINS(props,"placement") ? props.at("placement") : "none";
+            uint32_t capacity = PCONTAINS(props,"capacity") ? std::stoul(props.at("capacity"),nullptr,0) : 4096;
+            uint16_t entry_size = PCONTAINS(props,"entry_size") ? std::stoul(props.at("entry_size"),nullptr,0) : 64;
+            uint64_t count = PCONTAINS(props,"count") ? std::stoull(props.at("count"),nullptr,0) : 100000;
+            key_t fixed_key = PCONTAINS(props,"key") ? static_cast<key_t>(std::stol(props.at("key"),nullptr,0)) : 0;
+            if (fixed_key != 0) {
+                entry_size = wsong::ipc::RingBuffer::get_ring_buffer(fixed_key)->attribute().entry_size;
+            }
+            if (entry_size < 16) {
+                throw wsong::ws_exp("scale needs entry_size >= 16, but it is " + std::to_string(entry_size));
+            }
+
+            // per-process results in shared memory
+            struct process_result {
+                uint64_t    messages;
+                uint64_t    elapsed_ns;
+                uint64_t    p50_ns;
+                uint64_t    p99_ns;
+            };
+            struct scale_state {
+                std::atomic<uint64_t>   received;
+                process_result          results[];
+            };
+
+            std::cout << "producers,consumers,placement,throughput,producer_fairness,consumer_fairness,"
+                         "consumer_p50_ns,consumer_p99_ns" << std::endl;
+            std::random_device rd;
+            for (auto producers: producer_counts)
+            for (auto consumers: consumer_counts) {
+                if (producers == 0 || consumers == 0) {
+                    continue;
+                }
+                key_t key = fixed_key;
+                if (key == 0) {
+                    wsong::ipc::RingBufferAttribute attribute = {
+                        .key        = static_cast<key_t>(rd() & 0x7fffffff),
+                        .id         = 0,
+                        .page_size  = 4096,
+                        .capacity   = capacity,
+                        .entry_size = entry_size,
+                        .multiple_consumer  = (consumers > 1),
+                        .multiple_producer  = (producers > 1),
+                        .trace_context      = false,
+                        .description    = "ipc_cli scale",
+                    };
+                    key = wsong::ipc::RingBuffer::create_ring_buffer(attribute);
+                } else {
+                    auto attr = wsong::ipc::RingBuffer::get_ring_buffer(key)->attribute();
+                    if ((producers > 1 && !attr.multiple_producer) || (consumers > 1 && !attr.multiple_consumer)) {
+                        std::cerr << "Skipping " << producers << "x" << consumers
+                                  << ": the ring buffer does not support it." << std::endl;
+                        continue;
+                    }
+                }
+
+                std::vector<int> producer_cpus, consumer_cpus;
+                assign_cpus(placement,producers,consumers,producer_cpus,consumer_cpus);
+
+                const size_t state_size = sizeof(scale_state) + (producers + consumers) * sizeof(process_result);
+                auto* state = reinterpret_cast<scale_state*>(mmap(nullptr,state_size,PROT_READ|PROT_WRITE,
+                                                                  MAP_SHARED|MAP_ANONYMOUS,-1,0));
+                if (state == MAP_FAILED) {
+                    throw wsong::ws_exp(std::string("mmap failed with error:") + std::strerror(errno));
+                }
+                const uint64_t total = count * producers;
+
+                auto start = steady_clock::now();
+                std::vector<pid_t> children;
+                for (uint32_t c = 0; c < consumers; c++) {
+                    pid_t pid = fork();
+                    if (pid == 0) {
+                        pin_to_cpu(consumer_cpus[c]);
+                        auto rb = wsong::ipc::RingBuffer::get_ring_buffer(key);
+                        std::vector<uint8_t> msg(entry_size);
+                        std::vector<uint64_t> latencies;
+                        latencies.reserve(total);
+                        auto begin = steady_clock::now();
+                        auto last_receive = begin;
+                        while (state->received.load(std::memory_order_relaxed) < total) {
+                            try {
+                                rb->consume(msg.data(),entry_size,10ms);
+                            } catch (const wsong::ws_timeout_exp&) {
+                                if (steady_clock::now() - last_receive > 5s) {
+                                    break;
+                                }
+                                continue;
+                            }
+                            last_receive = steady_clock::now();
+                            latencies.push_back(duration_cast<nanoseconds>(last_receive.time_since_epoch()).count()
+                                                - *reinterpret_cast<uint64_t*>(msg.data()));
+                            state->received.fetch_add(1,std::memory_order_relaxed);
+                        }
+                        process_result& result = state->results[producers + c];
+                        result.messages     = latencies.size();
+                        result.elapsed_ns   = duration_cast<nanoseconds>(last_receive - begin).count();
+                        if (latencies.size() > 0) {
+                            std::sort(latencies.begin(),latencies.end());
+                            result.p50_ns   = latencies[latencies.size()/2];
+                            result.p99_ns   = latencies[latencies.size()*99/100];
+                        }
+                        _exit(0);
+                    }
+                    children.push_back(pid);
+                }
+                for (uint32_t p = 0; p < producers; p++) {
+                    pid_t pid = fork();
+                    if (pid == 0) {
+                        pin_to_cpu(producer_cpus[p]);
+                        auto rb = wsong::ipc::RingBuffer::get_ring_buffer(key);
+                        std::vector<uint8_t> msg(entry_size,0);
+                        auto begin = steady_clock::now();
+                        for (uint64_t i = 0; i < count; i++) {
+                            *reinterpret_cast<uint64_t*>(msg.data()) =
+                                duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+                            rb->produce(msg.data(),entry_size,1min);
+                        }
+                        state->results[p].messages   = count;
+                        state->results[p].elapsed_ns = duration_cast<nanoseconds>(steady_clock::now() - begin).count();
+                        _exit(0);
+                    }
+                    children.push_back(pid);
+                }
+                for (auto pid: children) {
+                    waitpid(pid,nullptr,0);
+                }
+                const double seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1e9;
+
+                std::vector<double> producer_rates, consumer_shares, p50s, p99s;
+                for (uint32_t p = 0; p < producers; p++) {
+                    producer_rates.push_back(state->results[p].elapsed_ns == 0 ? 0.0 :
+                                             state->results[p].messages * 1e9 / state->results[p].elapsed_ns);
+                }
+                for (uint32_t c = 0; c < consumers; c++) {
+                    const process_result& result = state->results[producers + c];
+                    consumer_shares.push_back(result.messages);
+                    p50s.push_back(result.p50_ns);
+                    p99s.push_back(result.p99_ns);
+                }
+                const uint64_t received = state->received.load();
+                munmap(state,state_size);
+                if (fixed_key == 0) {
+                    wsong::ipc::RingBuffer::delete_ring_buffer(key);
+                }
+
+                auto join = [](const std::vector<double>& values) {
+                    std::ostringstream oss;
+                    for (size_t i = 0; i < values.size(); i++) {
+                        oss << (i ? ";" : "") << static_cast<uint64_t>(values[i]);
+                    }
+                    return oss.str();
+                };
+                std::cout << producers << "," << consumers << "," << placement << ","
+                          << static_cast<uint64_t>(received / seconds) << ","
+                          << jain_fairness(producer_rates) << "," << jain_fairness(consumer_shares) << ","
+                          << join(p50s) << "," << join(p99s) << std::endl;
+                if (received != total) {
+                    std::cerr << "Warning: " << (total - received) << " messages were not received." << std::endl;
+                }
+            }
+        }
+    },
+    {"ringbuffer","relay",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory 'key' property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+
+            if (!PCONTAINS(props,"nodes")) {
+                throw wsong::ws_exp("Mandatory 'nodes' property is not found. Please specify it using '-p nodes=<n1,n2,...>'");
+            }
+            std::vector<wsong::ipc::RingRelayTarget> targets;
+            for (auto& node: split_list(props.at("nodes"))) {
+                targets.push_back({std::stoi(node),0});
+            }
+            if (PCONTAINS(props,"keys")) {
+                auto keys = split_list(props.at("keys"));
+                for (size_t i = 0; i < keys.size() && i < targets.size(); i++) {
+                    targets[i].key = static_cast<key_t>(std::stol(keys[i],nullptr,0));
+                }
+            }
+
+            uint32_t batch = 64;
+            if (PCONTAINS(props,"batch")) {
+                batch = std::stoul(props.at("batch"),nullptr,0);
+            }
+
+            uint64_t interval_ms = 1000;
+            if (PCONTAINS(props,"interval")) {
+                interval_ms = std::stoul(props.at("interval"),nullptr,0);
+            }
+
+            wsong::ipc::RingRelay relay(key,targets,batch);
+            for (auto& s: relay.stats()) {
+                std::cout << "Relaying to NUMA node " << s.numa_node
+                          << " with ring buffer key = 0x" << std::hex << s.key << std::dec << std::endl;
+            }
+
+            std::atomic<bool> stop = false;
+            std::thread reporter(
+                [&relay,&stop,interval_ms] () {
+                    while (!stop.load()) {
+                        std::this_thread::sleep_for(milliseconds(interval_ms));
+                        for (auto& s: relay.stats()) {
+                            std::cerr << "node " << s.numa_node << ": relayed=" << s.relayed
+                                      << " batches=" << s.batches << " lag=" << s.lag << std::endl;
+                        }
+                    }
+                });
+            std::cerr << "Press Enter to Finish." << std::endl;
+            std::cin.get();
+            stop.store(true);
+            reporter.join();
+            relay.stop();
+            for (auto& s: relay.stats()) {
+                wsong::ipc::RingBuffer::delete_ring_buffer(s.key);
+            }
+        }
+    },
+    {"ringbuffer","merge",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"keys")) {
+                throw wsong::ws_exp("Mandatory 'keys' property is not found. Please specify it using '-p keys=<k1,k2,...>'");
+            }
+            std::vector<key_t> keys;
+            for (auto& key: split_list(props.at("keys"))) {
+                keys.push_back(static_cast<key_t>(std::stol(key,nullptr,0)));
+            }
+
+            uint16_t offset = 0;
+            if (PCONTAINS(props,"offset")) {
+                offset = static_cast<uint16_t>(std::stoul(props.at("offset"),nullptr,0));
+            }
+
+            uint64_t lateness = WS_MERGE_STRICT;
+            if (PCONTAINS(props,"lateness") && props.at("lateness") != "strict") {
+                lateness = std::stoull(props.at("lateness"),nullptr,0);
+            }
+
+            wsong::ipc::RingMerger merger(keys,offset,lateness);
+            std::atomic<bool> stop = false;
+            std::thread merger_thread(
+                [&merger,&stop] () {
+                    while (!stop.load()) {
+                        merger.poll([](const void*, uint64_t key, uint32_t ring_index) {
+                                        std::cout << ring_index << " " << key << "\n";
+                                    });
+                    }
+                });
+            std::cerr << "Press Enter to Finish." << std::endl;
+            std::cin.get();
+            stop.store(true);
+            merger_thread.join();
+            auto stats = merger.stats();
+            std::cerr << "emitted=" << stats.emitted << " late=" << stats.late
+                      << " watermark=" << stats.watermark << std::endl;
+        }
+    },
+    {"ringbuffer","mergecheck",
+        [](const Properties& props) {
+            const uint64_t count = PCONTAINS(props,"count") ? std::stoull(props.at("count"),nullptr,0) : 10;
+            const uint64_t lateness = PCONTAINS(props,"lateness") ? std::stoull(props.at("lateness"),nullptr,0) : 3;
+            if (count == 0 || count > 4096) {
+                throw wsong::ws_exp("count must be in [1,4096].");
+            }
+            std::random_device rd;
+            wsong::ipc::RingBufferAttribute attribute = {
+                .key        = 0,
+                .id         = 0,
+                .page_size  = 4096,
+                .capacity   = 4096,
+                .entry_size = 64,
+                .multiple_consumer  = false,
+                .multiple_producer  = false,
+                .trace_context      = false,
+                .description    = "ipc_cli mergecheck",
+            };
+            std::vector<key_t> keys;
+            for (int i = 0; i < 2; i++) {
+                attribute.key = static_cast<key_t>(rd() & 0x7fffffff);
+                keys.push_back(wsong::ipc::RingBuffer::create_ring_buffer(attribute));
+            }
+            bool passed = true;
+            auto check = [&passed] (const std::string& what, uint64_t value, uint64_t expected) {
+                std::cout << what << ": " << value << (value == expected ? "" : " (expected " +
+                             std::to_string(expected) + ")") << std::endl;
+                passed = passed && value == expected;
+            };
+            try {
+                auto busy = wsong::ipc::RingBuffer::get_ring_buffer(keys[0]);
+                auto idle = wsong::ipc::RingBuffer::get_ring_buffer(keys[1]);
+                uint8_t entry[64] = {0};
+                for (uint64_t key = 1; key <= count; key++) {
+                    std::memcpy(entry,&key,sizeof(key));
+                    busy->produce(entry,sizeof(entry),0);
+                }
+                wsong::ipc::RingMerger merger(keys,0,lateness);
+                uint64_t last = 0;
+                bool ordered = true;
+                auto handler = [&] (const void*, uint64_t key, uint32_t) {
+                    ordered = ordered && key > last;
+                    last = key;
+                };
+                // with the other ring buffer idle, the entries more than `lateness` behind the newest one go out.
+                const uint64_t ready = count > lateness ? count - lateness : 0;
+                check("emitted with an idle ring buffer",merger.poll(handler),ready);
+                check("watermark",merger.stats().watermark,count);
+                // a late entry in the idle ring buffer releases the rest.
+                const uint64_t late = count + lateness;
+                std::memcpy(entry,&late,sizeof(late));
+                idle->produce(entry,sizeof(entry),0);
+                check("emitted after the idle ring buffer publishes",merger.poll(handler),count - ready);
+                check("in key order",ordered,true);
+            } catch (...) {
+                wsong::ipc::RingBuffer::delete_ring_buffer(keys[0]);
+                wsong::ipc::RingBuffer::delete_ring_buffer(keys[1]);
+                throw;
+            }
+            wsong::ipc::RingBuffer::delete_ring_buffer(keys[0]);
+            wsong::ipc::RingBuffer::delete_ring_buffer(keys[1]);
+            std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+            if (!passed) {
+                exit(1);
+            }
+        }
+    },
+    {"ringbuffer","monitor",
+        [](const Properties& props) {
+            std::vector<key_t> keys;
+            if (!PCONTAINS(props,"keys") || props.at("keys") == "all") {
+                keys = wsong::ipc::RingBuffer::list_ring_buffers();
+            } else {
+                for (auto& key: split_list(props.at("keys"))) {
+                    keys.push_back(static_cast<key_t>(std::stol(key,nullptr,0)));
+                }
+            }
+
+            uint64_t interval_ms = 1000;
+            if (PCONTAINS(props,"interval")) {
+                interval_ms = std::stoul(props.at("interval"),nullptr,0);
+            }
+
+            bool csv = false;
+            if (PCONTAINS(props,"format")) {
+                if (props.at("format") == "csv") {
+                    csv = true;
+                } else if (props.at("format") != "top") {
+                    throw wsong::ws_exp("Unknown format:" + props.at("format"));
+                }
+            }
+
+            uint64_t count = 0;
+            if (PCONTAINS(props,"count")) {
+                count = std::stoul(props.at("count"),nullptr,0);
+            }
+
+            // attach read-only, so that sampling never writes to the ring buffer cachelines.
+            struct monitored_ring {
+                std::unique_ptr<wsong::ipc::RingBuffer> ring;
+                wsong::ipc::RingBufferAttribute         attribute;
+                wsong::ipc::RingBufferStats             last;
+            };
+            std::vector<monitored_ring> rings;
+            for (auto key: keys) {
+                auto ring = wsong::ipc::RingBuffer::get_ring_buffer(key,true);
+                auto attribute = ring->attribute();
+                auto last = ring->stats();
+                rings.push_back({std::move(ring),attribute,last});
+            }
+
+            if (csv) {
+                std::cout << "timestamp_ns,key,head,tail,occupancy,produce_rate,consume_rate,lag_us,"
+                             "full_stalls,empty_stalls" << std::endl;
+            }
+            auto last_time = steady_clock::now();
+            for (uint64_t sample = 0; count == 0 || sample < count; sample++) {
+                std::this_thread::sleep_for(milliseconds(interval_ms));
+                auto now = steady_clock::now();
+                const double seconds = duration_cast<nanoseconds>(now - last_time).count() / 1e9;
+                last_time = now;
+                if (!csv) {
+                    std::cout << "\033[H\033[2J"
+                              << std::left << std::setw(12) << "key"
+                              << std::right << std::setw(12) << "occupancy"
+                              << std::setw(8)  << "occ%"
+                              << std::setw(14) << "produce/s"
+                              << std::setw(14) << "consume/s"
+                              << std::setw(12) << "lag(us)"
+                              << std::setw(12) << "full/s"
+                              << std::setw(12) << "empty/s"
+                              << "  description" << std::endl;
+                }
+                for (auto& mr: rings) {
+                    auto stats = mr.ring->stats();
+                    const uint32_t occupancy    = stats.tail - stats.head;
+                    const double produce_rate   = (stats.tail - mr.last.tail) / seconds;
+                    const double consume_rate   = (stats.head - mr.last.head) / seconds;
+                    const double lag_us         = (occupancy == 0) ? 0.0 :
+                                                  (consume_rate > 0 ? occupancy / consume_rate * 1e6 : -1.0);
+                    const double full_rate      = (stats.full_stalls - mr.last.full_stalls) / seconds;
+                    const double empty_rate     = (stats.empty_stalls - mr.last.empty_stalls) / seconds;
+                    if (csv) {
+                        std::cout << duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count()
+                                  << ",0x" << std::hex << mr.attribute.key << std::dec
+                                  << "," << stats.head << "," << stats.tail << "," << occupancy
+                                  << "," << produce_rate << "," << consume_rate << "," << lag_us
+                                  << "," << stats.full_stalls << "," << stats.empty_stalls << std::endl;
+                    } else {
+                        std::ostringstream key_str;
+                        key_str << "0x" << std::hex << mr.attribute.key;
+                        std::cout << std::left << std::setw(12) << key_str.str()
+                                  << std::right << std::setw(12) << occupancy
+                                  << std::setw(8)  << std::fixed << std::setprecision(1)
+                                  << (100.0 * occupancy / (mr.attribute.capacity - 1))
+                                  << std::setw(14) << std::setprecision(0) << produce_rate
+                                  << std::setw(14) << consume_rate
+                                  << std::setw(12) << std::setprecision(1) << lag_us
+                                  << std::setw(12) << std::setprecision(0) << full_rate
+                                  << std::setw(12) << empty_rate
+                                  << "  " << mr.attribute.description << std::endl;
+                    }
+                    mr.last = stats;
+                }
+            }
+        }
+    },
+    {"ringbuffer","logcat",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            const size_t batch = PCONTAINS(props,"batch") ? std::stoul(props.at("batch"),nullptr,0) : 1024;
+            const uint64_t interval_us = PCONTAINS(props,"interval") ?
+                                         std::stoull(props.at("interval"),nullptr,0) : 1000;
+            std::ofstream outfile;
+            if (PCONTAINS(props,"output")) {
+                outfile.open(props.at("output"),std::ios::app);
+                if (!outfile.is_open()) {
+                    throw wsong::ws_exp("Failed to open " + props.at("output"));
+                }
+            }
+            std::ostream& out = outfile.is_open() ? outfile : std::cout;
+
+            wsong::ipc::RingLogReader reader(key);
+            while (true) {
+                if (reader.poll(out,batch) == 0) {
+                    out.flush();
+                    std::this_thread::sleep_for(microseconds(interval_us));
+                }
+            }
+        }
+    },
+    {"ringbuffer","bridge",
+        [](const Properties& props) {
+            const std::string role = PCONTAINS(props,"role") ? props.at("role") : "loopback";
+            if (role != "send" && role != "receive" && role != "loopback") {
+                throw wsong::ws_exp("Unknown role:" + role);
+            }
+            wsong::ipc::RingBridgeAttribute attribute = {
+                .protocol           = wsong::ipc::WS_BRIDGE_TCP,
+                .address            = {'\0'},
+                .port               = static_cast<uint16_t>(role == "loopback" ? 0 : 9000),
+                .max_batch          = 256,
+                .latency_budget_ns  = 50000,
+                .max_datagram       = 1472,
+            };
+            if (PCONTAINS(props,"protocol")) {
+                if (props.at("protocol") == "udp") {
+                    attribute.protocol = wsong::ipc::WS_BRIDGE_UDP;
+                } else if (props.at("protocol") != "tcp") {
+                    throw wsong::ws_exp("Unknown protocol:" + props.at("protocol"));
+                }
+            }
+            std::string address = (role == "receive") ? "" : "127.0.0.1";
+            if (PCONTAINS(props,"address")) {
+                address = props.at("address");
+            }
+            if (address.size() >= sizeof(attribute.address)) {
+                throw wsong::ws_exp("Address is too long:" + address);
+            }
+            std::memcpy(attribute.address,address.c_str(),address.size() + 1);
+            if (PCONTAINS(props,"port")) {
+                attribute.port = static_cast<uint16_t>(std::stoul(props.at("port"),nullptr,0));
+            }
+            if (PCONTAINS(props,"batch")) {
+                attribute.max_batch = std::stoul(props.at("batch"),nullptr,0);
+            }
+            if (PCONTAINS(props,"budget")) {
+                attribute.latency_budget_ns = std::stoull(props.at("budget"),nullptr,0) * 1000;
+            }
+            if (PCONTAINS(props,"datagram")) {
+                attribute.max_datagram = std::stoul(props.at("datagram"),nullptr,0);
+            }
+            const uint64_t interval_ms = PCONTAINS(props,"interval") ? std::stoull(props.at("interval"),nullptr,0) : 1000;
+
+            auto print_latency = [](const char* hop, const wsong::ipc::RingBridgeLatency& l) {
+                std::cerr << " " << hop << "(p50/p99/max ns)=" << l.p50_ns << "/" << l.p99_ns << "/" << l.max_ns;
+            };
+            auto print_stats = [&print_latency](const char* side, wsong::ipc::RingBridgeBase& bridge) {
+                auto s = bridge.stats();
+                std::cerr << side << ": messages=" << s.messages << " batches=" << s.batches
+                          << " avg_batch=" << (s.batches ? s.messages / s.batches : 0);
+                if (std::string(side) == "sender") {
+                    std::cerr << " batch_target=" << s.batch_target;
+                    print_latency("ring_to_wire",s.ring_to_wire);
+                } else {
+                    std::cerr << " lost=" << s.lost;
+                    print_latency("ring_to_wire",s.ring_to_wire);
+                    print_latency("wire_to_ring",s.wire_to_ring);
+                    print_latency("end_to_end",s.end_to_end);
+                }
+                if (!bridge.error().empty()) {
+                    std::cerr << " error=" << bridge.error();
+                }
+                std::cerr << std::endl;
+            };
+
+            if (role != "loopback") {
+                if (!PCONTAINS(props,"key")) {
+                    throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+                }
+                const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+                std::unique_ptr<wsong::ipc::RingBridgeBase> bridge;
+                if (role == "send") {
+                    bridge = std::make_unique<wsong::ipc::RingBridgeSender>(key,attribute);
+                } else {
+                    auto receiver = std::make_unique<wsong::ipc::RingBridgeReceiver>(key,attribute);
+                    std::cerr << "Listening on port " << receiver->port() << std::endl;
+                    bridge = std::move(receiver);
+                }
+                std::atomic<bool> stop = false;
+                std::thread reporter(
+                    [&] () {
+                        while (!stop.load()) {
+                            std::this_thread::sleep_for(milliseconds(interval_ms));
+                            print_stats(role == "send" ? "sender" : "receiver",*bridge);
+                        }
+                    });
+                std::cerr << "Press Enter to Finish." << std::endl;
+                std::cin.get();
+                stop.store(true);
+                reporter.join();
+                bridge->stop();
+                return;
+            }
+
+            // loopback: producer -> source ring -> sender -> socket -> receiver -> target ring -> consumer
+            const uint32_t capacity = PCONTAINS(props,"capacity") ? std::stoul(props.at("capacity"),nullptr,0) : 4096;
+            const uint16_t entry_size = PCONTAINS(props,"entry_size") ?
+                                        std::stoul(props.at("entry_size"),nullptr,0) : 64;
+            const uint64_t count = PCONTAINS(props,"count") ? std::stoull(props.at("count"),nullptr,0) : 1000000;
+            const uint64_t rate = PCONTAINS(props,"rate") ? std::stoull(props.at("rate"),nullptr,0) : 0;
+            if (entry_size < sizeof(uint64_t)) {
+                throw wsong::ws_exp("Entry size must be at least 8 bytes for the timestamps.");
+            }
+            std::random_device rd;
+            wsong::ipc::RingBufferAttribute rb_attribute = {
+                .key        = 0,
+                .id         = 0,
+                .page_size  = 4096,
+                .capacity   = capacity,
+                .entry_size = entry_size,
+                .multiple_consumer  = false,
+                .multiple_producer  = false,
+                .trace_context      = false,
+                .description    = "ipc_cli bridge loopback",
+            };
+            rb_attribute.key = static_cast<key_t>(rd() & 0x7fffffff);
+            const key_t source_key = wsong::ipc::RingBuffer::create_ring_buffer(rb_attribute);
+            rb_attribute.key = static_cast<key_t>(rd() & 0x7fffffff);
+            const key_t target_key = wsong::ipc::RingBuffer::create_ring_buffer(rb_attribute);
+
+            std::vector<uint64_t> latencies;
+            latencies.reserve(count);
+            uint64_t elapsed_ns = 0;
+            {
+                wsong::ipc::RingBridgeReceiver receiver(target_key,attribute);
+                attribute.port = receiver.port();
+                wsong::ipc::RingBridgeSender sender(source_key,attribute);
+
+                auto realtime = []() {
+                    return static_cast<uint64_t>(duration_cast<nanoseconds>(
+                                system_clock::now().time_since_epoch()).count());
+                };
+                std::thread consumer(
+                    [&] () {
+                        auto rb = wsong::ipc::RingBuffer::get_ring_buffer(target_key);
+                        std::vector<uint8_t> msg(entry_size);
+                        uint64_t deadline = realtime() + 60000000000ull;
+                        for (uint64_t i = 0; i < count; i++) {
+                            try {
+                                rb->consume(msg.data(),entry_size,deadline - std::min(deadline,realtime()));
+                            } catch (const wsong::ws_timeout_exp&) {
+                                // lost over UDP
+                                break;
+                            }
+                            uint64_t ts;
+                            std::memcpy(&ts,msg.data(),sizeof(ts));
+                            latencies.push_back(realtime() - ts);
+                            deadline = realtime() + 1000000000ull;
+                        }
+                    });
+                auto rb = wsong::ipc::RingBuffer::get_ring_buffer(source_key);
+                std::vector<uint8_t> msg(entry_size,0);
+                const uint64_t start = realtime();
+                for (uint64_t i = 0; i < count; i++) {
+                    if (rate > 0) {
+                        const uint64_t due = start + i * 1000000000ull / rate;
+                        while (realtime() < due) {}
+                    }
+                    const uint64_t ts = realtime();
+                    std::memcpy(msg.data(),&ts,sizeof(ts));
+                    rb->produce(msg.data(),entry_size,1min);
+                }
+                consumer.join();
+                elapsed_ns = realtime() - start;
+                print_stats("sender",sender);
+                print_stats("receiver",receiver);
+            }
+            wsong::ipc::RingBuffer::delete_ring_buffer(source_key);
+            wsong::ipc::RingBuffer::delete_ring_buffer(target_key);
+
+            std::sort(latencies.begin(),latencies.end());
+            std::cout << "messages:     " << latencies.size() << "/" << count << std::endl;
+            std::cout << "throughput:   " << static_cast<uint64_t>(latencies.size() * 1e9 / elapsed_ns) << " msg/s"
+                      << std::endl;
+            if (!latencies.empty()) {
+                std::cout << "latency(ns):  p50=" << latencies[latencies.size()/2]
+                          << " p99=" << latencies[latencies.size()*99/100]
+                          << " max=" << latencies.back() << std::endl;
+            }
+        }
+    },
+    {"ringbuffer","message",
+        [](const Properties& props) {
+            using layout = wsong::ipc::MessageLayout<cli_quote>;
+            const uint32_t capacity = PCONTAINS(props,"capacity") ? std::stoul(props.at("capacity"),nullptr,0) : 4096;
+            const uint16_t entry_size = PCONTAINS(props,"entry_size") ?
+                                        std::stoul(props.at("entry_size"),nullptr,0) : 64;
+            const size_t venues = PCONTAINS(props,"venues") ? std::stoull(props.at("venues"),nullptr,0) : 4;
+            const uint64_t count = PCONTAINS(props,"count") ? std::stoull(props.at("count"),nullptr,0) : 10000000;
+
+            std::srand(static_cast<unsigned>(time(nullptr)));
+            wsong::ipc::RingBufferAttribute attribute = {
+                .key                = static_cast<key_t>(rand()),
+                .id                 = 0,
+                .page_size          = 4096,
+                .capacity           = capacity,
+                .entry_size         = entry_size,
+                .multiple_consumer  = false,
+                .multiple_producer  = false,
+                .trace_context      = false,
+                .description        = "ringbuffer message",
+            };
+            wsong::ipc::MessageRing<cli_quote>::describe(attribute);
+            if (layout::fixed_size + venues * sizeof(uint16_t) > attribute.entry_size) {
+                throw wsong::ws_invalid_argument_exp("The entry size " + std::to_string(attribute.entry_size) +
+                                                     " cannot hold " + std::to_string(venues) + " venues.");
+            }
+            const key_t key = wsong::ipc::RingBuffer::create_ring_buffer(attribute);
+            std::cout << "ring buffer " << key << ": \"" << attribute.description << "\", entry size "
+                      << attribute.entry_size << ", message " << layout::fixed_size << " + "
+                      << venues * sizeof(uint16_t) << " Bytes" << std::endl;
+            const uint32_t batch = capacity / 2;
+            try {
+                // copy: the struct a producer fills and produce()s, and the consumer consume()s.
+                struct quote_t {
+                    uint64_t    seq;
+                    char        symbol[8];
+                    double      price;
+                    uint32_t    quantity;
+                    uint16_t    num_venues;
+                    uint16_t    venues[];
+                };
+                const uint16_t copy_size = static_cast<uint16_t>(sizeof(quote_t) + venues * sizeof(uint16_t));
+                std::vector<uint64_t> in(attribute.entry_size / sizeof(uint64_t) + 1), out(in.size());
+                quote_t* quote = reinterpret_cast<quote_t*>(in.data());
+                const quote_t* received = reinterpret_cast<const quote_t*>(out.data());
+                auto rbptr = wsong::ipc::RingBuffer::get_ring_buffer(key);
+                uint64_t copy_sum = 0;
+                auto start = steady_clock::now();
+                for (uint64_t seq = 0; seq < count;) {
+                    const uint64_t end = std::min<uint64_t>(seq + batch,count);
+                    for (uint64_t i = seq; i < end; i++) {
+                        quote->seq = i;
+                        std::memcpy(quote->symbol,"WSONG",6);
+                        quote->price = static_cast<double>(i);
+                        quote->quantity = static_cast<uint32_t>(i);
+                        quote->num_venues = static_cast<uint16_t>(venues);
+                        for (size_t v = 0; v < venues; v++) {
+                            quote->venues[v] = static_cast<uint16_t>(v);
+                        }
+                        rbptr->produce(quote,copy_size,1s);
+                    }
+                    for (; seq < end; seq++) {
+                        rbptr->consume(out.data(),copy_size,1s);
+                        copy_sum += received->seq + received->quantity + received->num_venues;
+                    }
+                }
+                const double copy_ns = duration_cast<nanoseconds>(steady_clock::now() - start).count() /
+                                       static_cast<double>(count);
+                rbptr.reset();
+
+                // in place
+                wsong::ipc::MessageRing<cli_quote> ring(key);
+                uint64_t view_sum = 0;
+                start = steady_clock::now();
+                for (uint64_t seq = 0; seq < count;) {
+                    const uint64_t end = std::min<uint64_t>(seq + batch,count);
+                    for (uint64_t i = seq; i < end; i++) {
+                        auto builder = ring.reserve(1s);
+                        builder.set<cli_quote::seq>(i);
+                        std::memcpy(builder.field<cli_quote::symbol>(),"WSONG",6);
+                        builder.set<cli_quote::price>(static_cast<double>(i));
+                        builder.set<cli_quote::quantity>(static_cast<uint32_t>(i));
+                        uint16_t* tail = builder.tail<cli_quote::venues>(venues);
+                        for (size_t v = 0; v < venues; v++) {
+                            tail[v] = static_cast<uint16_t>(v);
+                        }
+                        if (i + 1 == end) {
+                            ring.publish(builder);
+                        }
+                    }
+                    for (; seq < end; seq++) {
+                        auto view = ring.next(1s);
+                        view_sum += view.get<cli_quote::seq>() + view.get<cli_quote::quantity>() +
+                                    view.tail<cli_quote::venues>().size();
+                        if (seq + 1 == end) {
+                            ring.release(view);
+                        }
+                    }
+                }
+                const double view_ns = duration_cast<nanoseconds>(steady_clock::now() - start).count() /
+                                       static_cast<double>(count);
+
+                std::cout << "copy:     " << copy_ns << " ns/message" << std::endl;
+                std::cout << "in place: " << view_ns << " ns/message" << std::endl;
+                if (copy_sum != view_sum) {
+                    throw wsong::ws_exp("message test FAILED: the checksums differ.");
+                }
+                try {
+                    wsong::ipc::MessageRing<cli_quote_v2> mismatch(key);
+                    throw wsong::ws_exp("message test FAILED: schema cli.quote/2 attached.");
+                } catch (const wsong::ws_invalid_argument_exp& ex) {
+                    std::cout << "attach with cli.quote/2 rejected: " << ex.what() << std::endl;
+                }
+            } catch (...) {
+                wsong::ipc::RingBuffer::delete_ring_buffer(key);
+                throw;
+            }
+            wsong::ipc::RingBuffer::delete_ring_buffer(key);
+        }
+    },
+    {"ringbuffer","trace",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"files")) {
+                throw wsong::ws_exp("Mandatory files property is not found. Please specify it using '-p files=<logs>'");
+            }
+            const uint64_t paths = PCONTAINS(props,"paths") ? std::stoull(props.at("paths"),nullptr,0) : 0;
+
+            // the trace events of all processes, by trace id.
+            struct trace_event_t {
+                bool        produce;
+                uint64_t    ts_ns;
+                uint32_t    ring;
+                uint32_t    hop;
+                uint64_t    parent_ns;
+            };
+            std::map<uint64_t,std::vector<trace_event_t>> traces;
+            std::stringstream files(props.at("files"));
+            std::string file;
+            while (std::getline(files,file,',')) {
+                std::ifstream infile(file);
+                if (!infile.is_open()) {
+                    throw wsong::ws_exp("Failed to open " + file);
+                }
+                std::string line;
+                while (std::getline(infile,line)) {
+                    if (line.empty() || line[0] == '#') {
+                        continue;
+                    }
+                    std::istringstream fields(line);
+                    uint64_t tag, ts_ns, trace_id, ring, hop, parent_ns;
+                    if (!(fields >> tag >> ts_ns >> trace_id >> ring >> hop >> parent_ns) ||
+                        (tag != WS_RING_TRACE_PRODUCE_TAG && tag != WS_RING_TRACE_CONSUME_TAG)) {
+                        continue;
+                    }
+                    traces[trace_id].push_back({tag == WS_RING_TRACE_PRODUCE_TAG,ts_ns,static_cast<uint32_t>(ring),
+                                                static_cast<uint32_t>(hop),parent_ns});
+                }
+            }
+
+            // queue: produce to consume on a hop; stage: consume of the previous hop to produce in the process.
+            std::map<std::pair<uint32_t,uint32_t>,std::vector<int64_t>> queue_latency, stage_latency;
+            std::vector<int64_t> end_to_end;
+            uint64_t printed = 0;
+            for (auto& [trace_id,events]: traces) {
+                std::sort(events.begin(),events.end(),[](const trace_event_t& a, const trace_event_t& b) {
+                    return std::tie(a.hop,b.produce,a.ts_ns) < std::tie(b.hop,a.produce,b.ts_ns);
+                });
+                std::ostringstream path;
+                path << "0x" << std::hex << trace_id << std::dec << ":";
+                const trace_event_t* last_consume = nullptr;
+                for (const auto& event: events) {
+                    if (event.produce) {
+                        if (last_consume != nullptr && last_consume->hop + 1 == event.hop) {
+                            const int64_t latency = static_cast<int64_t>(event.ts_ns - last_consume->ts_ns);
+                            stage_latency[{event.hop,event.ring}].push_back(latency);
+                            path << " -(" << latency << "ns)-";
+                        }
+                        path << " ring 0x" << std::hex << event.ring << std::dec;
+                    } else {
+                        const int64_t latency = static_cast<int64_t>(event.ts_ns - event.parent_ns);
+                        queue_latency[{event.hop,event.ring}].push_back(latency);
+                        path << " [" << latency << "ns]";
+                        last_consume = &event;
+                    }
+                }
+                if (last_consume != nullptr && events.front().produce && events.front().hop == 0) {
+                    end_to_end.push_back(static_cast<int64_t>(last_consume->ts_ns - events.front().ts_ns));
+                }
+                if (printed < paths) {
+                    std::cout << path.str() << std::endl;
+                    printed ++;
+                }
+            }
+
+            auto print_latency = [](std::vector<int64_t>& latency) {
+                if (latency.empty()) {
+                    std::cout << std::setw(10) << "-" << std::setw(10) << "-" << std::setw(10) << "-";
+                    return;
+                }
+                std::sort(latency.begin(),latency.end());
+                std::cout << std::setw(10) << latency[latency.size()/2]
+                          << std::setw(10) << latency[latency.size()*99/100]
+                          << std::setw(10) << latency.back();
+            };
+            std::cout << "traces:       " << traces.size() << std::endl;
+            std::cout << std::setw(4) << "hop" << std::setw(12) << "ring" << std::setw(10) << "messages"
+                      << std::setw(30) << "queue p50/p99/max (ns)" << std::setw(30) << "stage p50/p99/max (ns)"
+                      << std::endl;
+            for (auto& [hop_ring,latency]: queue_latency) {
+                std::ostringstream ring;
+                ring << "0x" << std::hex << hop_ring.second;
+                std::cout << std::setw(4) << hop_ring.first << std::setw(12) << ring.str()
+                          << std::setw(10) << latency.size();
+                print_latency(latency);
+                print_latency(stage_latency[hop_ring]);
+                std::cout << std::endl;
+            }
+            std::cout << "end-to-end p50/p99/max (ns): ";
+            print_latency(end_to_end);
+            std::cout << " over " << end_to_end.size() << " messages" << std::endl;
+        }
+    },
+    {"ringpool","more",
+        [](const Properties& props) {
+            std::string command = "more";
+            if (props.find("command")!=props.cend()) {
+                command = props.at("command");
+            }
+            std::string more_string;
+            if (command == "more") {
+                more_string =   "Properties:\n"
+                                "command:=more|show|create|delete [more]\n";
+            } else if (command == "show" || command == "delete") {
+                more_string =   "Properties:\n"
+                                "key:=<ring pool key>\n";
+            } else if (command == "create") {
+                more_string =   "Properties:\n"
+                                "key:=<key value>\n"
+                                "page_size:=4K|2M|1G [2M]\n"
+                                "num_rings:=<# of ring buffers in the pool> [1024]\n"
+                                "capacity:=<capacity as # of entries per ring buffer>, must be power-of-two [64]\n"
+                                "entry_size:=<size in bytes>, must be power-of-two and smaller than 64KB [64]\n"
+                                "description:=<desc string>, less than 255 characters [""]\n";
+            } else {
+                more_string =   "Unknown command:" + command + "\n";
+            }
+            std::cout << more_string << std::endl;
+        }
+    },
+    {"ringpool","create",
+        [](const Properties& props) {
+            wsong::ipc::RingPoolAttribute attribute = {
+                .key        = 0,
+                .id         = 0,
+                .page_size  = 1<<21,
+                .num_rings  = 1024,
+                .capacity   = 64,
+                .entry_size = 64,
+                .description    = {'\0'},
+            };
+            if (PCONTAINS(props,"key")) {
+                attribute.key = std::stol(props.at("key"),nullptr,0);
+            }
+            if (attribute.key == 0) {
+                std::srand(static_cast<unsigned>(time(nullptr)));
+                attribute.key = static_cast<key_t>(rand());
+            }
+            if (PCONTAINS(props,"page_size")) {
+                std::string pss = props.at("page_size");
+                if (pss == "4K") {
+                    attribute.page_size = 1<<12;
+                } else if (pss == "1G") {
+                    attribute.page_size = 1<<30;
+                } else if (pss.size() > 0 && pss != "2M") {
+                    throw wsong::ws_exp("Unknown page size:" + pss);
+                }
+            }
+            if (PCONTAINS(props,"num_rings")) {
+                attribute.num_rings = std::stoul(props.at("num_rings"));
+            }
+            if (PCONTAINS(props,"capacity")) {
+                attribute.capacity = std::stoul(props.at("capacity"));
+            }
+            if (PCONTAINS(props,"entry_size")) {
+                attribute.entry_size = std::stoul(props.at("entry_size"));
+            }
+            if (PCONTAINS(props,"description")) {
+                auto desc = props.at("description");
+                if (desc.size() <= 255) {
+                    std::memcpy(attribute.description,desc.c_str(),desc.size());
+                } else {
+                    throw wsong::ws_exp("Description is too long. 255 max characters allowed.");
+                }
+            }
+
+            auto key = wsong::ipc::RingPool::create_ring_pool(attribute);
+
+            std::cout << "A ring pool is created with key = 0x" << std::hex << key << std::endl;
+        }
+    },
+    {"ringpool","show",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            auto ring_pool_ptr = wsong::ipc::RingPool::get_ring_pool(key);
+            auto attribute = ring_pool_ptr->attribute();
+            std::cout << "key:          0x" << std::hex << attribute.key << std::dec << std::endl;
+            std::cout << "id:           "   << attribute.id << std::endl;
+            std::cout << "page_size:    "   << attribute.page_size/1024 << " KB" << std::endl;
+            std::cout << "num_rings:    "   << attribute.num_rings << std::endl;
+            std::cout << "capacity:     "   << attribute.capacity << std::endl;
+            std::cout << "entry_size:   "   << attribute.entry_size << " Bytes" << std::endl;
+            std::cout << "description:  "   << attribute.description << std::endl;
+            std::cout << "allocated:    "   << ring_pool_ptr->allocated() << std::endl;
+        }
+    },
+    {"ringpool","delete",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            wsong::ipc::RingPool::delete_ring_pool(key);
+            std::cout << "RingPool with key=0x" << std::hex << key << std::dec << " is deleted." << std::endl;
+        }
+    },
+    {"priorityring","more",
+        [](const Properties& props) {
+            std::string command = "more";
+            if (props.find("command")!=props.cend()) {
+                command = props.at("command");
+            }
+            std::string more_string;
+            if (command == "more") {
+                more_string =   "Properties:\n"
+                                "command:=more|show|create|delete|perf [more]\n";
+            } else if (command == "show" || command == "delete") {
+                more_string =   "Properties:\n"
+                                "key:=<priority ring key>\n";
+            } else if (command == "create") {
+                more_string =   "Properties:\n"
+                                "key:=<key value>\n"
+                                "page_size:=4K|2M|1G [2M]\n"
+                                "num_lanes:=<# of priority lanes, lane 0 is the highest>, up to 64 [2]\n"
+                                "capacity:=<capacity as # of entries per lane>, must be power-of-two [4096]\n"
+                                "entry_size:=<size in bytes>, must be power-of-two and smaller than 64KB [64]\n"
+                                "mp:=<true|false>, support multiple producers per lane [false]\n"
+                                "policy:=strict|weighted [strict]\n"
+                                "weights:=<comma separated weight per lane>, weight 0 means strict priority [1,1,...]\n"
+                                "description:=<desc string>, less than 255 characters [""]\n";
+            } else if (command == "perf") {
+                more_string =   "Properties:\n"
+                                "key:=<priority ring key>\n"
+                                "count:=<# of bulk messages on the last lane> [1000000]\n"
+                                "urgent_every:=<send an urgent message on lane 0 every # of bulk messages> [1000]\n"
+                                "work_ns:=<processing time per message on the consumer side> [100]\n";
+            } else {
+                more_string =   "Unknown command:" + command + "\n";
+            }
+            std::cout << more_string << std::endl;
+        }
+    },
+    {"priorityring","create",
+        [](const Properties& props) {
+            wsong::ipc::PriorityRingAttribute attribute = {
+                .key        = 0,
+                .id         = 0,
+                .page_size  = 1<<21,
+                .num_lanes  = 2,
+                .capacity   = 4096,
+                .entry_size = 64,
+                .multiple_producer  = false,
+                .drain_policy   = wsong::ipc::WS_DRAIN_STRICT,
+                .weights        = {0},
+                .description    = {'\0'},
+            };
+            if (PCONTAINS(props,"key")) {
+                attribute.key = std::stol(props.at("key"),nullptr,0);
+            }
+            if (attribute.key == 0) {
+                std::srand(static_cast<unsigned>(time(nullptr)));
+                attribute.key = static_cast<key_t>(rand());
+            }
+            if (PCONTAINS(props,"page_size")) {
+                std::string pss = props.at("page_size");
+                if (pss == "4K") {
+                    attribute.page_size = 1<<12;
+                } else if (pss == "1G") {
+                    attribute.page_size = 1<<30;
+                } else if (pss.size() > 0 && pss != "2M") {
+                    throw wsong::ws_exp("Unknown page size:" + pss);
+                }
+            }
+            if (PCONTAINS(props,"num_lanes")) {
+                attribute.num_lanes = std::stoul(props.at("num_lanes"));
+            }
+            if (PCONTAINS(props,"capacity")) {
+                attribute.capacity = std::stoul(props.at("capacity"));
+            }
+            if (PCONTAINS(props,"entry_size")) {
+                attribute.entry_size = std::stoul(props.at("entry_size"));
+            }
+            if (PCONTAINS(props,"mp")) {
+                attribute.multiple_producer = (props.at("mp") == "true");
+            }
+            if (PCONTAINS(props,"policy")) {
+                std::string policy = props.at("policy");
+                if (policy == "weighted") {
+                    attribute.drain_policy = wsong::ipc::WS_DRAIN_WEIGHTED;
+                } else if (policy != "strict") {
+                    throw wsong::ws_exp("Unknown drain policy:" + policy);
+                }
+            }
+            for (uint32_t l = 0; l < WS_PRIORITY_RING_MAX_LANES; l++) {
+                attribute.weights[l] = 1;
+            }
+            if (PCONTAINS(props,"weights")) {
+                auto weights = split_list(props.at("weights"));
+                for (uint32_t l = 0; l < weights.size() && l < WS_PRIORITY_RING_MAX_LANES; l++) {
+                    attribute.weights[l] = std::stoul(weights[l]);
+                }
+            }
+            if (PCONTAINS(props,"description")) {
+                auto desc = props.at("description");
+                if (desc.size() <= 255) {
+                    std::memcpy(attribute.description,desc.c_str(),desc.size());
+                } else {
+                    throw wsong::ws_exp("Description is too long. 255 max characters allowed.");
+                }
+            }
+
+            auto key = wsong::ipc::PriorityRing::create_priority_ring(attribute);
+
+            std::cout << "A priority ring is created with key = 0x" << std::hex << key << std::endl;
+        }
+    },
+    {"priorityring","show",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            auto priority_ring_ptr = wsong::ipc::PriorityRing::get_priority_ring(key);
+            auto attribute = priority_ring_ptr->attribute();
+            std::cout << "key:          0x" << std::hex << attribute.key << std::dec << std::endl;
+            std::cout << "id:           "   << attribute.id << std::endl;
+            std::cout << "page_size:    "   << attribute.page_size/1024 << " KB" << std::endl;
+            std::cout << "num_lanes:    "   << attribute.num_lanes << std::endl;
+            std::cout << "capacity:     "   << attribute.capacity << std::endl;
+            std::cout << "entry_size:   "   << attribute.entry_size << " Bytes" << std::endl;
+            std::cout << "mp:           "   << attribute.multiple_producer << std::endl;
+            std::cout << "policy:       "   << (attribute.drain_policy == wsong::ipc::WS_DRAIN_WEIGHTED ?
+                                                "weighted" : "strict") << std::endl;
+            std::cout << "description:  "   << attribute.description << std::endl;
+            std::cout << "nonempty:     0x" << std::hex << priority_ring_ptr->nonempty_lanes() << std::dec << std::endl;
+            for (uint32_t l = 0; l < attribute.num_lanes; l++) {
+                std::cout << "lane " << std::setw(2) << l << ":      size=" << priority_ring_ptr->size(l);
+                if (attribute.drain_policy == wsong::ipc::WS_DRAIN_WEIGHTED) {
+                    std::cout << " weight=" << attribute.weights[l];
+                }
+                std::cout << std::endl;
+            }
+        }
+    },
+    {"priorityring","delete",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            wsong::ipc::PriorityRing::delete_priority_ring(key);
+            std::cout << "PriorityRing with key=0x" << std::hex << key << std::dec << " is deleted." << std::endl;
+        }
+    },
+    {"priorityring","perf",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            const uint64_t count = PCONTAINS(props,"count") ? std::stoull(props.at("count"),nullptr,0) : 1000000;
+            const uint64_t urgent_every = PCONTAINS(props,"urgent_every") ?
+                                          std::stoull(props.at("urgent_every"),nullptr,0) : 1000;
+            const uint64_t work_ns = PCONTAINS(props,"work_ns") ? std::stoull(props.at("work_ns"),nullptr,0) : 100;
+            auto attribute = wsong::ipc::PriorityRing::get_priority_ring(key)->attribute();
+            if (attribute.entry_size < sizeof(uint64_t) || urgent_every == 0) {
+                throw wsong::ws_exp("perf needs entry_size >= 8 and urgent_every > 0.");
+            }
+            const uint32_t bulk_lane = attribute.num_lanes - 1;
+            const uint64_t total = count + count / urgent_every;
+
+            // the producer floods the bulk lane and injects urgent messages on lane 0.
+            pid_t pid = fork();
+            if (pid == 0) {
+                auto pr = wsong::ipc::PriorityRing::get_priority_ring(key);
+                std::vector<uint8_t> msg(attribute.entry_size,0);
+                uint64_t* psts = reinterpret_cast<uint64_t*>(msg.data());
+                for (uint64_t i = 1; i <= count; i++) {
+                    *psts = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+                    pr->produce(bulk_lane,msg.data(),attribute.entry_size,1min);
+                    if (i % urgent_every == 0) {
+                        *psts = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+                        pr->produce(0,msg.data(),attribute.entry_size,1min);
+                    }
+                }
+                _exit(0);
+            }
+
+            auto pr = wsong::ipc::PriorityRing::get_priority_ring(key);
+            std::vector<uint8_t> msg(attribute.entry_size,0);
+            std::vector<std::vector<uint64_t>> latencies(attribute.num_lanes);
+            for (uint64_t i = 0; i < total; i++) {
+                uint32_t lane = pr->consume(msg.data(),attribute.entry_size,10s);
+                auto now = steady_clock::now();
+                latencies[lane].push_back(duration_cast<nanoseconds>(now.time_since_epoch()).count()
+                                          - *reinterpret_cast<uint64_t*>(msg.data()));
+                // emulate the processing time.
+                while (steady_clock::now() - now < nanoseconds(work_ns));
+            }
+            waitpid(pid,nullptr,0);
+
+            std::cout << "lane,messages,p50_ns,p99_ns,max_ns" << std::endl;
+            for (uint32_t l = 0; l < attribute.num_lanes; l++) {
+                auto& lat = latencies[l];
+                if (lat.empty()) {
+                    continue;
+                }
+                std::sort(lat.begin(),lat.end());
+                std::cout << l << "," << lat.size() << "," << lat[lat.size()/2] << ","
+                          << lat[lat.size()*99/100] << "," << lat.back() << std::endl;
+            }
+        }
+    },
+    {"objectstore","more",
+        [](const Properties& props) {
+            std::string command = "more";
+            if (props.find("command")!=props.cend()) {
+                command = props.at("command");
+            }
+            std::string more_string;
+            if (command == "more") {
+                more_string =   "Properties:\n"
+                                "command:=more|show|create|delete|gc|perf [more]\n";
+            } else if (command == "show" || command == "delete" || command == "gc") {
+                more_string =   "Properties:\n"
+                                "key:=<object store key>\n";
+            } else if (command == "create") {
+                more_string =   "Properties:\n"
+                                "key:=<key value>\n"
+                                "page_size:=4K|2M|1G [2M]\n"
+                                "block_size:=<allocation unit in bytes>, must be power-of-two [65536]\n"
+                                "num_blocks:=<# of blocks in the data segment> [4096]\n"
+                                "max_objects:=<maximum # of objects> [1024]\n"
+                                "max_clients:=<maximum # of attached clients>, up to 256 [16]\n"
+                                "description:=<desc string>, less than 255 characters [""]\n";
+            } else if (command == "perf") {
+                more_string =   "Properties:\n"
+                                "key:=<object store key>\n"
+                                "size:=<object size in bytes> [1048576]\n"
+                                "count:=<# of objects> [1000]\n"
+                                "depth:=<# of handles in flight> [16]\n";
+            } else {
+                more_string =   "Unknown command:" + command + "\n";
+            }
+            std::cout << more_string << std::endl;
+        }
+    },
+    {"objectstore","create",
+        [](const Properties& props) {
+            wsong::ipc::ObjectStoreAttribute attribute = {
+                .key        = 0,
+                .id         = 0,
+                .data_id    = 0,
+                .page_size  = 1<<21,
+                .block_size = 1<<16,
+                .num_blocks = 4096,
+                .max_objects    = 1024,
+                .max_clients    = 16,
+                .description    = {'\0'},
+            };
+            if (PCONTAINS(props,"key")) {
+                attribute.key = std::stol(props.at("key"),nullptr,0);
+            }
+            if (attribute.key == 0) {
+                std::srand(static_cast<unsigned>(time(nullptr)));
+                attribute.key = static_cast<key_t>(rand());
+            }
+            if (PCONTAINS(props,"page_size")) {
+                attribute.page_size = parse_page_size(props.at("page_size"));
+            }
+            if (PCONTAINS(props,"block_size")) {
+                attribute.block_size = std::stoul(props.at("block_size"),nullptr,0);
+            }
+            if (PCONTAINS(props,"num_blocks")) {
+                attribute.num_blocks = std::stoul(props.at("num_blocks"),nullptr,0);
+            }
+            if (PCONTAINS(props,"max_objects")) {
+                attribute.max_objects = std::stoul(props.at("max_objects"),nullptr,0);
+            }
+            if (PCONTAINS(props,"max_clients")) {
+                attribute.max_clients = std::stoul(props.at("max_clients"),nullptr,0);
+            }
+            if (PCONTAINS(props,"description")) {
+                auto desc = props.at("description");
+                if (desc.size() <= 255) {
+                    std::memcpy(attribute.description,desc.c_str(),desc.size());
+                } else {
+                    throw wsong::ws_exp("Description is too long. 255 max characters allowed.");
+                }
+            }
+
+            auto key = wsong::ipc::ObjectStore::create_object_store(attribute);
+
+            std::cout << "An object store is created with key = 0x" << std::hex << key << std::endl;
+        }
+    },
+    {"objectstore","show",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            auto object_store_ptr = wsong::ipc::ObjectStore::get_object_store(key,true);
+            auto attribute = object_store_ptr->attribute();
+            auto stats = object_store_ptr->stats();
+            std::cout << "key:          0x" << std::hex << attribute.key << std::dec << std::endl;
+            std::cout << "id:           "   << attribute.id << std::endl;
+            std::cout << "data_id:      "   << attribute.data_id << std::endl;
+            std::cout << "page_size:    "   << attribute.page_size/1024 << " KB" << std::endl;
+            std::cout << "block_size:   "   << attribute.block_size << " Bytes" << std::endl;
+            std::cout << "num_blocks:   "   << attribute.num_blocks << std::endl;
+            std::cout << "max_objects:  "   << attribute.max_objects << std::endl;
+            std::cout << "max_clients:  "   << attribute.max_clients << std::endl;
+            std::cout << "description:  "   << attribute.description << std::endl;
+            std::cout << "objects:      "   << stats.objects << std::endl;
+            std::cout << "used_blocks:  "   << stats.used_blocks << std::endl;
+            // this client included
+            std::cout << "clients:      "   << stats.clients - 1 << std::endl;
+        }
+    },
+    {"objectstore","delete",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            wsong::ipc::ObjectStore::delete_object_store(key);
+            std::cout << "ObjectStore with key=0x" << std::hex << key << std::dec << " is deleted." << std::endl;
+        }
+    },
+    {"objectstore","gc",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            auto object_store_ptr = wsong::ipc::ObjectStore::get_object_store(key,true);
+            const uint32_t reclaimed = object_store_ptr->reclaim();
+            auto stats = object_store_ptr->stats();
+            std::cout << "Reclaimed " << reclaimed << " dead clients. objects=" << stats.objects << " used_blocks=" << stats.used_blocks
+                      << " clients=" << stats.clients - 1 << std::endl;
+        }
+    },
+    {"objectstore","perf",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            const uint64_t size = PCONTAINS(props,"size") ? std::stoull(props.at("size"),nullptr,0) : (1ull<<20);
+            const uint64_t count = PCONTAINS(props,"count") ? std::stoull(props.at("count"),nullptr,0) : 1000;
+            const uint32_t depth = PCONTAINS(props,"depth") ? std::stoul(props.at("depth"),nullptr,0) : 16;
+
+            // the handles go through a ring buffer, the payloads stay in the object store.
+            std::random_device rd;
+            wsong::ipc::RingBufferAttribute rb_attribute = {
+                .key        = static_cast<key_t>(rd() & 0x7fffffff),
+                .id         = 0,
+                .page_size  = 4096,
+                .capacity   = std::bit_ceil(depth + 1),
+                .entry_size = sizeof(wsong::ipc::ObjectHandle),
+                .multiple_consumer  = false,
+                .multiple_producer  = false,
+                .trace_context      = false,
+                .description    = "ipc_cli objectstore perf",
+            };
+            const key_t rb_key = wsong::ipc::RingBuffer::create_ring_buffer(rb_attribute);
+
+            pid_t pid = fork();
+            if (pid == 0) {
+                // consumer: attach read-only, read every object in place.
+                auto store = wsong::ipc::ObjectStore::get_object_store(key,true);
+                auto rb = wsong::ipc::RingBuffer::get_ring_buffer(rb_key);
+                uint64_t checksum = 0;
+                for (uint64_t i = 0; i < count; i++) {
+                    wsong::ipc::ObjectHandle handle;
+                    rb->consume(&handle,sizeof(handle),1min);
+                    handle = store->adopt(handle);
+                    const uint64_t* words = reinterpret_cast<const uint64_t*>(store->get(handle));
+                    for (uint64_t w = 0; w < store->size(handle) / sizeof(uint64_t); w++) {
+                        checksum += words[w];
+                    }
+                    store->release(handle);
+                }
+                _exit(checksum == count * (size / sizeof(uint64_t)) ? 0 : 1);
+            }
+
+            auto store = wsong::ipc::ObjectStore::get_object_store(key);
+            auto rb = wsong::ipc::RingBuffer::get_ring_buffer(rb_key);
+            auto start = steady_clock::now();
+            for (uint64_t i = 0; i < count; i++) {
+                wsong::ipc::ObjectHandle handle = WS_OBJECT_STORE_INVALID_HANDLE;
+                while (handle == WS_OBJECT_STORE_INVALID_HANDLE) {
+                    try {
+                        handle = store->create(size);
+                    } catch (const wsong::ws_exp&) {
+                        // wait for the consumer to release some objects.
+                        std::this_thread::yield();
+                    }
+                }
+                uint64_t* words = reinterpret_cast<uint64_t*>(store->data(handle));
+                std::fill(words,words + size / sizeof(uint64_t),1ull);
+                store->seal(handle);
+                rb->produce(&handle,sizeof(handle),1min);
+            }
+            int status = 0;
+            waitpid(pid,&status,0);
+            const double seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1e9;
+            wsong::ipc::RingBuffer::delete_ring_buffer(rb_key);
+            std::cout << "objects/s:    " << static_cast<uint64_t>(count / seconds) << std::endl;
+            std::cout << "throughput:   " << count * size / seconds / (1ull<<30) << " GiB/s" << std::endl;
+            std::cout << "checksum:     " << (WIFEXITED(status) && WEXITSTATUS(status) == 0 ? "ok" : "FAILED")
+                      << std::endl;
+        }
+    },
+    {"workqueue","more",
+        [](const Properties& props) {
+            std::string command = "more";
+            if (props.find("command")!=props.cend()) {
+                command = props.at("command");
+            }
+            std::string more_string;
+            if (command == "more") {
+                more_string =   "Properties:\n"
+                                "command:=more|show|create|delete|gc|perf [more]\n";
+            } else if (command == "show" || command == "delete" || command == "gc") {
+                more_string =   "Properties:\n"
+                                "key:=<work queue key>\n";
+            } else if (command == "create") {
+                more_string =   "Properties:\n"
+                                "key:=<key value>\n"
+                                "page_size:=4K|2M|1G [4K]\n"
+                                "capacity:=<capacity>, must be power-of-two [4096]\n"
+                                "entry_size:=<entry size in bytes> [64]\n"
+                                "max_consumers:=<maximum # of consumers>, up to 255 [16]\n"
+                                "max_leases:=<maximum # of leases per consumer> [16]\n"
+                                "lease_timeout:=<lease timeout in microseconds>, 0 for never [0]\n"
+                                "description:=<desc string>, less than 255 characters [""]\n";
+            } else if (command == "perf") {
+                more_string =   "Properties:\n"
+                                "key:=<work queue key>\n"
+                                "count:=<# of messages> [100000]\n"
+                                "workers:=<# of worker processes> [4]\n"
+                                "leases:=<# of leases a worker holds> [4]\n"
+                                "crash:=yes|no, one worker dies with its leases half way [yes]\n";
+            } else {
+                more_string =   "Unknown command:" + command + "\n";
+            }
+            std::cout << more_string << std::endl;
+        }
+    },
+    {"workqueue","create",
+        [](const Properties& props) {
+            wsong::ipc::WorkQueueAttribute attribute = {
+                .key        = 0,
+                .id         = 0,
+                .page_size  = 4096,
+                .capacity   = 4096,
+                .entry_size = 64,
+                .max_consumers  = 16,
+                .max_leases     = 16,
+                .lease_timeout_ns   = 0,
+                .description    = {'\0'},
+            };
+            if (PCONTAINS(props,"key")) {
+                attribute.key = std::stol(props.at("key"),nullptr,0);
+            }
+            if (attribute.key == 0) {
+                std::srand(static_cast<unsigned>(time(nullptr)));
+                attribute.key = static_cast<key_t>(rand());
+            }
+            if (PCONTAINS(props,"page_size")) {
+                attribute.page_size = parse_page_size(props.at("page_size"));
+            }
+            if (PCONTAINS(props,"capacity")) {
+                attribute.capacity = std::stoul(props.at("capacity"),nullptr,0);
+            }
+            if (PCONTAINS(props,"entry_size")) {
+                attribute.entry_size = static_cast<uint16_t>(std::stoul(props.at("entry_size"),nullptr,0));
+            }
+            if (PCONTAINS(props,"max_consumers")) {
+                attribute.max_consumers = std::stoul(props.at("max_consumers"),nullptr,0);
+            }
+            if (PCONTAINS(props,"max_leases")) {
+                attribute.max_leases = std::stoul(props.at("max_leases"),nullptr,0);
+            }
+            if (PCONTAINS(props,"lease_timeout")) {
+                attribute.lease_timeout_ns = std::stoull(props.at("lease_timeout"),nullptr,0) * 1000;
+            }
+            if (PCONTAINS(props,"description")) {
+                auto desc = props.at("description");
+                if (desc.size() <= 255) {
+                    std::memcpy(attribute.description,desc.c_str(),desc.size());
+                } else {
+                    throw wsong::ws_exp("Description is too long. 255 max characters allowed.");
+                }
+            }
+
+            auto key = wsong::ipc::WorkQueue::create_work_queue(attribute);
+
+            std::cout << "A work queue is created with key = 0x" << std::hex << key << std::endl;
+        }
+    },
+    {"workqueue","show",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            auto work_queue_ptr = wsong::ipc::WorkQueue::get_work_queue(key);
+            auto attribute = work_queue_ptr->attribute();
+            auto stats = work_queue_ptr->stats();
+            std::cout << "key:          0x" << std::hex << attribute.key << std::dec << std::endl;
+            std::cout << "id:           "   << attribute.id << std::endl;
+            std::cout << "page_size:    "   << attribute.page_size/1024 << " KB" << std::endl;
+            std::cout << "capacity:     "   << attribute.capacity << std::endl;
+            std::cout << "entry_size:   "   << attribute.entry_size << " Bytes" << std::endl;
+            std::cout << "max_consumers:"   << attribute.max_consumers << std::endl;
+            std::cout << "max_leases:   "   << attribute.max_leases << std::endl;
+            std::cout << "lease_timeout:"   << attribute.lease_timeout_ns/1000 << " us" << std::endl;
+            std::cout << "description:  "   << attribute.description << std::endl;
+            std::cout << "queued:       "   << stats.queued << std::endl;
+            std::cout << "leased:       "   << stats.leased << std::endl;
+            std::cout << "orphans:      "   << stats.orphans << std::endl;
+            std::cout << "redelivered:  "   << stats.redelivered << std::endl;
+            std::cout << "expired:      "   << stats.expired << std::endl;
+            std::cout << "consumers:    "   << stats.consumers << std::endl;
+        }
+    },
+    {"workqueue","delete",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            wsong::ipc::WorkQueue::delete_work_queue(key);
+            std::cout << "WorkQueue with key=0x" << std::hex << key << std::dec << " is deleted." << std::endl;
+        }
+    },
+    {"workqueue","gc",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            auto work_queue_ptr = wsong::ipc::WorkQueue::get_work_queue(key);
+            const uint32_t orphaned = work_queue_ptr->reclaim();
+            auto stats = work_queue_ptr->stats();
+            std::cout << "Orphaned " << orphaned << " leases. orphans=" << stats.orphans << " leased=" << stats.leased
+                      << " consumers=" << stats.consumers << std::endl;
+        }
+    },
+    {"workqueue","perf",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            const uint64_t count = PCONTAINS(props,"count") ? std::stoull(props.at("count"),nullptr,0) : 100000;
+            const uint32_t workers = PCONTAINS(props,"workers") ? std::stoul(props.at("workers"),nullptr,0) : 4;
+            const uint32_t leases = PCONTAINS(props,"leases") ? std::stoul(props.at("leases"),nullptr,0) : 4;
+            const bool crash = !PCONTAINS(props,"crash") || props.at("crash") == "yes";
+
+            // per message: how many times it was processed and acknowledged, shared with the workers.
+            struct perf_board_t {
+                std::atomic<uint64_t>   done;
+                std::atomic<uint32_t>   counts[];
+            };
+            const size_t board_size = sizeof(perf_board_t) + 2 * count * sizeof(std::atomic<uint32_t>);
+            void* board_ptr = mmap(nullptr,board_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+            if (board_ptr == MAP_FAILED) {
+                throw wsong::ws_exp(std::string("mmap failed with error:") + std::strerror(errno));
+            }
+            perf_board_t* board = reinterpret_cast<perf_board_t*>(board_ptr);
+            std::atomic<uint32_t>* processed = board->counts;
+            std::atomic<uint32_t>* acked = board->counts + count;
+
+            std::vector<pid_t> pids;
+            for (uint32_t w = 0; w < workers; w++) {
+                pid_t pid = fork();
+                if (pid == 0) {
+                    auto wq = wsong::ipc::WorkQueue::get_work_queue(key);
+                    std::vector<wsong::ipc::WorkLease> held;
+                    uint64_t handled = 0;
+                    while (board->done.load(std::memory_order_relaxed) < count) {
+                        try {
+                            held.push_back(wq->lease(10ms));
+                        } catch (const wsong::ws_timeout_exp&) {
+                        }
+                        if (held.size() < leases &&
+                            board->done.load(std::memory_order_relaxed) + held.size() < count) {
+                            continue;
+                        }
+                        for (auto& lease: held) {
+                            const uint64_t id = *reinterpret_cast<const uint64_t*>(lease.data);
+                            processed[id].fetch_add(1,std::memory_order_relaxed);
+                        }
+                        // the crashing worker dies after processing, before acknowledging.
+                        handled += held.size();
+                        if (crash && w == 0 && handled > count / workers / 4) {
+                            _exit(0);
+                        }
+                        for (auto& lease: held) {
+                            const uint64_t id = *reinterpret_cast<const uint64_t*>(lease.data);
+                            if (wq->ack(lease) && acked[id].fetch_add(1,std::memory_order_relaxed) == 0) {
+                                board->done.fetch_add(1,std::memory_order_relaxed);
+                            }
+                        }
+                        held.clear();
+                    }
+                    wq.reset();
+                    _exit(0);
+                }
+                pids.push_back(pid);
+            }
+
+            auto wq = wsong::ipc::WorkQueue::get_work_queue(key);
+            std::vector<uint8_t> entry(wq->attribute().entry_size,0);
+            auto start = steady_clock::now();
+            for (uint64_t id = 0; id < count; id++) {
+                *reinterpret_cast<uint64_t*>(entry.data()) = id;
+                wq->produce(entry.data(),static_cast<uint16_t>(entry.size()),1min);
+            }
+            for (auto pid: pids) {
+                waitpid(pid,nullptr,0);
+            }
+            const double seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1e9;
+            uint64_t missing = 0, duplicates = 0;
+            for (uint64_t id = 0; id < count; id++) {
+                if (acked[id].load() == 0) {
+                    missing ++;
+                }
+                if (processed[id].load() > 1) {
+                    duplicates += processed[id].load() - 1;
+                }
+            }
+            auto stats = wq->stats();
+            munmap(board_ptr,board_size);
+            std::cout << "messages/s:   " << static_cast<uint64_t>(count / seconds) << std::endl;
+            std::cout << "acked:        " << count - missing << "/" << count << std::endl;
+            std::cout << "duplicates:   " << duplicates << std::endl;
+            std::cout << "redelivered:  " << stats.redelivered << std::endl;
+            std::cout << "expired:      " << stats.expired << std::endl;
+        }
+    },
+    {"epochtable","more",
+        [](const Properties& props) {
+            std::string command = "more";
+            if (props.find("command")!=props.cend()) {
+                command = props.at("command");
+            }
+            std::string more_string;
+            if (command == "more") {
+                more_string =   "Properties:\n"
+                                "command:=more|show|create|delete|gc|publish|perf [more]\n";
+            } else if (command == "show" || command == "delete" || command == "gc") {
+                more_string =   "Properties:\n"
+                                "key:=<epoch table key>\n";
+            } else if (command == "create") {
+                more_string =   "Properties:\n"
+                                "key:=<key value>\n"
+                                "page_size:=4K|2M|1G [2M]\n"
+                                "slot_size:=<capacity of a version in bytes> [67108864]\n"
+                                "num_slots:=<# of version slots>, 2 to 256 [4]\n"
+                                "max_clients:=<maximum # of attached clients>, up to 4096 [64]\n"
+                                "description:=<desc string>, less than 255 characters [""]\n";
+            } else if (command == "publish") {
+                more_string =   "Properties:\n"
+                                "key:=<epoch table key>\n"
+                                "file:=<the file to publish as the next version>\n";
+            } else if (command == "perf") {
+                more_string =   "Properties:\n"
+                                "key:=<epoch table key>\n"
+                                "size:=<version size in bytes> [1048576]\n"
+                                "count:=<# of versions to publish> [100]\n"
+                                "interval:=<microseconds between the versions> [1000]\n"
+                                "readers:=<# of reader processes> [2]\n"
+                                "crash:=yes|no, one reader dies in a read section half way [yes]\n";
+            } else {
+                more_string =   "Unknown command:" + command + "\n";
+            }
+            std::cout << more_string << std::endl;
+        }
+    },
+    {"epochtable","create",
+        [](const Properties& props) {
+            wsong::ipc::EpochTableAttribute attribute = {
+                .key        = 0,
+                .id         = 0,
+                .data_id    = 0,
+                .page_size  = 1<<21,
+                .slot_size  = 1ull<<26,
+                .num_slots  = 4,
+                .max_clients    = 64,
+                .description    = {'\0'},
+            };
+            if (PCONTAINS(props,"key")) {
+                attribute.key = std::stol(props.at("key"),nullptr,0);
+            }
+            if (attribute.key == 0) {
+                std::srand(static_cast<unsigned>(time(nullptr)));
+                attribute.key = static_cast<key_t>(rand());
+            }
+            if (PCONTAINS(props,"page_size")) {
+                attribute.page_size = parse_page_size(props.at("page_size"));
+            }
+            if (PCONTAINS(props,"slot_size")) {
+                attribute.slot_size = std::stoull(props.at("slot_size"),nullptr,0);
+            }
+            if (PCONTAINS(props,"num_slots")) {
+                attribute.num_slots = std::stoul(props.at("num_slots"),nullptr,0);
+            }
+            if (PCONTAINS(props,"max_clients")) {
+                attribute.max_clients = std::stoul(props.at("max_clients"),nullptr,0);
+            }
+            if (PCONTAINS(props,"description")) {
+                auto desc = props.at("description");
+                if (desc.size() <= 255) {
+                    std::memcpy(attribute.description,desc.c_str(),desc.size());
+                } else {
+                    throw wsong::ws_exp("Description is too long. 255 max characters allowed.");
+                }
+            }
+
+            auto key = wsong::ipc::EpochTable::create_epoch_table(attribute);
+
+            std::cout << "An epoch table is created with key = 0x" << std::hex << key << std::endl;
+        }
+    },
+    {"epochtable","show",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            auto epoch_table_ptr = wsong::ipc::EpochTable::get_epoch_table(key,true);
+            auto attribute = epoch_table_ptr->attribute();
+            auto stats = epoch_table_ptr->stats();
+            std::cout << "key:          0x" << std::hex << attribute.key << std::dec << std::endl;
+            std::cout << "id:           "   << attribute.id << std::endl;
+            std::cout << "data_id:      "   << attribute.data_id << std::endl;
+            std::cout << "page_size:    "   << attribute.page_size/1024 << " KB" << std::endl;
+            std::cout << "slot_size:    "   << attribute.slot_size << " Bytes" << std::endl;
+            std::cout << "num_slots:    "   << attribute.num_slots << std::endl;
+            std::cout << "max_clients:  "   << attribute.max_clients << std::endl;
+            std::cout << "description:  "   << attribute.description << std::endl;
+            std::cout << "version:      "   << stats.version << std::endl;
+            std::cout << "size:         "   << stats.size << " Bytes" << std::endl;
+            std::cout << "published:    "   << stats.published << std::endl;
+            std::cout << "reclaimed:    "   << stats.reclaimed << std::endl;
+            std::cout << "free_slots:   "   << stats.free_slots << std::endl;
+            std::cout << "preparing:    "   << stats.preparing_slots << std::endl;
+            std::cout << "retired:      "   << stats.retired_slots << std::endl;
+            // this client included
+            std::cout << "clients:      "   << stats.clients - 1 << std::endl;
+            std::cout << "reading:      "   << stats.reading_clients << std::endl;
+        }
+    },
+    {"epochtable","delete",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            wsong::ipc::EpochTable::delete_epoch_table(key);
+            std::cout << "EpochTable with key=0x" << std::hex << key << std::dec << " is deleted." << std::endl;
+        }
+    },
+    {"epochtable","gc",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            auto epoch_table_ptr = wsong::ipc::EpochTable::get_epoch_table(key,true);
+            const uint32_t reclaimed = epoch_table_ptr->reclaim();
+            auto stats = epoch_table_ptr->stats();
+            std::cout << "Reclaimed " << reclaimed << " retired versions. free_slots=" << stats.free_slots
+                      << " retired=" << stats.retired_slots << " clients=" << stats.clients - 1 << std::endl;
+        }
+    },
+    {"epochtable","publish",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key") || !PCONTAINS(props,"file")) {
+                throw wsong::ws_exp("Mandatory key or file property is not found. "
+                                    "Please specify them using '-p key=<key> -p file=<file>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            std::ifstream infile(props.at("file"),std::ios::binary | std::ios::ate);
+            if (!infile.is_open()) {
+                throw wsong::ws_exp("Cannot open file:" + props.at("file"));
+            }
+            const uint64_t size = static_cast<uint64_t>(infile.tellg());
+            infile.seekg(0);
+            auto epoch_table_ptr = wsong::ipc::EpochTable::get_epoch_table(key);
+            void* data = epoch_table_ptr->prepare(size,10s);
+            if (!infile.read(reinterpret_cast<char*>(data),size)) {
+                epoch_table_ptr->abandon();
+                throw wsong::ws_exp("Failed to read file:" + props.at("file"));
+            }
+            const uint64_t version = epoch_table_ptr->publish();
+            std::cout << "Published " << size << " bytes as version " << version << "." << std::endl;
+        }
+    },
+    {"epochtable","perf",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            const uint64_t size = PCONTAINS(props,"size") ? std::stoull(props.at("size"),nullptr,0) : (1ull<<20);
+            const uint64_t count = PCONTAINS(props,"count") ? std::stoull(props.at("count"),nullptr,0) : 100;
+            const uint64_t interval_us = PCONTAINS(props,"interval") ? std::stoull(props.at("interval"),nullptr,0) : 1000;
+            const uint32_t readers = PCONTAINS(props,"readers") ? std::stoul(props.at("readers"),nullptr,0) : 2;
+            const bool crash = !PCONTAINS(props,"crash") || props.at("crash") == "yes";
+            if (size < sizeof(uint64_t)) {
+                throw wsong::ws_invalid_argument_exp("size must be at least 8 bytes.");
+            }
+
+            // shared with the readers.
+            struct perf_board_t {
+                std::atomic<uint64_t>   version;
+                std::atomic<bool>       done;
+                std::atomic<uint64_t>   reads;
+                std::atomic<uint64_t>   read_ns;
+                std::atomic<uint64_t>   torn;
+            };
+            void* board_ptr = mmap(nullptr,sizeof(perf_board_t),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+            if (board_ptr == MAP_FAILED) {
+                throw wsong::ws_exp(std::string("mmap failed with error:") + std::strerror(errno));
+            }
+            perf_board_t* board = reinterpret_cast<perf_board_t*>(board_ptr);
+
+            std::vector<pid_t> pids;
+            for (uint32_t r = 0; r < readers; r++) {
+                pid_t pid = fork();
+                if (pid == 0) {
+                    auto table = wsong::ipc::EpochTable::get_epoch_table(key,true);
+                    uint64_t reads = 0, torn = 0;
+                    auto start = steady_clock::now();
+                    while (!board->done.load(std::memory_order_relaxed)) {
+                        // the crashing reader dies in a read section, pinning its version.
+                        if (crash && r == 0 && board->version.load(std::memory_order_relaxed) > count / 2) {
+                            table->read_lock();
+                            _exit(0);
+                        }
+                        for (int i = 0; i < 1000; i++) {
+                            auto version = table->read_lock();
+                            if (version.data != nullptr) {
+                                // every word of a version is its version number.
+                                const uint64_t* words = reinterpret_cast<const uint64_t*>(version.data);
+                                const uint64_t num_words = version.size / sizeof(uint64_t);
+                                if (words[0] != version.version || words[num_words / 2] != version.version ||
+                                    words[num_words - 1] != version.version) {
+                                    torn ++;
+                                }
+                            }
+                            table->read_unlock();
+                        }
+                        reads += 1000;
+                    }
+                    board->read_ns.fetch_add(duration_cast<nanoseconds>(steady_clock::now() - start).count());
+                    board->reads.fetch_add(reads);
+                    board->torn.fetch_add(torn);
+                    table.reset();
+                    _exit(0);
+                }
+                pids.push_back(pid);
+            }
+
+            auto stop_readers = [&]() {
+                board->done.store(true,std::memory_order_relaxed);
+                for (auto pid: pids) {
+                    waitpid(pid,nullptr,0);
+                }
+            };
+            auto table = wsong::ipc::EpochTable::get_epoch_table(key);
+            uint64_t build_ns = 0, publish_ns = 0;
+            auto start = steady_clock::now();
+            try {
+                for (uint64_t i = 0; i < count; i++) {
+                    auto t0 = steady_clock::now();
+                    uint64_t* words = reinterpret_cast<uint64_t*>(table->prepare(size,10s));
+                    // the version number is predictable: we are the only writer.
+                    const uint64_t version = table->stats().version + 1;
+                    std::fill(words,words + size / sizeof(uint64_t),version);
+                    auto t1 = steady_clock::now();
+                    board->version.store(table->publish(),std::memory_order_relaxed);
+                    auto t2 = steady_clock::now();
+                    build_ns += duration_cast<nanoseconds>(t1 - t0).count();
+                    publish_ns += duration_cast<nanoseconds>(t2 - t1).count();
+                    std::this_thread::sleep_for(microseconds(interval_us));
+                }
+            } catch (...) {
+                stop_readers();
+                munmap(board_ptr,sizeof(perf_board_t));
+                throw;
+            }
+            stop_readers();
+            const double seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1e9;
+            auto stats = table->stats();
+            const uint64_t reads = board->reads.load();
+            std::cout << "versions/s:   " << static_cast<uint64_t>(count / seconds) << std::endl;
+            std::cout << "build:        " << build_ns / count / 1000 << " us/version" << std::endl;
+            std::cout << "publish:      " << publish_ns / count / 1000 << " us/version" << std::endl;
+            std::cout << "reads:        " << reads << std::endl;
+            std::cout << "read cost:    " << (reads > 0 ? static_cast<double>(board->read_ns.load()) / reads : 0.0)
+                      << " ns/read" << std::endl;
+            std::cout << "torn reads:   " << board->torn.load() << std::endl;
+            std::cout << "reclaimed:    " << stats.reclaimed << std::endl;
+            std::cout << "retired:      " << stats.retired_slots << std::endl;
+            munmap(board_ptr,sizeof(perf_board_t));
+        }
+    },
+    {"shmpipe","more",
+        [](const Properties& props) {
+            std::string command = "more";
+            if (props.find("command")!=props.cend()) {
+                command = props.at("command");
+            }
+            std::string more_string;
+            if (command == "more") {
+                more_string =   "Properties:\n"
+                                "command:=more|show|create|delete|write|read|perf|unixping [more]\n";
+            } else if (command == "show" || command == "delete") {
+                more_string =   "Properties:\n"
+                                "key:=<shm pipe key>\n";
+            } else if (command == "create") {
+                more_string =   "Properties:\n"
+                                "key:=<key value>\n"
+                                "page_size:=4K|2M|1G [4K]\n"
+                                "capacity:=<capacity in bytes>, must be power-of-two [1048576]\n"
+                                "blocking:=1|0, sleep on a futex instead of polling [1]\n"
+                                "mode:=<permission bits of the segment> [0644]\n"
+                                "description:=<desc string>, less than 255 characters [""]\n";
+            } else if (command == "write") {
+                more_string =   "Properties:\n"
+                                "key:=<shm pipe key>\n"
+                                "file:=<the file to write into the pipe> [stdin]\n"
+                                "close:=1|0, close the writer's end at the end of file [1]\n";
+            } else if (command == "read") {
+                more_string =   "Properties:\n"
+                                "key:=<shm pipe key>\n"
+                                "file:=<the file to save the stream to> [stdout]\n";
+            } else if (command == "perf") {
+                more_string =   "Properties:\n"
+                                "chunk:=<bytes per read and write call>, a multiple of 256 [65536]\n"
+                                "total:=<bytes to stream> [1073741824]\n"
+                                "capacity:=<capacity of the pipes in bytes> [1048576]\n"
+                                "blocking:=1|0, test a blocking shm pipe [1]\n";
+            } else if (command == "unixping") {
+                more_string =   "Round trips over an AF_UNIX stream socket, to compare a plain run with one under\n"
+                                "LD_PRELOAD=libwsongunix.so WSONG_UNIX_PATHS=<path>.\n"
+                                "Properties:\n"
+                                "path:=<socket path> [/tmp/wsong_unixping.sock]\n"
+                                "size:=<message size in bytes> [64]\n"
+                                "count:=<number of round trips> [100000]\n";
+            } else {
+                more_string =   "Unknown command:" + command + "\n";
+            }
+            std::cout << more_string << std::endl;
+        }
+    },
+    {"shmpipe","create",
+        [](const Properties& props) {
+            wsong::ipc::ShmPipeAttribute attribute = {
+                .key        = 0,
+                .id         = 0,
+                .page_size  = 4096,
+                .capacity   = 1<<20,
+                .blocking   = true,
+                .mode       = 0644,
+                .description    = {'\0'},
+            };
+            if (PCONTAINS(props,"key")) {
+                attribute.key = std::stol(props.at("key"),nullptr,0);
+            }
+            if (attribute.key == 0) {
+                std::srand(static_cast<unsigned>(time(nullptr)));
+                attribute.key = static_cast<key_t>(rand());
+            }
+            if (PCONTAINS(props,"page_size")) {
+                attribute.page_size = parse_page_size(props.at("page_size"));
+            }
+            if (PCONTAINS(props,"capacity")) {
+                attribute.capacity = std::stoull(props.at("capacity"),nullptr,0);
+            }
+            if (PCONTAINS(props,"blocking")) {
+                if (props.at("blocking") == "0") {
+                    attribute.blocking = false;
+                } else if (props.at("blocking") != "1") {
+                    throw wsong::ws_exp("Unknow blocking setting:" + props.at("blocking"));
+                }
+            }
+            if (PCONTAINS(props,"mode")) {
+                attribute.mode = static_cast<uint32_t>(std::stoul(props.at("mode"),nullptr,8));
+            }
+            if (PCONTAINS(props,"description")) {
+                auto desc = props.at("description");
+                if (desc.size() <= 255) {
+                    std::memcpy(attribute.description,desc.c_str(),desc.size());
+                } else {
+                    throw wsong::ws_exp("Description is too long. 255 max characters allowed.");
+                }
+            }
+
+            auto key = wsong::ipc::ShmPipe::create_shm_pipe(attribute);
+
+            std::cout << "A shm pipe is created with key = 0x" << std::hex << key << std::endl;
+        }
+    },
+    {"shmpipe","show",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            auto pipe_ptr = wsong::ipc::ShmPipe::get_shm_pipe(key,true);
+            auto attribute = pipe_ptr->attribute();
+            auto stats = pipe_ptr->stats();
+            std::cout << "key:          0x" << std::hex << attribute.key << std::dec << std::endl;
+            std::cout << "id:           "   << attribute.id << std::endl;
+            std::cout << "page_size:    "   << attribute.page_size/1024 << " KB" << std::endl;
+            std::cout << "capacity:     "   << attribute.capacity << " Bytes" << std::endl;
+            std::cout << "blocking:     "   << attribute.blocking << std::endl;
+            std::cout << "mode:         0"  << std::oct << attribute.mode << std::dec << std::endl;
+            std::cout << "description:  "   << attribute.description << std::endl;
+            std::cout << "current size: "   << stats.tail - stats.head << " Bytes" << std::endl;
+            std::cout << "read:         "   << stats.head << " Bytes" << std::endl;
+            std::cout << "written:      "   << stats.tail << " Bytes" << std::endl;
+            std::cout << "full stalls:  "   << stats.full_stalls << std::endl;
+            std::cout << "empty stalls: "   << stats.empty_stalls << std::endl;
+            std::cout << "writer closed: "  << stats.writer_closed << std::endl;
+            std::cout << "reader closed: "  << stats.reader_closed << std::endl;
+        }
+    },
+    {"shmpipe","delete",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            wsong::ipc::ShmPipe::delete_shm_pipe(key);
+            std::cout << "ShmPipe with key=0x" << std::hex << key << std::dec << " is deleted." << std::endl;
+        }
+    },
+    {"shmpipe","write",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            int fd = STDIN_FILENO;
+            if (PCONTAINS(props,"file")) {
+                fd = open(props.at("file").c_str(),O_RDONLY);
+                if (fd == -1) {
+                    throw wsong::ws_exp("Cannot open file:" + props.at("file"));
+                }
+            }
+            auto pipe_ptr = wsong::ipc::ShmPipe::get_shm_pipe(key);
+            uint64_t total = 0;
+            size_t moved;
+            while ((moved = pipe_ptr->splice_from(fd,SIZE_MAX,UINT64_MAX)) > 0) {
+                total += moved;
+            }
+            if (!PCONTAINS(props,"close") || props.at("close") == "1") {
+                pipe_ptr->close_writer();
+            }
+            if (fd != STDIN_FILENO) {
+                close(fd);
+            }
+            std::cerr << total << " bytes written." << std::endl;
+        }
+    },
+    {"shmpipe","read",
+        [](const Properties& props) {
+            if (!PCONTAINS(props,"key")) {
+                throw wsong::ws_exp("Mandatory key property is not found. Please specify it using '-p key=<key>'");
+            }
+            const key_t key = static_cast<key_t>(std::stol(props.at("key"),nullptr,0));
+            int fd = STDOUT_FILENO;
+            if (PCONTAINS(props,"file")) {
+                fd = open(props.at("file").c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+                if (fd == -1) {
+                    throw wsong::ws_exp("Cannot open file:" + props.at("file"));
+                }
+            }
+            auto pipe_ptr = wsong::ipc::ShmPipe::get_shm_pipe(key);
+            uint64_t total = 0;
+            size_t moved;
+            while ((moved = pipe_ptr->splice_to(fd,SIZE_MAX,UINT64_MAX)) > 0) {
+                total += moved;
+            }
+            if (fd != STDOUT_FILENO) {
+                close(fd);
+            }
+            std::cerr << total << " bytes read." << std::endl;
+        }
+    },
+    {"shmpipe","perf",
+        [](const Properties& props) {
+            const size_t chunk = PCONTAINS(props,"chunk") ? std::stoull(props.at("chunk"),nullptr,0) : 65536;
+            const uint64_t total = PCONTAINS(props,"total") ? std::stoull(props.at("total"),nullptr,0) : (1ull<<30);
+            const uint64_t capacity = PCONTAINS(props,"capacity") ?
+                                      std::stoull(props.at("capacity"),nullptr,0) : (1ull<<20);
+            const bool blocking = !PCONTAINS(props,"blocking") || props.at("blocking") == "1";
+            if (chunk == 0 || chunk % 256 != 0) {
+                throw wsong::ws_invalid_argument_exp("chunk must be a non-zero multiple of 256.");
+            }
+
+            // The stream byte at offset n is n % 256, so the reader checks where each read lands.
+            std::vector<uint8_t> pattern(chunk);
+            for (size_t i = 0; i < chunk; i++) {
+                pattern[i] = static_cast<uint8_t>(i);
+            }
+            struct perf_result_t {
+                double      seconds;
+                uint64_t    received;
+                uint64_t    reads;
+                uint64_t    errors;
+            };
+            // run a writer process streaming `total` bytes to a reader in this process.
+            auto run = [&](const std::function<void()>& writer,
+                           const std::function<size_t(void*,size_t)>& reader,
+                           const std::function<void()>& forked) {
+                perf_result_t result = {0,0,0,0};
+                std::vector<uint8_t> buffer(chunk);
+                auto start = steady_clock::now();
+                pid_t pid = fork();
+                if (pid == 0) {
+                    writer();
+                    _exit(0);
+                }
+                forked();
+                size_t got;
+                while ((got = reader(buffer.data(),chunk)) > 0) {
+                    if (buffer[0] != static_cast<uint8_t>(result.received) ||
+                        buffer[got - 1] != static_cast<uint8_t>(result.received + got - 1)) {
+                        result.errors ++;
+                    }
+                    result.received += got;
+                    result.reads ++;
+                }
+                result.seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1e9;
+                waitpid(pid,nullptr,0);
+                return result;
+            };
+            auto report = [&](const char* name, const perf_result_t& result) {
+                std::cout << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(2)
+                          << std::setw(8) << result.received / result.seconds / (1ull<<30) << " GB/s  "
+                          << std::setw(10) << result.reads << " reads  "
+                          << std::setw(8) << (result.reads > 0 ? result.received / result.reads : 0) << " B/read  "
+                          << result.errors << " errors" << std::endl;
+                std::cout.unsetf(std::ios::fixed);
+                if (result.received != total || result.errors != 0) {
+                    throw wsong::ws_exp(std::string(name) + " perf test FAILED.");
+                }
+            };
+
+            // shm pipe
+            std::srand(static_cast<unsigned>(time(nullptr)));
+            wsong::ipc::ShmPipeAttribute attribute = {
+                .key        = static_cast<key_t>(rand()),
+                .id         = 0,
+                .page_size  = 4096,
+                .capacity   = capacity,
+                .blocking   = blocking,
+                .mode       = 0600,
+                .description    = "shmpipe perf",
+            };
+            const key_t key = wsong::ipc::ShmPipe::create_shm_pipe(attribute);
+            perf_result_t shm_result;
+            try {
+                auto pipe_ptr = wsong::ipc::ShmPipe::get_shm_pipe(key);
+                shm_result = run([&]() {
+                                    for (uint64_t sent = 0; sent < total; sent += chunk) {
+                                        pipe_ptr->write(pattern.data(),std::min<uint64_t>(chunk,total - sent),1min);
+                                    }
+                                    pipe_ptr->close_writer();
+                                 },
+                                 [&](void* buffer, size_t size) {
+                                    return pipe_ptr->read(buffer,size,1min);
+                                 },
+                                 [](){});
+            } catch (...) {
+                wsong::ipc::ShmPipe::delete_shm_pipe(key);
+                throw;
+            }
+            wsong::ipc::ShmPipe::delete_shm_pipe(key);
+
+            // pipe(2) of the same capacity, as far as the system allows.
+            int fds[2];
+            if (pipe(fds) == -1) {
+                throw wsong::ws_exp(std::string("pipe failed with error:") + std::strerror(errno));
+            }
+            const int pipe_capacity = fcntl(fds[1],F_SETPIPE_SZ,static_cast<int>(capacity));
+            auto kernel_result = run([&]() {
+                                        close(fds[0]);
+                                        for (uint64_t sent = 0; sent < total; sent += chunk) {
+                                            const uint8_t* p = pattern.data();
+                                            size_t left = std::min<uint64_t>(chunk,total - sent);
+                                            while (left > 0) {
+                                                ssize_t n = write(fds[1],p,left);
+                                                if (n <= 0) {
+                                                    _exit(1);
+                                                }
+                                                p       += n;
+                                                left    -= n;
+                                            }
+                                        }
+                                        close(fds[1]);
+                                     },
+                                     [&](void* buffer, size_t size) {
+                                        ssize_t n = ::read(fds[0],buffer,size);
+                                        return n > 0 ? static_cast<size_t>(n) : 0;
+                                     },
+                                     [&]() {
+                                        // the reader only sees the end of file with the writer's end closed here.
+                                        close(fds[1]);
+                                     });
+            close(fds[0]);
+
+            std::cout << "chunk " << chunk << " Bytes, " << total << " Bytes streamed, capacity " << capacity
+                      << " Bytes" << (blocking ? " (blocking)" : " (polling)") << ", pipe(2) capacity "
+                      << (pipe_capacity > 0 ? std::to_string(pipe_capacity) : std::string("default")) << " Bytes"
+                      << std::endl;
+            report("shm pipe",shm_result);
+            report("pipe(2)",kernel_result);
+        }
+    },
+    {"shmpipe","unixping",
+        [](const Properties& props) {
+            const std::string path = PCONTAINS(props,"path") ? props.at("path") : "/tmp/wsong_unixping.sock";
+            const size_t size = PCONTAINS(props,"size") ? std::stoull(props.at("size"),nullptr,0) : 64;
+            const uint64_t count = PCONTAINS(props,"count") ? std::stoull(props.at("count"),nullptr,0) : 100000;
+            struct sockaddr_un addr;
+            std::memset(&addr,0,sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            if (size == 0 || path.size() >= sizeof(addr.sun_path)) {
+                throw wsong::ws_invalid_argument_exp("Invalid size or path.");
+            }
+            std::memcpy(addr.sun_path,path.c_str(),path.size());
+            // send or receive a whole message.
+            auto transfer = [size](int fd, uint8_t* buffer, bool sending) {
+                size_t done = 0;
+                while (done < size) {
+                    ssize_t n = sending ? ::send(fd,buffer + done,size - done,MSG_NOSIGNAL)
+                                        : ::recv(fd,buffer + done,size - done,0);
+                    if (n <= 0) {
+                        return false;
+                    }
+                    done += n;
+                }
+                return true;
+            };
+
+            unlink(path.c_str());
+            int listener = socket(AF_UNIX,SOCK_STREAM,0);
+            if (listener == -1 ||
+                bind(listener,reinterpret_cast<struct sockaddr*>(&addr),sizeof(addr)) == -1 ||
+                listen(listener,1) == -1) {
+                throw wsong::ws_exp(std::string("Failed to listen on " + path + ":") + std::strerror(errno));
+            }
+            pid_t pid = fork();
+            if (pid == 0) {
+                // the echo server
+                std::vector<uint8_t> buffer(size);
+                int fd = accept(listener,nullptr,nullptr);
+                while (fd != -1 && transfer(fd,buffer.data(),false) && transfer(fd,buffer.data(),true));
+                _exit(0);
+            }
+            close(listener);
+            int fd = socket(AF_UNIX,SOCK_STREAM,0);
+            if (fd == -1 || connect(fd,reinterpret_cast<struct sockaddr*>(&addr),sizeof(addr)) == -1) {
+                kill(pid,SIGKILL);
+                waitpid(pid,nullptr,0);
+                unlink(path.c_str());
+                throw wsong::ws_exp(std::string("Failed to connect to " + path + ":") + std::strerror(errno));
+            }
+            std::vector<uint8_t> buffer(size,0x5a);
+            std::vector<uint64_t> latencies;
+            latencies.reserve(count);
+            bool ok = true;
+            for (uint64_t i = 0; i < count && ok; i++) {
+                auto start = steady_clock::now();
+                ok = transfer(fd,buffer.data(),true) && transfer(fd,buffer.data(),false);
+                latencies.push_back(duration_cast<nanoseconds>(steady_clock::now() - start).count());
+            }
+            close(fd);
+            waitpid(pid,nullptr,0);
+            unlink(path.c_str());
+            if (!ok) {
+                throw wsong::ws_exp("unixping FAILED: the connection is broken.");
+            }
+            std::sort(latencies.begin(),latencies.end());
+            uint64_t sum = 0;
+            for (auto latency : latencies) {
+                sum += latency;
+            }
+            std::cout << count << " round trips of " << size << " Bytes over " << path << std::endl;
+            std::cout << "avg:  " << sum / count << " ns" << std::endl;
+            std::cout << "p50:  " << latencies[count / 2] << " ns" << std::endl;
+            std::cout << "p99:  " << latencies[count * 99 / 100] << " ns" << std::endl;
+            std::cout << "max:  " << latencies.back() << " ns" << std::endl;
+        }
+    },
     {nullptr,nullptr,{}}
 };
 
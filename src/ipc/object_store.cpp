@@ -0,0 +1,505 @@
+/**
+ * @file    object_store.cpp
+ * @brief   Object store implementation.
+ */
+
+#include <wsong/ipc/object_store.hpp>
+
+#include "process.hpp"
+
+#include <sys/types.h>
+#include <signal.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <asm-generic/hugetlb_encode.h>
+#endif
+
+#include <cstring>
+#include <cerrno>
+#include <string>
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+struct object_store_client_t {
+    std::atomic<int32_t>    pid;
+    uint64_t                start_time;
+} WS_CL_ALIGNED;
+
+enum object_state_t : uint32_t {
+    OS_FREE     = 0,
+    OS_WRITABLE = 1,
+    OS_SEALED   = 2,
+};
+
+struct object_store_object_t {
+    // generation in the higher 32 bits, reference count in the lower 32 bits.
+    std::atomic<uint64_t>   gen_ref;
+    std::atomic<uint32_t>   state;
+    uint32_t                first_block;
+    uint32_t                num_blocks;
+    uint64_t                size;
+} WS_CL_ALIGNED;
+
+#define OS_ROUND_UP(x,a)        ((((x) + (a) - 1) / (a)) * (a))
+#define OS_CLIENTS_BYTES(attr)  (static_cast<size_t>((attr).max_clients) * sizeof(object_store_client_t))
+#define OS_OBJECTS_BYTES(attr)  (static_cast<size_t>((attr).max_objects) * sizeof(object_store_object_t))
+#define OS_COUNTS_BYTES(attr)   OS_ROUND_UP(static_cast<size_t>((attr).max_clients) * (attr).max_objects * \
+                                    sizeof(std::atomic<uint16_t>), CACHELINE_SIZE)
+#define OS_BITMAP_BYTES(attr)   OS_ROUND_UP((((attr).num_blocks + 63) / 64) * sizeof(uint64_t), CACHELINE_SIZE)
+#define OS_METADATA_BYTES(attr) (sizeof(ObjectStoreHeader) + OS_CLIENTS_BYTES(attr) + OS_OBJECTS_BYTES(attr) + \
+                                    OS_COUNTS_BYTES(attr) + OS_BITMAP_BYTES(attr))
+
+#define OS_HEADER               const_cast<ObjectStoreHeader*>(this->info_ptr)
+#define OS_ATTRIBUTE            (this->info_ptr->info.attribute)
+#define OS_CLIENTS              reinterpret_cast<object_store_client_t*>( \
+                                    reinterpret_cast<uintptr_t>(this->info_ptr) + sizeof(ObjectStoreHeader))
+#define OS_OBJECTS              reinterpret_cast<object_store_object_t*>( \
+                                    reinterpret_cast<uintptr_t>(OS_CLIENTS) + OS_CLIENTS_BYTES(OS_ATTRIBUTE))
+#define OS_COUNT(c,o)           (reinterpret_cast<std::atomic<uint16_t>*>( \
+                                    reinterpret_cast<uintptr_t>(OS_OBJECTS) + OS_OBJECTS_BYTES(OS_ATTRIBUTE)) \
+                                    [static_cast<size_t>(c) * OS_ATTRIBUTE.max_objects + (o)])
+#define OS_BITMAP               reinterpret_cast<uint64_t*>( \
+                                    reinterpret_cast<uintptr_t>(OS_OBJECTS) + OS_OBJECTS_BYTES(OS_ATTRIBUTE) + \
+                                    OS_COUNTS_BYTES(OS_ATTRIBUTE))
+#define OS_BLOCK_ADDRESS(b)     reinterpret_cast<void*>( \
+                                    reinterpret_cast<uintptr_t>(this->data_ptr) + \
+                                    static_cast<size_t>(b) * OS_ATTRIBUTE.block_size)
+
+#define OS_HANDLE(gen,client,object) \
+                                ((static_cast<uint64_t>(gen) << 32) | (static_cast<uint64_t>(client) << 24) | (object))
+#define OS_HANDLE_OBJECT(h)     static_cast<uint32_t>((h) & 0xffffff)
+#define OS_HANDLE_CLIENT(h)     static_cast<uint32_t>(((h) >> 24) & 0xff)
+#define OS_HANDLE_GEN(h)        static_cast<uint32_t>((h) >> 32)
+#define OS_GEN(gr)              static_cast<uint32_t>((gr) >> 32)
+#define OS_REF(gr)              static_cast<uint32_t>((gr) & 0xffffffff)
+
+/**
+ * @endcond
+ */
+
+ObjectStore::ObjectStore(void* mem_ptr, void* data_ptr, bool read_only) :
+    info_ptr(reinterpret_cast<const ObjectStoreHeader*>(mem_ptr)),
+    data_ptr(data_ptr),
+    read_only(read_only),
+    client(OS_ATTRIBUTE.max_clients) {
+    const pid_t pid = getpid();
+    const uint64_t start_time = process_start_time(pid);
+    // free the slots of dead clients first.
+    reclaim();
+    lock();
+    for (this->client = 0; this->client < OS_ATTRIBUTE.max_clients; this->client++) {
+        if (OS_CLIENTS[this->client].pid.load(std::memory_order_relaxed) == 0) {
+            OS_CLIENTS[this->client].start_time = start_time;
+            OS_CLIENTS[this->client].pid.store(pid,std::memory_order_release);
+            break;
+        }
+    }
+    unlock();
+    if (this->client == OS_ATTRIBUTE.max_clients) {
+        shmdt(this->data_ptr);
+        shmdt(this->info_ptr);
+        throw ws_exp("Object store is full: all " + std::to_string(OS_ATTRIBUTE.max_clients) +
+                     " client slots are in use.");
+    }
+}
+
+ObjectStore::~ObjectStore() {
+    lock();
+    reclaim_client(this->client);
+    unlock();
+    shmdt(this->data_ptr);
+    shmdt(this->info_ptr);
+}
+
+void ObjectStore::lock() {
+    int ret = pthread_mutex_lock(&OS_HEADER->info.mutex);
+    if (ret == EOWNERDEAD) {
+        // The owner died in the critical section. The protected updates are short, so we take over the state as is.
+        pthread_mutex_consistent(&OS_HEADER->info.mutex);
+    } else if (ret != 0) {
+        throw ws_exp(std::string("pthread_mutex_lock failed with error:") + std::strerror(ret));
+    }
+}
+
+void ObjectStore::unlock() {
+    pthread_mutex_unlock(&OS_HEADER->info.mutex);
+}
+
+ObjectStoreAttribute ObjectStore::attribute() {
+    return OS_ATTRIBUTE;
+}
+
+ObjectStoreStats ObjectStore::stats() {
+    ObjectStoreStats stats;
+    stats.objects       = OS_HEADER->info.objects.load(std::memory_order_relaxed);
+    stats.used_blocks   = OS_HEADER->info.used_blocks.load(std::memory_order_relaxed);
+    stats.clients       = 0;
+    for (uint32_t c = 0; c < OS_ATTRIBUTE.max_clients; c++) {
+        if (OS_CLIENTS[c].pid.load(std::memory_order_relaxed) != 0) {
+            stats.clients ++;
+        }
+    }
+    return stats;
+}
+
+uint32_t ObjectStore::validate(ObjectHandle handle) {
+    const uint32_t object = OS_HANDLE_OBJECT(handle);
+    if (object >= OS_ATTRIBUTE.max_objects || OS_HANDLE_CLIENT(handle) >= OS_ATTRIBUTE.max_clients) {
+        throw ws_invalid_argument_exp("Invalid object handle:" + std::to_string(handle));
+    }
+    const uint64_t gen_ref = OS_OBJECTS[object].gen_ref.load(std::memory_order_acquire);
+    if (OS_GEN(gen_ref) != OS_HANDLE_GEN(handle) || OS_REF(gen_ref) == 0) {
+        throw ws_invalid_argument_exp("Stale object handle:" + std::to_string(handle));
+    }
+    return object;
+}
+
+ObjectHandle ObjectStore::create(uint64_t size) {
+    if (this->read_only) {
+        throw ws_exp("Cannot create objects in a read-only object store.");
+    }
+    if (size == 0) {
+        throw ws_invalid_argument_exp("Invalid object size:0");
+    }
+    const uint64_t num_blocks = (size + OS_ATTRIBUTE.block_size - 1) / OS_ATTRIBUTE.block_size;
+    if (num_blocks > OS_ATTRIBUTE.num_blocks) {
+        throw ws_invalid_argument_exp("Object size " + std::to_string(size) + " exceeds the object store.");
+    }
+
+    lock();
+    // find a free slot
+    uint32_t object = OS_ATTRIBUTE.max_objects;
+    for (uint32_t i = 0; i < OS_ATTRIBUTE.max_objects; i++) {
+        const uint32_t o = (OS_HEADER->info.next_object + i) % OS_ATTRIBUTE.max_objects;
+        if (OS_OBJECTS[o].state.load(std::memory_order_relaxed) == OS_FREE) {
+            object = o;
+            break;
+        }
+    }
+    // find contiguous free blocks, next-fit.
+    uint64_t* bitmap = OS_BITMAP;
+    uint32_t first_block = OS_ATTRIBUTE.num_blocks;
+    uint32_t run = 0;
+    for (uint64_t i = 0; object < OS_ATTRIBUTE.max_objects && i < OS_ATTRIBUTE.num_blocks + num_blocks; i++) {
+        const uint32_t b = (OS_HEADER->info.next_block + i) % OS_ATTRIBUTE.num_blocks;
+        if (b == 0) {
+            run = 0; // a run does not wrap around.
+        }
+        if ((b % 64) == 0 && bitmap[b / 64] == ~0ull) {
+            run = 0;
+            i += 63;
+            continue;
+        }
+        if (bitmap[b / 64] & (1ull << (b % 64))) {
+            run = 0;
+        } else if (++run == num_blocks) {
+            first_block = b + 1 - num_blocks;
+            break;
+        }
+    }
+    if (object == OS_ATTRIBUTE.max_objects || first_block == OS_ATTRIBUTE.num_blocks) {
+        unlock();
+        throw ws_exp("Object store is out of " + std::string(object == OS_ATTRIBUTE.max_objects ? "slots" : "space") +
+                     " for an object of " + std::to_string(size) + " bytes.");
+    }
+    for (uint32_t b = first_block; b < first_block + num_blocks; b++) {
+        bitmap[b / 64] |= (1ull << (b % 64));
+    }
+    object_store_object_t& entry = OS_OBJECTS[object];
+    uint32_t gen = OS_GEN(entry.gen_ref.load(std::memory_order_relaxed)) + 1;
+    if (gen == 0) {
+        gen = 1;
+    }
+    entry.first_block   = first_block;
+    entry.num_blocks    = num_blocks;
+    entry.size          = size;
+    entry.state.store(OS_WRITABLE,std::memory_order_relaxed);
+    OS_COUNT(this->client,object).store(1,std::memory_order_relaxed);
+    entry.gen_ref.store((static_cast<uint64_t>(gen) << 32) | 1,std::memory_order_release);
+    OS_HEADER->info.next_object = (object + 1) % OS_ATTRIBUTE.max_objects;
+    OS_HEADER->info.next_block  = (first_block + num_blocks) % OS_ATTRIBUTE.num_blocks;
+    OS_HEADER->info.objects.fetch_add(1,std::memory_order_relaxed);
+    OS_HEADER->info.used_blocks.fetch_add(num_blocks,std::memory_order_relaxed);
+    unlock();
+
+    return OS_HANDLE(gen,this->client,object);
+}
+
+void* ObjectStore::data(ObjectHandle handle) {
+    const uint32_t object = validate(handle);
+    if (this->read_only || OS_OBJECTS[object].state.load(std::memory_order_relaxed) != OS_WRITABLE) {
+        throw ws_exp("Object " + std::to_string(handle) + " is not writable.");
+    }
+    return OS_BLOCK_ADDRESS(OS_OBJECTS[object].first_block);
+}
+
+void ObjectStore::seal(ObjectHandle handle) {
+    const uint32_t object = validate(handle);
+    uint32_t expected = OS_WRITABLE;
+    // release: the content is visible to whoever sees the object sealed.
+    if (!OS_OBJECTS[object].state.compare_exchange_strong(expected,OS_SEALED,std::memory_order_release)) {
+        throw ws_exp("Object " + std::to_string(handle) + " is not writable.");
+    }
+}
+
+const void* ObjectStore::get(ObjectHandle handle) {
+    const uint32_t object = validate(handle);
+    if (OS_OBJECTS[object].state.load(std::memory_order_acquire) != OS_SEALED) {
+        throw ws_exp("Object " + std::to_string(handle) + " is not sealed.");
+    }
+    return OS_BLOCK_ADDRESS(OS_OBJECTS[object].first_block);
+}
+
+uint64_t ObjectStore::size(ObjectHandle handle) {
+    return OS_OBJECTS[validate(handle)].size;
+}
+
+ObjectHandle ObjectStore::acquire(ObjectHandle handle) {
+    const uint32_t object = validate(handle);
+    uint64_t gen_ref = OS_OBJECTS[object].gen_ref.load(std::memory_order_relaxed);
+    do {
+        if (OS_GEN(gen_ref) != OS_HANDLE_GEN(handle) || OS_REF(gen_ref) == 0) {
+            throw ws_invalid_argument_exp("Stale object handle:" + std::to_string(handle));
+        }
+    } while (!OS_OBJECTS[object].gen_ref.compare_exchange_weak(gen_ref,gen_ref + 1,std::memory_order_acquire));
+    OS_COUNT(this->client,object).fetch_add(1,std::memory_order_relaxed);
+    return OS_HANDLE(OS_HANDLE_GEN(handle),this->client,object);
+}
+
+ObjectHandle ObjectStore::adopt(ObjectHandle handle) {
+    const uint32_t object = validate(handle);
+    const uint32_t sender = OS_HANDLE_CLIENT(handle);
+    if (sender == this->client) {
+        return handle;
+    }
+    // take the reference away from the sender, unless it has been reclaimed.
+    std::atomic<uint16_t>& count = OS_COUNT(sender,object);
+    uint16_t expected = count.load(std::memory_order_relaxed);
+    do {
+        if (expected == 0) {
+            throw ws_invalid_argument_exp("Object reference " + std::to_string(handle) + " has been reclaimed.");
+        }
+    } while (!count.compare_exchange_weak(expected,expected - 1,std::memory_order_acquire));
+    OS_COUNT(this->client,object).fetch_add(1,std::memory_order_relaxed);
+    return OS_HANDLE(OS_HANDLE_GEN(handle),this->client,object);
+}
+
+void ObjectStore::release(ObjectHandle handle) {
+    const uint32_t object = validate(handle);
+    std::atomic<uint16_t>& count = OS_COUNT(OS_HANDLE_CLIENT(handle),object);
+    uint16_t expected = count.load(std::memory_order_relaxed);
+    do {
+        if (expected == 0) {
+            throw ws_invalid_argument_exp("Object reference " + std::to_string(handle) + " has been reclaimed.");
+        }
+    } while (!count.compare_exchange_weak(expected,expected - 1,std::memory_order_release));
+    drop_references(object,1);
+}
+
+void ObjectStore::drop_references(uint32_t object, uint32_t count) {
+    // acq_rel: the last holder sees all reads of the other holders done before freeing the blocks.
+    const uint64_t gen_ref = OS_OBJECTS[object].gen_ref.fetch_sub(count,std::memory_order_acq_rel);
+    if (OS_REF(gen_ref) == count) {
+        free_object(object);
+    }
+}
+
+void ObjectStore::free_object(uint32_t object) {
+    // The mutex is recursive, so this is safe from reclaim_client() too.
+    lock();
+    object_store_object_t& entry = OS_OBJECTS[object];
+    uint64_t* bitmap = OS_BITMAP;
+    for (uint32_t b = entry.first_block; b < entry.first_block + entry.num_blocks; b++) {
+        bitmap[b / 64] &= ~(1ull << (b % 64));
+    }
+    OS_HEADER->info.used_blocks.fetch_sub(entry.num_blocks,std::memory_order_relaxed);
+    OS_HEADER->info.objects.fetch_sub(1,std::memory_order_relaxed);
+    entry.state.store(OS_FREE,std::memory_order_release);
+    unlock();
+}
+
+void ObjectStore::reclaim_client(uint32_t client) {
+    for (uint32_t o = 0; o < OS_ATTRIBUTE.max_objects; o++) {
+        const uint16_t count = OS_COUNT(client,o).exchange(0,std::memory_order_acq_rel);
+        if (count > 0) {
+            drop_references(o,count);
+        }
+    }
+    OS_CLIENTS[client].pid.store(0,std::memory_order_release);
+}
+
+uint32_t ObjectStore::reclaim() {
+    uint32_t reclaimed = 0;
+    // under the mutex, so that a client slot is not reused while its references are being dropped.
+    lock();
+    for (uint32_t c = 0; c < OS_ATTRIBUTE.max_clients; c++) {
+        const pid_t pid = OS_CLIENTS[c].pid.load(std::memory_order_acquire);
+        if (pid == 0 || c == this->client) {
+            continue;
+        }
+        if (process_start_time(pid) != OS_CLIENTS[c].start_time) {
+            reclaim_client(c);
+            reclaimed ++;
+        }
+    }
+    unlock();
+    return reclaimed;
+}
+
+key_t ObjectStore::create_object_store(const ObjectStoreAttribute& attribute) {
+    // validate check
+    if ((attribute.block_size & (attribute.block_size - 1)) || (attribute.block_size < CACHELINE_SIZE)) {
+        throw ws_invalid_argument_exp("Invalid block_size:" + std::to_string(attribute.block_size));
+    }
+    if (attribute.num_blocks == 0) {
+        throw ws_invalid_argument_exp("Invalid num_blocks:0");
+    }
+    if (attribute.max_objects == 0 || attribute.max_objects > WS_OBJECT_STORE_MAX_OBJECTS) {
+        throw ws_invalid_argument_exp("Invalid max_objects:" + std::to_string(attribute.max_objects));
+    }
+    if (attribute.max_clients == 0 || attribute.max_clients > WS_OBJECT_STORE_MAX_CLIENTS) {
+        throw ws_invalid_argument_exp("Invalid max_clients:" + std::to_string(attribute.max_clients));
+    }
+
+    int data_shmflg = IPC_CREAT | IPC_EXCL | 0644; // the default permission
+    switch (attribute.page_size) {
+    case 1<<12:
+        break;
+#if defined(__linux__)
+    case 1<<21:
+        data_shmflg |= (SHM_HUGETLB | (HUGETLB_FLAG_ENCODE_2MB));
+        break;
+    case 1<<30:
+        data_shmflg |= (SHM_HUGETLB | (HUGETLB_FLAG_ENCODE_1GB));
+        break;
+#endif
+    default:
+        throw ws_invalid_argument_exp("Invalid page_size:" + std::to_string(attribute.page_size));
+    }
+
+    // create the metadata segment
+    int shmid = shmget(attribute.key,OS_ROUND_UP(OS_METADATA_BYTES(attribute),4096ul),IPC_CREAT | IPC_EXCL | 0644);
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") +
+                     std::strerror(errno));
+    }
+
+    // create the data segment, which is only known by its id.
+    int data_shmid = shmget(IPC_PRIVATE,OS_ROUND_UP(static_cast<size_t>(attribute.num_blocks) * attribute.block_size,
+                                                    static_cast<size_t>(attribute.page_size)),data_shmflg);
+    if (data_shmid == -1) {
+        int err = errno;
+        shmctl(shmid,IPC_RMID,nullptr);
+        throw ws_exp(std::string("shmget for data failed with error:") +
+                     std::strerror(err));
+    }
+
+    // lock memory
+    if (shmctl(shmid,SHM_LOCK,nullptr) == -1 || shmctl(data_shmid,SHM_LOCK,nullptr) == -1) {
+        int err = errno;
+        shmctl(shmid,IPC_RMID,nullptr);
+        shmctl(data_shmid,IPC_RMID,nullptr);
+        errno = err;
+        throw ws_exp(std::string("pinning pages: shmctl failed with error:") +
+                     std::strerror(err));
+    }
+
+    // get key
+    struct shmid_ds buf;
+    if (shmctl(shmid,IPC_STAT,&buf) == -1) {
+        int err = errno;
+        shmctl(shmid,IPC_RMID,nullptr);
+        shmctl(data_shmid,IPC_RMID,nullptr);
+        errno = err;
+        throw ws_exp(std::string("get stat: shmctl failed with error:") +
+                     std::strerror(err));
+    }
+
+    // attach to memory region
+    void* ptr = shmat(shmid,nullptr,0);
+    if (ptr == (void*)-1) {
+        int err = errno;
+        shmctl(shmid,IPC_RMID,nullptr);
+        shmctl(data_shmid,IPC_RMID,nullptr);
+        errno = err;
+        throw ws_exp(std::string("attach: shmat failed with error:") +
+                     std::strerror(err));
+    }
+
+    // initialize, the shared memory is zero-filled so all objects, blocks and client slots are free.
+    ObjectStoreHeader* osh      = reinterpret_cast<ObjectStoreHeader*>(ptr);
+    osh->info.attribute         = attribute;
+    osh->info.attribute.id      = shmid;
+    osh->info.attribute.data_id = data_shmid;
+    osh->info.attribute.key     = buf.shm_perm.__key;
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr,PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex_attr,PTHREAD_MUTEX_ROBUST);
+    pthread_mutexattr_settype(&mutex_attr,PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&osh->info.mutex,&mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+
+    // detach memory region
+    if (shmdt(ptr) == -1) {
+        throw ws_exp(std::string("detach: shmdt failed with error:") +
+                     std::strerror(errno));
+    }
+
+    return buf.shm_perm.__key;
+}
+
+void ObjectStore::delete_object_store(const key_t key) {
+    int shmid = shmget(key,0,0);
+
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") +
+                     std::strerror(errno));
+    }
+
+    void* ptr = shmat(shmid,nullptr,SHM_RDONLY);
+    if (ptr == (void*)-1) {
+        throw ws_exp(std::string("attach: shmat failed with error:") +
+                     std::strerror(errno));
+    }
+    const int data_shmid = reinterpret_cast<ObjectStoreHeader*>(ptr)->info.attribute.data_id;
+    shmdt(ptr);
+
+    if (shmctl(data_shmid,IPC_RMID,nullptr) == -1 || shmctl(shmid,IPC_RMID,nullptr) == -1) {
+        throw ws_exp(std::string("delete shared memory: shmctl failed with error:") +
+                     std::strerror(errno));
+    }
+}
+
+std::unique_ptr<ObjectStore> ObjectStore::get_object_store(const key_t key, bool read_only) {
+    int shmid = shmget(key,0,0);
+
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") +
+                     std::strerror(errno));
+    }
+
+    void* mem_ptr = shmat(shmid,nullptr,0);
+    if (mem_ptr == (void*)-1) {
+        throw ws_exp(std::string("Memory attach failed: shmat failed with error:") +
+                     std::strerror(errno));
+    }
+
+    void* data_ptr = shmat(reinterpret_cast<ObjectStoreHeader*>(mem_ptr)->info.attribute.data_id,nullptr,
+                           read_only ? SHM_RDONLY : 0);
+    if (data_ptr == (void*)-1) {
+        int err = errno;
+        shmdt(mem_ptr);
+        throw ws_exp(std::string("Data attach failed: shmat failed with error:") +
+                     std::strerror(err));
+    }
+
+    return std::unique_ptr<ObjectStore>(new ObjectStore(mem_ptr,data_ptr,read_only));
+}
+
+}
+}
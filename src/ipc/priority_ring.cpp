@@ -0,0 +1,346 @@
+/**
+ * @file    priority_ring.cpp
+ * @brief   Priority ring implementation.
+ */
+
+#include <wsong/ipc/priority_ring.hpp>
+
+#include <sys/types.h>
+#if defined(__linux__)
+#include <asm-generic/hugetlb_encode.h>
+#endif
+
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <string>
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+struct priority_lane_t {
+    union {
+        std::atomic<uint32_t>   head;
+        uint8_t                 cacheline[CACHELINE_SIZE];
+    } head_cl WS_CL_ALIGNED;
+    union {
+        std::atomic<uint32_t>   tail;
+        uint8_t                 cacheline[CACHELINE_SIZE];
+    } tail_cl WS_CL_ALIGNED;
+    union {
+        std::atomic<bool>       lock;
+        uint8_t                 cacheline[CACHELINE_SIZE];
+    } producer_lock_cl WS_CL_ALIGNED;
+};
+
+#define PR_ROUND_UP(x,a)        ((((x) + (a) - 1) / (a)) * (a))
+#define PR_LANE_BYTES(attr)     PR_ROUND_UP(sizeof(priority_lane_t) + \
+                                    static_cast<size_t>((attr).capacity) * (attr).entry_size, CACHELINE_SIZE)
+
+#define PR_ATTRIBUTE            (this->info_ptr->info.attribute)
+#define PR_NONEMPTY             (const_cast<PriorityRingHeader*>(this->info_ptr)->info.nonempty)
+#define PR_LANE(l)              reinterpret_cast<priority_lane_t*>( \
+                                    reinterpret_cast<uintptr_t>(this->info_ptr) + sizeof(PriorityRingHeader) + \
+                                    static_cast<size_t>(l) * PR_LANE_BYTES(PR_ATTRIBUTE) \
+                                )
+#define PR_BUFFER(lane,idx)     reinterpret_cast<void*>( \
+                                    reinterpret_cast<uintptr_t>(lane) + sizeof(priority_lane_t) + \
+                                    ((idx) % PR_ATTRIBUTE.capacity) * PR_ATTRIBUTE.entry_size \
+                                )
+#define PR_VALIDATE_LANE(l)     if ((l) >= PR_ATTRIBUTE.num_lanes) { \
+                                    throw ws_invalid_argument_exp("Invalid priority ring lane:" + std::to_string(l)); \
+                                }
+/**
+ * @endcond
+ */
+
+/*
+ * The summary word protocol
+ * =========================
+ * A lane's bit is set by the producers and cleared by the consumer. The consumer clears the bit when it drains the
+ * lane, then re-checks the tail and sets the bit again if the lane has become non-empty in the meantime. A producer
+ * publishes the tail with a release store, then sets the bit unless it reads it set. Nothing orders the producer's
+ * tail store before its read of the bit, so it may still read the bit set after the consumer cleared it and missed
+ * the new tail, and the lane is left non-empty with its bit clear. Instead of a full fence on every produce, the
+ * consumer pays for that race: it remembers the lanes it cleared, and re-checks their tails on every pass until their
+ * bits are set again, including while it spins on an empty summary word. A missed entry is therefore picked up as
+ * soon as the producer's tail store becomes visible. A set bit for an empty lane only costs the consumer one extra
+ * probe. In steady state under load the bit stays set and the producers only read the summary word.
+ */
+PriorityRing::PriorityRing(void* mem_ptr) :
+    info_ptr(reinterpret_cast<const PriorityRingHeader*>(mem_ptr)),
+    current_lane(0),
+    credits(0),
+    strict_lanes(0),
+    cleared(0) {
+    if (PR_ATTRIBUTE.drain_policy == WS_DRAIN_WEIGHTED) {
+        for (uint32_t l = 0; l < PR_ATTRIBUTE.num_lanes; l++) {
+            if (PR_ATTRIBUTE.weights[l] == 0) {
+                this->strict_lanes |= (1ull << l);
+            }
+        }
+    }
+}
+
+PriorityRing::~PriorityRing() {
+    shmdt(this->info_ptr);
+}
+
+PriorityRingAttribute PriorityRing::attribute() {
+    return PR_ATTRIBUTE;
+}
+
+void PriorityRing::produce(uint32_t lane_id, const void* buffer, uint16_t size, uint64_t timeout_ns) {
+    PR_VALIDATE_LANE(lane_id);
+    if (size > PR_ATTRIBUTE.entry_size || size == 0) {
+        throw ws_invalid_argument_exp("Priority ring produce() is called with invalid size.");
+    }
+
+    priority_lane_t* lane = PR_LANE(lane_id);
+    // lock
+    if (PR_ATTRIBUTE.multiple_producer) {
+        bool expected = false;
+        while(!lane->producer_lock_cl.lock.compare_exchange_weak(expected,true,std::memory_order_acquire)) {
+            expected = false;
+        }
+    }
+
+    // produce
+    const uint32_t tail = lane->tail_cl.tail.load(std::memory_order_relaxed);
+    bool succ = (tail - lane->head_cl.head.load(std::memory_order_acquire) < PR_ATTRIBUTE.capacity - 1);
+    if (!succ) {
+        const auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(timeout_ns);
+        do {
+            succ = (tail - lane->head_cl.head.load(std::memory_order_acquire) < PR_ATTRIBUTE.capacity - 1);
+        } while (!succ && std::chrono::steady_clock::now() < end);
+    }
+    if (succ) {
+        std::memcpy(PR_BUFFER(lane,tail),buffer,size);
+        lane->tail_cl.tail.store(tail + 1,std::memory_order_release);
+    }
+
+    // unlock
+    if (PR_ATTRIBUTE.multiple_producer) {
+        lane->producer_lock_cl.lock.store(false,std::memory_order_release);
+    }
+
+    if (!succ) {
+        throw ws_timeout_exp("Priority ring produce call timeout.");
+    }
+
+    // publish the lane in the summary word; a stale set bit is caught up by the consumer.
+    const uint64_t bit = (1ull << lane_id);
+    if ((PR_NONEMPTY.load(std::memory_order_relaxed) & bit) == 0) {
+        PR_NONEMPTY.fetch_or(bit,std::memory_order_release);
+    }
+}
+
+uint32_t PriorityRing::pick_lane(uint64_t nonempty) {
+    if (PR_ATTRIBUTE.drain_policy != WS_DRAIN_WEIGHTED) {
+        return __builtin_ctzll(nonempty);
+    }
+    const uint64_t urgent = nonempty & this->strict_lanes;
+    if (urgent) {
+        return __builtin_ctzll(urgent);
+    }
+    // weighted round-robin: stay on the current lane until its credits run out or it drains.
+    if (this->credits == 0 || (nonempty & (1ull << this->current_lane)) == 0) {
+        const uint64_t after = (this->current_lane + 1 < WS_PRIORITY_RING_MAX_LANES) ?
+                               (nonempty & (~0ull << (this->current_lane + 1))) : 0;
+        this->current_lane = __builtin_ctzll(after ? after : nonempty);
+        this->credits = PR_ATTRIBUTE.weights[this->current_lane];
+    }
+    return this->current_lane;
+}
+
+uint32_t PriorityRing::consume(void* buffer, uint16_t size, uint64_t timeout_ns) {
+    if (size > PR_ATTRIBUTE.entry_size || size == 0) {
+        throw ws_invalid_argument_exp("Priority ring consume() is called with invalid size.");
+    }
+
+    bool timing = false;
+    std::chrono::steady_clock::time_point end;
+    while (true) {
+        uint64_t nonempty = PR_NONEMPTY.load(std::memory_order_acquire);
+        // the lanes cleared by us and not set since may have been refilled by a producer reading a stale bit.
+        this->cleared &= ~nonempty;
+        for (uint64_t stale = this->cleared; stale != 0; stale &= (stale - 1)) {
+            const uint32_t stale_id = __builtin_ctzll(stale);
+            priority_lane_t* lane = PR_LANE(stale_id);
+            if (lane->tail_cl.tail.load(std::memory_order_acquire) !=
+                lane->head_cl.head.load(std::memory_order_relaxed)) {
+                const uint64_t bit = (1ull << stale_id);
+                PR_NONEMPTY.fetch_or(bit,std::memory_order_relaxed);
+                nonempty |= bit;
+                this->cleared &= ~bit;
+            }
+        }
+        if (nonempty == 0) {
+            // slow path: wait for the producers until timeout.
+            if (!timing) {
+                end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(timeout_ns);
+                timing = true;
+            } else if (std::chrono::steady_clock::now() >= end) {
+                throw ws_timeout_exp("Priority ring consume call timeout.");
+            }
+            continue;
+        }
+
+        const uint32_t lane_id = pick_lane(nonempty);
+        priority_lane_t* lane = PR_LANE(lane_id);
+        // the consumer is the only writer of head.
+        uint32_t head = lane->head_cl.head.load(std::memory_order_relaxed);
+        const uint32_t tail = lane->tail_cl.tail.load(std::memory_order_acquire);
+        const bool found = (tail != head);
+        if (found) {
+            std::memcpy(buffer,PR_BUFFER(lane,head),size);
+            lane->head_cl.head.store(++head,std::memory_order_release);
+            if ((this->strict_lanes & (1ull << lane_id)) == 0 && this->credits > 0) {
+                this->credits --;
+            }
+        }
+        if (tail == head) {
+            // drained: clear the bit and re-check.
+            const uint64_t bit = (1ull << lane_id);
+            PR_NONEMPTY.fetch_and(~bit,std::memory_order_acq_rel);
+            if (lane->tail_cl.tail.load(std::memory_order_acquire) != head) {
+                PR_NONEMPTY.fetch_or(bit,std::memory_order_relaxed);
+            } else {
+                this->cleared |= bit;
+            }
+        }
+        if (found) {
+            return lane_id;
+        }
+    }
+}
+
+uint64_t PriorityRing::nonempty_lanes() {
+    return PR_NONEMPTY.load(std::memory_order_acquire);
+}
+
+uint32_t PriorityRing::size(uint32_t lane_id) {
+    PR_VALIDATE_LANE(lane_id);
+    priority_lane_t* lane = PR_LANE(lane_id);
+    return lane->tail_cl.tail.load(std::memory_order_acquire) - lane->head_cl.head.load(std::memory_order_acquire);
+}
+
+bool PriorityRing::empty() {
+    return nonempty_lanes() == 0;
+}
+
+key_t PriorityRing::create_priority_ring(const PriorityRingAttribute& attribute) {
+    // validate check
+    if ((attribute.entry_size & (attribute.entry_size - 1)) || (attribute.entry_size == 0)) {
+        throw ws_invalid_argument_exp("Invalid entry_size:" + std::to_string(attribute.entry_size));
+    }
+    if ((attribute.capacity & (attribute.capacity - 1)) || (attribute.capacity < 2)) {
+        throw ws_invalid_argument_exp("Invalid capacity:" + std::to_string(attribute.capacity));
+    }
+    if (attribute.num_lanes == 0 || attribute.num_lanes > WS_PRIORITY_RING_MAX_LANES) {
+        throw ws_invalid_argument_exp("Invalid num_lanes:" + std::to_string(attribute.num_lanes));
+    }
+    if (attribute.drain_policy != WS_DRAIN_STRICT && attribute.drain_policy != WS_DRAIN_WEIGHTED) {
+        throw ws_invalid_argument_exp("Invalid drain_policy:" + std::to_string(attribute.drain_policy));
+    }
+
+    // create priority ring memory
+    int shmflg = IPC_CREAT | IPC_EXCL | 0644; // the default permission
+    switch (attribute.page_size) {
+    case 1<<12:
+        break;
+#if defined(__linux__)
+    case 1<<21:
+        shmflg |= (SHM_HUGETLB | (HUGETLB_FLAG_ENCODE_2MB));
+        break;
+    case 1<<30:
+        shmflg |= (SHM_HUGETLB | (HUGETLB_FLAG_ENCODE_1GB));
+        break;
+#endif
+    default:
+        throw ws_invalid_argument_exp("Invalid page_size:" + std::to_string(attribute.page_size));
+    }
+
+    size_t shared_memory_region_size = PR_ROUND_UP(sizeof(PriorityRingHeader)
+                                                   + attribute.num_lanes * PR_LANE_BYTES(attribute),
+                                                   static_cast<size_t>(attribute.page_size));
+
+    int shmid = shmget(attribute.key,shared_memory_region_size,shmflg);
+
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") +
+                     std::strerror(errno));
+    }
+
+    // lock memory
+    if (shmctl(shmid,SHM_LOCK,nullptr) == -1) {
+        throw ws_exp(std::string("pinning pages: shmctl failed with error:") +
+                     std::strerror(errno));
+    }
+
+    // get key
+    struct shmid_ds buf;
+    if (shmctl(shmid,IPC_STAT,&buf) == -1) {
+        throw ws_exp(std::string("get stat: shmctl failed with error:") +
+                     std::strerror(errno));
+    }
+
+    // attach to memory region
+    void* ptr = shmat(shmid,nullptr,0);
+    if (ptr == (void*)-1) {
+        throw ws_exp(std::string("attach: shmat failed with error:") +
+                     std::strerror(errno));
+    }
+
+    // initialize, the shared memory is zero-filled so all lanes are empty.
+    PriorityRingHeader* prh = reinterpret_cast<PriorityRingHeader*>(ptr);
+    prh->info.attribute     = attribute;
+    prh->info.attribute.id  = shmid;
+    prh->info.attribute.key = buf.shm_perm.__key;
+    prh->info.nonempty.store(0);
+
+    // detach memory region
+    if (shmdt(ptr) == -1) {
+        throw ws_exp(std::string("detach: shmdt failed with error:") +
+                     std::strerror(errno));
+    }
+
+    return buf.shm_perm.__key;
+}
+
+void PriorityRing::delete_priority_ring(const key_t key) {
+    int shmid = shmget(key,0,0);
+
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") +
+                     std::strerror(errno));
+    }
+
+    if (shmctl(shmid,IPC_RMID,nullptr) == -1) {
+        throw ws_exp(std::string("delete shared memory: shmctl failed with error:") +
+                     std::strerror(errno));
+    }
+}
+
+std::unique_ptr<PriorityRing> PriorityRing::get_priority_ring(const key_t key) {
+    int shmid = shmget(key,0,0);
+
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") +
+                     std::strerror(errno));
+    }
+
+    void* mem_ptr = shmat(shmid,nullptr,0);
+    if (mem_ptr == (void*)-1) {
+        throw ws_exp(std::string("Memory attach failed: shmat failed with error:") +
+                     std::strerror(errno));
+    }
+
+    return std::unique_ptr<PriorityRing>(new PriorityRing(mem_ptr));
+}
+
+}
+}
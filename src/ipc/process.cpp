@@ -0,0 +1,39 @@
+/**
+ * @file    process.cpp
+ * @brief   Process liveness implementation.
+ */
+
+#include "process.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace wsong {
+namespace ipc {
+
+uint64_t process_start_time(pid_t pid) {
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if (!stat.is_open() || !std::getline(stat,line)) {
+        return 0;
+    }
+    // skip "pid (comm)", the comm may contain spaces.
+    auto pos = line.rfind(')');
+    if (pos == std::string::npos || pos + 2 >= line.size()) {
+        return 0;
+    }
+    std::istringstream fields(line.substr(pos + 2));
+    std::string field;
+    // a zombie is dead to us, though its parent has not waited for it yet.
+    if (!(fields >> field) || field == "Z" || field == "X") {
+        return 0;
+    }
+    // starttime is the 22nd field, the 19th after state.
+    for (int i = 0; i < 19 && (fields >> field); i++);
+    return std::strtoull(field.c_str(),nullptr,10);
+}
+
+}
+}
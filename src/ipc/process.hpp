@@ -0,0 +1,27 @@
+#pragma once
+
+/**
+ * @file    process.hpp
+ * @brief   Process liveness, shared by the IPCs that reclaim the slots of dead clients. It is not installed.
+ */
+
+#include <sys/types.h>
+#include <cinttypes>
+
+#include <wsong/common.h>
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @fn uint64_t process_start_time(pid_t pid)
+ * @brief   Get the start time of a process in clock ticks since boot, which tells a reused pid from the original
+ * process.
+ * @param[in]   pid     The process id.
+ * @return  The start time, or 0 if the process does not exist or is a zombie: a crashed client its parent has not
+ *          waited for yet must not keep its slot.
+ */
+WS_DLL_PRIVATE uint64_t process_start_time(pid_t pid);
+
+}
+}
@@ -0,0 +1,580 @@
+/**
+ * @file    ring_bridge.cpp
+ * @brief   Ring-to-socket bridge implementation.
+ */
+
+#include <wsong/ipc/ring_bridge.hpp>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+#define BR_IO_TIMEOUT_MS        (100)
+#define BR_RATE_INTERVAL_NS     (10000ull)
+#define BR_RECV_BATCH           (64)
+#define BR_ERROR(what)          (std::string(what) + " failed with error:" + std::strerror(errno))
+
+static inline uint64_t realtime_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME,&ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+// Resolve the address and create a socket of the protocol, connected or bound.
+static int open_socket(const RingBridgeAttribute& attribute, bool passive) {
+    struct addrinfo hints;
+    std::memset(&hints,0,sizeof(hints));
+    hints.ai_family     = AF_UNSPEC;
+    hints.ai_socktype   = (attribute.protocol == WS_BRIDGE_TCP) ? SOCK_STREAM : SOCK_DGRAM;
+    hints.ai_flags      = passive ? AI_PASSIVE : 0;
+    struct addrinfo* result = nullptr;
+    const std::string port = std::to_string(attribute.port);
+    const char* host = (attribute.address[0] == '\0') ? nullptr : attribute.address;
+    int ret = getaddrinfo(host,port.c_str(),&hints,&result);
+    if (ret != 0) {
+        throw ws_invalid_argument_exp("Cannot resolve " + std::string(host ? host : "*") + ":" + port + ": " +
+                                      gai_strerror(ret));
+    }
+    int sock = -1;
+    std::string last_error;
+    for (struct addrinfo* ai = result; ai != nullptr; ai = ai->ai_next) {
+        sock = socket(ai->ai_family,ai->ai_socktype,ai->ai_protocol);
+        if (sock == -1) {
+            last_error = BR_ERROR("socket");
+            continue;
+        }
+        if (passive) {
+            int one = 1;
+            setsockopt(sock,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+            if (bind(sock,ai->ai_addr,ai->ai_addrlen) == 0 &&
+                (attribute.protocol == WS_BRIDGE_UDP || listen(sock,1) == 0)) {
+                break;
+            }
+            last_error = BR_ERROR("bind");
+        } else {
+            if (connect(sock,ai->ai_addr,ai->ai_addrlen) == 0) {
+                break;
+            }
+            last_error = BR_ERROR("connect");
+        }
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(result);
+    if (sock == -1) {
+        throw ws_exp(last_error);
+    }
+    // time out the blocking calls, so that the bridge thread notices stop().
+    struct timeval tv = {.tv_sec = 0, .tv_usec = BR_IO_TIMEOUT_MS * 1000};
+    setsockopt(sock,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+    setsockopt(sock,SOL_SOCKET,SO_SNDTIMEO,&tv,sizeof(tv));
+    return sock;
+}
+
+// Write or read all bytes described by an iovec array. It returns false if stopped or if the peer is gone.
+static bool transfer_all(int sock, struct iovec* iov, int iovcnt, bool write, const std::atomic<bool>& stopped) {
+    while (iovcnt > 0) {
+        ssize_t n;
+        if (write) {
+            // writev() without SIGPIPE when the receiver is gone.
+            struct msghdr msg;
+            std::memset(&msg,0,sizeof(msg));
+            msg.msg_iov     = iov;
+            msg.msg_iovlen  = std::min(iovcnt,IOV_MAX);
+            n = sendmsg(sock,&msg,MSG_NOSIGNAL);
+        } else {
+            n = readv(sock,iov,std::min(iovcnt,IOV_MAX));
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                if (stopped.load(std::memory_order_relaxed)) {
+                    return false;
+                }
+                continue;
+            }
+            throw ws_exp(BR_ERROR(write ? "sendmsg" : "readv"));
+        }
+        if (n == 0 && !write) {
+            return false;
+        }
+        // skip the completed iovecs.
+        while (iovcnt > 0 && static_cast<size_t>(n) >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov ++;
+            iovcnt --;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = reinterpret_cast<uint8_t*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+// Append a buffer to an iovec array, merging it with the last one if they are adjacent.
+static void append_iovec(std::vector<struct iovec>& iovs, void* base, size_t len) {
+    if (!iovs.empty() && reinterpret_cast<uint8_t*>(iovs.back().iov_base) + iovs.back().iov_len == base) {
+        iovs.back().iov_len += len;
+    } else {
+        iovs.push_back({base,len});
+    }
+}
+/**
+ * @endcond
+ */
+
+RingBridgeHistogram::RingBridgeHistogram() : max(0) {
+    for (auto& bucket: buckets) {
+        bucket.store(0,std::memory_order_relaxed);
+    }
+}
+
+void RingBridgeHistogram::record(uint64_t value) {
+    // log-linear: values below 16 have their own buckets, then 16 sub-buckets per power of two.
+    uint32_t index = static_cast<uint32_t>(value);
+    if (value >= 16) {
+        const uint32_t shift = 63 - __builtin_clzll(value) - 4;
+        index = (shift + 1) * 16 + static_cast<uint32_t>((value >> shift) & 15);
+    }
+    buckets[index].fetch_add(1,std::memory_order_relaxed);
+    uint64_t current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current,value,std::memory_order_relaxed)) {}
+}
+
+RingBridgeLatency RingBridgeHistogram::summary() {
+    uint64_t counts[WS_BRIDGE_HISTOGRAM_BUCKETS];
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < WS_BRIDGE_HISTOGRAM_BUCKETS; i++) {
+        counts[i] = buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    auto percentile = [&](uint64_t per_mille) -> uint64_t {
+        if (total == 0) {
+            return 0;
+        }
+        const uint64_t rank = (total * per_mille + 999) / 1000;
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < WS_BRIDGE_HISTOGRAM_BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                if (i < 16) {
+                    return i;
+                }
+                // the upper bound of the bucket
+                const uint32_t shift = i / 16 - 1;
+                return ((static_cast<uint64_t>(16 + i % 16 + 1)) << shift) - 1;
+            }
+        }
+        return max.load(std::memory_order_relaxed);
+    };
+    const uint64_t max_ns = max.load(std::memory_order_relaxed);
+    return {
+        .p50_ns = std::min(percentile(500),max_ns),
+        .p99_ns = std::min(percentile(990),max_ns),
+        .max_ns = max_ns,
+    };
+}
+
+RingBridgeBase::RingBridgeBase(const key_t key, const RingBridgeAttribute& attribute):
+    attribute(attribute),
+    ring(RingBuffer::get_ring_buffer(key)),
+    sock(-1),
+    stopped(false),
+    messages(0),
+    batches(0),
+    bytes(0),
+    lost(0),
+    batch_target(1) {
+    if (attribute.protocol != WS_BRIDGE_TCP && attribute.protocol != WS_BRIDGE_UDP) {
+        throw ws_invalid_argument_exp("Unknown bridge protocol:" + std::to_string(attribute.protocol));
+    }
+    if (attribute.max_batch == 0 || attribute.max_batch > UINT16_MAX) {
+        throw ws_invalid_argument_exp("Invalid max_batch:" + std::to_string(attribute.max_batch));
+    }
+}
+
+RingBridgeBase::~RingBridgeBase() {
+    stop();
+}
+
+void RingBridgeBase::fail(const std::string& message) {
+    std::lock_guard<std::mutex> lock(error_mutex);
+    error_message = message;
+}
+
+void RingBridgeBase::stop() {
+    stopped.store(true);
+    if (thread.joinable()) {
+        thread.join();
+    }
+    if (sock != -1) {
+        close(sock);
+        sock = -1;
+    }
+}
+
+bool RingBridgeBase::running() {
+    return !stopped.load() && error().empty();
+}
+
+std::string RingBridgeBase::error() {
+    std::lock_guard<std::mutex> lock(error_mutex);
+    return error_message;
+}
+
+RingBridgeStats RingBridgeBase::stats() {
+    return {
+        .messages       = messages.load(std::memory_order_relaxed),
+        .batches        = batches.load(std::memory_order_relaxed),
+        .bytes          = bytes.load(std::memory_order_relaxed),
+        .lost           = lost.load(std::memory_order_relaxed),
+        .batch_target   = batch_target.load(std::memory_order_relaxed),
+        .ring_to_wire   = ring_to_wire.summary(),
+        .wire_to_ring   = wire_to_ring.summary(),
+        .end_to_end     = end_to_end.summary(),
+    };
+}
+
+RingBridgeSender::RingBridgeSender(const key_t source_key, const RingBridgeAttribute& attribute):
+    RingBridgeBase(source_key,attribute) {
+    const RingBufferAttribute ring_attribute = ring->attribute();
+    if (attribute.protocol == WS_BRIDGE_UDP &&
+        attribute.max_datagram < sizeof(RingBridgeFrame) + ring_attribute.entry_size) {
+        throw ws_invalid_argument_exp("max_datagram:" + std::to_string(attribute.max_datagram) +
+                                      " cannot hold an entry of " + std::to_string(ring_attribute.entry_size) +
+                                      " bytes.");
+    }
+    if (attribute.protocol == WS_BRIDGE_UDP && attribute.max_datagram > WS_BRIDGE_MAX_DATAGRAM) {
+        throw ws_invalid_argument_exp("max_datagram:" + std::to_string(attribute.max_datagram) + " is beyond " +
+                                      std::to_string(WS_BRIDGE_MAX_DATAGRAM) + " bytes.");
+    }
+    sock = open_socket(attribute,false);
+    if (attribute.protocol == WS_BRIDGE_TCP) {
+        int one = 1;
+        setsockopt(sock,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+    }
+    thread = std::thread([this]() {
+        try {
+            run();
+        } catch (const std::exception& e) {
+            fail(e.what());
+        }
+    });
+}
+
+RingBridgeSender::~RingBridgeSender() {
+    stop();
+}
+
+void RingBridgeSender::send_batch(uint32_t head, uint32_t count, uint64_t oldest_ns, uint64_t& sequence) {
+    const uint16_t entry_size = ring->attribute().entry_size;
+    const uint32_t per_frame = (attribute.protocol == WS_BRIDGE_TCP) ? count :
+                               (attribute.max_datagram - sizeof(RingBridgeFrame)) / entry_size;
+    const uint32_t num_frames = (count + per_frame - 1) / per_frame;
+    if (frames.size() < num_frames) {
+        frames.resize(num_frames);
+        iovs.resize(num_frames);
+        msgs.resize(num_frames);
+    }
+
+    const uint64_t send_ns = realtime_ns();
+    uint64_t total_bytes = 0;
+    for (uint32_t f = 0; f < num_frames; f++) {
+        const uint32_t first = f * per_frame;
+        const uint32_t n = std::min(per_frame,count - first);
+        frames[f] = {
+            .magic      = WS_BRIDGE_FRAME_MAGIC,
+            .entry_size = entry_size,
+            .count      = static_cast<uint16_t>(n),
+            .sequence   = sequence + first,
+            .oldest_ns  = oldest_ns,
+            .send_ns    = send_ns,
+        };
+        iovs[f].clear();
+        iovs[f].push_back({&frames[f],sizeof(RingBridgeFrame)});
+        // straight from the slots; the contiguous ones go in one iovec.
+        for (uint32_t i = 0; i < n; i++) {
+            append_iovec(iovs[f],ring->slot(head + first + i),entry_size);
+        }
+        total_bytes += sizeof(RingBridgeFrame) + static_cast<uint64_t>(n) * entry_size;
+    }
+
+    if (attribute.protocol == WS_BRIDGE_TCP) {
+        if (!transfer_all(sock,iovs[0].data(),static_cast<int>(iovs[0].size()),true,stopped)) {
+            return;
+        }
+    } else {
+        std::memset(msgs.data(),0,sizeof(struct mmsghdr) * num_frames);
+        for (uint32_t f = 0; f < num_frames; f++) {
+            msgs[f].msg_hdr.msg_iov     = iovs[f].data();
+            msgs[f].msg_hdr.msg_iovlen  = iovs[f].size();
+        }
+        uint32_t sent = 0;
+        while (sent < num_frames) {
+            int ret = sendmmsg(sock,msgs.data() + sent,num_frames - sent,0);
+            if (ret < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                    if (stopped.load(std::memory_order_relaxed)) {
+                        return;
+                    }
+                    continue;
+                }
+                // the receiver is not there yet, the datagrams are lost as on the wire.
+                if (errno == ECONNREFUSED) {
+                    break;
+                }
+                throw ws_exp(BR_ERROR("sendmmsg"));
+            }
+            sent += ret;
+        }
+    }
+    sequence += count;
+    ring_to_wire.record(send_ns - std::min(send_ns,oldest_ns));
+    messages.fetch_add(count,std::memory_order_relaxed);
+    batches.fetch_add(1,std::memory_order_relaxed);
+    bytes.fetch_add(total_bytes,std::memory_order_relaxed);
+}
+
+void RingBridgeSender::run() {
+    const uint32_t capacity = ring->attribute().capacity;
+    uint32_t head           = ring->head_position();
+    uint64_t sequence       = 0;
+    uint64_t oldest_ns      = 0;
+    // the arrival rate in entries per nanosecond, as an exponentially weighted moving average.
+    double   rate           = 0.0;
+    uint32_t rate_tail      = ring->tail_position();
+    uint64_t rate_ns        = realtime_ns();
+    uint32_t target         = 1;
+
+    while (!stopped.load(std::memory_order_relaxed)) {
+        const uint32_t tail = ring->tail_position();
+        const uint64_t now  = realtime_ns();
+        if (now - rate_ns >= BR_RATE_INTERVAL_NS) {
+            const double sample = static_cast<double>(tail - rate_tail) / static_cast<double>(now - rate_ns);
+            rate        = rate * 0.875 + sample * 0.125;
+            rate_tail   = tail;
+            rate_ns     = now;
+            // wait for what is expected to arrive within the budget, but never more than the ring buffer can hold.
+            const double expected = rate * static_cast<double>(attribute.latency_budget_ns);
+            target = static_cast<uint32_t>(std::clamp(expected,1.0,
+                static_cast<double>(std::min(attribute.max_batch,capacity - 1))));
+            batch_target.store(target,std::memory_order_relaxed);
+        }
+        const uint32_t available = tail - head;
+        if (available == 0) {
+            oldest_ns = 0;
+            continue;
+        }
+        if (oldest_ns == 0) {
+            oldest_ns = now;
+        }
+        if (available < target && now - oldest_ns < attribute.latency_budget_ns) {
+            continue;
+        }
+        const uint32_t n = std::min(available,attribute.max_batch);
+        send_batch(head,n,oldest_ns,sequence);
+        head += n;
+        ring->advance_head(head);
+        // the entries left behind have been waiting since before now.
+        if (available == n) {
+            oldest_ns = 0;
+        }
+    }
+}
+
+RingBridgeReceiver::RingBridgeReceiver(const key_t target_key, const RingBridgeAttribute& attribute):
+    RingBridgeBase(target_key,attribute),
+    bound_port(attribute.port) {
+    sock = open_socket(attribute,true);
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getsockname(sock,reinterpret_cast<struct sockaddr*>(&addr),&addr_len) == 0) {
+        bound_port = ntohs((addr.ss_family == AF_INET6) ?
+                           reinterpret_cast<struct sockaddr_in6*>(&addr)->sin6_port :
+                           reinterpret_cast<struct sockaddr_in*>(&addr)->sin_port);
+    }
+    thread = std::thread([this]() {
+        try {
+            run();
+        } catch (const std::exception& e) {
+            fail(e.what());
+        }
+    });
+}
+
+RingBridgeReceiver::~RingBridgeReceiver() {
+    stop();
+}
+
+uint16_t RingBridgeReceiver::port() {
+    return bound_port;
+}
+
+void RingBridgeReceiver::run() {
+    if (attribute.protocol == WS_BRIDGE_TCP) {
+        run_tcp();
+    } else {
+        run_udp();
+    }
+}
+
+bool RingBridgeReceiver::wait_for_space(uint32_t tail, uint32_t count) {
+    const uint32_t capacity = ring->attribute().capacity;
+    while (capacity - 1 - (tail - ring->head_position()) < count) {
+        if (stopped.load(std::memory_order_relaxed)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void RingBridgeReceiver::published(uint32_t count, uint64_t oldest_ns, uint64_t send_ns, uint64_t frame_bytes) {
+    const uint64_t now = realtime_ns();
+    ring_to_wire.record(send_ns - std::min(send_ns,oldest_ns));
+    wire_to_ring.record(now - std::min(now,send_ns));
+    end_to_end.record(now - std::min(now,oldest_ns));
+    messages.fetch_add(count,std::memory_order_relaxed);
+    batches.fetch_add(1,std::memory_order_relaxed);
+    bytes.fetch_add(frame_bytes,std::memory_order_relaxed);
+}
+
+void RingBridgeReceiver::run_tcp() {
+    const RingBufferAttribute ring_attribute = ring->attribute();
+    std::vector<struct iovec> iovs;
+    uint32_t tail = ring->tail_position();
+
+    while (!stopped.load(std::memory_order_relaxed)) {
+        struct pollfd pfd = {.fd = sock, .events = POLLIN, .revents = 0};
+        if (poll(&pfd,1,BR_IO_TIMEOUT_MS) <= 0) {
+            continue;
+        }
+        int conn = accept(sock,nullptr,nullptr);
+        if (conn == -1) {
+            continue;
+        }
+        struct timeval tv = {.tv_sec = 0, .tv_usec = BR_IO_TIMEOUT_MS * 1000};
+        setsockopt(conn,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+
+        try {
+            while (!stopped.load(std::memory_order_relaxed)) {
+                RingBridgeFrame frame;
+                struct iovec header_iov = {&frame,sizeof(frame)};
+                if (!transfer_all(conn,&header_iov,1,false,stopped)) {
+                    break;
+                }
+                if (frame.magic != WS_BRIDGE_FRAME_MAGIC || frame.entry_size > ring_attribute.entry_size) {
+                    throw ws_exp("Bad bridge frame: magic=" + std::to_string(frame.magic) + " entry_size=" +
+                                 std::to_string(frame.entry_size));
+                }
+                // back-pressure: read the entries straight into the slots as the target ring buffer drains.
+                uint32_t remaining = frame.count;
+                bool complete = true;
+                while (remaining > 0) {
+                    const uint32_t n = std::min(remaining,ring_attribute.capacity - 1);
+                    if (!wait_for_space(tail,n)) {
+                        complete = false;
+                        break;
+                    }
+                    iovs.clear();
+                    for (uint32_t i = 0; i < n; i++) {
+                        append_iovec(iovs,ring->slot(tail + i),frame.entry_size);
+                    }
+                    if (!transfer_all(conn,iovs.data(),static_cast<int>(iovs.size()),false,stopped)) {
+                        complete = false;
+                        break;
+                    }
+                    tail += n;
+                    ring->advance_tail(tail);
+                    remaining -= n;
+                }
+                if (!complete) {
+                    break;
+                }
+                published(frame.count,frame.oldest_ns,frame.send_ns,
+                          sizeof(frame) + static_cast<uint64_t>(frame.count) * frame.entry_size);
+            }
+        } catch (...) {
+            close(conn);
+            throw;
+        }
+        close(conn);
+    }
+}
+
+void RingBridgeReceiver::run_udp() {
+    const RingBufferAttribute ring_attribute = ring->attribute();
+    const uint32_t datagram_size = std::max<uint32_t>(attribute.max_datagram,sizeof(RingBridgeFrame));
+    std::vector<uint8_t> buffers(static_cast<size_t>(datagram_size) * BR_RECV_BATCH);
+    std::vector<struct iovec> iovs(BR_RECV_BATCH);
+    std::vector<struct mmsghdr> msgs(BR_RECV_BATCH);
+    uint32_t tail = ring->tail_position();
+    uint64_t expected = 0;
+
+    while (!stopped.load(std::memory_order_relaxed)) {
+        std::memset(msgs.data(),0,sizeof(struct mmsghdr) * BR_RECV_BATCH);
+        for (uint32_t i = 0; i < BR_RECV_BATCH; i++) {
+            iovs[i] = {buffers.data() + static_cast<size_t>(i) * datagram_size,datagram_size};
+            msgs[i].msg_hdr.msg_iov     = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen  = 1;
+        }
+        // block for the first datagram, then take what is there.
+        int received = recvmmsg(sock,msgs.data(),BR_RECV_BATCH,MSG_WAITFORONE,nullptr);
+        if (received < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                continue;
+            }
+            throw ws_exp(BR_ERROR("recvmmsg"));
+        }
+        for (int m = 0; m < received; m++) {
+            const uint8_t* datagram = reinterpret_cast<const uint8_t*>(iovs[m].iov_base);
+            const uint32_t len = msgs[m].msg_len;
+            RingBridgeFrame frame;
+            if (len < sizeof(frame)) {
+                continue;
+            }
+            std::memcpy(&frame,datagram,sizeof(frame));
+            if (frame.magic != WS_BRIDGE_FRAME_MAGIC || frame.entry_size > ring_attribute.entry_size ||
+                sizeof(frame) + static_cast<uint64_t>(frame.count) * frame.entry_size > len ||
+                frame.count >= ring_attribute.capacity) {
+                continue;
+            }
+            // a gap in the sequence numbers is lost, until a late datagram fills it.
+            if (frame.sequence > expected) {
+                lost.fetch_add(frame.sequence - expected,std::memory_order_relaxed);
+            } else if (frame.sequence + frame.count <= expected) {
+                lost.fetch_sub(std::min<uint64_t>(frame.count,lost.load(std::memory_order_relaxed)),
+                               std::memory_order_relaxed);
+            }
+            expected = std::max(expected,frame.sequence + frame.count);
+            if (!wait_for_space(tail,frame.count)) {
+                return;
+            }
+            for (uint32_t i = 0; i < frame.count; i++) {
+                std::memcpy(ring->slot(tail + i),datagram + sizeof(frame) + i * frame.entry_size,frame.entry_size);
+            }
+            tail += frame.count;
+            ring->advance_tail(tail);
+            published(frame.count,frame.oldest_ns,frame.send_ns,len);
+        }
+    }
+}
+
+}
+}
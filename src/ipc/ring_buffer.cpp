@@ -4,16 +4,25 @@
  */
 
 #include <wsong/ipc/ring_buffer.hpp>
+#include <wsong/perf/timing.hpp>
 
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #if defined(__linux__)
 #include <asm-generic/hugetlb_encode.h>
 #endif
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #include <iostream>
 #include <chrono>
 #include <cstring>
 #include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <thread>
 
 namespace wsong {
 namespace ipc {
@@ -36,9 +45,8 @@ namespace ipc {
                                     reinterpret_cast<uintptr_t>(RB_ADDRESS) + \
                                     (idx % RB_CAPACITY) * RB_ENTRY_SIZE \
                                 )
-#define RB_HEAD_BUFFER          RB_BUFFER(RB_HEAD)
-#define RB_TAIL_BUFFER          RB_BUFFER(RB_TAIL)
-#define RB_SIZE                 ((RB_TAIL - RB_HEAD) % RB_CAPACITY)
+#define RB_SIZE                 ((RB_TAIL.load(std::memory_order_acquire) - \
+                                  RB_HEAD.load(std::memory_order_acquire)) % RB_CAPACITY)
 #define RB_IS_FULL              (RB_SIZE == RB_CAPACITY - 1)
 #define RB_IS_EMPTY             (RB_SIZE == 0)
 
@@ -48,174 +56,590 @@ namespace ipc {
                                 (RB_STATE_PTR->producer_lock_cl.lock)
 #define RB_MULTIPLE_CONSUMER_LOCK \
                                 (RB_STATE_PTR->consumer_lock_cl.lock)
+#define RB_EMPTY_STALLS         (RB_STATE_PTR->head_cl.empty_stalls)
+#define RB_FULL_STALLS          (RB_STATE_PTR->tail_cl.full_stalls)
+#define RB_SUCCESSOR            (RB_STATE_PTR->tail_cl.successor)
+#define RB_SEALED               (RB_STATE_PTR->tail_cl.sealed)
+#define RB_RESIZE_STATE         (RB_STATE_PTR->tail_cl.resize_state)
+// the resize states
+#define RB_RESIZABLE            (0)
+#define RB_POSITIONED           (1)
+#define RB_RESIZED              (2)
+// count a stall once per call, the counter is only written by the (locked) owner of the cacheline.
+#define RB_COUNT_STALL(counter) counter.store(counter.load(std::memory_order_relaxed) + 1, \
+                                              std::memory_order_relaxed)
+
+#define WS_RING_BUFFER_MAGIC    (0x52465542474e4952ull) // "RINGBUFR"
+
+#define RB_TRACED               (RB_ATTRIBUTE.trace_context)
+// the payload size of a traced ring buffer
+#define RB_PAYLOAD_SIZE         (RB_TRACED ? RB_ENTRY_SIZE - sizeof(TraceContext) : RB_ENTRY_SIZE)
+
+// The trace context of the entry the thread consumed last.
+static thread_local TraceContext current_trace_context = {0,0,0,0};
+// The lower half of the trace ids assigned by this process, the pid being the upper half.
+static std::atomic<uint32_t> trace_id_counter{0};
+
+// The number of slots scanned at a time by consume_filtered(), one bit each in the match mask.
+#define RB_SCAN_BATCH           (64)
+
+// Scan up to RB_SCAN_BATCH contiguous slots, returning the mask of the matching ones.
+using filter_scanner_t = uint64_t (*)(const uint8_t* base, uint32_t entry_size, uint32_t count,
+                                      const RingFilter& filter);
+
+static inline uint32_t filter_field(const uint8_t* entry, const RingFilter& filter) {
+    uint32_t field = 0;
+    std::memcpy(&field,entry + filter.offset,filter.width);
+    return field & filter.mask;
+}
+
+static uint64_t scan_scalar(const uint8_t* base, uint32_t entry_size, uint32_t count, const RingFilter& filter) {
+    uint64_t matches = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const uint32_t field = filter_field(base + static_cast<size_t>(i) * entry_size,filter);
+        for (uint32_t k = 0; k < filter.num_ids; k++) {
+            if (field == filter.ids[k]) {
+                matches |= 1ull << i;
+                break;
+            }
+        }
+    }
+    return matches;
+}
+
+#if defined(__x86_64__)
+// Gather the field of 8 slots at a time. The 32-bit loads end at the end of the field, so they never read past the
+// entry: the field sits in the upper bytes of the loaded word.
+__attribute__((target("avx2")))
+static uint64_t scan_avx2(const uint8_t* base, uint32_t entry_size, uint32_t count, const RingFilter& filter) {
+    const int32_t load_offset = static_cast<int32_t>(filter.offset) + filter.width - 4;
+    const __m256i stride    = _mm256_set1_epi32(static_cast<int32_t>(entry_size) * 8);
+    const __m256i mask      = _mm256_set1_epi32(static_cast<int32_t>(filter.mask));
+    __m256i indexes = _mm256_mullo_epi32(_mm256_setr_epi32(0,1,2,3,4,5,6,7),
+                                         _mm256_set1_epi32(static_cast<int32_t>(entry_size)));
+    __m256i ids[WS_RING_FILTER_MAX_IDS];
+    for (uint32_t k = 0; k < filter.num_ids; k++) {
+        ids[k] = _mm256_set1_epi32(static_cast<int32_t>(filter.ids[k]));
+    }
+    uint64_t matches = 0;
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i fields = _mm256_i32gather_epi32(reinterpret_cast<const int*>(base + load_offset),indexes,1);
+        fields = _mm256_srli_epi32(fields,(4 - filter.width) * 8);
+        fields = _mm256_and_si256(fields,mask);
+        __m256i hits = _mm256_cmpeq_epi32(fields,ids[0]);
+        for (uint32_t k = 1; k < filter.num_ids; k++) {
+            hits = _mm256_or_si256(hits,_mm256_cmpeq_epi32(fields,ids[k]));
+        }
+        matches |= static_cast<uint64_t>(_mm256_movemask_ps(_mm256_castsi256_ps(hits))) << i;
+        indexes = _mm256_add_epi32(indexes,stride);
+    }
+    if (i < count) {
+        matches |= scan_scalar(base + static_cast<size_t>(i) * entry_size,entry_size,count - i,filter) << i;
+    }
+    return matches;
+}
+#endif
+
+// Create and initialize the shared memory of a ring buffer, returning its shmid.
+static int create_ring_segment(const RingBufferAttribute& attribute, key_t shm_key) {
+    size_t shared_memory_region_size = attribute.capacity * attribute.entry_size 
+                                       + sizeof (RingBufferHeader);
+
+    // validate check
+    if ((attribute.entry_size & (attribute.entry_size - 1)) || (attribute.entry_size == 0)) {
+        throw ws_invalid_argument_exp("Invalid entry_size:" + std::to_string(attribute.entry_size));
+    }
+    if ((attribute.capacity & (attribute.capacity - 1)) || (attribute.capacity == 0)) {
+        throw ws_invalid_argument_exp("Invalid capacity:" + std::to_string(attribute.capacity));
+    }
+    if (attribute.trace_context && attribute.entry_size <= sizeof(TraceContext)) {
+        throw ws_invalid_argument_exp("Invalid entry_size:" + std::to_string(attribute.entry_size) +
+                                      ". A traced ring buffer needs more than " + std::to_string(sizeof(TraceContext)) +
+                                      " bytes for the trace context.");
+    }
+
+    // create ring buffer memory
+    int shmflg = IPC_CREAT | IPC_EXCL | 0644; // the default permission
+    switch (attribute.page_size) {
+    case 1<<12:
+        break;
+#if defined(__linux__)
+    case 1<<21:
+        shmflg |= (SHM_HUGETLB | (HUGETLB_FLAG_ENCODE_2MB));
+        break;
+    case 1<<30:
+        shmflg |= (SHM_HUGETLB | (HUGETLB_FLAG_ENCODE_1GB));
+        break;
+#endif
+    default:
+        throw ws_invalid_argument_exp("Invalid page_size:" + std::to_string(attribute.page_size));
+    }
+
+    int shmid = shmget(shm_key,shared_memory_region_size,shmflg);
+
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") + 
+                     std::strerror(errno));
+    }
+
+    // lock memory
+    if (shmctl(shmid,SHM_LOCK,nullptr) == -1) {
+        throw ws_exp(std::string("pinning pages: shmctl failed with error:") + 
+                     std::strerror(errno));
+    }
+
+    // get key
+    struct shmid_ds buf;
+    if (shmctl(shmid,IPC_STAT,&buf) == -1) {
+        throw ws_exp(std::string("get stat: shmctl failed with error:") +
+                     std::strerror(errno));
+    }
+
+    // attach to memory region
+    void* ptr = shmat(shmid,nullptr,0);
+    if (ptr == (void*)-1) {
+        throw ws_exp(std::string("attach: shmat failed with error:") + 
+                     std::strerror(errno));
+    }
+
+    // initialize, a successor keeps the key of the ring buffer it is resized from.
+    RingBufferHeader* rbh   = reinterpret_cast<RingBufferHeader*>(ptr);
+    rbh->info.attribute     = attribute;
+    rbh->info.attribute.id  = shmid;
+    rbh->info.attribute.key = (shm_key == IPC_PRIVATE) ? attribute.key : buf.shm_perm.__key;
+    rbh->info.magic         = WS_RING_BUFFER_MAGIC;
+
+    // detach memory region
+    if (shmdt(ptr) == -1) {
+        throw ws_exp(std::string("detach: shmdt failed with error:") +
+                     std::strerror(errno));
+    }
+
+    return shmid;
+}
+
+// Attach the shared memory of a ring buffer by its shmid.
+static void* attach_ring_segment(int shmid, bool read_only) {
+    void* mem_ptr = shmat(shmid,nullptr,read_only ? SHM_RDONLY : 0);
+    if (mem_ptr == (void*)-1) {
+        throw ws_exp(std::string("Memory attach failed: shmat failed with error:") +
+                     std::strerror(errno));
+    }
+    return mem_ptr;
+}
+
+static filter_scanner_t select_scanner(const RingFilter& filter) {
+#if defined(__x86_64__)
+    // the 32-bit loads need the field to end at least 4 bytes into the entry.
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2 && filter.offset + filter.width >= 4) {
+        return scan_avx2;
+    }
+#endif
+    return scan_scalar;
+}
 /**
  * @endcond
  */
 
-RingBuffer::RingBuffer(void* mem_ptr) : 
-    info_ptr(reinterpret_cast<const RingBufferHeader*>(mem_ptr)) {
+RingBuffer::RingBuffer(void* mem_ptr, bool read_only) : 
+    info_ptr(reinterpret_cast<const RingBufferHeader*>(mem_ptr)),
+    cached_head(RB_HEAD.load(std::memory_order_acquire)),
+    cached_tail(RB_TAIL.load(std::memory_order_acquire)),
+    successor(nullptr),
+    drained(false),
+    forward(nullptr),
+    read_only(read_only),
+    positioned(false) {
 }
 
 RingBuffer::~RingBuffer(){
     shmdt(this->info_ptr);
 }
 
+RingBuffer* RingBuffer::successor_ring() {
+    if (!this->successor) {
+        const int shmid = RB_SUCCESSOR.load(std::memory_order_acquire) - 1;
+        this->successor.reset(new RingBuffer(attach_ring_segment(shmid,false)));
+    }
+    return this->successor.get();
+}
+
+void RingBuffer::claim_positions() {
+    // a read-only handle cannot move a position, so it does not keep the ring buffer from being resized.
+    if (!this->read_only) {
+        uint8_t expected = RB_RESIZABLE;
+        if (!RB_RESIZE_STATE.compare_exchange_strong(expected,RB_POSITIONED,std::memory_order_acq_rel) &&
+            expected == RB_RESIZED) {
+            throw ws_exp("Ring buffer " + std::to_string(RB_ATTRIBUTE.key) +
+                         " is resized. The position API does not follow a resize.");
+        }
+    }
+    this->positioned = true;
+}
+
 RingBufferAttribute RingBuffer::attribute() {
     return RB_ATTRIBUTE;
 }
 
+RingBufferStats RingBuffer::stats() {
+    RingBufferStats stats;
+    stats.head          = RB_HEAD.load(std::memory_order_acquire);
+    stats.tail          = RB_TAIL.load(std::memory_order_acquire);
+    stats.empty_stalls  = RB_EMPTY_STALLS.load(std::memory_order_relaxed);
+    stats.full_stalls   = RB_FULL_STALLS.load(std::memory_order_relaxed);
+    stats.successor_id  = RB_SUCCESSOR.load(std::memory_order_acquire) - 1;
+    stats.sealed        = RB_SEALED.load(std::memory_order_acquire);
+    return stats;
+}
+
+/*
+ * Memory ordering of the produce/consume hot path
+ * ===============================================
+ * Each index has exactly one writer at a time: the tail is only written by the producer, and the head only by the
+ * consumer (with multiple producers or consumers, by the lock holder; the lock's acquire/release orders the hand-over
+ * between holders). So the owner reads its own index with a relaxed load and publishes it with a plain release store
+ * instead of a locked read-modify-write. The peer index is read with an acquire load:
+ * - The producer copies the entry into the slot, then store-releases tail. The consumer load-acquires tail before
+ *   reading the slot, so it sees the whole entry.
+ * - The consumer copies the entry out of the slot, then store-releases head. The producer load-acquires head before
+ *   overwriting the slot, so the consumer has finished reading it.
+ * Each side also keeps a process-local copy of the peer index and only reloads it from the shared cacheline when the
+ * ring buffer looks full (producer) or empty (consumer). A stale copy is always conservative since both indexes only
+ * move forward.
+ *
+ * Resize
+ * ======
+ * A resize stores the successor in the tail cacheline, then seals the ring buffer: the resizer does it under the
+ * producer lock with multiple producers, and the only producer does it otherwise, after publishing its last entry
+ * here. Either way, the release store of `sealed` follows the last tail store. The consumer loads `sealed` with
+ * acquire before reloading the tail, so when it finds the ring buffer sealed and empty, no entry will ever come, and
+ * it moves on to the successor.
+ */
 void RingBuffer::produce(const void* buffer, uint16_t size, uint64_t timeout_ns) {
+    if (!try_produce(buffer,size,timeout_ns)) {
+        throw ws_timeout_exp("Ring buffer produce call timeout.");
+    }
+}
+
+bool RingBuffer::try_produce(const void* buffer, uint16_t size, uint64_t timeout_ns) {
     // invalidation check
-    if (size > RB_ENTRY_SIZE || size == 0) {
+    if (size > RB_PAYLOAD_SIZE || size == 0) {
         throw ws_invalid_argument_exp("Ring buffer produce() is called with invalid size.");
     }
 
+    // a resized ring buffer forwards to the last ring buffer of the chain.
+    if (__builtin_expect(this->forward != nullptr || RB_SUCCESSOR.load(std::memory_order_acquire) != 0,0)) {
+        if (this->forward == nullptr) {
+            if (!RB_MULTIPLE_PRODUCER) {
+                // our last entry here is published.
+                RB_SEALED.store(true,std::memory_order_release);
+            }
+            this->forward = successor_ring();
+        }
+        // skip the ring buffers sealed since, the handles of the chain stay attached.
+        while (this->forward->forward != nullptr) {
+            this->forward = this->forward->forward;
+        }
+        return this->forward->try_produce(buffer,size,timeout_ns);
+    }
+
+    // continue the current trace, or start a new one.
+    TraceContext context;
+    if (RB_TRACED) {
+        if (current_trace_context.trace_id != 0) {
+            context.trace_id    = current_trace_context.trace_id;
+            context.hop         = current_trace_context.hop + 1;
+        } else {
+            context.trace_id    = (static_cast<uint64_t>(getpid()) << 32) |
+                                  (trace_id_counter.fetch_add(1,std::memory_order_relaxed) + 1);
+            context.hop         = 0;
+        }
+        context.ring        = RB_ATTRIBUTE.key;
+        context.parent_ns   = perf::timing_now_ns();
+    }
+
     // lock
     if (RB_MULTIPLE_PRODUCER) {
         bool expected = false;
-        while(!RB_MULTIPLE_PRODUCER_LOCK.compare_exchange_weak(expected,true));
+        while(!RB_MULTIPLE_PRODUCER_LOCK.compare_exchange_weak(expected,true,std::memory_order_acquire)) {
+            expected = false;
+        }
+        // resized while we were waiting for the lock.
+        if (RB_SUCCESSOR.load(std::memory_order_acquire) != 0) {
+            RB_MULTIPLE_PRODUCER_LOCK.store(false,std::memory_order_release);
+            this->forward = successor_ring();
+            return this->forward->try_produce(buffer,size,timeout_ns);
+        }
     }
 
     // produce
-    const auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(timeout_ns);
-    bool succ = false;
-    do {
-        if (RB_IS_FULL) {
-            continue;
+    const uint32_t tail = RB_TAIL.load(std::memory_order_relaxed);
+    bool succ = true;
+    if (tail - this->cached_head >= RB_CAPACITY - 1) {
+        this->cached_head = RB_HEAD.load(std::memory_order_acquire);
+        if (tail - this->cached_head >= RB_CAPACITY - 1) {
+            // slow path: wait for the consumers until timeout.
+            RB_COUNT_STALL(RB_FULL_STALLS);
+            const auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(timeout_ns);
+            do {
+                this->cached_head = RB_HEAD.load(std::memory_order_acquire);
+                succ = (tail - this->cached_head < RB_CAPACITY - 1);
+            } while (!succ && std::chrono::steady_clock::now() < end);
+        }
+    }
+    if (succ) {
+        if (RB_TRACED) {
+            std::memcpy(RB_BUFFER(tail),&context,sizeof(context));
+            std::memcpy(reinterpret_cast<uint8_t*>(RB_BUFFER(tail)) + sizeof(context),buffer,size);
         } else {
-            std::memcpy(RB_TAIL_BUFFER,buffer,size);
-            RB_TAIL ++;
-            succ = true;
-            break;
+            std::memcpy(RB_BUFFER(tail),buffer,size);
         }
-    } while (end < std::chrono::steady_clock::now());
+        RB_TAIL.store(tail + 1,std::memory_order_release);
+    }
 
     // unlock
     if (RB_MULTIPLE_PRODUCER) {
-        bool expected = true;
-        while(!RB_MULTIPLE_PRODUCER_LOCK.compare_exchange_weak(expected,false));
+        RB_MULTIPLE_PRODUCER_LOCK.store(false,std::memory_order_release);
     }
 
-    // error
     if (!succ) {
-        throw ws_timeout_exp("Ring buffer produce call timeout.");
+        return false;
+    }
+
+    // link the new span to the one the thread consumed last, outside of the lock.
+    if (RB_TRACED) {
+        perf::timing_punch(WS_RING_TRACE_PRODUCE_TAG,context.trace_id,static_cast<uint32_t>(context.ring),context.hop,
+                        context.hop > 0 ? current_trace_context.parent_ns : 0);
     }
+    return true;
 }
 
 void RingBuffer::consume(void* buffer, uint16_t size, uint64_t timeout_ns) {
     // validation check
-    if (size > RB_ENTRY_SIZE || size == 0) {
+    if (size > RB_PAYLOAD_SIZE || size == 0) {
         throw ws_invalid_argument_exp("Ring buffer consume() is called with invalid size.");
     }
+    if (__builtin_expect(this->drained,0)) {
+        successor_ring()->consume(buffer,size,timeout_ns);
+        return;
+    }
 
     // lock
     if (RB_MULTIPLE_CONSUMER) {
         bool expected = false;
-        while(!RB_MULTIPLE_CONSUMER_LOCK.compare_exchange_weak(expected,true));
+        while(!RB_MULTIPLE_CONSUMER_LOCK.compare_exchange_weak(expected,true,std::memory_order_acquire)) {
+            expected = false;
+        }
     }
 
     // consume
-    const auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(timeout_ns);
-    bool succ = false;
-    do {
-        if (RB_IS_EMPTY) {
-            continue;
+    const uint32_t head = RB_HEAD.load(std::memory_order_relaxed);
+    bool succ = true;
+    // With multiple consumers, other consumers may have moved head beyond our cached tail.
+    if (static_cast<int32_t>(this->cached_tail - head) <= 0) {
+        this->cached_tail = RB_TAIL.load(std::memory_order_acquire);
+        if (this->cached_tail == head) {
+            // slow path: wait for the producers until timeout, or until a resize seals the drained ring buffer.
+            RB_COUNT_STALL(RB_EMPTY_STALLS);
+            const auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(timeout_ns);
+            do {
+                const bool sealed = RB_SEALED.load(std::memory_order_acquire);
+                this->cached_tail = RB_TAIL.load(std::memory_order_acquire);
+                succ = (this->cached_tail != head);
+                this->drained = (sealed && !succ);
+            } while (!succ && !this->drained && std::chrono::steady_clock::now() < end);
+        }
+    }
+    if (succ) {
+        if (RB_TRACED) {
+            std::memcpy(&current_trace_context,RB_BUFFER(head),sizeof(TraceContext));
+            std::memcpy(buffer,reinterpret_cast<const uint8_t*>(RB_BUFFER(head)) + sizeof(TraceContext),size);
         } else {
-            std::memcpy(buffer,RB_HEAD_BUFFER,size);
-            RB_HEAD ++;
-            succ = true;
-            break;
+            std::memcpy(buffer,RB_BUFFER(head),size);
         }
-    } while (end > std::chrono::steady_clock::now());
+        RB_HEAD.store(head + 1,std::memory_order_release);
+    }
 
     // unlock
     if (RB_MULTIPLE_CONSUMER) {
-        bool expected = true;
-        while(!RB_MULTIPLE_CONSUMER_LOCK.compare_exchange_weak(expected,false));
+        RB_MULTIPLE_CONSUMER_LOCK.store(false,std::memory_order_release);
+    }
+
+    if (this->drained) {
+        successor_ring()->consume(buffer,size,timeout_ns);
+        return;
     }
 
     // error
     if (!succ) {
         throw ws_timeout_exp("Ring buffer consumer call timeout.");
     }
+
+    if (RB_TRACED) {
+        perf::timing_punch(WS_RING_TRACE_CONSUME_TAG,current_trace_context.trace_id,
+                        static_cast<uint32_t>(current_trace_context.ring),current_trace_context.hop,
+                        current_trace_context.parent_ns);
+    }
 }
 
-uint32_t RingBuffer::size() {
-    return RB_SIZE;
+const TraceContext& RingBuffer::current_trace() {
+    return current_trace_context;
 }
 
-bool RingBuffer::empty() {
-    return RB_IS_EMPTY;
+void RingBuffer::set_current_trace(const TraceContext& context) {
+    current_trace_context = context;
 }
 
-key_t RingBuffer::create_ring_buffer(const RingBufferAttribute& attribute) {
-    size_t shared_memory_region_size = attribute.capacity * attribute.entry_size 
-                                       + sizeof (RingBufferHeader);
+uint32_t RingBuffer::consume_filtered(const RingFilter& filter, void* buffer, uint32_t max_entries) {
+    uint8_t* out = reinterpret_cast<uint8_t*>(buffer);
+    const uint16_t payload_size = RB_PAYLOAD_SIZE;
+    return consume_filtered(filter,
+                            [&out,payload_size](const void* entry) {
+                                std::memcpy(out,entry,payload_size);
+                                out += payload_size;
+                            },
+                            max_entries);
+}
 
-    // validate check
-    if ((attribute.entry_size & (attribute.entry_size - 1)) || (attribute.entry_size == 0)) {
-        throw ws_invalid_argument_exp("Invalid entry_size:" + std::to_string(attribute.entry_size));
+uint32_t RingBuffer::consume_filtered(const RingFilter& filter, const FilterHandler& handler, uint32_t max_entries) {
+    // validation check
+    if (filter.width != 1 && filter.width != 2 && filter.width != 4) {
+        throw ws_invalid_argument_exp("Ring filter width must be 1, 2, or 4.");
     }
-    if ((attribute.capacity & (attribute.capacity - 1)) || (attribute.capacity == 0)) {
-        throw ws_invalid_argument_exp("Invalid capacity:" + std::to_string(attribute.capacity));
+    if (static_cast<uint32_t>(filter.offset) + filter.width > RB_PAYLOAD_SIZE) {
+        throw ws_invalid_argument_exp("Ring filter field is beyond the entry size.");
+    }
+    if (filter.num_ids == 0 || filter.num_ids > WS_RING_FILTER_MAX_IDS) {
+        throw ws_invalid_argument_exp("Ring filter must have 1 to " + std::to_string(WS_RING_FILTER_MAX_IDS) + " ids.");
+    }
+    if (__builtin_expect(this->drained,0)) {
+        return successor_ring()->consume_filtered(filter,handler,max_entries);
     }
+    const filter_scanner_t scan = select_scanner(filter);
+    // the filter and the handler see the payload, after the trace context of a traced ring buffer.
+    const size_t payload_offset = RB_TRACED ? sizeof(TraceContext) : 0;
 
-    // create ring buffer memory
-    int shmflg = IPC_CREAT | IPC_EXCL | 0644; // the default permission
-    switch (attribute.page_size) {
-    case 1<<12:
-        break;
-#if defined(__linux__)
-    case 1<<21:
-        shmflg |= (SHM_HUGETLB | (HUGETLB_FLAG_ENCODE_2MB));
-        break;
-    case 1<<30:
-        shmflg |= (SHM_HUGETLB | (HUGETLB_FLAG_ENCODE_1GB));
-        break;
-#endif
-    default:
-        throw ws_invalid_argument_exp("Invalid page_size:" + std::to_string(attribute.page_size));
+    // lock
+    if (RB_MULTIPLE_CONSUMER) {
+        bool expected = false;
+        while(!RB_MULTIPLE_CONSUMER_LOCK.compare_exchange_weak(expected,true,std::memory_order_acquire)) {
+            expected = false;
+        }
     }
 
-    int shmid = shmget(attribute.key,shared_memory_region_size,shmflg);
+    // scan in batches of contiguous slots
+    const uint32_t head = RB_HEAD.load(std::memory_order_relaxed);
+    this->cached_tail = RB_TAIL.load(std::memory_order_acquire);
+    uint32_t pos = head;
+    uint32_t delivered = 0;
+    try {
+        while (pos != this->cached_tail && delivered < max_entries) {
+            const uint32_t count = std::min({this->cached_tail - pos,
+                                             static_cast<uint32_t>(RB_SCAN_BATCH),
+                                             RB_CAPACITY - pos % RB_CAPACITY});
+            uint64_t matches = scan(reinterpret_cast<const uint8_t*>(RB_BUFFER(pos)) + payload_offset,RB_ENTRY_SIZE,
+                                    count,filter);
+            const uint32_t start = pos;
+            while (matches != 0 && delivered < max_entries) {
+                const uint32_t i = __builtin_ctzll(matches);
+                matches &= matches - 1;
+                // the head stays before the entry being handed over until the handler returns.
+                handler(reinterpret_cast<const uint8_t*>(RB_BUFFER((start + i))) + payload_offset);
+                delivered ++;
+                pos = start + i + 1;
+            }
+            if (delivered < max_entries) {
+                pos = start + count;
+            }
+        }
+    } catch (...) {
+        // the entries handed over so far are consumed, the one the handler threw on is not.
+        if (pos != head) {
+            RB_HEAD.store(pos,std::memory_order_release);
+        }
+        if (RB_MULTIPLE_CONSUMER) {
+            RB_MULTIPLE_CONSUMER_LOCK.store(false,std::memory_order_release);
+        }
+        throw;
+    }
+    if (pos != head) {
+        RB_HEAD.store(pos,std::memory_order_release);
+    }
+    // scanned to the end of a sealed ring buffer.
+    if (pos == this->cached_tail && delivered < max_entries && RB_SEALED.load(std::memory_order_acquire)) {
+        this->cached_tail = RB_TAIL.load(std::memory_order_acquire);
+        this->drained = (this->cached_tail == pos);
+    }
 
-    if (shmid == -1) {
-        throw ws_exp(std::string("shmget failed with error:") + 
-                     std::strerror(errno));
+    // unlock
+    if (RB_MULTIPLE_CONSUMER) {
+        RB_MULTIPLE_CONSUMER_LOCK.store(false,std::memory_order_release);
     }
 
-    // lock memory
-    if (shmctl(shmid,SHM_LOCK,nullptr) == -1) {
-        throw ws_exp(std::string("pinning pages: shmctl failed with error:") + 
-                     std::strerror(errno));
+    if (this->drained) {
+        delivered += successor_ring()->consume_filtered(filter,handler,max_entries - delivered);
     }
+    return delivered;
+}
 
-    // get key
-    struct shmid_ds buf;
-    if (shmctl(shmid,IPC_STAT,&buf) == -1) {
-        throw ws_exp(std::string("get stat: shmctl failed with error:") +
-                     std::strerror(errno));
+uint32_t RingBuffer::size() {
+    if (this->drained) {
+        return successor_ring()->size();
     }
+    return RB_SIZE;
+}
 
-    // attach to memory region
-    void* ptr = shmat(shmid,nullptr,0);
-    if (ptr == (void*)-1) {
-        throw ws_exp(std::string("attach: shmat failed with error:") + 
-                     std::strerror(errno));
+bool RingBuffer::empty() {
+    if (this->drained) {
+        return successor_ring()->empty();
     }
+    return RB_IS_EMPTY;
+}
 
-    // initialize
-    RingBufferHeader* rbh   = reinterpret_cast<RingBufferHeader*>(ptr);
-    rbh->info.attribute     = attribute;
-    rbh->info.attribute.id  = shmid;
-    rbh->info.attribute.key = buf.shm_perm.__key;
+uint32_t RingBuffer::head_position() {
+    if (__builtin_expect(!this->positioned,0)) {
+        claim_positions();
+    }
+    return RB_HEAD.load(std::memory_order_acquire);
+}
 
-    // detach memory region
-    if (shmdt(ptr) == -1) {
-        throw ws_exp(std::string("detach: shmdt failed with error:") +
-                     std::strerror(errno));
+uint32_t RingBuffer::tail_position() {
+    if (__builtin_expect(!this->positioned,0)) {
+        claim_positions();
     }
+    return RB_TAIL.load(std::memory_order_acquire);
+}
+
+void* RingBuffer::slot(uint32_t position) {
+    if (__builtin_expect(!this->positioned,0)) {
+        claim_positions();
+    }
+    return RB_BUFFER(position);
+}
+
+void RingBuffer::advance_head(uint32_t position) {
+    if (__builtin_expect(!this->positioned,0)) {
+        claim_positions();
+    }
+    RB_HEAD.store(position,std::memory_order_release);
+}
+
+void RingBuffer::advance_tail(uint32_t position) {
+    if (__builtin_expect(!this->positioned,0)) {
+        claim_positions();
+    }
+    RB_TAIL.store(position,std::memory_order_release);
+}
 
+key_t RingBuffer::create_ring_buffer(const RingBufferAttribute& attribute) {
+    const int shmid = create_ring_segment(attribute,attribute.key);
+    struct shmid_ds buf;
+    if (shmctl(shmid,IPC_STAT,&buf) == -1) {
+        throw ws_exp(std::string("get stat: shmctl failed with error:") +
+                     std::strerror(errno));
+    }
     return buf.shm_perm.__key;
 }
 
@@ -227,13 +651,92 @@ void RingBuffer::delete_ring_buffer(const key_t key) {
                      std::strerror(errno));
     }
 
-    if (shmctl(shmid,IPC_RMID,nullptr) == -1) {
-        throw ws_exp(std::string("deltete shared memory: shmctl failed with error:") +
-                     std::strerror(errno));
+    // delete the successors along with it.
+    while (shmid != -1) {
+        int next = -1;
+        void* ptr = shmat(shmid,nullptr,SHM_RDONLY);
+        if (ptr != (void*)-1) {
+            const RingBufferHeader* rbh = reinterpret_cast<const RingBufferHeader*>(ptr);
+            if (rbh->info.magic == WS_RING_BUFFER_MAGIC) {
+                next = rbh->info.state.tail_cl.successor.load(std::memory_order_acquire) - 1;
+            }
+            shmdt(ptr);
+        }
+        if (shmctl(shmid,IPC_RMID,nullptr) == -1) {
+            throw ws_exp(std::string("deltete shared memory: shmctl failed with error:") +
+                         std::strerror(errno));
+        }
+        shmid = next;
+    }
+}
+
+bool RingBuffer::resize_ring_buffer(const key_t key, uint32_t capacity, uint64_t timeout_ns) {
+    // resize the last ring buffer of the chain.
+    auto ring = get_ring_buffer(key);
+    RingBufferState* state = const_cast<RingBufferState*>(&ring->info_ptr->info.state);
+    while (state->tail_cl.successor.load(std::memory_order_acquire) != 0) {
+        ring.reset(new RingBuffer(attach_ring_segment(state->tail_cl.successor.load(std::memory_order_acquire) - 1,
+                                                      false)));
+        state = const_cast<RingBufferState*>(&ring->info_ptr->info.state);
+    }
+    const RingBufferAttribute old_attribute = ring->attribute();
+    RingBufferAttribute attribute = old_attribute;
+    attribute.capacity = capacity;
+
+    // the position API does not follow a resize, so a ring buffer used through it stays where it is.
+    uint8_t resize_state = RB_RESIZABLE;
+    if (!state->tail_cl.resize_state.compare_exchange_strong(resize_state,RB_RESIZED,std::memory_order_acq_rel)) {
+        if (resize_state == RB_POSITIONED) {
+            throw ws_exp("Ring buffer " + std::to_string(key) +
+                         " is used through the position API, which does not follow a resize.");
+        }
+        throw ws_exp("Ring buffer " + std::to_string(key) + " is being resized by another process.");
+    }
+    int shmid;
+    try {
+        shmid = create_ring_segment(attribute,IPC_PRIVATE);
+    } catch (...) {
+        state->tail_cl.resize_state.store(RB_RESIZABLE,std::memory_order_release);
+        throw;
+    }
+
+    // link
+    state->tail_cl.successor.store(shmid + 1,std::memory_order_release);
+
+    // seal, the only producer does it by itself.
+    if (attribute.multiple_producer) {
+        bool unlocked = false;
+        while(!state->producer_lock_cl.lock.compare_exchange_weak(unlocked,true,std::memory_order_acquire)) {
+            unlocked = false;
+        }
+        state->tail_cl.sealed.store(true,std::memory_order_release);
+        state->producer_lock_cl.lock.store(false,std::memory_order_release);
+    }
+
+    // wait for the consumers to drain it
+    const auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(timeout_ns);
+    while (!state->tail_cl.sealed.load(std::memory_order_acquire) ||
+           state->tail_cl.tail.load(std::memory_order_acquire) != state->head_cl.head.load(std::memory_order_acquire)) {
+        if (std::chrono::steady_clock::now() >= end) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    // Nobody touches the entries any more, only the header. Unpin them and free them in whole pages.
+    shmctl(old_attribute.id,SHM_UNLOCK,nullptr);
+    const uintptr_t page_size   = old_attribute.page_size;
+    const uintptr_t entries     = reinterpret_cast<uintptr_t>(ring->info_ptr) + sizeof(RingBufferHeader);
+    const uintptr_t start       = (entries + page_size - 1) / page_size * page_size;
+    const uintptr_t stop        = (entries + static_cast<uintptr_t>(old_attribute.capacity) * old_attribute.entry_size)
+                                  / page_size * page_size;
+    if (stop > start) {
+        madvise(reinterpret_cast<void*>(start),stop - start,MADV_REMOVE);
     }
+    return true;
 }
 
-std::unique_ptr<RingBuffer> RingBuffer::get_ring_buffer(const key_t key) {
+std::unique_ptr<RingBuffer> RingBuffer::get_ring_buffer(const key_t key, bool read_only) {
     int shmid = shmget(key,0,0);
 
     if (shmid == -1) {
@@ -241,16 +744,40 @@ std::unique_ptr<RingBuffer> RingBuffer::get_ring_buffer(const key_t key) {
                      std::strerror(errno));
     }
 
-    void* mem_ptr = shmat(shmid,nullptr,0);
-    if (mem_ptr == nullptr) {
-        throw ws_exp(std::string("Memory attach failed: shmat failed with error:") +
-                     std::strerror(errno));
-    }
-
-    RingBuffer* rb = new RingBuffer(mem_ptr);
+    RingBuffer* rb = new RingBuffer(attach_ring_segment(shmid,read_only),read_only);
 
     return std::unique_ptr<RingBuffer>(rb);
 }
 
+std::vector<key_t> RingBuffer::list_ring_buffers() {
+    std::vector<key_t> keys;
+    std::ifstream sysvipc("/proc/sysvipc/shm");
+    if (!sysvipc) {
+        throw ws_exp("Failed to open /proc/sysvipc/shm.");
+    }
+    std::string line;
+    // skip the title line
+    std::getline(sysvipc,line);
+    while (std::getline(sysvipc,line)) {
+        std::istringstream fields(line);
+        long long key;
+        int shmid;
+        unsigned perms;
+        size_t size;
+        if (!(fields >> key >> shmid >> perms >> size) || key == IPC_PRIVATE || size < sizeof(RingBufferHeader)) {
+            continue;
+        }
+        void* ptr = shmat(shmid,nullptr,SHM_RDONLY);
+        if (ptr == (void*)-1) {
+            continue;
+        }
+        if (reinterpret_cast<const RingBufferHeader*>(ptr)->info.magic == WS_RING_BUFFER_MAGIC) {
+            keys.push_back(static_cast<key_t>(key));
+        }
+        shmdt(ptr);
+    }
+    return keys;
+}
+
 }
 }
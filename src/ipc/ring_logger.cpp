@@ -0,0 +1,289 @@
+/**
+ * @file    ring_logger.cpp
+ * @brief   Ring logger implementation.
+ */
+
+#include <wsong/ipc/ring_logger.hpp>
+
+#include <ctime>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+// A serialized format definition, followed by the file and the format strings, both null-terminated.
+struct log_definition_t {
+    uint32_t    id;
+    uint32_t    line;
+    uint8_t     level;
+    uint8_t     num_args;
+    char        arg_types[WS_LOG_MAX_ARGS];
+} __attribute__((packed));
+
+#define RL_PUBLISH_TIMEOUT_NS   (1000000000ull)
+#define RL_MIN_ENTRY_SIZE       (64)
+
+static const char* level_names[] = {"DEBUG","INFO ","WARN ","ERROR"};
+
+// The format table is filled during static initialization, so it is created on first use.
+static std::vector<const LogFormat*>& format_table() {
+    static std::vector<const LogFormat*> table;
+    return table;
+}
+
+static std::mutex& format_table_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+/**
+ * @endcond
+ */
+
+void log_register_format(const LogFormat* format) {
+    std::lock_guard<std::mutex> lock(format_table_mutex());
+    format_table().push_back(format);
+}
+
+std::vector<const LogFormat*> log_registered_formats() {
+    std::lock_guard<std::mutex> lock(format_table_mutex());
+    return format_table();
+}
+
+RingLogger::RingLogger(key_t key, uint64_t timeout_ns) :
+    ring_buffer(RingBuffer::get_ring_buffer(key)),
+    max_record_size(std::min<uint16_t>(this->ring_buffer->attribute().entry_size,WS_LOG_MAX_RECORD_SIZE)),
+    timeout_ns(timeout_ns),
+    min_level(WS_LOG_LEVEL_DEBUG),
+    dropped_records(0) {
+    if (this->max_record_size < RL_MIN_ENTRY_SIZE) {
+        throw ws_invalid_argument_exp("Ring logger needs an entry size of at least " +
+                                      std::to_string(RL_MIN_ENTRY_SIZE) + " bytes.");
+    }
+    publish_formats();
+}
+
+RingLogger::~RingLogger() {}
+
+void RingLogger::publish_formats() {
+    uint8_t record[WS_LOG_MAX_RECORD_SIZE] __attribute__ (( aligned(CACHELINE_SIZE) ));
+    const uint16_t chunk_size = this->max_record_size - sizeof(LogRecordHeader);
+    for (const LogFormat* f: log_registered_formats()) {
+        // serialize
+        std::string definition(sizeof(log_definition_t),'\0');
+        log_definition_t* ld = reinterpret_cast<log_definition_t*>(definition.data());
+        ld->id          = f->id;
+        ld->line        = f->line;
+        ld->level       = f->level;
+        ld->num_args    = f->num_args;
+        std::memcpy(ld->arg_types,f->arg_types,WS_LOG_MAX_ARGS);
+        definition.append(f->file).push_back('\0');
+        definition.append(f->format).push_back('\0');
+        if (definition.size() > UINT16_MAX) {
+            throw ws_invalid_argument_exp("Log format is too long at " + std::string(f->file) + ":" +
+                                          std::to_string(f->line));
+        }
+        // send in chunks
+        for (size_t offset = 0; offset < definition.size(); offset += chunk_size) {
+            const uint16_t len = std::min<size_t>(chunk_size,definition.size() - offset);
+            LogRecordHeader* header = reinterpret_cast<LogRecordHeader*>(record);
+            header->format_id   = WS_LOG_DEFINITION_ID;
+            header->size        = sizeof(LogRecordHeader) + len;
+            header->offset      = static_cast<uint16_t>(offset);
+            header->timestamp   = (static_cast<uint64_t>(f->id) << 32) | definition.size();
+            std::memcpy(record + sizeof(LogRecordHeader),definition.data() + offset,len);
+            this->ring_buffer->produce(record,header->size,RL_PUBLISH_TIMEOUT_NS);
+        }
+    }
+}
+
+void RingLogger::set_level(LogLevel level) {
+    this->min_level.store(level,std::memory_order_relaxed);
+}
+
+uint64_t RingLogger::dropped() {
+    return this->dropped_records.load(std::memory_order_relaxed);
+}
+
+RingLogReader::RingLogReader(key_t key) :
+    ring_buffer(RingBuffer::get_ring_buffer(key)) {}
+
+RingLogReader::~RingLogReader() {}
+
+void RingLogReader::define(const LogRecordHeader* header) {
+    const uint32_t id       = static_cast<uint32_t>(header->timestamp >> 32);
+    const uint32_t length   = static_cast<uint32_t>(header->timestamp & 0xffffffff);
+    const uint16_t len      = header->size - sizeof(LogRecordHeader);
+    if (this->formats.find(id) != this->formats.end() || length < sizeof(log_definition_t)) {
+        return;
+    }
+    std::string& definition = this->definitions[id];
+    definition.resize(length);
+    if (static_cast<uint32_t>(header->offset) + len > length) {
+        return;
+    }
+    std::memcpy(definition.data() + header->offset,reinterpret_cast<const uint8_t*>(header + 1),len);
+    // Chunks of the same definition from several processes may interleave, but they carry the same bytes and each
+    // process sends its chunks in order: when a last chunk arrives, all bytes have been written.
+    if (header->offset + len == length) {
+        const log_definition_t* ld = reinterpret_cast<const log_definition_t*>(definition.data());
+        LogFormat f;
+        f.id        = ld->id;
+        f.line      = ld->line;
+        f.level     = ld->level;
+        f.num_args  = ld->num_args;
+        std::memcpy(f.arg_types,ld->arg_types,WS_LOG_MAX_ARGS);
+        f.file      = definition.data() + sizeof(log_definition_t);
+        f.format    = f.file + std::strlen(f.file) + 1;
+        this->formats.emplace(id,f);
+    }
+}
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+template <typename T>
+static void append_printf(std::string& out, const std::string& spec, T value) {
+    char buf[256];
+    int len = std::snprintf(buf,sizeof(buf),spec.c_str(),value);
+    if (len < 0) {
+        return;
+    }
+    if (static_cast<size_t>(len) < sizeof(buf)) {
+        out.append(buf,len);
+    } else {
+        std::vector<char> large(len + 1);
+        std::snprintf(large.data(),large.size(),spec.c_str(),value);
+        out.append(large.data(),len);
+    }
+}
+/**
+ * @endcond
+ */
+
+std::string RingLogReader::format(const void* record) {
+    const LogRecordHeader* header = reinterpret_cast<const LogRecordHeader*>(record);
+    std::string line;
+
+    // timestamp
+    char tbuf[64];
+    struct tm tm;
+    const time_t seconds = static_cast<time_t>(header->timestamp / 1000000000ull);
+    localtime_r(&seconds,&tm);
+    size_t tlen = std::strftime(tbuf,sizeof(tbuf),"%F %T",&tm);
+    std::snprintf(tbuf + tlen,sizeof(tbuf) - tlen,".%09" PRIu64 " ",static_cast<uint64_t>(header->timestamp % 1000000000ull));
+    line.append(tbuf);
+
+    auto it = this->formats.find(header->format_id);
+    if (it == this->formats.end()) {
+        std::snprintf(tbuf,sizeof(tbuf),"<unknown log format 0x%08x>\n",header->format_id);
+        line.append(tbuf);
+        return line;
+    }
+    const LogFormat& f = it->second;
+    line.append(level_names[f.level < 4 ? f.level : 3]).append(" ");
+    const char* file = std::strrchr(f.file,'/');
+    line.append(file ? file + 1 : f.file).append(":").append(std::to_string(f.line)).append(" ");
+
+    // walk the format string and the arguments side by side.
+    const uint8_t* args = reinterpret_cast<const uint8_t*>(header + 1);
+    const uint8_t* args_end = reinterpret_cast<const uint8_t*>(header) + header->size;
+    uint32_t arg = 0;
+    const char* p = f.format;
+    while (*p) {
+        if (*p != '%') {
+            line.push_back(*p++);
+            continue;
+        }
+        if (p[1] == '%') {
+            line.push_back('%');
+            p += 2;
+            continue;
+        }
+        // parse flags, width and precision; drop length modifiers, which are decided by the recorded type.
+        std::string spec = "%";
+        p++;
+        while (*p && std::strchr("-+ #0123456789.",*p)) {
+            spec.push_back(*p++);
+        }
+        while (*p && std::strchr("hlLqjzt",*p)) {
+            p++;
+        }
+        const char conv = *p ? *p++ : 's';
+        const bool int_conv = std::strchr("diouxXc",conv) != nullptr;
+        const bool float_conv = std::strchr("eEfFgGaA",conv) != nullptr;
+
+        const char type = (arg < f.num_args) ? f.arg_types[arg++] : '\0';
+        if (type == 's') {
+            uint16_t len = 0;
+            if (args + sizeof(uint16_t) <= args_end) {
+                std::memcpy(&len,args,sizeof(uint16_t));
+                args += sizeof(uint16_t);
+            }
+            len = std::min<size_t>(len,args_end - args);
+            append_printf(line,spec + "s",std::string(reinterpret_cast<const char*>(args),len).c_str());
+            args += len;
+            continue;
+        }
+        if (type == '\0' || args + sizeof(uint64_t) > args_end) {
+            // missing or truncated argument
+            line.append("<?>");
+            continue;
+        }
+        uint64_t value;
+        std::memcpy(&value,args,sizeof(uint64_t));
+        args += sizeof(uint64_t);
+        double dvalue;
+        std::memcpy(&dvalue,&value,sizeof(double));
+        if (type == 'd') {
+            if (int_conv) {
+                append_printf(line,spec + "lld",static_cast<long long>(dvalue));
+            } else {
+                append_printf(line,spec + (float_conv ? std::string(1,conv) : "g"),dvalue);
+            }
+        } else if (type == 'p' || conv == 'p') {
+            append_printf(line,spec + "p",reinterpret_cast<void*>(value));
+        } else if (float_conv) {
+            append_printf(line,spec + conv,(type == 'i') ? static_cast<double>(static_cast<int64_t>(value)) :
+                                                          static_cast<double>(value));
+        } else if (conv == 'c') {
+            append_printf(line,spec + "c",static_cast<int>(value));
+        } else {
+            const char c = int_conv ? conv : (type == 'i' ? 'd' : 'u');
+            append_printf(line,spec + "ll" + c,static_cast<long long>(value));
+        }
+    }
+    line.push_back('\n');
+    return line;
+}
+
+size_t RingLogReader::poll(std::ostream& out, size_t max_records) {
+    // zero-copy: format the records in place and release the slots in one batch.
+    const uint32_t head = this->ring_buffer->head_position();
+    const uint32_t tail = this->ring_buffer->tail_position();
+    const uint32_t count = std::min<uint32_t>(tail - head,max_records);
+    std::string batch;
+    for (uint32_t pos = head; pos != head + count; pos++) {
+        const LogRecordHeader* header = reinterpret_cast<const LogRecordHeader*>(this->ring_buffer->slot(pos));
+        if (header->format_id == WS_LOG_DEFINITION_ID) {
+            define(header);
+        } else {
+            batch.append(format(header));
+        }
+    }
+    if (count > 0) {
+        this->ring_buffer->advance_head(head + count);
+    }
+    if (batch.size() > 0) {
+        out.write(batch.data(),batch.size());
+    }
+    return count;
+}
+
+}
+}
@@ -0,0 +1,121 @@
+/**
+ * @file    ring_merger.cpp
+ * @brief   Ordered k-way merge consumer implementation.
+ */
+
+#include <wsong/ipc/ring_merger.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+#define MERGE_HEAP_CMP  [](const HeapEntry& a, const HeapEntry& b) { \
+                            return a.key > b.key || (a.key == b.key && a.ring_index > b.ring_index); \
+                        }
+/**
+ * @endcond
+ */
+
+RingMerger::RingMerger(const std::vector<key_t>& keys, uint16_t key_offset, uint64_t lateness):
+    key_offset(key_offset),
+    lateness(lateness),
+    last_emitted(0),
+    statistics{0,0,0} {
+    if (keys.empty()) {
+        throw ws_invalid_argument_exp("RingMerger requires at least one ring buffer.");
+    }
+    for (auto key: keys) {
+        auto ring = RingBuffer::get_ring_buffer(key);
+        if (static_cast<uint32_t>(key_offset) + sizeof(uint64_t) > ring->attribute().entry_size) {
+            throw ws_invalid_argument_exp("Invalid key_offset:" + std::to_string(key_offset)
+                                          + " for entry_size:" + std::to_string(ring->attribute().entry_size));
+        }
+        rings.emplace_back(std::move(ring));
+    }
+    in_heap.resize(rings.size(),false);
+    heap.reserve(rings.size());
+}
+
+RingMerger::~RingMerger() {}
+
+void RingMerger::peek(uint32_t ring_index) {
+    auto& ring = rings[ring_index];
+    const uint32_t head = ring->head_position();
+    if (ring->tail_position() == head) {
+        return;
+    }
+    uint64_t key;
+    std::memcpy(&key,reinterpret_cast<const uint8_t*>(ring->slot(head)) + key_offset,sizeof(key));
+    heap.push_back({key,ring_index});
+    std::push_heap(heap.begin(),heap.end(),MERGE_HEAP_CMP);
+    in_heap[ring_index] = true;
+    statistics.watermark = std::max(statistics.watermark,key);
+}
+
+void RingMerger::advance_watermark() {
+    // the entries in [head, tail) stay in place until the merger consumes them, so the newest one is safe to read.
+    for (auto& ring : rings) {
+        const uint32_t tail = ring->tail_position();
+        if (tail == ring->head_position()) {
+            continue;
+        }
+        uint64_t key;
+        std::memcpy(&key,reinterpret_cast<const uint8_t*>(ring->slot(tail - 1)) + key_offset,sizeof(key));
+        statistics.watermark = std::max(statistics.watermark,key);
+    }
+}
+
+size_t RingMerger::poll(const Handler& handler, size_t max_entries) {
+    size_t emitted = 0;
+    while (emitted < max_entries) {
+        for (uint32_t i = 0; i < rings.size(); i++) {
+            if (!in_heap[i]) {
+                peek(i);
+            }
+        }
+        if (heap.empty()) {
+            break;
+        }
+        // The watermark is never behind the smallest head entry since that entry has been observed.
+        // Only an entry held back by an idle ring buffer reads the tails, to leave the producers' cachelines alone.
+        const HeapEntry& top = heap.front();
+        if (heap.size() < rings.size() && statistics.watermark - top.key < lateness) {
+            advance_watermark();
+            if (statistics.watermark - top.key < lateness) {
+                break;
+            }
+        }
+
+        std::pop_heap(heap.begin(),heap.end(),MERGE_HEAP_CMP);
+        const HeapEntry next = heap.back();
+        heap.pop_back();
+        in_heap[next.ring_index] = false;
+
+        auto& ring = rings[next.ring_index];
+        const uint32_t head = ring->head_position();
+        handler(ring->slot(head),next.key,next.ring_index);
+        ring->advance_head(head + 1);
+
+        if (statistics.emitted > 0 && next.key < last_emitted) {
+            statistics.late ++;
+        } else {
+            last_emitted = next.key;
+        }
+        statistics.emitted ++;
+        emitted ++;
+    }
+    return emitted;
+}
+
+RingMergerStats RingMerger::stats() {
+    return statistics;
+}
+
+}
+}
@@ -0,0 +1,77 @@
+/**
+ * @file    ring_message.cpp
+ * @brief   The schema stamp of the message rings.
+ */
+
+#include <wsong/ipc/ring_message.hpp>
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+#define RM_STAMP_PREFIX     "schema="
+
+// The "<name>/<version>" stamped into a ring buffer description, empty if there is none.
+static std::string_view schema_stamp(const RingBufferAttribute& attribute) {
+    const std::string_view description(attribute.description,strnlen(attribute.description,
+                                                                      sizeof(attribute.description)));
+    size_t pos = description.find(RM_STAMP_PREFIX);
+    while (pos != std::string_view::npos && pos > 0 && description[pos - 1] != ' ') {
+        pos = description.find(RM_STAMP_PREFIX,pos + 1);
+    }
+    if (pos == std::string_view::npos) {
+        return {};
+    }
+    const std::string_view stamp = description.substr(pos + sizeof(RM_STAMP_PREFIX) - 1);
+    return stamp.substr(0,stamp.find(' '));
+}
+/**
+ * @endcond
+ */
+
+void message_schema_describe(RingBufferAttribute& attribute, const char* name, uint16_t version) {
+    if (!schema_stamp(attribute).empty()) {
+        throw ws_invalid_argument_exp("The ring buffer description is already stamped with schema " +
+                                      std::string(schema_stamp(attribute)) + ".");
+    }
+    const size_t length = strnlen(attribute.description,sizeof(attribute.description));
+    const int written = std::snprintf(attribute.description + length,sizeof(attribute.description) - length,
+                                      "%s" RM_STAMP_PREFIX "%s/%u",(length > 0 ? " " : ""),name,version);
+    if (written < 0 || static_cast<size_t>(written) >= sizeof(attribute.description) - length) {
+        attribute.description[length] = '\0';
+        throw ws_invalid_argument_exp("No room in the ring buffer description for schema " + std::string(name) + ".");
+    }
+}
+
+void message_schema_check(const RingBufferAttribute& attribute, const char* name, uint16_t version,
+                          size_t fixed_size, size_t alignment) {
+    const std::string expected = std::string(name) + "/" + std::to_string(version);
+    const std::string_view stamp = schema_stamp(attribute);
+    if (stamp.empty()) {
+        throw ws_invalid_argument_exp("Ring buffer " + std::to_string(attribute.key) +
+                                      " has no message schema, expecting " + expected + ".");
+    }
+    if (stamp != expected) {
+        throw ws_invalid_argument_exp("Ring buffer " + std::to_string(attribute.key) + " carries schema " +
+                                      std::string(stamp) + ", not " + expected + ".");
+    }
+    if (attribute.entry_size < fixed_size) {
+        throw ws_invalid_argument_exp("The entry size " + std::to_string(attribute.entry_size) +
+                                      " of ring buffer " + std::to_string(attribute.key) + " is smaller than the " +
+                                      std::to_string(fixed_size) + " bytes of schema " + expected + ".");
+    }
+    if (attribute.entry_size % alignment != 0) {
+        throw ws_invalid_argument_exp("The entry size " + std::to_string(attribute.entry_size) +
+                                      " of ring buffer " + std::to_string(attribute.key) +
+                                      " misaligns the messages of schema " + expected + ".");
+    }
+}
+
+}
+}
@@ -0,0 +1,276 @@
+/**
+ * @file    ring_pool.cpp
+ * @brief   Ring pool implementation.
+ */
+
+#include <wsong/ipc/ring_pool.hpp>
+
+#include <sys/types.h>
+#if defined(__linux__)
+#include <asm-generic/hugetlb_encode.h>
+#endif
+
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <string>
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+struct pooled_ring_t {
+    union {
+        std::atomic<uint32_t>   head;
+        uint8_t                 cacheline[CACHELINE_SIZE];
+    } head_cl WS_CL_ALIGNED;
+    union {
+        std::atomic<uint32_t>   tail;
+        uint8_t                 cacheline[CACHELINE_SIZE];
+    } tail_cl WS_CL_ALIGNED;
+};
+
+#define RP_ROUND_UP(x,a)        ((((x) + (a) - 1) / (a)) * (a))
+#define RP_BITMAP_BYTES(attr)   RP_ROUND_UP((((attr).num_rings + 63) / 64) * sizeof(uint64_t), CACHELINE_SIZE)
+#define RP_RING_BYTES(attr)     RP_ROUND_UP(sizeof(pooled_ring_t) + \
+                                    static_cast<size_t>((attr).capacity) * (attr).entry_size, CACHELINE_SIZE)
+
+#define RP_ATTRIBUTE            (this->info_ptr->info.attribute)
+#define RP_ALLOCATED            (const_cast<RingPoolHeader*>(this->info_ptr)->info.allocated)
+#define RP_BITMAP               reinterpret_cast<std::atomic<uint64_t>*>( \
+                                    reinterpret_cast<uintptr_t>(this->info_ptr) + sizeof(RingPoolHeader) \
+                                )
+#define RP_RING(h)              reinterpret_cast<pooled_ring_t*>( \
+                                    reinterpret_cast<uintptr_t>(this->info_ptr) + sizeof(RingPoolHeader) + \
+                                    RP_BITMAP_BYTES(RP_ATTRIBUTE) + static_cast<size_t>(h) * RP_RING_BYTES(RP_ATTRIBUTE) \
+                                )
+#define RP_BUFFER(ring,idx)     reinterpret_cast<void*>( \
+                                    reinterpret_cast<uintptr_t>(ring) + sizeof(pooled_ring_t) + \
+                                    ((idx) % RP_ATTRIBUTE.capacity) * RP_ATTRIBUTE.entry_size \
+                                )
+#define RP_VALIDATE_HANDLE(h)   if ((h) >= RP_ATTRIBUTE.num_rings) { \
+                                    throw ws_invalid_argument_exp("Invalid ring pool handle:" + std::to_string(h)); \
+                                }
+/**
+ * @endcond
+ */
+
+RingPool::RingPool(void* mem_ptr) :
+    info_ptr(reinterpret_cast<const RingPoolHeader*>(mem_ptr)) {
+}
+
+RingPool::~RingPool() {
+    shmdt(this->info_ptr);
+}
+
+RingPoolAttribute RingPool::attribute() {
+    return RP_ATTRIBUTE;
+}
+
+uint32_t RingPool::allocated() {
+    return RP_ALLOCATED.load(std::memory_order_relaxed);
+}
+
+RingPoolHandle RingPool::allocate() {
+    const uint32_t num_words = (RP_ATTRIBUTE.num_rings + 63) / 64;
+    for (uint32_t i = 0; i < num_words; i++) {
+        const uint32_t bits = (i == num_words - 1 && (RP_ATTRIBUTE.num_rings % 64)) ?
+                              (RP_ATTRIBUTE.num_rings % 64) : 64;
+        const uint64_t valid = (bits == 64) ? ~0ull : ((1ull << bits) - 1);
+        uint64_t word = RP_BITMAP[i].load(std::memory_order_relaxed);
+        while (~word & valid) {
+            const uint32_t bit = __builtin_ctzll(~word & valid);
+            if (RP_BITMAP[i].compare_exchange_weak(word, word | (1ull << bit), std::memory_order_acquire)) {
+                const RingPoolHandle handle = i * 64 + bit;
+                pooled_ring_t* ring = RP_RING(handle);
+                ring->head_cl.head.store(0,std::memory_order_relaxed);
+                ring->tail_cl.tail.store(0,std::memory_order_release);
+                RP_ALLOCATED.fetch_add(1,std::memory_order_relaxed);
+                return handle;
+            }
+        }
+    }
+    throw ws_exp("Ring pool is exhausted: all " + std::to_string(RP_ATTRIBUTE.num_rings) + " ring buffers are in use.");
+}
+
+void RingPool::release(RingPoolHandle handle) {
+    RP_VALIDATE_HANDLE(handle);
+    const uint64_t mask = 1ull << (handle % 64);
+    if ((RP_BITMAP[handle / 64].fetch_and(~mask,std::memory_order_release) & mask) == 0) {
+        throw ws_invalid_argument_exp("Ring pool handle " + std::to_string(handle) + " is not allocated.");
+    }
+    RP_ALLOCATED.fetch_sub(1,std::memory_order_relaxed);
+}
+
+void RingPool::produce(RingPoolHandle handle, const void* buffer, uint16_t size, uint64_t timeout_ns) {
+    RP_VALIDATE_HANDLE(handle);
+    if (size > RP_ATTRIBUTE.entry_size || size == 0) {
+        throw ws_invalid_argument_exp("Ring pool produce() is called with invalid size.");
+    }
+
+    pooled_ring_t* ring = RP_RING(handle);
+    // the producer is the only writer of tail.
+    const uint32_t tail = ring->tail_cl.tail.load(std::memory_order_relaxed);
+    if (tail - ring->head_cl.head.load(std::memory_order_acquire) >= RP_ATTRIBUTE.capacity - 1) {
+        const auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(timeout_ns);
+        while (tail - ring->head_cl.head.load(std::memory_order_acquire) >= RP_ATTRIBUTE.capacity - 1) {
+            if (std::chrono::steady_clock::now() > end) {
+                throw ws_timeout_exp("Ring pool produce call timeout.");
+            }
+        }
+    }
+    std::memcpy(RP_BUFFER(ring,tail),buffer,size);
+    ring->tail_cl.tail.store(tail + 1,std::memory_order_release);
+}
+
+void RingPool::consume(RingPoolHandle handle, void* buffer, uint16_t size, uint64_t timeout_ns) {
+    RP_VALIDATE_HANDLE(handle);
+    if (size > RP_ATTRIBUTE.entry_size || size == 0) {
+        throw ws_invalid_argument_exp("Ring pool consume() is called with invalid size.");
+    }
+
+    pooled_ring_t* ring = RP_RING(handle);
+    // the consumer is the only writer of head.
+    const uint32_t head = ring->head_cl.head.load(std::memory_order_relaxed);
+    if (ring->tail_cl.tail.load(std::memory_order_acquire) == head) {
+        const auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(timeout_ns);
+        while (ring->tail_cl.tail.load(std::memory_order_acquire) == head) {
+            if (std::chrono::steady_clock::now() > end) {
+                throw ws_timeout_exp("Ring pool consume call timeout.");
+            }
+        }
+    }
+    std::memcpy(buffer,RP_BUFFER(ring,head),size);
+    ring->head_cl.head.store(head + 1,std::memory_order_release);
+}
+
+uint32_t RingPool::size(RingPoolHandle handle) {
+    RP_VALIDATE_HANDLE(handle);
+    pooled_ring_t* ring = RP_RING(handle);
+    return ring->tail_cl.tail.load(std::memory_order_acquire) - ring->head_cl.head.load(std::memory_order_acquire);
+}
+
+bool RingPool::empty(RingPoolHandle handle) {
+    return size(handle) == 0;
+}
+
+key_t RingPool::create_ring_pool(const RingPoolAttribute& attribute) {
+    // validate check
+    if ((attribute.entry_size & (attribute.entry_size - 1)) || (attribute.entry_size == 0)) {
+        throw ws_invalid_argument_exp("Invalid entry_size:" + std::to_string(attribute.entry_size));
+    }
+    if ((attribute.capacity & (attribute.capacity - 1)) || (attribute.capacity < 2)) {
+        throw ws_invalid_argument_exp("Invalid capacity:" + std::to_string(attribute.capacity));
+    }
+    if (attribute.num_rings == 0) {
+        throw ws_invalid_argument_exp("Invalid num_rings:0");
+    }
+
+    // create ring pool memory
+    int shmflg = IPC_CREAT | IPC_EXCL | 0644; // the default permission
+    switch (attribute.page_size) {
+    case 1<<12:
+        break;
+#if defined(__linux__)
+    case 1<<21:
+        shmflg |= (SHM_HUGETLB | (HUGETLB_FLAG_ENCODE_2MB));
+        break;
+    case 1<<30:
+        shmflg |= (SHM_HUGETLB | (HUGETLB_FLAG_ENCODE_1GB));
+        break;
+#endif
+    default:
+        throw ws_invalid_argument_exp("Invalid page_size:" + std::to_string(attribute.page_size));
+    }
+
+    size_t shared_memory_region_size = RP_ROUND_UP(sizeof(RingPoolHeader) + RP_BITMAP_BYTES(attribute)
+                                                   + attribute.num_rings * RP_RING_BYTES(attribute),
+                                                   static_cast<size_t>(attribute.page_size));
+
+    int shmid = shmget(attribute.key,shared_memory_region_size,shmflg);
+
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") +
+                     std::strerror(errno));
+    }
+
+    // lock memory
+    if (shmctl(shmid,SHM_LOCK,nullptr) == -1) {
+        int err = errno;
+        shmctl(shmid,IPC_RMID,nullptr);
+        errno = err;
+        throw ws_exp(std::string("pinning pages: shmctl failed with error:") +
+                     std::strerror(err));
+    }
+
+    // get key
+    struct shmid_ds buf;
+    if (shmctl(shmid,IPC_STAT,&buf) == -1) {
+        int err = errno;
+        shmctl(shmid,IPC_RMID,nullptr);
+        errno = err;
+        throw ws_exp(std::string("get stat: shmctl failed with error:") +
+                     std::strerror(err));
+    }
+
+    // attach to memory region
+    void* ptr = shmat(shmid,nullptr,0);
+    if (ptr == (void*)-1) {
+        int err = errno;
+        shmctl(shmid,IPC_RMID,nullptr);
+        errno = err;
+        throw ws_exp(std::string("attach: shmat failed with error:") +
+                     std::strerror(err));
+    }
+
+    // initialize, the shared memory is zero-filled so all ring buffers are free.
+    RingPoolHeader* rph     = reinterpret_cast<RingPoolHeader*>(ptr);
+    rph->info.attribute     = attribute;
+    rph->info.attribute.id  = shmid;
+    rph->info.attribute.key = buf.shm_perm.__key;
+    rph->info.allocated.store(0);
+
+    // detach memory region
+    if (shmdt(ptr) == -1) {
+        throw ws_exp(std::string("detach: shmdt failed with error:") +
+                     std::strerror(errno));
+    }
+
+    return buf.shm_perm.__key;
+}
+
+void RingPool::delete_ring_pool(const key_t key) {
+    int shmid = shmget(key,0,0);
+
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") +
+                     std::strerror(errno));
+    }
+
+    if (shmctl(shmid,IPC_RMID,nullptr) == -1) {
+        throw ws_exp(std::string("delete shared memory: shmctl failed with error:") +
+                     std::strerror(errno));
+    }
+}
+
+std::unique_ptr<RingPool> RingPool::get_ring_pool(const key_t key) {
+    int shmid = shmget(key,0,0);
+
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") +
+                     std::strerror(errno));
+    }
+
+    void* mem_ptr = shmat(shmid,nullptr,0);
+    if (mem_ptr == (void*)-1) {
+        throw ws_exp(std::string("Memory attach failed: shmat failed with error:") +
+                     std::strerror(errno));
+    }
+
+    return std::unique_ptr<RingPool>(new RingPool(mem_ptr));
+}
+
+}
+}
@@ -0,0 +1,233 @@
+/**
+ * @file    ring_relay.cpp
+ * @brief   Cross-NUMA ring buffer relay implementation.
+ */
+
+#include <wsong/ipc/ring_relay.hpp>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <future>
+#include <random>
+#include <string>
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+// How many times a lane draws another random key for its target ring buffer when the key is taken.
+#define RR_CREATE_RETRIES       (16)
+// The NUMA nodes a relay lane can be bound to.
+#define RR_MAX_NODES            (1024)
+#define RR_MASK_BITS            (8 * sizeof(unsigned long))
+/**
+ * @endcond
+ */
+
+/**
+ * @brief   Pin the calling thread to the cpus of a NUMA node and prefer allocating memory on that node.
+ * @param[in]   numa_node   The NUMA node.
+ */
+static void bind_to_numa_node(int numa_node) {
+    if (numa_node < 0 || numa_node >= RR_MAX_NODES) {
+        throw ws_invalid_argument_exp("Invalid NUMA node:" + std::to_string(numa_node));
+    }
+    // cpu affinity
+    std::ifstream cpulist_file("/sys/devices/system/node/node" + std::to_string(numa_node) + "/cpulist");
+    std::string cpulist;
+    if (!cpulist_file || !std::getline(cpulist_file,cpulist) || cpulist.empty()) {
+        throw ws_invalid_argument_exp("Invalid NUMA node:" + std::to_string(numa_node));
+    }
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    size_t pos = 0;
+    while (pos < cpulist.size()) {
+        size_t end = cpulist.find(',',pos);
+        if (end == std::string::npos) {
+            end = cpulist.size();
+        }
+        std::string range = cpulist.substr(pos,end-pos);
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0,dash));
+        int last  = (dash == std::string::npos) ? first : std::stoi(range.substr(dash+1));
+        for (int cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu,&cpuset);
+        }
+        pos = end + 1;
+    }
+    int ret = pthread_setaffinity_np(pthread_self(),sizeof(cpuset),&cpuset);
+    if (ret != 0) {
+        throw ws_exp(std::string("pthread_setaffinity_np failed with error:") + std::strerror(ret));
+    }
+
+#if defined(__linux__)
+    // memory policy, pages are placed on the node of the thread touching them first.
+    unsigned long nodemask[RR_MAX_NODES / RR_MASK_BITS] = {0};
+    nodemask[numa_node / RR_MASK_BITS] = 1ul << (numa_node % RR_MASK_BITS);
+    // set_mempolicy() reads maxnode - 1 bits, hence the + 1.
+    if (syscall(SYS_set_mempolicy,MPOL_PREFERRED,nodemask,RR_MAX_NODES + 1) == -1) {
+        throw ws_exp(std::string("set_mempolicy failed with error:") + std::strerror(errno));
+    }
+#endif
+}
+
+RingRelay::RingRelay(const key_t source_key, const std::vector<RingRelayTarget>& targets, uint32_t batch_size):
+    source(RingBuffer::get_ring_buffer(source_key)),
+    batch_size(batch_size),
+    stopped(false) {
+    if (targets.empty()) {
+        throw ws_invalid_argument_exp("RingRelay requires at least one target.");
+    }
+    if (batch_size == 0) {
+        throw ws_invalid_argument_exp("Invalid batch_size:0");
+    }
+
+    const uint32_t head = source->head_position();
+    for (size_t i = 0; i < targets.size(); i++) {
+        auto lane = std::make_unique<Lane>();
+        lane->target = targets[i];
+        lane->cursor.store(head);
+        lane->relayed.store(0);
+        lane->batches.store(0);
+        lane->created = false;
+        lanes.emplace_back(std::move(lane));
+    }
+
+    std::random_device rd;
+    try {
+        for (size_t i = 0; i < lanes.size(); i++) {
+            Lane& lane = *lanes[i];
+            // The target ring buffer is created and prefaulted by the pinned relay thread so that its pages are local
+            // to the target node.
+            std::promise<void> ready;
+            auto ready_future = ready.get_future();
+            lane.thread = std::thread(
+                [this,&lane,&ready,&rd,releaser=(i==0)]() {
+                    try {
+                        bind_to_numa_node(lane.target.numa_node);
+                        RingBufferAttribute attribute = source->attribute();
+                        attribute.id  = 0;
+                        const bool random_key = (lane.target.key == 0);
+                        for (int retry = 0;; retry++) {
+                            attribute.key = random_key ? static_cast<key_t>(rd() & 0x7fffffff) : lane.target.key;
+                            errno = 0;
+                            try {
+                                lane.target.key = RingBuffer::create_ring_buffer(attribute);
+                                break;
+                            } catch (ws_exp&) {
+                                // a random key may be taken by another ring buffer.
+                                if (!random_key || errno != EEXIST || retry == RR_CREATE_RETRIES) {
+                                    throw;
+                                }
+                            }
+                        }
+                        lane.created = true;
+                        lane.ring = RingBuffer::get_ring_buffer(lane.target.key);
+                        for (uint32_t pos = 0; pos < attribute.capacity; pos ++) {
+                            std::memset(lane.ring->slot(pos),0,attribute.entry_size);
+                        }
+                    } catch (...) {
+                        ready.set_exception(std::current_exception());
+                        return;
+                    }
+                    ready.set_value();
+                    relay(lane,releaser);
+                });
+            ready_future.get();
+        }
+    } catch (...) {
+        stop();
+        // the target ring buffers created so far would stay behind as orphans.
+        for (auto& lane: lanes) {
+            if (lane->created) {
+                lane->ring.reset();
+                try {
+                    RingBuffer::delete_ring_buffer(lane->target.key);
+                } catch (ws_exp&) {
+                }
+            }
+        }
+        throw;
+    }
+}
+
+RingRelay::~RingRelay() {
+    stop();
+}
+
+void RingRelay::stop() {
+    stopped.store(true);
+    for (auto& lane: lanes) {
+        if (lane->thread.joinable()) {
+            lane->thread.join();
+        }
+    }
+}
+
+void RingRelay::relay(Lane& lane, bool releaser) {
+    const RingBufferAttribute attribute = source->attribute();
+    uint32_t cursor         = lane.cursor.load(std::memory_order_relaxed);
+    uint32_t target_tail    = lane.ring->tail_position();
+    uint32_t released       = source->head_position();
+
+    while (!stopped.load(std::memory_order_relaxed)) {
+        const uint32_t available    = source->tail_position() - cursor;
+        const uint32_t space        = attribute.capacity - 1 - (target_tail - lane.ring->head_position());
+        const uint32_t n            = std::min({available,space,batch_size});
+        if (n > 0) {
+            for (uint32_t i = 0; i < n; i++) {
+                std::memcpy(lane.ring->slot(target_tail + i),source->slot(cursor + i),attribute.entry_size);
+            }
+            target_tail += n;
+            cursor      += n;
+            lane.ring->advance_tail(target_tail);
+            lane.cursor.store(cursor,std::memory_order_release);
+            lane.relayed.fetch_add(n,std::memory_order_relaxed);
+            lane.batches.fetch_add(1,std::memory_order_relaxed);
+        }
+        // Only one thread moves the source head, to the slowest cursor, so that it never goes backward.
+        if (releaser) {
+            uint32_t slowest = cursor;
+            for (auto& other: lanes) {
+                uint32_t other_cursor = other->cursor.load(std::memory_order_acquire);
+                if (other_cursor - released < slowest - released) {
+                    slowest = other_cursor;
+                }
+            }
+            if (slowest != released) {
+                source->advance_head(slowest);
+                released = slowest;
+            }
+        }
+    }
+}
+
+std::vector<RingRelayStats> RingRelay::stats() {
+    std::vector<RingRelayStats> ret;
+    const uint32_t tail = source->tail_position();
+    for (auto& lane: lanes) {
+        ret.push_back({
+            .numa_node  = lane->target.numa_node,
+            .key        = lane->target.key,
+            .relayed    = lane->relayed.load(std::memory_order_relaxed),
+            .batches    = lane->batches.load(std::memory_order_relaxed),
+            .lag        = tail - lane->cursor.load(std::memory_order_relaxed),
+        });
+    }
+    return ret;
+}
+
+}
+}
@@ -0,0 +1,524 @@
+/**
+ * @file    shm_pipe.cpp
+ * @brief   Shared-memory byte-stream pipe implementation.
+ */
+
+#include <wsong/ipc/shm_pipe.hpp>
+
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <asm-generic/hugetlb_encode.h>
+#include <linux/futex.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <string>
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+#define SP_ATTRIBUTE            (this->info_ptr->info.attribute)
+#define SP_STATE_PTR            const_cast<ShmPipeState*>(&this->info_ptr->info.state)
+#define SP_DATA                 reinterpret_cast<uint8_t*>( \
+                                    reinterpret_cast<uintptr_t>(this->info_ptr) + sizeof(ShmPipeHeader) \
+                                )
+#define SP_CAPACITY             (SP_ATTRIBUTE.capacity)
+#define SP_BLOCKING             (SP_ATTRIBUTE.blocking)
+
+#define SP_HEAD                 (SP_STATE_PTR->head_cl.head)
+#define SP_EMPTY_STALLS         (SP_STATE_PTR->head_cl.empty_stalls)
+#define SP_SPACE_FUTEX          (SP_STATE_PTR->head_cl.space_futex)
+#define SP_WRITER_SLEEPING      (SP_STATE_PTR->head_cl.writer_sleeping)
+#define SP_READER_CLOSED        (SP_STATE_PTR->head_cl.reader_closed)
+#define SP_TAIL                 (SP_STATE_PTR->tail_cl.tail)
+#define SP_FULL_STALLS          (SP_STATE_PTR->tail_cl.full_stalls)
+#define SP_DATA_FUTEX           (SP_STATE_PTR->tail_cl.data_futex)
+#define SP_READER_SLEEPING      (SP_STATE_PTR->tail_cl.reader_sleeping)
+#define SP_WRITER_CLOSED        (SP_STATE_PTR->tail_cl.writer_closed)
+// count a stall once per call, the counter is only written by the owner of the cacheline.
+#define SP_COUNT_STALL(counter) counter.store(counter.load(std::memory_order_relaxed) + 1, \
+                                              std::memory_order_relaxed)
+
+#define WS_SHM_PIPE_MAGIC       (0x21455049504d4853ull) // "SHMPIPE!"
+
+#define SP_ROUND_UP(x,a)        (((x) + (a) - 1) / (a) * (a))
+
+// How long a blocking pipe spins before it sleeps.
+#define SP_SPIN_NS              (10000)
+// Timeouts are capped to a year, so that the deadline does not overflow.
+#define SP_MAX_TIMEOUT_NS       (365ull * 24 * 3600 * 1000000000ull)
+
+using sp_clock = std::chrono::steady_clock;
+
+static sp_clock::time_point sp_deadline(uint64_t timeout_ns) {
+    return sp_clock::now() + std::chrono::nanoseconds(std::min<uint64_t>(timeout_ns,SP_MAX_TIMEOUT_NS));
+}
+
+static uint64_t sp_remaining_ns(const sp_clock::time_point& deadline) {
+    const auto now = sp_clock::now();
+    return now < deadline ? std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now).count() : 0;
+}
+
+static void sp_futex_wait(std::atomic<uint32_t>& futex, uint32_t expected, uint64_t timeout_ns) {
+#if defined(__linux__)
+    struct timespec ts;
+    ts.tv_sec   = static_cast<time_t>(timeout_ns / 1000000000);
+    ts.tv_nsec  = static_cast<long>(timeout_ns % 1000000000);
+    // shared, not FUTEX_PRIVATE_FLAG: the peer is in another process.
+    syscall(SYS_futex,reinterpret_cast<uint32_t*>(&futex),FUTEX_WAIT,expected,&ts,nullptr,0);
+#endif
+}
+
+// Wake up the peer if it is sleeping, after publishing a position.
+static void sp_wake(std::atomic<uint32_t>& futex, std::atomic<uint32_t>& sleeping) {
+    // orders the position store before the sleeping load; the sleeper orders them the other way around.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed) != 0) {
+        futex.fetch_add(1,std::memory_order_release);
+#if defined(__linux__)
+        syscall(SYS_futex,reinterpret_cast<uint32_t*>(&futex),FUTEX_WAKE,1,nullptr,nullptr,0);
+#endif
+    }
+}
+
+// Wait until ready() or the deadline. A blocking pipe sleeps on the futex after a short spin, a polling one spins.
+template <typename Ready>
+static bool sp_wait(const Ready& ready, bool blocking, std::atomic<uint32_t>& futex, std::atomic<uint32_t>& sleeping,
+                    const sp_clock::time_point& deadline) {
+    const auto spin_end = sp_clock::now() + std::chrono::nanoseconds(SP_SPIN_NS);
+    while (!ready()) {
+        const auto now = sp_clock::now();
+        if (now >= deadline) {
+            return false;
+        }
+        if (!blocking || now < spin_end) {
+            continue;
+        }
+        const uint32_t seq = futex.load(std::memory_order_acquire);
+        sleeping.store(1,std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ready()) {
+            sp_futex_wait(futex,seq,sp_remaining_ns(deadline));
+        }
+        sleeping.store(0,std::memory_order_relaxed);
+    }
+    return true;
+}
+
+// Copy `size` bytes between the ring at `pos` and the buffers, skipping their first `skip` bytes.
+static void sp_copy(uint8_t* ring, uint64_t capacity, uint64_t pos, const struct iovec* iov, int iovcnt, size_t skip,
+                    size_t size, bool to_ring) {
+    for (int i = 0; i < iovcnt && size > 0; i++) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            continue;
+        }
+        uint8_t* buffer = reinterpret_cast<uint8_t*>(iov[i].iov_base) + skip;
+        size_t len = std::min(iov[i].iov_len - skip,size);
+        skip = 0;
+        size -= len;
+        while (len > 0) {
+            const uint64_t offset = pos & (capacity - 1);
+            const size_t chunk = std::min<uint64_t>(len,capacity - offset);
+            if (to_ring) {
+                std::memcpy(ring + offset,buffer,chunk);
+            } else {
+                std::memcpy(buffer,ring + offset,chunk);
+            }
+            buffer  += chunk;
+            pos     += chunk;
+            len     -= chunk;
+        }
+    }
+}
+
+// Describe `size` bytes of the ring at `pos` as up to two contiguous regions.
+static int sp_regions(uint8_t* ring, uint64_t capacity, uint64_t pos, size_t size, struct iovec* iov) {
+    const uint64_t offset = pos & (capacity - 1);
+    const size_t first = std::min<uint64_t>(size,capacity - offset);
+    iov[0].iov_base = ring + offset;
+    iov[0].iov_len  = first;
+    if (first == size) {
+        return 1;
+    }
+    iov[1].iov_base = ring;
+    iov[1].iov_len  = size - first;
+    return 2;
+}
+
+static size_t sp_total(const struct iovec* iov, int iovcnt) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    return total;
+}
+/**
+ * @endcond
+ */
+
+ShmPipe::ShmPipe(void* mem_ptr) :
+    info_ptr(reinterpret_cast<const ShmPipeHeader*>(mem_ptr)),
+    cached_head(SP_HEAD.load(std::memory_order_acquire)),
+    cached_tail(SP_TAIL.load(std::memory_order_acquire)) {
+}
+
+ShmPipe::~ShmPipe() {
+    shmdt(this->info_ptr);
+}
+
+ShmPipeAttribute ShmPipe::attribute() {
+    return SP_ATTRIBUTE;
+}
+
+ShmPipeStats ShmPipe::stats() {
+    ShmPipeStats stats;
+    stats.head          = SP_HEAD.load(std::memory_order_acquire);
+    stats.tail          = SP_TAIL.load(std::memory_order_acquire);
+    stats.empty_stalls  = SP_EMPTY_STALLS.load(std::memory_order_relaxed);
+    stats.full_stalls   = SP_FULL_STALLS.load(std::memory_order_relaxed);
+    stats.writer_closed = SP_WRITER_CLOSED.load(std::memory_order_acquire);
+    stats.reader_closed = SP_READER_CLOSED.load(std::memory_order_acquire);
+    return stats;
+}
+
+uint64_t ShmPipe::size() {
+    return SP_TAIL.load(std::memory_order_acquire) - SP_HEAD.load(std::memory_order_acquire);
+}
+
+/*
+ * The memory ordering follows the ring buffer: the writer copies the bytes in and store-releases the tail, the reader
+ * load-acquires the tail before copying them out, and the other way around for the head. `writer_closed` is stored
+ * after the last tail, so a reader finding it set knows the tail is final.
+ *
+ * A sleeper stores its sleeping flag, fences, and checks the peer position again before sleeping on the futex with
+ * the futex value it read before. The peer stores its position, fences, and checks the sleeping flag. So either the
+ * sleeper sees the new position, or the peer sees the flag, bumps the futex, and wakes it up; a bump after the
+ * sleeper read the futex makes FUTEX_WAIT return right away.
+ */
+uint64_t ShmPipe::readable(uint64_t timeout_ns) {
+    const uint64_t head = SP_HEAD.load(std::memory_order_relaxed);
+    if (this->cached_tail != head) {
+        return this->cached_tail - head;
+    }
+    this->cached_tail = SP_TAIL.load(std::memory_order_acquire);
+    if (this->cached_tail != head) {
+        return this->cached_tail - head;
+    }
+    // slow path: wait for the writer until timeout.
+    SP_COUNT_STALL(SP_EMPTY_STALLS);
+    bool closed = false;
+    sp_wait([&]() {
+                closed = SP_WRITER_CLOSED.load(std::memory_order_acquire);
+                this->cached_tail = SP_TAIL.load(std::memory_order_acquire);
+                return closed || this->cached_tail != head;
+            },
+            SP_BLOCKING,SP_DATA_FUTEX,SP_READER_SLEEPING,sp_deadline(timeout_ns));
+    if (this->cached_tail != head) {
+        return this->cached_tail - head;
+    }
+    if (closed) {
+        return 0;
+    }
+    throw ws_timeout_exp("Shm pipe read call timeout.");
+}
+
+void ShmPipe::consumed(uint64_t head) {
+    SP_HEAD.store(head,std::memory_order_release);
+    if (SP_BLOCKING) {
+        sp_wake(SP_SPACE_FUTEX,SP_WRITER_SLEEPING);
+    }
+}
+
+uint64_t ShmPipe::writable(uint64_t tail, uint64_t timeout_ns) {
+    uint64_t room = SP_CAPACITY - (tail - this->cached_head);
+    if (room > 0) {
+        return room;
+    }
+    this->cached_head = SP_HEAD.load(std::memory_order_acquire);
+    bool closed = SP_READER_CLOSED.load(std::memory_order_acquire);
+    room = SP_CAPACITY - (tail - this->cached_head);
+    if (room == 0 && !closed) {
+        // slow path: wait for the reader until timeout.
+        SP_COUNT_STALL(SP_FULL_STALLS);
+        sp_wait([&]() {
+                    closed = SP_READER_CLOSED.load(std::memory_order_acquire);
+                    this->cached_head = SP_HEAD.load(std::memory_order_acquire);
+                    return closed || tail - this->cached_head < SP_CAPACITY;
+                },
+                SP_BLOCKING,SP_SPACE_FUTEX,SP_WRITER_SLEEPING,sp_deadline(timeout_ns));
+        room = SP_CAPACITY - (tail - this->cached_head);
+    }
+    if (closed) {
+        throw ws_exp("Shm pipe write call on a pipe closed by the reader.");
+    }
+    return room;
+}
+
+void ShmPipe::produced(uint64_t tail) {
+    SP_TAIL.store(tail,std::memory_order_release);
+    if (SP_BLOCKING) {
+        sp_wake(SP_DATA_FUTEX,SP_READER_SLEEPING);
+    }
+}
+
+size_t ShmPipe::read(void* buffer, size_t size, uint64_t timeout_ns) {
+    struct iovec iov = {buffer,size};
+    return readv(&iov,1,timeout_ns);
+}
+
+size_t ShmPipe::readv(const struct iovec* iov, int iovcnt, uint64_t timeout_ns) {
+    const size_t total = sp_total(iov,iovcnt);
+    if (total == 0) {
+        return 0;
+    }
+    const uint64_t available = readable(timeout_ns);
+    if (available == 0) {
+        return 0;
+    }
+    const size_t size = std::min<uint64_t>(available,total);
+    const uint64_t head = SP_HEAD.load(std::memory_order_relaxed);
+    sp_copy(SP_DATA,SP_CAPACITY,head,iov,iovcnt,0,size,false);
+    consumed(head + size);
+    return size;
+}
+
+size_t ShmPipe::write(const void* buffer, size_t size, uint64_t timeout_ns) {
+    struct iovec iov = {const_cast<void*>(buffer),size};
+    return writev(&iov,1,timeout_ns);
+}
+
+size_t ShmPipe::writev(const struct iovec* iov, int iovcnt, uint64_t timeout_ns) {
+    const size_t total = sp_total(iov,iovcnt);
+    if (total == 0) {
+        return 0;
+    }
+    const auto deadline = sp_deadline(timeout_ns);
+    uint64_t tail = SP_TAIL.load(std::memory_order_relaxed);
+    uint64_t published = tail;
+    size_t written = 0;
+    while (written < total) {
+        uint64_t room = SP_CAPACITY - (tail - this->cached_head);
+        if (room == 0) {
+            // let the reader drain what we have written so far.
+            if (tail != published) {
+                produced(tail);
+                published = tail;
+            }
+            room = writable(tail,sp_remaining_ns(deadline));
+            if (room == 0) {
+                break;
+            }
+        }
+        const size_t size = std::min<uint64_t>(room,total - written);
+        sp_copy(SP_DATA,SP_CAPACITY,tail,iov,iovcnt,written,size,true);
+        tail    += size;
+        written += size;
+    }
+    if (tail != published) {
+        produced(tail);
+    }
+    if (written == 0) {
+        throw ws_timeout_exp("Shm pipe write call timeout.");
+    }
+    return written;
+}
+
+size_t ShmPipe::splice_from(int fd, size_t size, uint64_t timeout_ns) {
+    if (size == 0) {
+        return 0;
+    }
+    const uint64_t tail = SP_TAIL.load(std::memory_order_relaxed);
+    const uint64_t room = writable(tail,timeout_ns);
+    if (room == 0) {
+        throw ws_timeout_exp("Shm pipe splice_from call timeout.");
+    }
+    struct iovec iov[2];
+    const int iovcnt = sp_regions(SP_DATA,SP_CAPACITY,tail,std::min<uint64_t>(room,size),iov);
+    ssize_t moved;
+    do {
+        moved = ::readv(fd,iov,iovcnt);
+    } while (moved == -1 && errno == EINTR);
+    if (moved == -1) {
+        throw ws_exp(std::string("Shm pipe splice_from: readv failed with error:") + std::strerror(errno));
+    }
+    if (moved > 0) {
+        produced(tail + moved);
+    }
+    return static_cast<size_t>(moved);
+}
+
+size_t ShmPipe::splice_to(int fd, size_t size, uint64_t timeout_ns) {
+    if (size == 0) {
+        return 0;
+    }
+    const uint64_t available = readable(timeout_ns);
+    if (available == 0) {
+        return 0;
+    }
+    const uint64_t head = SP_HEAD.load(std::memory_order_relaxed);
+    struct iovec iov[2];
+    const int iovcnt = sp_regions(SP_DATA,SP_CAPACITY,head,std::min<uint64_t>(available,size),iov);
+    ssize_t moved;
+    do {
+        moved = ::writev(fd,iov,iovcnt);
+    } while (moved == -1 && errno == EINTR);
+    if (moved == -1) {
+        throw ws_exp(std::string("Shm pipe splice_to: writev failed with error:") + std::strerror(errno));
+    }
+    if (moved > 0) {
+        consumed(head + moved);
+    }
+    return static_cast<size_t>(moved);
+}
+
+void ShmPipe::close_writer() {
+    SP_WRITER_CLOSED.store(true,std::memory_order_release);
+    if (SP_BLOCKING) {
+        sp_wake(SP_DATA_FUTEX,SP_READER_SLEEPING);
+    }
+}
+
+void ShmPipe::close_reader() {
+    SP_READER_CLOSED.store(true,std::memory_order_release);
+    if (SP_BLOCKING) {
+        sp_wake(SP_SPACE_FUTEX,SP_WRITER_SLEEPING);
+    }
+}
+
+/*
+ * Arming uses the futex handshake of a blocking pipe, with the caller's notification in place of the futex: the reader
+ * stores the flag, fences, and checks the tail, and the writer stores the tail, fences, and checks the flag. The flag
+ * stays set when the reader finds bytes, which costs at most one spurious notification.
+ */
+bool ShmPipe::arm_reader() {
+    if (SP_BLOCKING) {
+        throw ws_exp("Shm pipe arm_reader() is called on a blocking pipe.");
+    }
+    SP_READER_SLEEPING.store(1,std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const bool closed = SP_WRITER_CLOSED.load(std::memory_order_acquire);
+    this->cached_tail = SP_TAIL.load(std::memory_order_acquire);
+    return !closed && this->cached_tail == SP_HEAD.load(std::memory_order_relaxed);
+}
+
+bool ShmPipe::disarm_reader() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return SP_READER_SLEEPING.load(std::memory_order_relaxed) != 0 &&
+           SP_READER_SLEEPING.exchange(0,std::memory_order_relaxed) != 0;
+}
+
+key_t ShmPipe::create_shm_pipe(const ShmPipeAttribute& attribute) {
+    // validate check
+    if ((attribute.capacity & (attribute.capacity - 1)) || (attribute.capacity == 0)) {
+        throw ws_invalid_argument_exp("Invalid capacity:" + std::to_string(attribute.capacity));
+    }
+
+    if (attribute.mode & ~0777u) {
+        throw ws_invalid_argument_exp("Invalid mode:" + std::to_string(attribute.mode));
+    }
+
+    // create pipe memory
+    int shmflg = IPC_CREAT | IPC_EXCL | (attribute.mode != 0 ? static_cast<int>(attribute.mode) : 0644);
+    switch (attribute.page_size) {
+    case 1<<12:
+        break;
+#if defined(__linux__)
+    case 1<<21:
+        shmflg |= (SHM_HUGETLB | (HUGETLB_FLAG_ENCODE_2MB));
+        break;
+    case 1<<30:
+        shmflg |= (SHM_HUGETLB | (HUGETLB_FLAG_ENCODE_1GB));
+        break;
+#endif
+    default:
+        throw ws_invalid_argument_exp("Invalid page_size:" + std::to_string(attribute.page_size));
+    }
+
+    // the segment takes whole pages anyway
+    const size_t shared_memory_region_size = SP_ROUND_UP(sizeof(ShmPipeHeader) + attribute.capacity,
+                                                         static_cast<size_t>(attribute.page_size));
+    int shmid = shmget(attribute.key,shared_memory_region_size,shmflg);
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") + std::strerror(errno));
+    }
+
+    // lock memory
+    if (shmctl(shmid,SHM_LOCK,nullptr) == -1) {
+        int err = errno;
+        shmctl(shmid,IPC_RMID,nullptr);
+        errno = err;
+        throw ws_exp(std::string("pinning pages: shmctl failed with error:") + std::strerror(err));
+    }
+
+    // get key
+    struct shmid_ds buf;
+    if (shmctl(shmid,IPC_STAT,&buf) == -1) {
+        int err = errno;
+        shmctl(shmid,IPC_RMID,nullptr);
+        errno = err;
+        throw ws_exp(std::string("get stat: shmctl failed with error:") + std::strerror(err));
+    }
+
+    // attach to memory region
+    void* ptr = shmat(shmid,nullptr,0);
+    if (ptr == (void*)-1) {
+        int err = errno;
+        shmctl(shmid,IPC_RMID,nullptr);
+        errno = err;
+        throw ws_exp(std::string("attach: shmat failed with error:") + std::strerror(err));
+    }
+
+    // initialize
+    ShmPipeHeader* sph      = reinterpret_cast<ShmPipeHeader*>(ptr);
+    sph->info.attribute      = attribute;
+    sph->info.attribute.id   = shmid;
+    sph->info.attribute.key  = buf.shm_perm.__key;
+    sph->info.attribute.mode = static_cast<uint32_t>(shmflg & 0777);
+    sph->info.magic          = WS_SHM_PIPE_MAGIC;
+
+    // detach memory region
+    if (shmdt(ptr) == -1) {
+        throw ws_exp(std::string("detach: shmdt failed with error:") + std::strerror(errno));
+    }
+
+    return buf.shm_perm.__key;
+}
+
+void ShmPipe::delete_shm_pipe(const key_t key) {
+    int shmid = shmget(key,0,0);
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") + std::strerror(errno));
+    }
+    if (shmctl(shmid,IPC_RMID,nullptr) == -1) {
+        throw ws_exp(std::string("delete shared memory: shmctl failed with error:") + std::strerror(errno));
+    }
+}
+
+std::unique_ptr<ShmPipe> ShmPipe::get_shm_pipe(const key_t key, bool read_only) {
+    int shmid = shmget(key,0,0);
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") + std::strerror(errno));
+    }
+
+    void* mem_ptr = shmat(shmid,nullptr,read_only ? SHM_RDONLY : 0);
+    if (mem_ptr == (void*)-1) {
+        throw ws_exp(std::string("Memory attach failed: shmat failed with error:") + std::strerror(errno));
+    }
+    if (reinterpret_cast<const ShmPipeHeader*>(mem_ptr)->info.magic != WS_SHM_PIPE_MAGIC) {
+        shmdt(mem_ptr);
+        throw ws_exp("The shared memory with key " + std::to_string(key) + " is not a shm pipe.");
+    }
+
+    return std::unique_ptr<ShmPipe>(new ShmPipe(mem_ptr));
+}
+
+}
+}
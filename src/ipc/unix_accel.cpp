@@ -0,0 +1,773 @@
+/**
+ * @file    unix_accel.cpp
+ * @brief   libwsongunix: moves the bytes of selected AF_UNIX stream sockets through shared-memory pipes.
+ *
+ * Preload it into both ends of a connection, and select the socket paths with `WSONG_UNIX_PATHS`:
+ * ```
+ * LD_PRELOAD=libwsongunix.so WSONG_UNIX_PATHS='/run/app/[a-z]*.sock:@abstract-name' ./server
+ * LD_PRELOAD=libwsongunix.so WSONG_UNIX_PATHS='/run/app/[a-z]*.sock:@abstract-name' ./client
+ * ```
+ * `WSONG_UNIX_PATHS` is a colon-separated list of `fnmatch(3)` patterns; an abstract socket name is matched with a
+ * leading `@`. `WSONG_UNIX_CAPACITY` sets the capacity of each direction in bytes (a power of two, 1MB by default),
+ * and `WSONG_UNIX_SPIN_US` how long a blocking receive or send spins on an empty or full pipe before it sleeps or
+ * yields (50us by default, 0 on a uniprocessor, where the spin only delays the peer).
+ *
+ * When a client connects to a selected path, it creates two polling `ShmPipe`s, one for each direction, with mode
+ * `0600` so that only the user of both ends can attach them, and sends their keys in a hello message over the socket;
+ * the server's `accept()` recognizes the hello, attaches the pipes, and acknowledges. From then on `send`/`recv`,
+ * `read`/`write`, and their vector and message variants copy through the pipes without a system call. A connection
+ * falls back to the plain socket when anything in the handshake fails, when the peer is not preloaded, or when it runs
+ * as another user.
+ *
+ * The socket file descriptor stays the application's, so `poll`/`epoll`/`select`, socket options and `close` keep
+ * working: a receiver with an empty pipe arms it and waits on the socket, and a sender that finds the receiver armed
+ * rings a one-byte doorbell through the socket. The doorbells are consumed by the library and never returned to the
+ * application.
+ *
+ * Limitations:
+ * - Only `SOCK_STREAM` sockets, and only the data path: ancillary data (`SCM_RIGHTS`, `SCM_CREDENTIALS`) and
+ *   `MSG_PEEK`/`MSG_OOB` fail with `EOPNOTSUPP` on an accelerated connection.
+ * - An accelerated socket is always writable for `poll(POLLOUT)`; a full pipe makes a non-blocking send return
+ *   `EAGAIN`.
+ * - A server waits up to a second in `accept()` for the hello of a client on a selected path, so the clients of a
+ *   selected path should all be preloaded.
+ * - The connection belongs to the process that negotiated it: a `fork()`ed child or a file descriptor passed to
+ *   another process sees only the doorbells, and a `close()` in the child leaves the pipes to the parent. `dup()`ed
+ *   descriptors go to the plain socket.
+ */
+#include <wsong/ipc/shm_pipe.hpp>
+#include <wsong/exceptions.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace wsong;
+using namespace wsong::ipc;
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+#define UA_MAGIC                (0x58434341584e5557ull)     // "WUNXACCX"
+#define UA_VERSION              (1)
+#define UA_MAX_FDS              (65536)
+#define UA_DEFAULT_CAPACITY     (1ull<<20)
+#define UA_DEFAULT_SPIN_US      (50)
+#define UA_HANDSHAKE_TIMEOUT_MS (1000)
+#define UA_CREATE_RETRIES       (16)
+
+// the hello from the client, carrying the keys of the pipes.
+struct ua_hello_t {
+    uint64_t    magic;
+    uint32_t    version;
+    key_t       client_to_server;
+    key_t       server_to_client;
+};
+
+// the reply of the server: status 0 for accepted.
+struct ua_reply_t {
+    uint64_t    magic;
+    uint32_t    status;
+};
+
+struct ua_connection_t {
+    std::unique_ptr<ShmPipe>    in;
+    std::unique_ptr<ShmPipe>    out;
+    std::mutex                  recv_lock;
+    std::mutex                  send_lock;
+    std::atomic<bool>           nonblocking;
+    // the process that negotiated the connection; a forked child inherits the entry but not the pipes.
+    pid_t                       owner;
+};
+
+// the functions interposed by this library.
+struct ua_real_t {
+    int     (*connect)(int,const struct sockaddr*,socklen_t);
+    int     (*accept)(int,struct sockaddr*,socklen_t*);
+    int     (*accept4)(int,struct sockaddr*,socklen_t*,int);
+    int     (*close)(int);
+    int     (*shutdown)(int,int);
+    int     (*dup2)(int,int);
+    int     (*dup3)(int,int,int);
+    int     (*fcntl)(int,int,...);
+    int     (*ioctl)(int,unsigned long,...);
+    ssize_t (*read)(int,void*,size_t);
+    ssize_t (*write)(int,const void*,size_t);
+    ssize_t (*readv)(int,const struct iovec*,int);
+    ssize_t (*writev)(int,const struct iovec*,int);
+    ssize_t (*recv)(int,void*,size_t,int);
+    ssize_t (*send)(int,const void*,size_t,int);
+    ssize_t (*recvfrom)(int,void*,size_t,int,struct sockaddr*,socklen_t*);
+    ssize_t (*sendto)(int,const void*,size_t,int,const struct sockaddr*,socklen_t);
+    ssize_t (*recvmsg)(int,struct msghdr*,int);
+    ssize_t (*sendmsg)(int,const struct msghdr*,int);
+};
+
+using ua_connection_ptr = std::shared_ptr<ua_connection_t>;
+
+static ua_real_t                        ua_real;
+static std::vector<std::string>         ua_patterns;
+static uint64_t                         ua_capacity = UA_DEFAULT_CAPACITY;
+static uint64_t                         ua_spin_ns = UA_DEFAULT_SPIN_US * 1000ull;
+// the pid of this process, kept up to date by the fork handler instead of a getpid() on every interposed call.
+static pid_t                            ua_pid;
+
+#define UA_RESOLVE(name)        ua_real.name = reinterpret_cast<decltype(ua_real.name)>(dlsym(RTLD_NEXT,#name))
+
+static void ua_resolve() {
+    UA_RESOLVE(connect);
+    UA_RESOLVE(accept);
+    UA_RESOLVE(accept4);
+    UA_RESOLVE(close);
+    UA_RESOLVE(shutdown);
+    UA_RESOLVE(dup2);
+    UA_RESOLVE(dup3);
+    UA_RESOLVE(fcntl);
+    UA_RESOLVE(ioctl);
+    UA_RESOLVE(read);
+    UA_RESOLVE(write);
+    UA_RESOLVE(readv);
+    UA_RESOLVE(writev);
+    UA_RESOLVE(recv);
+    UA_RESOLVE(send);
+    UA_RESOLVE(recvfrom);
+    UA_RESOLVE(sendto);
+    UA_RESOLVE(recvmsg);
+    UA_RESOLVE(sendmsg);
+}
+
+// an interposed call made before the constructor, e.g. by the constructor of another library, resolves them first.
+#define UA_REAL(name)           (ua_real.name != nullptr ? ua_real.name : (ua_resolve(),ua_real.name))
+
+static void ua_forked() {
+    ua_pid = getpid();
+}
+
+__attribute__((constructor)) static void ua_load() {
+    ua_resolve();
+    ua_forked();
+    pthread_atfork(nullptr,nullptr,ua_forked);
+    const char* paths = getenv("WSONG_UNIX_PATHS");
+    if (paths != nullptr) {
+        std::string patterns(paths);
+        size_t start = 0;
+        while (start <= patterns.size()) {
+            size_t end = patterns.find(':',start);
+            if (end == std::string::npos) {
+                end = patterns.size();
+            }
+            if (end > start) {
+                ua_patterns.emplace_back(patterns.substr(start,end - start));
+            }
+            start = end + 1;
+        }
+    }
+    const char* capacity = getenv("WSONG_UNIX_CAPACITY");
+    if (capacity != nullptr) {
+        const uint64_t value = std::strtoull(capacity,nullptr,0);
+        if (value >= 4096 && (value & (value - 1)) == 0) {
+            ua_capacity = value;
+        }
+    }
+    const char* spin_us = getenv("WSONG_UNIX_SPIN_US");
+    if (sysconf(_SC_NPROCESSORS_ONLN) == 1) {
+        ua_spin_ns = 0;
+    }
+    if (spin_us != nullptr) {
+        ua_spin_ns = std::strtoull(spin_us,nullptr,0) * 1000ull;
+    }
+}
+
+/*
+ * The connections by file descriptor. A call on a connection holds a reference, so that a close() in another thread
+ * frees the connection only after the last call in flight returns. The table is never destroyed: the destructors of
+ * other libraries may still close sockets at exit.
+ */
+static std::atomic<ua_connection_ptr>* ua_connections() {
+    static std::atomic<ua_connection_ptr>* connections = new std::atomic<ua_connection_ptr>[UA_MAX_FDS];
+    return connections;
+}
+
+// the connection of a file descriptor, or nullptr for a plain socket or a connection inherited from the parent.
+static inline ua_connection_ptr ua_get(int fd) {
+    if (fd < 0 || fd >= UA_MAX_FDS) {
+        return nullptr;
+    }
+    ua_connection_ptr connection = ua_connections()[fd].load(std::memory_order_acquire);
+    if (connection != nullptr && connection->owner != ua_pid) {
+        return nullptr;
+    }
+    return connection;
+}
+
+// the path of a unix socket address, with an abstract name as "@name".
+static bool ua_path(const struct sockaddr* addr, socklen_t addrlen, std::string& path) {
+    if (addr == nullptr || addr->sa_family != AF_UNIX || addrlen <= offsetof(struct sockaddr_un,sun_path)) {
+        return false;
+    }
+    const struct sockaddr_un* un = reinterpret_cast<const struct sockaddr_un*>(addr);
+    const size_t len = std::min<size_t>(addrlen - offsetof(struct sockaddr_un,sun_path),sizeof(un->sun_path));
+    if (un->sun_path[0] == '\0') {
+        path.assign(1,'@').append(un->sun_path + 1,len - 1);
+    } else {
+        path.assign(un->sun_path,strnlen(un->sun_path,len));
+    }
+    return true;
+}
+
+static bool ua_selected(const struct sockaddr* addr, socklen_t addrlen) {
+    std::string path;
+    if (ua_patterns.empty() || !ua_path(addr,addrlen,path)) {
+        return false;
+    }
+    for (const auto& pattern : ua_patterns) {
+        if (fnmatch(pattern.c_str(),path.c_str(),0) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// a stream socket connected to a process of the same user, who can attach the pipes.
+static bool ua_eligible(int fd) {
+    int type = 0;
+    socklen_t len = sizeof(type);
+    if (getsockopt(fd,SOL_SOCKET,SO_TYPE,&type,&len) != 0 || type != SOCK_STREAM) {
+        return false;
+    }
+    struct ucred cred;
+    len = sizeof(cred);
+    return getsockopt(fd,SOL_SOCKET,SO_PEERCRED,&cred,&len) == 0 && cred.uid == geteuid();
+}
+
+// transfer exactly `size` bytes of the handshake over the socket, waiting up to the handshake timeout.
+static bool ua_transfer(int fd, void* buffer, size_t size, bool sending) {
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(buffer);
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(UA_HANDSHAKE_TIMEOUT_MS);
+    while (size > 0) {
+        ssize_t done = sending ? UA_REAL(send)(fd,bytes,size,MSG_DONTWAIT|MSG_NOSIGNAL)
+                               : UA_REAL(recv)(fd,bytes,size,MSG_DONTWAIT);
+        if (done > 0) {
+            bytes += done;
+            size  -= done;
+            continue;
+        }
+        if (done == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            return false;
+        }
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0) {
+            return false;
+        }
+        struct pollfd pfd = {fd,static_cast<short>(sending ? POLLOUT : POLLIN),0};
+        poll(&pfd,1,static_cast<int>(left));
+    }
+    return true;
+}
+
+static ua_connection_ptr ua_new_connection(int fd, key_t in_key, key_t out_key) {
+    auto connection = std::make_shared<ua_connection_t>();
+    if (ua_pid == 0) {
+        // negotiated before the constructor ran.
+        ua_forked();
+    }
+    connection->owner = ua_pid;
+    connection->in  = ShmPipe::get_shm_pipe(in_key);
+    connection->out = ShmPipe::get_shm_pipe(out_key);
+    connection->nonblocking.store((UA_REAL(fcntl)(fd,F_GETFL) & O_NONBLOCK) != 0,std::memory_order_relaxed);
+    // armed before the peer can write: the application may wait on the socket before its first receive.
+    connection->in->arm_reader();
+    return connection;
+}
+
+static key_t ua_create_pipe(std::mt19937& random) {
+    ShmPipeAttribute attribute;
+    std::memset(&attribute,0,sizeof(attribute));
+    attribute.page_size = 4096;
+    attribute.capacity  = ua_capacity;
+    attribute.blocking  = false;
+    attribute.mode      = 0600;
+    std::snprintf(attribute.description,sizeof(attribute.description),"libwsongunix connection of pid %d",getpid());
+    for (int retry = 0;; retry++) {
+        attribute.key = static_cast<key_t>(random() & 0x7fffffff);
+        try {
+            return ShmPipe::create_shm_pipe(attribute);
+        } catch (ws_exp&) {
+            if (retry == UA_CREATE_RETRIES || errno != EEXIST) {
+                throw;
+            }
+        }
+    }
+}
+
+// the client side of the handshake, on a connected socket.
+static void ua_negotiate_client(int fd) {
+    static thread_local std::mt19937 random(std::random_device{}());
+    if (!ua_eligible(fd)) {
+        return;
+    }
+    ua_hello_t hello = {UA_MAGIC,UA_VERSION,-1,-1};
+    ua_connection_ptr connection;
+    try {
+        hello.client_to_server = ua_create_pipe(random);
+        hello.server_to_client = ua_create_pipe(random);
+        connection = ua_new_connection(fd,hello.server_to_client,hello.client_to_server);
+    } catch (ws_exp&) {
+        // leave the connection plain, and the server waiting for a hello that never comes.
+    }
+    if (connection != nullptr) {
+        ua_reply_t reply;
+        if (ua_transfer(fd,&hello,sizeof(hello),true) &&
+            ua_transfer(fd,&reply,sizeof(reply),false) &&
+            reply.magic == UA_MAGIC && reply.status == 0) {
+            ua_connections()[fd].store(std::move(connection),std::memory_order_release);
+        }
+    }
+    // both sides are attached or gone: the segments go away with the last detach.
+    for (key_t key : {hello.client_to_server,hello.server_to_client}) {
+        if (key != -1) {
+            try {
+                ShmPipe::delete_shm_pipe(key);
+            } catch (ws_exp&) {
+            }
+        }
+    }
+}
+
+// the server side of the handshake, on an accepted socket.
+static void ua_negotiate_server(int fd) {
+    if (!ua_eligible(fd)) {
+        return;
+    }
+    ua_hello_t hello;
+    struct pollfd pfd = {fd,POLLIN,0};
+    if (poll(&pfd,1,UA_HANDSHAKE_TIMEOUT_MS) != 1 ||
+        UA_REAL(recv)(fd,&hello,sizeof(hello),MSG_PEEK|MSG_DONTWAIT) != sizeof(hello) ||
+        hello.magic != UA_MAGIC) {
+        // not a preloaded client: whatever it sent is the application's.
+        return;
+    }
+    if (!ua_transfer(fd,&hello,sizeof(hello),false)) {
+        return;
+    }
+    ua_reply_t reply = {UA_MAGIC,1};
+    ua_connection_ptr connection;
+    if (hello.version == UA_VERSION) {
+        try {
+            connection = ua_new_connection(fd,hello.client_to_server,hello.server_to_client);
+            reply.status = 0;
+        } catch (ws_exp&) {
+        }
+    }
+    if (ua_transfer(fd,&reply,sizeof(reply),true) && connection != nullptr) {
+        ua_connections()[fd].store(std::move(connection),std::memory_order_release);
+    }
+}
+
+static void ua_ring_doorbell(int fd) {
+    static const uint8_t doorbell = 1;
+    UA_REAL(send)(fd,&doorbell,1,MSG_DONTWAIT|MSG_NOSIGNAL);
+}
+
+/*
+ * Consume `count` doorbells, counted before the reader armed the pipe and found it empty, so they are for the bytes
+ * already read. A doorbell rung after arming stays, and keeps the socket readable as long as there are bytes in the
+ * pipe. False if the peer has closed the socket.
+ */
+static bool ua_consume_doorbells(int fd, int count) {
+    uint8_t doorbells[64];
+    while (count > 0) {
+        ssize_t n = UA_REAL(recv)(fd,doorbells,std::min<size_t>(count,sizeof(doorbells)),MSG_DONTWAIT);
+        if (n <= 0) {
+            break;
+        }
+        count -= static_cast<int>(n);
+    }
+    ssize_t n = UA_REAL(recv)(fd,doorbells,1,MSG_PEEK|MSG_DONTWAIT);
+    return n != 0 && !(n == -1 && errno == ECONNRESET);
+}
+
+static void ua_teardown(int fd) {
+    if (fd < 0 || fd >= UA_MAX_FDS) {
+        return;
+    }
+    // the calls still in flight keep the connection until they return.
+    ua_connection_ptr connection = ua_connections()[fd].exchange(nullptr,std::memory_order_acq_rel);
+    // an inherited connection only drops its attachments: the pipes stay open for the parent.
+    if (connection != nullptr && connection->owner == ua_pid) {
+        connection->out->close_writer();
+        connection->in->close_reader();
+        ua_ring_doorbell(fd);
+    }
+}
+
+static ssize_t ua_fail(int error) {
+    errno = error;
+    return -1;
+}
+
+// the buffers after the first `done` bytes of `iov`.
+static std::vector<struct iovec> ua_skip(const struct iovec* iov, int iovcnt, size_t done) {
+    std::vector<struct iovec> rest;
+    for (int i = 0; i < iovcnt; i++) {
+        if (done >= iov[i].iov_len) {
+            done -= iov[i].iov_len;
+            continue;
+        }
+        rest.push_back({reinterpret_cast<uint8_t*>(iov[i].iov_base) + done,iov[i].iov_len - done});
+        done = 0;
+    }
+    return rest;
+}
+
+static ssize_t ua_recv(ua_connection_t* connection, int fd, const struct iovec* iov, int iovcnt, int flags) {
+    if (flags & (MSG_PEEK|MSG_OOB)) {
+        return ua_fail(EOPNOTSUPP);
+    }
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    if (total == 0) {
+        return 0;
+    }
+    const bool nonblocking = (flags & MSG_DONTWAIT) || connection->nonblocking.load(std::memory_order_relaxed);
+    const bool wait_all = (flags & MSG_WAITALL) && !nonblocking;
+    std::lock_guard<std::mutex> lock(connection->recv_lock);
+    ShmPipe& pipe = *connection->in;
+    std::vector<struct iovec> rest;
+    const struct iovec* buffers = iov;
+    int count = iovcnt;
+    size_t received = 0;
+    while (true) {
+        if (pipe.size() > 0 || pipe.stats().writer_closed) {
+            // does not wait: there are bytes, or it is the end of stream.
+            const size_t n = pipe.readv(buffers,count,0);
+            received += n;
+            if (n == 0 || !wait_all || received == total) {
+                return static_cast<ssize_t>(received);
+            }
+            rest = ua_skip(iov,iovcnt,received);
+            buffers = rest.data();
+            count = static_cast<int>(rest.size());
+            continue;
+        }
+        if (!nonblocking) {
+            const auto spin_end = std::chrono::steady_clock::now() + std::chrono::nanoseconds(ua_spin_ns);
+            while (pipe.size() == 0 && std::chrono::steady_clock::now() < spin_end);
+            if (pipe.size() > 0) {
+                continue;
+            }
+        }
+        int doorbells = 0;
+        UA_REAL(ioctl)(fd,FIONREAD,&doorbells);
+        if (!pipe.arm_reader()) {
+            continue;
+        }
+        if (!ua_consume_doorbells(fd,doorbells)) {
+            // the peer is gone without closing its side of the pipe.
+            return static_cast<ssize_t>(received);
+        }
+        if (nonblocking) {
+            return received > 0 ? static_cast<ssize_t>(received) : ua_fail(EAGAIN);
+        }
+        struct pollfd pfd = {fd,POLLIN,0};
+        if (poll(&pfd,1,-1) == -1 && errno == EINTR) {
+            return received > 0 ? static_cast<ssize_t>(received) : ua_fail(EINTR);
+        }
+    }
+}
+
+static ssize_t ua_send(ua_connection_t* connection, int fd, const struct iovec* iov, int iovcnt, int flags) {
+    if (flags & MSG_OOB) {
+        return ua_fail(EOPNOTSUPP);
+    }
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    if (total == 0) {
+        return 0;
+    }
+    const bool nonblocking = (flags & MSG_DONTWAIT) || connection->nonblocking.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(connection->send_lock);
+    ShmPipe& pipe = *connection->out;
+    std::vector<struct iovec> rest;
+    const struct iovec* buffers = iov;
+    int count = iovcnt;
+    size_t sent = 0;
+    bool broken = false;
+    while (sent < total) {
+        size_t n = 0;
+        try {
+            n = pipe.writev(buffers,count,nonblocking ? 0 : ua_spin_ns);
+        } catch (ws_timeout_exp&) {
+        } catch (ws_exp&) {
+            broken = true;
+            break;
+        }
+        sent += n;
+        if (n > 0 && pipe.disarm_reader()) {
+            ua_ring_doorbell(fd);
+        }
+        if (nonblocking) {
+            break;
+        }
+        if (sent < total) {
+            // the pipe is full: give the receiver the cpu, and give up if it has gone.
+            struct pollfd pfd = {fd,0,0};
+            if (poll(&pfd,1,0) == 1 && (pfd.revents & (POLLHUP|POLLERR))) {
+                broken = true;
+                break;
+            }
+            sched_yield();
+            if (n > 0) {
+                rest = ua_skip(iov,iovcnt,sent);
+                buffers = rest.data();
+                count = static_cast<int>(rest.size());
+            }
+        }
+    }
+    if (sent > 0) {
+        return static_cast<ssize_t>(sent);
+    }
+    if (broken) {
+        if (!(flags & MSG_NOSIGNAL)) {
+            raise(SIGPIPE);
+        }
+        return ua_fail(EPIPE);
+    }
+    return ua_fail(EAGAIN);
+}
+/**
+ * @endcond
+ */
+
+extern "C" {
+
+WS_DLL_PUBLIC int connect(int fd, const struct sockaddr* addr, socklen_t addrlen) {
+    if (!ua_selected(addr,addrlen)) {
+        return UA_REAL(connect)(fd,addr,addrlen);
+    }
+    // the handshake completes in connect(), so a non-blocking connect is made blocking.
+    const int flags = UA_REAL(fcntl)(fd,F_GETFL);
+    if (flags != -1 && (flags & O_NONBLOCK)) {
+        UA_REAL(fcntl)(fd,F_SETFL,flags & ~O_NONBLOCK);
+    }
+    int ret = UA_REAL(connect)(fd,addr,addrlen);
+    const int error = errno;
+    if (ret == 0) {
+        ua_negotiate_client(fd);
+    }
+    if (flags != -1 && (flags & O_NONBLOCK)) {
+        UA_REAL(fcntl)(fd,F_SETFL,flags);
+    }
+    errno = error;
+    return ret;
+}
+
+WS_DLL_PUBLIC int accept4(int fd, struct sockaddr* addr, socklen_t* addrlen, int flags) {
+    int connected = UA_REAL(accept4)(fd,addr,addrlen,flags);
+    if (connected == -1 || ua_patterns.empty()) {
+        return connected;
+    }
+    struct sockaddr_un local;
+    socklen_t len = sizeof(local);
+    if (getsockname(fd,reinterpret_cast<struct sockaddr*>(&local),&len) == 0 &&
+        ua_selected(reinterpret_cast<struct sockaddr*>(&local),len)) {
+        ua_negotiate_server(connected);
+    }
+    return connected;
+}
+
+WS_DLL_PUBLIC int accept(int fd, struct sockaddr* addr, socklen_t* addrlen) {
+    return accept4(fd,addr,addrlen,0);
+}
+
+WS_DLL_PUBLIC int close(int fd) {
+    ua_teardown(fd);
+    return UA_REAL(close)(fd);
+}
+
+WS_DLL_PUBLIC int dup2(int oldfd, int newfd) {
+    if (oldfd != newfd) {
+        ua_teardown(newfd);
+    }
+    return UA_REAL(dup2)(oldfd,newfd);
+}
+
+WS_DLL_PUBLIC int dup3(int oldfd, int newfd, int flags) {
+    if (oldfd != newfd) {
+        ua_teardown(newfd);
+    }
+    return UA_REAL(dup3)(oldfd,newfd,flags);
+}
+
+WS_DLL_PUBLIC int shutdown(int fd, int how) {
+    ua_connection_ptr connection = ua_get(fd);
+    if (connection != nullptr) {
+        if (how == SHUT_WR || how == SHUT_RDWR) {
+            connection->out->close_writer();
+            ua_ring_doorbell(fd);
+        }
+        if (how == SHUT_RD || how == SHUT_RDWR) {
+            connection->in->close_reader();
+        }
+    }
+    return UA_REAL(shutdown)(fd,how);
+}
+
+WS_DLL_PUBLIC int fcntl(int fd, int cmd, ...) {
+    va_list args;
+    va_start(args,cmd);
+    void* arg = va_arg(args,void*);
+    va_end(args);
+    int ret = UA_REAL(fcntl)(fd,cmd,arg);
+    ua_connection_ptr connection = ua_get(fd);
+    if (ret != -1 && cmd == F_SETFL && connection != nullptr) {
+        connection->nonblocking.store((reinterpret_cast<intptr_t>(arg) & O_NONBLOCK) != 0,std::memory_order_relaxed);
+    }
+    return ret;
+}
+
+WS_DLL_PUBLIC int ioctl(int fd, unsigned long request, ...) {
+    va_list args;
+    va_start(args,request);
+    void* arg = va_arg(args,void*);
+    va_end(args);
+    int ret = UA_REAL(ioctl)(fd,request,arg);
+    ua_connection_ptr connection = ua_get(fd);
+    if (ret != -1 && connection != nullptr) {
+        if (request == FIONBIO) {
+            connection->nonblocking.store(*reinterpret_cast<int*>(arg) != 0,std::memory_order_relaxed);
+        } else if (request == FIONREAD) {
+            // the bytes in the socket are doorbells.
+            *reinterpret_cast<int*>(arg) = static_cast<int>(connection->in->size());
+        }
+    }
+    return ret;
+}
+
+WS_DLL_PUBLIC ssize_t read(int fd, void* buffer, size_t size) {
+    ua_connection_ptr connection = ua_get(fd);
+    if (connection == nullptr) {
+        return UA_REAL(read)(fd,buffer,size);
+    }
+    struct iovec iov = {buffer,size};
+    return ua_recv(connection.get(),fd,&iov,1,0);
+}
+
+WS_DLL_PUBLIC ssize_t write(int fd, const void* buffer, size_t size) {
+    ua_connection_ptr connection = ua_get(fd);
+    if (connection == nullptr) {
+        return UA_REAL(write)(fd,buffer,size);
+    }
+    struct iovec iov = {const_cast<void*>(buffer),size};
+    return ua_send(connection.get(),fd,&iov,1,0);
+}
+
+WS_DLL_PUBLIC ssize_t readv(int fd, const struct iovec* iov, int iovcnt) {
+    ua_connection_ptr connection = ua_get(fd);
+    if (connection == nullptr) {
+        return UA_REAL(readv)(fd,iov,iovcnt);
+    }
+    return ua_recv(connection.get(),fd,iov,iovcnt,0);
+}
+
+WS_DLL_PUBLIC ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
+    ua_connection_ptr connection = ua_get(fd);
+    if (connection == nullptr) {
+        return UA_REAL(writev)(fd,iov,iovcnt);
+    }
+    return ua_send(connection.get(),fd,iov,iovcnt,0);
+}
+
+WS_DLL_PUBLIC ssize_t recv(int fd, void* buffer, size_t size, int flags) {
+    ua_connection_ptr connection = ua_get(fd);
+    if (connection == nullptr) {
+        return UA_REAL(recv)(fd,buffer,size,flags);
+    }
+    struct iovec iov = {buffer,size};
+    return ua_recv(connection.get(),fd,&iov,1,flags);
+}
+
+WS_DLL_PUBLIC ssize_t send(int fd, const void* buffer, size_t size, int flags) {
+    ua_connection_ptr connection = ua_get(fd);
+    if (connection == nullptr) {
+        return UA_REAL(send)(fd,buffer,size,flags);
+    }
+    struct iovec iov = {const_cast<void*>(buffer),size};
+    return ua_send(connection.get(),fd,&iov,1,flags);
+}
+
+WS_DLL_PUBLIC ssize_t recvfrom(int fd, void* buffer, size_t size, int flags, struct sockaddr* addr,
+                               socklen_t* addrlen) {
+    ua_connection_ptr connection = ua_get(fd);
+    if (connection == nullptr) {
+        return UA_REAL(recvfrom)(fd,buffer,size,flags,addr,addrlen);
+    }
+    if (addrlen != nullptr) {
+        // a connected stream socket reports no source address.
+        *addrlen = 0;
+    }
+    struct iovec iov = {buffer,size};
+    return ua_recv(connection.get(),fd,&iov,1,flags);
+}
+
+WS_DLL_PUBLIC ssize_t sendto(int fd, const void* buffer, size_t size, int flags,
+                             const struct sockaddr* addr, socklen_t addrlen) {
+    ua_connection_ptr connection = ua_get(fd);
+    if (connection == nullptr) {
+        return UA_REAL(sendto)(fd,buffer,size,flags,addr,addrlen);
+    }
+    struct iovec iov = {const_cast<void*>(buffer),size};
+    return ua_send(connection.get(),fd,&iov,1,flags);
+}
+
+WS_DLL_PUBLIC ssize_t recvmsg(int fd, struct msghdr* msg, int flags) {
+    ua_connection_ptr connection = ua_get(fd);
+    if (connection == nullptr) {
+        return UA_REAL(recvmsg)(fd,msg,flags);
+    }
+    if (msg->msg_controllen > 0) {
+        return ua_fail(EOPNOTSUPP);
+    }
+    msg->msg_namelen = 0;
+    msg->msg_flags = 0;
+    return ua_recv(connection.get(),fd,msg->msg_iov,static_cast<int>(msg->msg_iovlen),flags);
+}
+
+WS_DLL_PUBLIC ssize_t sendmsg(int fd, const struct msghdr* msg, int flags) {
+    ua_connection_ptr connection = ua_get(fd);
+    if (connection == nullptr) {
+        return UA_REAL(sendmsg)(fd,msg,flags);
+    }
+    if (msg->msg_controllen > 0) {
+        return ua_fail(EOPNOTSUPP);
+    }
+    return ua_send(connection.get(),fd,msg->msg_iov,static_cast<int>(msg->msg_iovlen),flags);
+}
+
+}
@@ -0,0 +1,568 @@
+/**
+ * @file    work_queue.cpp
+ * @brief   Work queue implementation.
+ */
+
+#include <wsong/ipc/work_queue.hpp>
+
+#include "process.hpp"
+
+#include <sys/types.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <asm-generic/hugetlb_encode.h>
+#endif
+
+#include <cstring>
+#include <cerrno>
+#include <string>
+
+namespace wsong {
+namespace ipc {
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+struct work_queue_consumer_t {
+    std::atomic<int32_t>    pid;
+    uint64_t                start_time;
+} WS_CL_ALIGNED;
+
+struct work_queue_slot_t {
+    // the position of the entry plus one once it is produced, the position plus capacity once it is consumed.
+    std::atomic<uint64_t>   seq;
+};
+
+enum work_lease_kind_t : uint64_t {
+    WQ_FREE     = 0,
+    WQ_CLAIMING = 1,
+    WQ_LEASED   = 2,
+    WQ_ORPHANED = 3,
+};
+
+struct work_lease_slot_t {
+    // kind:8 | owner:8 | deliveries:16 | generation:32, changed with compare-and-swap.
+    std::atomic<uint64_t>   state;
+    // the ring position claimed, or leased from.
+    std::atomic<uint64_t>   position;
+    // when the lease was taken, in nanoseconds of the steady clock.
+    std::atomic<uint64_t>   leased_ns;
+    uint64_t                reserved;
+};
+
+#define WQ_ROUND_UP(x,a)        ((((x) + (a) - 1) / (a)) * (a))
+// a ring slot takes whole cachelines, so that neighbouring slots claimed by different cores do not false-share.
+#define WQ_SLOT_BYTES(attr)     WQ_ROUND_UP(sizeof(work_queue_slot_t) + (attr).entry_size, CACHELINE_SIZE)
+#define WQ_LEASE_BYTES(attr)    WQ_ROUND_UP(sizeof(work_lease_slot_t) + (attr).entry_size, CACHELINE_SIZE)
+#define WQ_NUM_LEASES(attr)     (static_cast<size_t>((attr).max_consumers) * (attr).max_leases)
+#define WQ_CONSUMERS_BYTES(attr) \
+                                (static_cast<size_t>((attr).max_consumers) * sizeof(work_queue_consumer_t))
+#define WQ_TOTAL_BYTES(attr)    (sizeof(WorkQueueHeader) + WQ_CONSUMERS_BYTES(attr) + \
+                                 static_cast<size_t>((attr).capacity) * WQ_SLOT_BYTES(attr) + \
+                                 WQ_NUM_LEASES(attr) * WQ_LEASE_BYTES(attr))
+
+#define WQ_HEADER               const_cast<WorkQueueHeader*>(this->info_ptr)
+#define WQ_ATTRIBUTE            (this->info_ptr->info.attribute)
+#define WQ_CONSUMERS            reinterpret_cast<work_queue_consumer_t*>( \
+                                    reinterpret_cast<uintptr_t>(this->info_ptr) + sizeof(WorkQueueHeader))
+#define WQ_SLOT(pos)            reinterpret_cast<work_queue_slot_t*>( \
+                                    reinterpret_cast<uintptr_t>(WQ_CONSUMERS) + WQ_CONSUMERS_BYTES(WQ_ATTRIBUTE) + \
+                                    ((pos) & (WQ_ATTRIBUTE.capacity - 1)) * WQ_SLOT_BYTES(WQ_ATTRIBUTE))
+#define WQ_SLOT_DATA(slot)      reinterpret_cast<uint8_t*>((slot) + 1)
+#define WQ_LEASE(l)             reinterpret_cast<work_lease_slot_t*>( \
+                                    reinterpret_cast<uintptr_t>(WQ_CONSUMERS) + WQ_CONSUMERS_BYTES(WQ_ATTRIBUTE) + \
+                                    static_cast<size_t>(WQ_ATTRIBUTE.capacity) * WQ_SLOT_BYTES(WQ_ATTRIBUTE) + \
+                                    static_cast<size_t>(l) * WQ_LEASE_BYTES(WQ_ATTRIBUTE))
+#define WQ_LEASE_DATA(lease)    reinterpret_cast<uint8_t*>((lease) + 1)
+
+#define WQ_STATE(kind,owner,deliveries,gen) \
+                                ((static_cast<uint64_t>(kind)) | (static_cast<uint64_t>(owner) << 8) | \
+                                 (static_cast<uint64_t>(deliveries) << 16) | (static_cast<uint64_t>(gen) << 32))
+#define WQ_KIND(st)             ((st) & 0xff)
+#define WQ_OWNER(st)            static_cast<uint32_t>(((st) >> 8) & 0xff)
+#define WQ_DELIVERIES(st)       static_cast<uint32_t>(((st) >> 16) & 0xffff)
+#define WQ_GEN(st)              static_cast<uint32_t>((st) >> 32)
+
+// how often an idle consumer runs reclaim()
+#define WQ_RECLAIM_INTERVAL_NS  (10000000ull)
+
+static inline uint64_t steady_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/**
+ * @endcond
+ */
+
+WorkQueue::WorkQueue(void* mem_ptr) :
+    info_ptr(reinterpret_cast<const WorkQueueHeader*>(mem_ptr)),
+    consumer(WQ_ATTRIBUTE.max_consumers),
+    next_lease(0) {}
+
+WorkQueue::~WorkQueue() {
+    if (this->consumer < WQ_ATTRIBUTE.max_consumers) {
+        // return the leases still held for redelivery.
+        std::vector<bool> dead(WQ_ATTRIBUTE.max_consumers,false);
+        uint32_t orphaned = 0;
+        lock();
+        reclaim_consumer(this->consumer,dead,orphaned);
+        WQ_CONSUMERS[this->consumer].pid.store(0,std::memory_order_release);
+        unlock();
+    }
+    shmdt(this->info_ptr);
+}
+
+void WorkQueue::lock() {
+    int ret = pthread_mutex_lock(&WQ_HEADER->info.mutex);
+    if (ret == EOWNERDEAD) {
+        // reclaim() is idempotent, so the state is taken over as is.
+        pthread_mutex_consistent(&WQ_HEADER->info.mutex);
+    } else if (ret != 0) {
+        throw ws_exp(std::string("pthread_mutex_lock failed with error:") + std::strerror(ret));
+    }
+}
+
+void WorkQueue::unlock() {
+    pthread_mutex_unlock(&WQ_HEADER->info.mutex);
+}
+
+void WorkQueue::register_consumer() {
+    const pid_t pid = getpid();
+    const uint64_t start_time = process_start_time(pid);
+    // free the slots of dead consumers first.
+    reclaim();
+    lock();
+    for (this->consumer = 0; this->consumer < WQ_ATTRIBUTE.max_consumers; this->consumer++) {
+        if (WQ_CONSUMERS[this->consumer].pid.load(std::memory_order_relaxed) == 0) {
+            WQ_CONSUMERS[this->consumer].start_time = start_time;
+            WQ_CONSUMERS[this->consumer].pid.store(pid,std::memory_order_release);
+            break;
+        }
+    }
+    unlock();
+    if (this->consumer == WQ_ATTRIBUTE.max_consumers) {
+        throw ws_exp("Work queue is full: all " + std::to_string(WQ_ATTRIBUTE.max_consumers) +
+                     " consumer slots are in use.");
+    }
+}
+
+WorkQueueAttribute WorkQueue::attribute() {
+    return WQ_ATTRIBUTE;
+}
+
+WorkQueueStats WorkQueue::stats() {
+    WorkQueueStats stats;
+    const uint64_t head = WQ_HEADER->info.head.load(std::memory_order_acquire);
+    const uint64_t tail = WQ_HEADER->info.tail.load(std::memory_order_acquire);
+    stats.queued        = tail - std::min(head,tail);
+    stats.leased        = 0;
+    for (size_t l = 0; l < WQ_NUM_LEASES(WQ_ATTRIBUTE); l++) {
+        if (WQ_KIND(WQ_LEASE(l)->state.load(std::memory_order_relaxed)) == WQ_LEASED) {
+            stats.leased ++;
+        }
+    }
+    stats.orphans       = WQ_HEADER->info.orphans.load(std::memory_order_relaxed);
+    stats.redelivered   = WQ_HEADER->info.redelivered.load(std::memory_order_relaxed);
+    stats.expired       = WQ_HEADER->info.expired.load(std::memory_order_relaxed);
+    stats.consumers     = 0;
+    for (uint32_t c = 0; c < WQ_ATTRIBUTE.max_consumers; c++) {
+        if (WQ_CONSUMERS[c].pid.load(std::memory_order_relaxed) != 0) {
+            stats.consumers ++;
+        }
+    }
+    return stats;
+}
+
+void WorkQueue::produce(const void* buffer, uint16_t size, uint64_t timeout_ns) {
+    // validation check
+    if (size > WQ_ATTRIBUTE.entry_size || size == 0) {
+        throw ws_invalid_argument_exp("Work queue produce() is called with invalid size.");
+    }
+
+    // claim a position
+    uint64_t pos = WQ_HEADER->info.tail.load(std::memory_order_relaxed);
+    uint64_t deadline = 0;
+    work_queue_slot_t* slot;
+    while (true) {
+        slot = WQ_SLOT(pos);
+        const int64_t dif = static_cast<int64_t>(slot->seq.load(std::memory_order_acquire) - pos);
+        if (dif == 0) {
+            if (WQ_HEADER->info.tail.compare_exchange_weak(pos,pos + 1,std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (dif < 0) {
+            // full: wait for the consumers until timeout.
+            const uint64_t now = steady_ns();
+            if (deadline == 0) {
+                deadline = now + timeout_ns;
+            }
+            if (now >= deadline) {
+                throw ws_timeout_exp("Work queue producer call timeout.");
+            }
+            pos = WQ_HEADER->info.tail.load(std::memory_order_relaxed);
+        } else {
+            pos = WQ_HEADER->info.tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    // publish
+    std::memcpy(WQ_SLOT_DATA(slot),buffer,size);
+    slot->seq.store(pos + 1,std::memory_order_release);
+}
+
+bool WorkQueue::take_orphan(WorkLease& lease) {
+    const size_t num_leases = WQ_NUM_LEASES(WQ_ATTRIBUTE);
+    for (size_t l = 0; l < num_leases; l++) {
+        work_lease_slot_t* ls = WQ_LEASE(l);
+        uint64_t st = ls->state.load(std::memory_order_acquire);
+        if (WQ_KIND(st) != WQ_ORPHANED) {
+            continue;
+        }
+        // stamp before taking it, so that reclaim() never sees the lease with the old time.
+        ls->leased_ns.store(steady_ns(),std::memory_order_relaxed);
+        const uint32_t deliveries = std::min(WQ_DELIVERIES(st) + 1,0xffffu);
+        if (ls->state.compare_exchange_strong(st,WQ_STATE(WQ_LEASED,this->consumer,deliveries,WQ_GEN(st)),
+                                              std::memory_order_acq_rel)) {
+            WQ_HEADER->info.orphans.fetch_sub(1,std::memory_order_relaxed);
+            WQ_HEADER->info.redelivered.fetch_add(1,std::memory_order_relaxed);
+            lease.slot          = static_cast<uint32_t>(l);
+            lease.generation    = WQ_GEN(st);
+            lease.deliveries    = deliveries;
+            lease.data          = WQ_LEASE_DATA(ls);
+            return true;
+        }
+    }
+    return false;
+}
+
+WorkLease WorkQueue::lease(uint64_t timeout_ns) {
+    if (this->consumer == WQ_ATTRIBUTE.max_consumers) {
+        register_consumer();
+    }
+    const uint32_t max_leases = WQ_ATTRIBUTE.max_leases;
+    const uint64_t capacity = WQ_ATTRIBUTE.capacity;
+    uint64_t deadline = 0;
+    WorkLease lease;
+
+    // a free lease slot of this consumer
+    work_lease_slot_t* ls = nullptr;
+    uint32_t l = 0;
+    uint64_t st = 0;
+    bool claiming = false;
+
+    while (true) {
+        // redeliveries first
+        if (WQ_HEADER->info.orphans.load(std::memory_order_relaxed) > 0 && take_orphan(lease)) {
+            if (claiming) {
+                ls->state.store(st,std::memory_order_release);
+            }
+            return lease;
+        }
+        if (ls == nullptr) {
+            for (uint32_t i = 0; i < max_leases; i++) {
+                l = this->consumer * max_leases + (this->next_lease + i) % max_leases;
+                st = WQ_LEASE(l)->state.load(std::memory_order_acquire);
+                if (WQ_KIND(st) == WQ_FREE) {
+                    ls = WQ_LEASE(l);
+                    break;
+                }
+            }
+            if (ls == nullptr) {
+                throw ws_exp("All " + std::to_string(max_leases) + " leases of this consumer are in use.");
+            }
+        }
+
+        uint64_t pos = WQ_HEADER->info.head.load(std::memory_order_relaxed);
+        work_queue_slot_t* slot = WQ_SLOT(pos);
+        const int64_t dif = static_cast<int64_t>(slot->seq.load(std::memory_order_acquire) - (pos + 1));
+        if (dif == 0) {
+            // record the claim before making it, so that reclaim() can finish it if we die.
+            ls->position.store(pos,std::memory_order_relaxed);
+            ls->state.store(WQ_STATE(WQ_CLAIMING,this->consumer,0,WQ_GEN(st)),std::memory_order_seq_cst);
+            claiming = true;
+            if (WQ_HEADER->info.head.compare_exchange_strong(pos,pos + 1,std::memory_order_seq_cst)) {
+                std::memcpy(WQ_LEASE_DATA(ls),WQ_SLOT_DATA(slot),WQ_ATTRIBUTE.entry_size);
+                ls->leased_ns.store(steady_ns(),std::memory_order_relaxed);
+                ls->state.store(WQ_STATE(WQ_LEASED,this->consumer,1,WQ_GEN(st)),std::memory_order_release);
+                // the entry is safe in the lease slot, hand the ring slot back to the producers.
+                slot->seq.store(pos + capacity,std::memory_order_release);
+                this->next_lease = (l - this->consumer * max_leases + 1) % max_leases;
+                lease.slot          = l;
+                lease.generation    = WQ_GEN(st);
+                lease.deliveries    = 1;
+                lease.data          = WQ_LEASE_DATA(ls);
+                return lease;
+            }
+        } else if (dif < 0) {
+            // empty
+            if (claiming) {
+                ls->state.store(st,std::memory_order_release);
+                claiming = false;
+            }
+            const uint64_t now = steady_ns();
+            uint64_t last = WQ_HEADER->info.last_reclaim_ns.load(std::memory_order_relaxed);
+            if (now - last >= WQ_RECLAIM_INTERVAL_NS &&
+                WQ_HEADER->info.last_reclaim_ns.compare_exchange_strong(last,now,std::memory_order_relaxed)) {
+                reclaim();
+                continue;
+            }
+            if (deadline == 0) {
+                deadline = now + timeout_ns;
+            }
+            if (now >= deadline) {
+                throw ws_timeout_exp("Work queue lease call timeout.");
+            }
+        }
+    }
+}
+
+bool WorkQueue::ack(const WorkLease& lease) {
+    if (lease.slot >= WQ_NUM_LEASES(WQ_ATTRIBUTE)) {
+        throw ws_invalid_argument_exp("Invalid lease slot:" + std::to_string(lease.slot));
+    }
+    uint64_t expected = WQ_STATE(WQ_LEASED,this->consumer,lease.deliveries,lease.generation);
+    return WQ_LEASE(lease.slot)->state.compare_exchange_strong(expected,WQ_STATE(WQ_FREE,0,0,lease.generation + 1),
+                                                               std::memory_order_release);
+}
+
+bool WorkQueue::nack(const WorkLease& lease) {
+    if (lease.slot >= WQ_NUM_LEASES(WQ_ATTRIBUTE)) {
+        throw ws_invalid_argument_exp("Invalid lease slot:" + std::to_string(lease.slot));
+    }
+    uint64_t expected = WQ_STATE(WQ_LEASED,this->consumer,lease.deliveries,lease.generation);
+    if (WQ_LEASE(lease.slot)->state.compare_exchange_strong(expected,
+            WQ_STATE(WQ_ORPHANED,this->consumer,lease.deliveries,lease.generation),std::memory_order_release)) {
+        WQ_HEADER->info.orphans.fetch_add(1,std::memory_order_release);
+        return true;
+    }
+    return false;
+}
+
+bool WorkQueue::reclaim_consumer(uint32_t consumer, const std::vector<bool>& dead, uint32_t& orphaned) {
+    const size_t num_leases = WQ_NUM_LEASES(WQ_ATTRIBUTE);
+    const uint64_t capacity = WQ_ATTRIBUTE.capacity;
+    bool resolved = true;
+    for (size_t l = 0; l < num_leases; l++) {
+        work_lease_slot_t* ls = WQ_LEASE(l);
+        uint64_t st = ls->state.load(std::memory_order_acquire);
+        if (WQ_OWNER(st) != consumer) {
+            continue;
+        }
+        const uint64_t pos = ls->position.load(std::memory_order_relaxed);
+        work_queue_slot_t* slot = WQ_SLOT(pos);
+        if (WQ_KIND(st) == WQ_LEASED) {
+            if (!ls->state.compare_exchange_strong(st,WQ_STATE(WQ_ORPHANED,consumer,WQ_DELIVERIES(st),WQ_GEN(st)),
+                                                   std::memory_order_acq_rel)) {
+                continue;
+            }
+            WQ_HEADER->info.orphans.fetch_add(1,std::memory_order_release);
+            orphaned ++;
+            // died between taking the entry and handing the ring slot back.
+            if (dead[consumer] && slot->seq.load(std::memory_order_acquire) == pos + 1) {
+                slot->seq.store(pos + capacity,std::memory_order_release);
+            }
+        } else if (WQ_KIND(st) == WQ_CLAIMING) {
+            // only a dead consumer leaves a claim behind.
+            const bool claimed = dead[consumer] &&
+                                 slot->seq.load(std::memory_order_acquire) == pos + 1 &&
+                                 WQ_HEADER->info.head.load(std::memory_order_seq_cst) > pos;
+            if (claimed) {
+                // the position is claimed but not handed back: by this consumer, or by another one recording the
+                // same position. Wait for a live claimer, and leave it to a leaseholder.
+                bool ours = true;
+                bool pending = false;
+                for (size_t o = 0; o < num_leases; o++) {
+                    const uint64_t ost = WQ_LEASE(o)->state.load(std::memory_order_acquire);
+                    if (o == l || WQ_LEASE(o)->position.load(std::memory_order_relaxed) != pos) {
+                        continue;
+                    }
+                    if ((WQ_KIND(ost) == WQ_CLAIMING && !dead[WQ_OWNER(ost)]) || WQ_KIND(ost) == WQ_LEASED) {
+                        ours = false;
+                        pending = (WQ_KIND(ost) == WQ_CLAIMING);
+                        break;
+                    }
+                }
+                if (ours) {
+                    std::memcpy(WQ_LEASE_DATA(ls),WQ_SLOT_DATA(slot),WQ_ATTRIBUTE.entry_size);
+                    ls->state.store(WQ_STATE(WQ_ORPHANED,consumer,0,WQ_GEN(st)),std::memory_order_release);
+                    WQ_HEADER->info.orphans.fetch_add(1,std::memory_order_release);
+                    orphaned ++;
+                    slot->seq.store(pos + capacity,std::memory_order_release);
+                    continue;
+                }
+                if (pending) {
+                    resolved = false;
+                    continue;
+                }
+            }
+            ls->state.store(WQ_STATE(WQ_FREE,0,0,WQ_GEN(st)),std::memory_order_release);
+        }
+    }
+    return resolved;
+}
+
+uint32_t WorkQueue::reclaim() {
+    const uint32_t max_consumers = WQ_ATTRIBUTE.max_consumers;
+    std::vector<bool> dead(max_consumers,false);
+    uint32_t orphaned = 0;
+    lock();
+    for (uint32_t c = 0; c < max_consumers; c++) {
+        const pid_t pid = WQ_CONSUMERS[c].pid.load(std::memory_order_acquire);
+        if (pid != 0 && c != this->consumer && process_start_time(pid) != WQ_CONSUMERS[c].start_time) {
+            dead[c] = true;
+        }
+    }
+    for (uint32_t c = 0; c < max_consumers; c++) {
+        if (dead[c] && reclaim_consumer(c,dead,orphaned)) {
+            WQ_CONSUMERS[c].pid.store(0,std::memory_order_release);
+        }
+    }
+    // expire the leases held too long by the live consumers.
+    if (WQ_ATTRIBUTE.lease_timeout_ns > 0) {
+        const uint64_t now = steady_ns();
+        for (size_t l = 0; l < WQ_NUM_LEASES(WQ_ATTRIBUTE); l++) {
+            work_lease_slot_t* ls = WQ_LEASE(l);
+            uint64_t st = ls->state.load(std::memory_order_acquire);
+            const uint64_t leased_ns = ls->leased_ns.load(std::memory_order_relaxed);
+            if (WQ_KIND(st) == WQ_LEASED && now > leased_ns && now - leased_ns > WQ_ATTRIBUTE.lease_timeout_ns &&
+                ls->state.compare_exchange_strong(st,WQ_STATE(WQ_ORPHANED,WQ_OWNER(st),WQ_DELIVERIES(st),WQ_GEN(st)),
+                                                  std::memory_order_acq_rel)) {
+                WQ_HEADER->info.orphans.fetch_add(1,std::memory_order_release);
+                WQ_HEADER->info.expired.fetch_add(1,std::memory_order_relaxed);
+                orphaned ++;
+            }
+        }
+    }
+    WQ_HEADER->info.last_reclaim_ns.store(steady_ns(),std::memory_order_relaxed);
+    unlock();
+    return orphaned;
+}
+
+key_t WorkQueue::create_work_queue(const WorkQueueAttribute& attribute) {
+    // validate check
+    if ((attribute.capacity & (attribute.capacity - 1)) || attribute.capacity < 2) {
+        throw ws_invalid_argument_exp("Invalid capacity:" + std::to_string(attribute.capacity) +
+                                      ". Capacity must be power-of-two.");
+    }
+    if (attribute.entry_size == 0) {
+        throw ws_invalid_argument_exp("Invalid entry_size:0");
+    }
+    if (attribute.max_consumers == 0 || attribute.max_consumers > WS_WORK_QUEUE_MAX_CONSUMERS) {
+        throw ws_invalid_argument_exp("Invalid max_consumers:" + std::to_string(attribute.max_consumers));
+    }
+    if (attribute.max_leases == 0) {
+        throw ws_invalid_argument_exp("Invalid max_leases:0");
+    }
+
+    int shmflg = IPC_CREAT | IPC_EXCL | 0644; // the default permission
+    switch (attribute.page_size) {
+    case 1<<12:
+        break;
+#if defined(__linux__)
+    case 1<<21:
+        shmflg |= (SHM_HUGETLB | (HUGETLB_FLAG_ENCODE_2MB));
+        break;
+    case 1<<30:
+        shmflg |= (SHM_HUGETLB | (HUGETLB_FLAG_ENCODE_1GB));
+        break;
+#endif
+    default:
+        throw ws_invalid_argument_exp("Invalid page_size:" + std::to_string(attribute.page_size));
+    }
+
+    // create
+    int shmid = shmget(attribute.key,WQ_ROUND_UP(WQ_TOTAL_BYTES(attribute),static_cast<size_t>(attribute.page_size)),
+                       shmflg);
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") +
+                     std::strerror(errno));
+    }
+
+    // lock memory
+    if (shmctl(shmid,SHM_LOCK,nullptr) == -1) {
+        int err = errno;
+        shmctl(shmid,IPC_RMID,nullptr);
+        errno = err;
+        throw ws_exp(std::string("pinning pages: shmctl failed with error:") +
+                     std::strerror(err));
+    }
+
+    // get key
+    struct shmid_ds buf;
+    if (shmctl(shmid,IPC_STAT,&buf) == -1) {
+        int err = errno;
+        shmctl(shmid,IPC_RMID,nullptr);
+        errno = err;
+        throw ws_exp(std::string("get stat: shmctl failed with error:") +
+                     std::strerror(err));
+    }
+
+    // attach to memory region
+    void* ptr = shmat(shmid,nullptr,0);
+    if (ptr == (void*)-1) {
+        int err = errno;
+        shmctl(shmid,IPC_RMID,nullptr);
+        errno = err;
+        throw ws_exp(std::string("attach: shmat failed with error:") +
+                     std::strerror(err));
+    }
+
+    // initialize, the shared memory is zero-filled so all consumer and lease slots are free.
+    WorkQueueHeader* wqh        = reinterpret_cast<WorkQueueHeader*>(ptr);
+    wqh->info.attribute         = attribute;
+    wqh->info.attribute.id      = shmid;
+    wqh->info.attribute.key     = buf.shm_perm.__key;
+    uint8_t* slots = reinterpret_cast<uint8_t*>(ptr) + sizeof(WorkQueueHeader) + WQ_CONSUMERS_BYTES(attribute);
+    for (uint32_t i = 0; i < attribute.capacity; i++) {
+        reinterpret_cast<work_queue_slot_t*>(slots + static_cast<size_t>(i) * WQ_SLOT_BYTES(attribute))->seq.store(i);
+    }
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr,PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex_attr,PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&wqh->info.mutex,&mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+
+    // detach memory region
+    if (shmdt(ptr) == -1) {
+        throw ws_exp(std::string("detach: shmdt failed with error:") +
+                     std::strerror(errno));
+    }
+
+    return buf.shm_perm.__key;
+}
+
+void WorkQueue::delete_work_queue(const key_t key) {
+    int shmid = shmget(key,0,0);
+
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") +
+                     std::strerror(errno));
+    }
+
+    if (shmctl(shmid,IPC_RMID,nullptr) == -1) {
+        throw ws_exp(std::string("delete shared memory: shmctl failed with error:") +
+                     std::strerror(errno));
+    }
+}
+
+std::unique_ptr<WorkQueue> WorkQueue::get_work_queue(const key_t key) {
+    int shmid = shmget(key,0,0);
+
+    if (shmid == -1) {
+        throw ws_exp(std::string("shmget failed with error:") +
+                     std::strerror(errno));
+    }
+
+    void* mem_ptr = shmat(shmid,nullptr,0);
+    if (mem_ptr == (void*)-1) {
+        throw ws_exp(std::string("Memory attach failed: shmat failed with error:") +
+                     std::strerror(errno));
+    }
+
+    return std::unique_ptr<WorkQueue>(new WorkQueue(mem_ptr));
+}
+
+}
+}
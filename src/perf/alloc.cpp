@@ -0,0 +1,56 @@
+/**
+ * @file    alloc.cpp
+ * @brief   Allocation counters implementation.
+ */
+
+#include <wsong/perf/alloc.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+namespace wsong {
+namespace perf {
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+static std::atomic<bool> alloc_hooks_loaded{false};
+
+// Write a string to stderr without allocating.
+static void alloc_write(const char* text) {
+    ssize_t ignored = write(STDERR_FILENO,text,strlen(text));
+    (void)ignored;
+}
+/**
+ * @endcond
+ */
+
+bool alloc_hooks_installed() {
+    return alloc_hooks_loaded.load(std::memory_order_acquire);
+}
+
+void alloc_hooks_install() {
+    alloc_hooks_loaded.store(true,std::memory_order_release);
+}
+
+void alloc_forbidden(size_t size) {
+    // no allocation from here on: the message is formatted on the stack.
+    char digits[24];
+    char* p = digits + sizeof(digits);
+    *--p = '\0';
+    do {
+        *--p = static_cast<char>('0' + size % 10);
+        size /= 10;
+    } while (size > 0);
+    alloc_write("libwsong: a ");
+    alloc_write(p);
+    alloc_write("-byte allocation in the no-allocation scope '");
+    alloc_write(alloc_thread_counters.forbidden_scope != nullptr ? alloc_thread_counters.forbidden_scope : "");
+    alloc_write("', aborting.\n");
+    std::abort();
+}
+
+}
+}
@@ -0,0 +1,98 @@
+/**
+ * @file    alloc_hooks.cpp
+ * @brief   The allocation hooks of libwsongalloc.
+ *
+ * They interpose the malloc family of the C library, count the calls in the calling thread's `AllocCounters`, and
+ * forward them to the glibc allocator.
+ */
+#include <wsong/perf/alloc.hpp>
+
+#include <errno.h>
+#include <stdlib.h>
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+// The glibc allocator, behind the interposed symbols.
+extern "C" {
+void*   __libc_malloc(size_t size);
+void    __libc_free(void* ptr);
+void*   __libc_calloc(size_t nmemb, size_t size);
+void*   __libc_realloc(void* ptr, size_t size);
+void*   __libc_memalign(size_t alignment, size_t size);
+void*   __libc_valloc(size_t size);
+void*   __libc_pvalloc(size_t size);
+}
+
+__attribute__((constructor)) static void alloc_hooks_load() {
+    wsong::perf::alloc_hooks_install();
+}
+
+using wsong::perf::alloc_record;
+using wsong::perf::alloc_record_free;
+
+extern "C" {
+
+WS_DLL_PUBLIC void* malloc(size_t size) {
+    alloc_record(size);
+    return __libc_malloc(size);
+}
+
+WS_DLL_PUBLIC void free(void* ptr) {
+    if (ptr != nullptr) {
+        alloc_record_free();
+    }
+    __libc_free(ptr);
+}
+
+WS_DLL_PUBLIC void* calloc(size_t nmemb, size_t size) {
+    alloc_record(nmemb * size);
+    return __libc_calloc(nmemb,size);
+}
+
+WS_DLL_PUBLIC void* realloc(void* ptr, size_t size) {
+    if (ptr != nullptr && size == 0) {
+        alloc_record_free();
+    } else {
+        alloc_record(size);
+    }
+    return __libc_realloc(ptr,size);
+}
+
+WS_DLL_PUBLIC int posix_memalign(void** memptr, size_t alignment, size_t size) {
+    if (alignment == 0 || alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    alloc_record(size);
+    void* ptr = __libc_memalign(alignment,size);
+    if (ptr == nullptr) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+WS_DLL_PUBLIC void* aligned_alloc(size_t alignment, size_t size) {
+    alloc_record(size);
+    return __libc_memalign(alignment,size);
+}
+
+WS_DLL_PUBLIC void* memalign(size_t alignment, size_t size) {
+    alloc_record(size);
+    return __libc_memalign(alignment,size);
+}
+
+WS_DLL_PUBLIC void* valloc(size_t size) {
+    alloc_record(size);
+    return __libc_valloc(size);
+}
+
+WS_DLL_PUBLIC void* pvalloc(size_t size) {
+    alloc_record(size);
+    return __libc_pvalloc(size);
+}
+
+}
+/**
+ * @endcond
+ */
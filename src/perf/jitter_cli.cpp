@@ -0,0 +1,316 @@
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <wsong/exceptions.hpp>
+#include <wsong/perf/timing.hpp>
+
+// The tag of the gap events, with user data: cpu, and the length of the gap in nanoseconds. The event timestamp is
+// the end of the gap.
+#define JT_GAP_TAG              (0x5753544a49545400ull)
+// The number of gaps per cpu kept for the percentiles. The ones beyond are only counted.
+#define JT_MAX_SAMPLES          (1ul<<20)
+
+const char* help_string_args =
+"--(c)pus <list>        the cpus to measure, e.g. 0,2-5. [all cpus the process may run on]\n"
+"--(d)uration <sec>     how long to measure. [10]\n"
+"--(t)hreshold <ns>     the shortest gap to record. [1000]\n"
+"--(o)utput <file>      save the gaps as timing events, see ws_timing_save().\n"
+"--(i)nterrupts         show the /proc/interrupts deltas on the measured cpus.\n"
+"--(h)elp               print this information.\n";
+
+static struct option long_options[] = {
+    {"cpus",        required_argument,  0,  'c'},
+    {"duration",    required_argument,  0,  'd'},
+    {"threshold",   required_argument,  0,  't'},
+    {"output",      required_argument,  0,  'o'},
+    {"interrupts",  no_argument,        0,  'i'},
+    {"help",        no_argument,        0,  'h'},
+    {0,0,0,0}
+};
+
+static void print_help(const char* cmd) {
+    std::cout << "libwsong jitter cli tool" << std::endl;
+    std::cout << "========================" << std::endl;
+    std::cout << "Usage: " << cmd << " [options]" << std::endl;
+    std::cout << "It spins on each cpu reading the time stamp counter, and records every gap in the loop, i.e. the\n"
+                 "time the cpu was taken away by interrupts, the scheduler, or the hypervisor." << std::endl;
+    std::cout << help_string_args << std::endl;
+}
+
+static inline uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+// The cheapest clock: the time stamp counter on x86, otherwise the monotonic clock in nanoseconds.
+static inline uint64_t read_ticks() {
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return monotonic_ns();
+#endif
+}
+
+static double ticks_per_ns() {
+#if defined(__x86_64__)
+    const uint64_t start_ns = monotonic_ns();
+    const uint64_t start_ticks = read_ticks();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    return static_cast<double>(read_ticks() - start_ticks) / (monotonic_ns() - start_ns);
+#else
+    return 1.0;
+#endif
+}
+
+static std::vector<int> parse_cpus(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges,range,',')) {
+        auto dash = range.find('-');
+        const int first = std::stoi(range.substr(0,dash));
+        const int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// The interrupt counters per source and cpu, from /proc/interrupts.
+struct interrupt_source_t {
+    std::string             description;
+    std::map<int,uint64_t>  counts;
+};
+
+static std::map<std::string,interrupt_source_t> read_interrupts() {
+    std::map<std::string,interrupt_source_t> sources;
+    std::ifstream infile("/proc/interrupts");
+    std::string line;
+    std::vector<int> columns;
+    if (!std::getline(infile,line)) {
+        return sources;
+    }
+    std::istringstream header(line);
+    std::string column;
+    while (header >> column) {
+        columns.push_back(std::stoi(column.substr(3)));
+    }
+    while (std::getline(infile,line)) {
+        std::istringstream fields(line);
+        std::string name;
+        fields >> name;
+        name.pop_back();
+        interrupt_source_t& source = sources[name];
+        for (int cpu: columns) {
+            uint64_t count;
+            if (!(fields >> count)) {
+                // e.g. ERR and MIS have a single count.
+                break;
+            }
+            source.counts[cpu] = count;
+        }
+        fields.clear();
+        std::getline(fields >> std::ws,source.description);
+    }
+    return sources;
+}
+
+struct cpu_jitter_t {
+    int                     cpu;
+    uint64_t                runtime_ns;
+    uint64_t                gaps;
+    uint64_t                interrupted_ns;
+    std::vector<uint32_t>   samples;
+    std::string             error;
+};
+
+static void measure(cpu_jitter_t& jitter, const uint64_t duration_ns, const uint64_t threshold_ns,
+                    const double ticks_per_ns, const bool punch) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(jitter.cpu,&cpuset);
+    if (pthread_setaffinity_np(pthread_self(),sizeof(cpuset),&cpuset) != 0) {
+        jitter.error = "failed to pin to cpu " + std::to_string(jitter.cpu);
+        return;
+    }
+    // keep the allocations out of the loop.
+    jitter.samples.reserve(JT_MAX_SAMPLES);
+    if (punch) {
+        // the timing buffer is prefaulted only when the gaps are saved, its page faults would be gaps too.
+        wsong::perf::timing_prepare();
+    }
+
+    const uint64_t threshold_ticks = static_cast<uint64_t>(threshold_ns * ticks_per_ns);
+    const uint64_t start = read_ticks();
+    const uint64_t end = start + static_cast<uint64_t>(duration_ns * ticks_per_ns);
+    uint64_t last = start;
+    uint64_t now;
+    do {
+        now = read_ticks();
+        if (now - last > threshold_ticks) {
+            const uint64_t gap_ns = static_cast<uint64_t>((now - last) / ticks_per_ns);
+            jitter.gaps ++;
+            jitter.interrupted_ns += gap_ns;
+            if (jitter.samples.size() < JT_MAX_SAMPLES) {
+                jitter.samples.push_back(static_cast<uint32_t>(std::min<uint64_t>(gap_ns,UINT32_MAX)));
+            }
+            if (punch) {
+                wsong::perf::timing_punch(JT_GAP_TAG,jitter.cpu,gap_ns);
+                // the punch itself is not a gap.
+                now = read_ticks();
+            }
+        }
+        last = now;
+    } while (now < end);
+    jitter.runtime_ns = static_cast<uint64_t>((now - start) / ticks_per_ns);
+}
+
+int main(int argc, char** argv) {
+    std::vector<int>    cpus;
+    uint64_t            duration_s = 10;
+    uint64_t            threshold_ns = 1000;
+    std::string         output;
+    bool                interrupts = false;
+
+    while(true) {
+        int option_index = 0;
+        int c = getopt_long(argc,argv,"c:d:t:o:ih",long_options, &option_index);
+
+        if (c == -1) {
+            break;
+        }
+
+        switch(c) {
+        case 'c':
+            cpus = parse_cpus(optarg);
+            break;
+        case 'd':
+            duration_s = std::stoul(optarg);
+            break;
+        case 't':
+            threshold_ns = std::stoul(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'i':
+            interrupts = true;
+            break;
+        case 'h':
+            print_help(argv[0]);
+            return 0;
+        case '?':
+        default:
+            std::cout << "skipping unknown argument." << std::endl;
+        }
+    }
+
+    if (cpus.empty()) {
+        cpu_set_t cpuset;
+        if (sched_getaffinity(0,sizeof(cpuset),&cpuset) != 0) {
+            throw wsong::ws_exp(std::string("sched_getaffinity failed with error:") + std::strerror(errno));
+        }
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu,&cpuset)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+
+    const double tpn = ticks_per_ns();
+    std::vector<cpu_jitter_t> jitters;
+    for (int cpu: cpus) {
+        jitters.push_back({cpu,0,0,0,{},{}});
+    }
+    std::cout << "Measuring " << cpus.size() << " cpus for " << duration_s << " seconds, threshold "
+              << threshold_ns << " ns, " << tpn << " ticks/ns." << std::endl;
+
+    auto interrupts_before = read_interrupts();
+    std::vector<std::thread> threads;
+    for (auto& jitter: jitters) {
+        threads.emplace_back(measure,std::ref(jitter),duration_s * 1000000000ull,threshold_ns,tpn,!output.empty());
+    }
+    for (auto& thread: threads) {
+        thread.join();
+    }
+    auto interrupts_after = read_interrupts();
+
+    // summary, like sysjitter
+    std::cout << std::setw(5) << "cpu" << std::setw(12) << "runtime(ms)" << std::setw(10) << "gaps"
+              << std::setw(10) << "gaps/s" << std::setw(16) << "interrupted(us)" << std::setw(10) << "int(%)"
+              << std::setw(10) << "p50(ns)" << std::setw(10) << "p99(ns)" << std::setw(12) << "p99.9(ns)"
+              << std::setw(12) << "max(ns)" << std::endl;
+    for (auto& jitter: jitters) {
+        std::cout << std::setw(5) << jitter.cpu;
+        if (!jitter.error.empty()) {
+            std::cout << "  " << jitter.error << std::endl;
+            continue;
+        }
+        std::sort(jitter.samples.begin(),jitter.samples.end());
+        auto percentile = [&jitter](double p) -> uint64_t {
+            return jitter.samples.empty() ? 0 : jitter.samples[static_cast<size_t>(p * (jitter.samples.size() - 1))];
+        };
+        const double seconds = jitter.runtime_ns / 1e9;
+        std::cout << std::setw(12) << jitter.runtime_ns / 1000000 << std::setw(10) << jitter.gaps
+                  << std::setw(10) << static_cast<uint64_t>(jitter.gaps / seconds)
+                  << std::setw(16) << jitter.interrupted_ns / 1000
+                  << std::setw(10) << std::fixed << std::setprecision(3)
+                  << 100.0 * jitter.interrupted_ns / std::max<uint64_t>(jitter.runtime_ns,1)
+                  << std::setw(10) << percentile(0.5) << std::setw(10) << percentile(0.99)
+                  << std::setw(12) << percentile(0.999) << std::setw(12) << percentile(1.0) << std::endl;
+    }
+
+    if (interrupts) {
+        std::cout << std::endl << "interrupts on the measured cpus:" << std::endl;
+        for (auto& jitter: jitters) {
+            std::vector<std::pair<uint64_t,std::string>> deltas;
+            for (auto& [name,source]: interrupts_after) {
+                auto before = interrupts_before.find(name);
+                if (source.counts.find(jitter.cpu) == source.counts.cend() || before == interrupts_before.cend()) {
+                    continue;
+                }
+                const uint64_t delta = source.counts.at(jitter.cpu) - before->second.counts[jitter.cpu];
+                if (delta > 0) {
+                    deltas.push_back({delta,name + " (" + source.description + ")"});
+                }
+            }
+            std::sort(deltas.rbegin(),deltas.rend());
+            std::cout << "cpu " << jitter.cpu << ":";
+            if (deltas.empty()) {
+                std::cout << " none";
+            }
+            std::cout << std::endl;
+            for (auto& [delta,name]: deltas) {
+                std::cout << std::setw(12) << delta << std::setw(10)
+                          << static_cast<uint64_t>(delta / std::max(jitter.runtime_ns / 1e9,1e-9)) << "/s  "
+                          << name << std::endl;
+            }
+        }
+    }
+
+    if (output.size() > 0) {
+        ws_timing_save(output.c_str());
+    }
+
+    return 0;
+}
@@ -0,0 +1,331 @@
+/**
+ * @file    metrics.cpp
+ * @brief   Shared memory metrics registry implementation.
+ */
+
+#include <wsong/perf/metrics.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <sstream>
+#include <thread>
+
+namespace wsong {
+namespace perf {
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+#define WS_METRICS_MAGIC        (0x5343495254454d57ull) // "WMETRICS"
+#define MR_ROUND_UP(x,a)        ((((x) + (a) - 1) / (a)) * (a))
+#define MR_ATTRIBUTE            (this->header->info.attribute)
+#define MR_DESCRIPTORS          reinterpret_cast<MetricDescriptor*>( \
+                                    reinterpret_cast<uintptr_t>(this->header) + sizeof(MetricsHeader) \
+                                )
+#define MR_SLABS                reinterpret_cast<std::atomic<uint64_t>*>( \
+                                    reinterpret_cast<uintptr_t>(MR_DESCRIPTORS) + \
+                                    MR_ROUND_UP(MR_ATTRIBUTE.max_metrics * sizeof(MetricDescriptor), CACHELINE_SIZE) \
+                                )
+#define MR_CELL(slab,cell)      (MR_SLABS + static_cast<size_t>(slab) * this->header->info.slab_stride + (cell))
+/**
+ * @endcond
+ */
+
+static std::string shm_name(const std::string& name) {
+    return (name.size() > 0 && name[0] == '/') ? name : ("/" + name);
+}
+
+// The HELP text with backslashes and newlines escaped, as the text exposition format requires.
+static std::string escape_help(const std::string& help) {
+    std::string escaped;
+    escaped.reserve(help.size());
+    for (const char c: help) {
+        if (c == '\\') {
+            escaped += "\\\\";
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+uint64_t metrics_histogram_upper_bound(uint32_t bucket) {
+    if (bucket < WS_METRICS_SUB_BUCKETS) {
+        return bucket;
+    }
+    const uint32_t shift    = (bucket >> WS_METRICS_SUB_BUCKET_BITS) - 1;
+    const uint64_t sub      = WS_METRICS_SUB_BUCKETS + (bucket & (WS_METRICS_SUB_BUCKETS - 1));
+    // the last bucket wraps around to UINT64_MAX.
+    return ((sub + 1) << shift) - 1;
+}
+
+MetricsRegistry::MetricsRegistry(void* mem_ptr, size_t mapped_size, bool writable):
+    header(reinterpret_cast<MetricsHeader*>(mem_ptr)),
+    mapped_size(mapped_size),
+    writable(writable) {
+}
+
+MetricsRegistry::~MetricsRegistry() {
+    munmap(header,mapped_size);
+}
+
+MetricsAttribute MetricsRegistry::attribute() {
+    return MR_ATTRIBUTE;
+}
+
+std::atomic<uint64_t>* MetricsRegistry::register_metric(const std::string& name, const std::string& help,
+                                                        MetricType type) {
+    if (!writable) {
+        throw ws_exp("Metrics registry is opened read-only.");
+    }
+    if (name.size() == 0 || name.size() >= WS_METRICS_NAME_LENGTH) {
+        throw ws_invalid_argument_exp("Invalid metric name:" + name);
+    }
+    const uint32_t cells = (type == WS_METRIC_HISTOGRAM) ? (WS_METRICS_HISTOGRAM_BUCKETS + 1) : 1;
+
+    // lock
+    bool expected = false;
+    while (!header->info.lock.compare_exchange_weak(expected,true,std::memory_order_acquire)) {
+        expected = false;
+    }
+
+    MetricDescriptor* descriptors = MR_DESCRIPTORS;
+    const uint32_t num_metrics = header->info.num_metrics.load(std::memory_order_relaxed);
+    std::atomic<uint64_t>* ret = nullptr;
+    std::string error;
+    for (uint32_t i = 0; i < num_metrics; i++) {
+        if (name == descriptors[i].name) {
+            if (descriptors[i].type == type) {
+                ret = MR_CELL(0,descriptors[i].cell);
+            } else {
+                error = "Metric " + name + " is registered with a different type.";
+            }
+            break;
+        }
+    }
+    if (ret == nullptr && error.empty()) {
+        if (num_metrics >= MR_ATTRIBUTE.max_metrics) {
+            error = "Metrics registry is full: max_metrics=" + std::to_string(MR_ATTRIBUTE.max_metrics);
+        } else if (header->info.used_cells + cells > MR_ATTRIBUTE.cells_per_thread) {
+            error = "Metrics registry is full: cells_per_thread=" + std::to_string(MR_ATTRIBUTE.cells_per_thread);
+        } else {
+            MetricDescriptor& descriptor = descriptors[num_metrics];
+            std::strncpy(descriptor.name,name.c_str(),WS_METRICS_NAME_LENGTH - 1);
+            std::strncpy(descriptor.help,help.c_str(),WS_METRICS_HELP_LENGTH - 1);
+            descriptor.type = type;
+            descriptor.cell = header->info.used_cells;
+            header->info.used_cells += cells;
+            ret = MR_CELL(0,descriptor.cell);
+            // publish the descriptor to the readers.
+            header->info.num_metrics.store(num_metrics + 1,std::memory_order_release);
+        }
+    }
+
+    // unlock
+    header->info.lock.store(false,std::memory_order_release);
+
+    if (ret == nullptr) {
+        throw ws_exp(error);
+    }
+    return ret;
+}
+
+Counter MetricsRegistry::counter(const std::string& name, const std::string& help) {
+    return Counter(register_metric(name,help,WS_METRIC_COUNTER),header->info.slab_stride,MR_ATTRIBUTE.max_threads,
+                   &header->info.next_slab);
+}
+
+Gauge MetricsRegistry::gauge(const std::string& name, const std::string& help) {
+    return Gauge(register_metric(name,help,WS_METRIC_GAUGE),header->info.slab_stride,MR_ATTRIBUTE.max_threads,
+                 &header->info.next_slab);
+}
+
+Histogram MetricsRegistry::histogram(const std::string& name, const std::string& help) {
+    return Histogram(register_metric(name,help,WS_METRIC_HISTOGRAM),header->info.slab_stride,MR_ATTRIBUTE.max_threads,
+                     &header->info.next_slab);
+}
+
+std::vector<MetricValue> MetricsRegistry::snapshot() {
+    std::vector<MetricValue> values;
+    const uint32_t num_metrics = header->info.num_metrics.load(std::memory_order_acquire);
+    const MetricDescriptor* descriptors = MR_DESCRIPTORS;
+    for (uint32_t i = 0; i < num_metrics; i++) {
+        MetricValue value {
+            .name       = descriptors[i].name,
+            .help       = descriptors[i].help,
+            .type       = descriptors[i].type,
+            .value      = 0,
+            .count      = 0,
+            .buckets    = {},
+        };
+        if (value.type == WS_METRIC_HISTOGRAM) {
+            value.buckets.resize(WS_METRICS_HISTOGRAM_BUCKETS,0);
+        }
+        for (uint32_t slab = 0; slab < MR_ATTRIBUTE.max_threads; slab++) {
+            const std::atomic<uint64_t>* cells = MR_CELL(slab,descriptors[i].cell);
+            if (value.type == WS_METRIC_HISTOGRAM) {
+                for (uint32_t b = 0; b < WS_METRICS_HISTOGRAM_BUCKETS; b++) {
+                    const uint64_t n = cells[b].load(std::memory_order_relaxed);
+                    value.buckets[b] += n;
+                    value.count += n;
+                }
+                value.value += cells[WS_METRICS_HISTOGRAM_BUCKETS].load(std::memory_order_relaxed);
+            } else {
+                value.value += static_cast<int64_t>(cells[0].load(std::memory_order_relaxed));
+            }
+        }
+        values.emplace_back(std::move(value));
+    }
+    return values;
+}
+
+std::string MetricsRegistry::prometheus() {
+    std::ostringstream text;
+    for (auto& value: snapshot()) {
+        if (value.help.size() > 0) {
+            text << "# HELP " << value.name << " " << escape_help(value.help) << "\n";
+        }
+        switch (value.type) {
+        case WS_METRIC_COUNTER:
+            text << "# TYPE " << value.name << " counter\n";
+            text << value.name << " " << static_cast<uint64_t>(value.value) << "\n";
+            break;
+        case WS_METRIC_GAUGE:
+            text << "# TYPE " << value.name << " gauge\n";
+            text << value.name << " " << value.value << "\n";
+            break;
+        case WS_METRIC_HISTOGRAM:
+            {
+                text << "# TYPE " << value.name << " histogram\n";
+                uint64_t cumulative = 0;
+                for (uint32_t b = 0; b < WS_METRICS_HISTOGRAM_BUCKETS; b++) {
+                    // only the non-empty buckets are exposed.
+                    if (value.buckets[b] == 0) {
+                        continue;
+                    }
+                    cumulative += value.buckets[b];
+                    text << value.name << "_bucket{le=\"" << metrics_histogram_upper_bound(b) << "\"} "
+                         << cumulative << "\n";
+                }
+                text << value.name << "_bucket{le=\"+Inf\"} " << value.count << "\n";
+                text << value.name << "_sum " << static_cast<uint64_t>(value.value) << "\n";
+                text << value.name << "_count " << value.count << "\n";
+            }
+            break;
+        }
+    }
+    return text.str();
+}
+
+std::unique_ptr<MetricsRegistry> MetricsRegistry::create(const std::string& name, const MetricsAttribute& attribute) {
+    // validate check
+    if (attribute.max_metrics == 0 || attribute.max_threads == 0 || attribute.cells_per_thread == 0) {
+        throw ws_invalid_argument_exp("Invalid metrics attribute: max_metrics, max_threads, and cells_per_thread "
+                                      "must be non-zero.");
+    }
+
+    int fd = shm_open(shm_name(name).c_str(),O_CREAT|O_EXCL|O_RDWR,0644);
+    if (fd == -1 && errno == EEXIST) {
+        // attach to the existing one.
+        fd = shm_open(shm_name(name).c_str(),O_RDWR,0);
+        if (fd == -1) {
+            throw ws_exp(std::string("shm_open failed with error:") + std::strerror(errno));
+        }
+        struct stat st;
+        // wait for the creator to size it.
+        for (int retry = 0; fstat(fd,&st) == 0 && st.st_size == 0 && retry < 1000; retry++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (st.st_size < static_cast<off_t>(sizeof(MetricsHeader))) {
+            close(fd);
+            throw ws_exp("Invalid metrics registry:" + name);
+        }
+        void* ptr = mmap(nullptr,st.st_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+        close(fd);
+        if (ptr == MAP_FAILED) {
+            throw ws_exp(std::string("mmap failed with error:") + std::strerror(errno));
+        }
+        MetricsHeader* header = reinterpret_cast<MetricsHeader*>(ptr);
+        for (int retry = 0; __atomic_load_n(&header->info.magic,__ATOMIC_ACQUIRE) != WS_METRICS_MAGIC; retry++) {
+            if (retry >= 1000) {
+                munmap(ptr,st.st_size);
+                throw ws_exp("Invalid metrics registry:" + name);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return std::unique_ptr<MetricsRegistry>(new MetricsRegistry(ptr,st.st_size,true));
+    } else if (fd == -1) {
+        throw ws_exp(std::string("shm_open failed with error:") + std::strerror(errno));
+    }
+
+    const uint32_t slab_stride  = MR_ROUND_UP(attribute.cells_per_thread, CACHELINE_SIZE/sizeof(uint64_t));
+    const size_t   size         = sizeof(MetricsHeader)
+                                + MR_ROUND_UP(attribute.max_metrics * sizeof(MetricDescriptor), CACHELINE_SIZE)
+                                + static_cast<size_t>(attribute.max_threads) * slab_stride * sizeof(uint64_t);
+    if (ftruncate(fd,size) == -1) {
+        close(fd);
+        shm_unlink(shm_name(name).c_str());
+        throw ws_exp(std::string("ftruncate failed with error:") + std::strerror(errno));
+    }
+    void* ptr = mmap(nullptr,size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        shm_unlink(shm_name(name).c_str());
+        throw ws_exp(std::string("mmap failed with error:") + std::strerror(errno));
+    }
+
+    // initialize, the segment is zero-filled.
+    MetricsHeader* header = reinterpret_cast<MetricsHeader*>(ptr);
+    header->info.attribute      = attribute;
+    header->info.slab_stride    = slab_stride;
+    header->info.used_cells     = 0;
+    header->info.num_metrics.store(0);
+    header->info.lock.store(false);
+    header->info.next_slab.store(0);
+    __atomic_store_n(&header->info.magic,WS_METRICS_MAGIC,__ATOMIC_RELEASE);
+
+    return std::unique_ptr<MetricsRegistry>(new MetricsRegistry(ptr,size,true));
+}
+
+std::unique_ptr<MetricsRegistry> MetricsRegistry::open(const std::string& name) {
+    int fd = shm_open(shm_name(name).c_str(),O_RDONLY,0);
+    if (fd == -1) {
+        throw ws_exp(std::string("shm_open failed with error:") + std::strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd,&st) == -1) {
+        close(fd);
+        throw ws_exp(std::string("fstat failed with error:") + std::strerror(errno));
+    }
+    if (st.st_size < static_cast<off_t>(sizeof(MetricsHeader))) {
+        close(fd);
+        throw ws_exp("Invalid metrics registry:" + name);
+    }
+    void* ptr = mmap(nullptr,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        throw ws_exp(std::string("mmap failed with error:") + std::strerror(errno));
+    }
+    if (__atomic_load_n(&reinterpret_cast<MetricsHeader*>(ptr)->info.magic,__ATOMIC_ACQUIRE) != WS_METRICS_MAGIC) {
+        munmap(ptr,st.st_size);
+        throw ws_exp("Invalid metrics registry:" + name);
+    }
+    return std::unique_ptr<MetricsRegistry>(new MetricsRegistry(ptr,st.st_size,false));
+}
+
+void MetricsRegistry::remove(const std::string& name) {
+    if (shm_unlink(shm_name(name).c_str()) == -1) {
+        throw ws_exp(std::string("shm_unlink failed with error:") + std::strerror(errno));
+    }
+}
+
+}
+}
@@ -0,0 +1,186 @@
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <wsong/perf/metrics.hpp>
+
+const char* help_string_args =
+"--(n)ame <name>        the name of the metrics registry shared memory. (mandatory)\n"
+"--(f)ormat <format>    output format:=text|prometheus [text]\n"
+"--(o)utput <file>      write the snapshot to a file instead of stdout.\n"
+"--(s)ocket <path>      serve the prometheus snapshot on a UNIX socket, one snapshot per connection.\n"
+"--(i)nterval <ms>      take a snapshot every <ms> milliseconds. [0, snapshot once]\n"
+"--(h)elp               print this information.\n";
+
+static struct option long_options[] = {
+    {"name",    required_argument,  0,  'n'},
+    {"format",  required_argument,  0,  'f'},
+    {"output",  required_argument,  0,  'o'},
+    {"socket",  required_argument,  0,  's'},
+    {"interval",required_argument,  0,  'i'},
+    {"help",    no_argument,        0,  'h'},
+    {0,0,0,0}
+};
+
+static void print_help(const char* cmd) {
+    std::cout << "libwsong metrics cli tool" << std::endl;
+    std::cout << "=========================" << std::endl;
+    std::cout << "Usage: " << cmd << " [options]" << std::endl;
+    std::cout << help_string_args << std::endl;
+}
+
+static std::string text_snapshot(wsong::perf::MetricsRegistry& registry) {
+    std::ostringstream text;
+    for (auto& value: registry.snapshot()) {
+        text << std::left << std::setw(WS_METRICS_NAME_LENGTH) << value.name;
+        switch(value.type) {
+        case wsong::perf::WS_METRIC_COUNTER:
+            text << " counter   " << static_cast<uint64_t>(value.value) << "\n";
+            break;
+        case wsong::perf::WS_METRIC_GAUGE:
+            text << " gauge     " << value.value << "\n";
+            break;
+        case wsong::perf::WS_METRIC_HISTOGRAM:
+            text << " histogram count=" << value.count << " sum=" << static_cast<uint64_t>(value.value);
+            if (value.count > 0) {
+                text << " avg=" << static_cast<uint64_t>(value.value)/value.count;
+                // percentiles by bucket upper bounds
+                for (double p: {0.5,0.99,0.999}) {
+                    uint64_t target = static_cast<uint64_t>(p*value.count);
+                    uint64_t cumulative = 0;
+                    for (uint32_t b = 0; b < value.buckets.size(); b++) {
+                        cumulative += value.buckets[b];
+                        if (cumulative > target) {
+                            text << " p" << p*100 << "<=" << wsong::perf::metrics_histogram_upper_bound(b);
+                            break;
+                        }
+                    }
+                }
+            }
+            text << "\n";
+            break;
+        }
+    }
+    return text.str();
+}
+
+static void serve(wsong::perf::MetricsRegistry& registry, const std::string& path) {
+    int sfd = socket(AF_UNIX,SOCK_STREAM,0);
+    if (sfd == -1) {
+        throw wsong::ws_exp(std::string("socket failed with error:") + std::strerror(errno));
+    }
+    struct sockaddr_un addr;
+    std::memset(&addr,0,sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw wsong::ws_invalid_argument_exp("Socket path is too long:" + path);
+    }
+    std::strncpy(addr.sun_path,path.c_str(),sizeof(addr.sun_path)-1);
+    unlink(path.c_str());
+    if (bind(sfd,reinterpret_cast<struct sockaddr*>(&addr),sizeof(addr)) == -1 || listen(sfd,16) == -1) {
+        throw wsong::ws_exp(std::string("bind/listen failed with error:") + std::strerror(errno));
+    }
+    while (true) {
+        int cfd = accept(sfd,nullptr,nullptr);
+        if (cfd == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw wsong::ws_exp(std::string("accept failed with error:") + std::strerror(errno));
+        }
+        std::string text = registry.prometheus();
+        size_t sent = 0;
+        while (sent < text.size()) {
+            ssize_t n = write(cfd,text.data() + sent,text.size() - sent);
+            if (n <= 0) {
+                break;
+            }
+            sent += n;
+        }
+        close(cfd);
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string name;
+    std::string format = "text";
+    std::string output;
+    std::string socket_path;
+    uint64_t    interval_ms = 0;
+
+    while(true) {
+        int option_index = 0;
+        int c = getopt_long(argc,argv,"n:f:o:s:i:h",long_options, &option_index);
+
+        if (c == -1) {
+            break;
+        }
+
+        switch(c) {
+        case 'n':
+            name = optarg;
+            break;
+        case 'f':
+            format = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 's':
+            socket_path = optarg;
+            break;
+        case 'i':
+            interval_ms = std::stoul(optarg);
+            break;
+        case 'h':
+            print_help(argv[0]);
+            return 0;
+        case '?':
+        default:
+            std::cout << "skipping unknown argument." << std::endl;
+        }
+    }
+
+    if (name.size() == 0 || (format != "text" && format != "prometheus")) {
+        print_help(argv[0]);
+        return 0;
+    }
+
+    auto registry = wsong::perf::MetricsRegistry::open(name);
+
+    if (socket_path.size() > 0) {
+        serve(*registry,socket_path);
+        return 0;
+    }
+
+    do {
+        std::string text = (format == "text") ? text_snapshot(*registry) : registry->prometheus();
+        if (output.size() > 0) {
+            // write and rename so that readers never see a partial snapshot.
+            std::string tmp = output + ".tmp";
+            std::ofstream outfile(tmp);
+            outfile << text;
+            outfile.close();
+            std::rename(tmp.c_str(),output.c_str());
+        } else {
+            std::cout << text << std::flush;
+        }
+        if (interval_ms > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+        }
+    } while (interval_ms > 0);
+
+    return 0;
+}
@@ -0,0 +1,251 @@
+/**
+ * @file    span.cpp
+ * @brief   Hierarchical span profiler implementation.
+ */
+
+#include <wsong/perf/span.hpp>
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <tuple>
+
+namespace wsong {
+namespace perf {
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+
+// The states of all threads, kept after the threads exit for the reports.
+static std::mutex               span_registry_mutex;
+static std::vector<SpanThread*> span_threads;
+
+// The state of the calling thread, shared by all the modules of the process that inline the spans.
+static thread_local SpanThread* span_thread_owner = nullptr;
+
+// A path of the merged call tree.
+struct span_merged_t {
+    std::string                     name;
+    std::map<std::string,size_t>    children;
+    uint64_t                        count = 0;
+    uint64_t                        inclusive_ns = 0;
+    uint64_t                        children_ns = 0;
+    uint64_t                        max_ns = 0;
+    uint64_t                        allocations = 0;
+    uint64_t                        allocated_bytes = 0;
+    std::vector<uint64_t>           histogram = std::vector<uint64_t>(WS_METRICS_HISTOGRAM_BUCKETS,0);
+};
+
+static uint64_t histogram_percentile(const std::vector<uint64_t>& histogram, uint64_t count, double p) {
+    if (count == 0) {
+        return 0;
+    }
+    const uint64_t target = static_cast<uint64_t>(p * count);
+    uint64_t cumulative = 0;
+    for (uint32_t b = 0; b < histogram.size(); b++) {
+        cumulative += histogram[b];
+        if (cumulative > target) {
+            return metrics_histogram_upper_bound(b);
+        }
+    }
+    return metrics_histogram_upper_bound(WS_METRICS_HISTOGRAM_BUCKETS - 1);
+}
+
+/**
+ * @endcond
+ */
+
+SpanThread* span_thread() {
+    if (span_thread_owner != nullptr) {
+        return span_thread_owner;
+    }
+    // the profiler's own allocations are not forbidden.
+    const uint32_t forbidden = alloc_thread_counters.forbidden;
+    alloc_thread_counters.forbidden = 0;
+    SpanThread* thread = new SpanThread();
+    thread->nodes.emplace_back();
+    thread->nodes[0].name = "";
+    thread->depth = 0;
+    {
+        std::lock_guard<std::mutex> lck(span_registry_mutex);
+        span_threads.push_back(thread);
+    }
+    span_thread_owner = thread;
+    alloc_thread_counters.forbidden = forbidden;
+    return thread;
+}
+
+uint32_t span_add_child(SpanThread* thread, uint32_t parent, const char* name) {
+    AllocCounters& allocs = alloc_thread_counters;
+    const AllocCounters before = allocs;
+    allocs.forbidden = 0;
+    uint32_t node;
+    {
+        std::lock_guard<std::mutex> lck(thread->mutex);
+        node = static_cast<uint32_t>(thread->nodes.size());
+        thread->nodes.emplace_back();
+        thread->nodes[node].name            = name;
+        thread->nodes[node].parent          = parent;
+        thread->nodes[node].first_child     = 0;
+        thread->nodes[node].next_sibling    = thread->nodes[parent].first_child;
+        thread->nodes[parent].first_child   = node;
+    }
+    allocs.forbidden = before.forbidden;
+    // the profiler's own allocations are not the open spans'.
+    const uint32_t depth = std::min<uint32_t>(thread->depth,WS_SPAN_MAX_DEPTH);
+    for (uint32_t i = 0; i < depth; i++) {
+        thread->stack[i].start_allocations      += allocs.allocations - before.allocations;
+        thread->stack[i].start_allocated_bytes  += allocs.allocated_bytes - before.allocated_bytes;
+    }
+    return node;
+}
+
+std::vector<SpanStats> SpanProfiler::snapshot() {
+    // merge the trees by path
+    std::vector<span_merged_t> merged(1);
+    std::lock_guard<std::mutex> lck(span_registry_mutex);
+    for (auto thread: span_threads) {
+        std::lock_guard<std::mutex> thread_lck(thread->mutex);
+        // (node, merged node) pairs to visit
+        std::vector<std::pair<uint32_t,size_t>> stack{{0,0}};
+        while (!stack.empty()) {
+            auto [node,target] = stack.back();
+            stack.pop_back();
+            for (uint32_t child = thread->nodes[node].first_child; child != 0;
+                 child = thread->nodes[child].next_sibling) {
+                const SpanNode& source = thread->nodes[child];
+                auto found = merged[target].children.find(source.name);
+                size_t index;
+                if (found == merged[target].children.end()) {
+                    index = merged.size();
+                    merged[target].children.emplace(source.name,index);
+                    merged.emplace_back();
+                    merged[index].name = source.name;
+                } else {
+                    index = found->second;
+                }
+                span_merged_t& path = merged[index];
+                path.count          += source.count.load(std::memory_order_relaxed);
+                path.inclusive_ns   += source.inclusive_ns.load(std::memory_order_relaxed);
+                path.children_ns    += source.children_ns.load(std::memory_order_relaxed);
+                path.max_ns         = std::max(path.max_ns,source.max_ns.load(std::memory_order_relaxed));
+                path.allocations    += source.allocations.load(std::memory_order_relaxed);
+                path.allocated_bytes+= source.allocated_bytes.load(std::memory_order_relaxed);
+                for (uint32_t b = 0; b < WS_METRICS_HISTOGRAM_BUCKETS; b++) {
+                    path.histogram[b] += source.histogram[b].load(std::memory_order_relaxed);
+                }
+                stack.push_back({child,index});
+            }
+        }
+    }
+
+    // depth-first, the heaviest child first
+    std::vector<SpanStats> stats;
+    std::vector<std::tuple<size_t,std::string,uint32_t>> stack{{0,"",0}};
+    while (!stack.empty()) {
+        auto [index,prefix,depth] = stack.back();
+        stack.pop_back();
+        const span_merged_t& path = merged[index];
+        std::string full_path = prefix;
+        if (index != 0) {
+            full_path = prefix.empty() ? path.name : prefix + ";" + path.name;
+        }
+        // the paths not seen since the last reset are skipped.
+        if (index != 0 && path.count > 0) {
+            stats.push_back({full_path,depth,path.count,path.inclusive_ns,
+                             path.inclusive_ns - std::min(path.children_ns,path.inclusive_ns),
+                             std::min(histogram_percentile(path.histogram,path.count,0.5),path.max_ns),
+                             std::min(histogram_percentile(path.histogram,path.count,0.99),path.max_ns),
+                             path.max_ns,path.allocations,path.allocated_bytes});
+        }
+        std::vector<size_t> children;
+        for (auto& child: path.children) {
+            children.push_back(child.second);
+        }
+        // pushed lightest first, so that the heaviest is visited first.
+        std::sort(children.begin(),children.end(),[&merged](size_t a, size_t b) {
+            return merged[a].inclusive_ns < merged[b].inclusive_ns;
+        });
+        for (auto child: children) {
+            stack.push_back({child,full_path,index == 0 ? 0 : depth + 1});
+        }
+    }
+    return stats;
+}
+
+std::string SpanProfiler::report() {
+    auto stats = snapshot();
+    uint64_t total_ns = 0;
+    for (auto& path: stats) {
+        if (path.depth == 0) {
+            total_ns += path.inclusive_ns;
+        }
+    }
+    // the allocation columns are only shown when they are counted.
+    const bool allocs = alloc_hooks_installed();
+    std::ostringstream text;
+    text << std::setw(14) << "inclusive(us)" << std::setw(8) << "incl%" << std::setw(14) << "exclusive(us)"
+         << std::setw(12) << "count" << std::setw(12) << "p50(ns)" << std::setw(12) << "p99(ns)"
+         << std::setw(12) << "max(ns)";
+    if (allocs) {
+        text << std::setw(12) << "allocs" << std::setw(14) << "alloc(bytes)";
+    }
+    text << "  span" << std::endl;
+    for (auto& path: stats) {
+        text << std::setw(14) << path.inclusive_ns / 1000
+             << std::setw(8) << std::fixed << std::setprecision(1)
+             << (total_ns > 0 ? 100.0 * path.inclusive_ns / total_ns : 0.0)
+             << std::setw(14) << path.exclusive_ns / 1000 << std::setw(12) << path.count
+             << std::setw(12) << path.p50_ns << std::setw(12) << path.p99_ns << std::setw(12) << path.max_ns;
+        if (allocs) {
+            text << std::setw(12) << path.allocations << std::setw(14) << path.allocated_bytes;
+        }
+        text << "  " << std::string(path.depth * 2,' ') << path.path.substr(path.path.rfind(';') + 1) << std::endl;
+    }
+    uint64_t overflows = 0;
+    {
+        std::lock_guard<std::mutex> lck(span_registry_mutex);
+        for (auto thread: span_threads) {
+            overflows += thread->overflows.load(std::memory_order_relaxed);
+        }
+    }
+    if (overflows > 0) {
+        text << "# " << overflows << " spans deeper than " << WS_SPAN_MAX_DEPTH << " are not recorded." << std::endl;
+    }
+    return text.str();
+}
+
+std::string SpanProfiler::collapsed() {
+    std::ostringstream text;
+    for (auto& path: snapshot()) {
+        if (path.exclusive_ns > 0) {
+            text << path.path << " " << path.exclusive_ns << "\n";
+        }
+    }
+    return text.str();
+}
+
+void SpanProfiler::reset() {
+    std::lock_guard<std::mutex> lck(span_registry_mutex);
+    for (auto thread: span_threads) {
+        std::lock_guard<std::mutex> thread_lck(thread->mutex);
+        for (auto& node: thread->nodes) {
+            node.count.store(0,std::memory_order_relaxed);
+            node.inclusive_ns.store(0,std::memory_order_relaxed);
+            node.children_ns.store(0,std::memory_order_relaxed);
+            node.max_ns.store(0,std::memory_order_relaxed);
+            node.allocations.store(0,std::memory_order_relaxed);
+            node.allocated_bytes.store(0,std::memory_order_relaxed);
+            for (auto& bucket: node.histogram) {
+                bucket.store(0,std::memory_order_relaxed);
+            }
+        }
+        thread->overflows.store(0,std::memory_order_relaxed);
+    }
+}
+
+}
+}
@@ -1,207 +1,284 @@
 #include <wsong/config.h>
 #include <wsong/perf/timing.h>
+#include <wsong/perf/timing.hpp>
 
 #include <memory>
+#include <mutex>
 #include <string>
 #include <fstream>
+#include <stdexcept>
+#include <vector>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <algorithm>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <asm-generic/hugetlb_encode.h>
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#endif
 
 namespace wsong {
-
-class Timestamp {
-private:
-    /**
-     * @brief Timestamp storage
-     * -# tag id
-     * -# user data 1
-     * -# user data 2
-     * -# timestamp in nanosecond
-     */
-    uint64_t*           _log;
-
-    /**
-     * @brief capacity (in entry number) of the log
-     */
-    size_t              capacity;
-
-    /**
-     * @brief the current entry position
-     */
-    size_t              position;
-
-    /**
-     * @brief Timestamp spinlock
-     */
-    pthread_spinlock_t  lck;
-
-    /**
-     * @brief Constructor
-     * @param[in]   num_entries   The number of entries in the timestamp, defaulted to 2^20.
-     */
-    Timestamp(size_t num_entries = 0);
-
-    /**
-     * @brief Log the timestamp
-     *
-     * @param[in]   tag     Event tag, a.k.a event identifier.
-     * @param[in]   u1      User data 1.
-     * @param[in]   u2      User data 2.
-     * @param[in]   u3      User data 3.
-     * @param[in]   u3      User data 4.
-     */
-    void instance_log(uint64_t tag, uint64_t u1, uint64_t u2, uint64_t u3, uint64_t u4);
-
-    /**
-     * @brief Flush the timestamps into a file
-     *
-     * @param[in]   filename    The name of the file.
-     * @param[in]   clear       clear the log after save if `clear` is `true`.
-     */
-    void instance_save(const std::string& filename, bool clear=true);
-
-    /**
-     * @brief Clear the in-memory timestamps
-     */
-    void instance_clear();
-
-    /**
-     * @brief the timestamp singleton.
-     */
-    static Timestamp _t;
-
+namespace perf {
+
+/**
+ * @cond    DoxygenSuppressed
+ */
+
+// The buffers of all threads, live or retired, protected by the registry mutex. The buffers are never freed: a
+// retired buffer goes back to the free list when its thread exits, and the next new thread appends to it, so a process
+// has as many buffers as it ever had threads punching at the same time. The events of the exited thread stay until
+// they are saved, cleared, or overwritten like the thread's own earliest events.
+static std::mutex                   timing_registry_mutex;
+static std::vector<TimingBuffer*>   timing_buffers;
+static std::vector<TimingBuffer*>   timing_free_buffers;
+
+// Retires the buffer when its thread exits.
+class TimingBufferOwner {
 public:
-    /**
-     * @brief The destructor
-     */
-    virtual ~Timestamp();
-
-    /**
-     * @brief log timestamp
-     *
-     * @param[in]   tag     Event tag, a.k.a event identifier.
-     * @param[in]   u1      User data 1.
-     * @param[in]   u2      User data 2.
-     * @param[in]   u2      User data 3.
-     * @param[in]   u2      User data 4.
-     */
-    static inline void log(uint64_t tag, uint64_t u1, uint64_t u2, uint64_t u3, uint64_t u4) {
-        _t.instance_log(tag,u1,u2,u3,u4);
+    TimingBuffer* buffer = nullptr;
+    ~TimingBufferOwner() {
+        if (buffer != nullptr) {
+            std::lock_guard<std::mutex> lck(timing_registry_mutex);
+            buffer->retired.store(true,std::memory_order_release);
+            timing_free_buffers.push_back(buffer);
+            // a punch from a later thread-local destructor takes a new buffer instead of sharing this one.
+            buffer = nullptr;
+            timing_buffer_cache = nullptr;
+        }
     }
+};
 
-    /**
-     * @brief Flush the timestamps into a file
-     *
-     * @param[in]   filename    Thename of the file.
-     * @param[in]   clear       Clear the log after save if `clear` is `true`.
-     */
-    static inline void save(const std::string& filename, bool clear=true) {
-        _t.instance_save(filename,clear);
-    }
+// The buffer of the calling thread, shared by all the modules of the process that inline the punch.
+static thread_local TimingBufferOwner timing_buffer_owner;
 
-    /**
-     * @brief clear the timestamps.
-     */
-    static inline void clear() {
-        _t.instance_clear();
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE     (23)
+#endif
+
+#define TIMING_LOG_BYTES(cap)   ((cap) * WS_TIMING_EVENT_WORDS * sizeof(uint64_t))
+#define TIMING_MAX_NODES        (1024)
+#define TIMING_MASK_BITS        (8 * sizeof(unsigned long))
+
+// The NUMA node of the cpu running the calling thread, -1 if unknown.
+static int timing_current_node() {
+#if defined(__linux__)
+    unsigned int cpu, node;
+    if (syscall(SYS_getcpu,&cpu,&node,nullptr) == 0) {
+        return static_cast<int>(node);
     }
-};
+#endif
+    return -1;
+}
 
-Timestamp::Timestamp(size_t num_entries):
-    _log(nullptr),capacity(0),position(0) {
-    // lock it
-    pthread_spin_init(&lck,PTHREAD_PROCESS_PRIVATE);
-    pthread_spin_lock(&lck);
+// The number of events per thread: `WSONG_TIMING_CAPACITY` if it is a power of two, or the default.
+static uint64_t timing_capacity() {
+    static const uint64_t capacity = []() -> uint64_t {
+        const char* value = getenv("WSONG_TIMING_CAPACITY");
+        const uint64_t capacity = value != nullptr ? strtoull(value,nullptr,0) : 0;
+        return (capacity > 0 && (capacity & (capacity - 1)) == 0) ? capacity : WS_TIMING_DEFAULT_CAPACITY;
+    }();
+    return capacity;
+}
 
-    capacity = ((num_entries == 0) ? WS_TIMING_DEFAULT_CAPACITY : num_entries);
-    size_t capacity_in_bytes = (capacity<<3)*sizeof(uint64_t); // each log has 8 uint64_t values.
+// Prefer the pages of a log on a NUMA node, and move the pages already there if `move`.
+static void timing_bind(uint64_t* log, size_t bytes, int node, bool move) {
+#if defined(__linux__)
+    if (node < 0 || node >= TIMING_MAX_NODES) {
+        return;
+    }
+    unsigned long nodemask[TIMING_MAX_NODES / TIMING_MASK_BITS] = {0};
+    nodemask[node / TIMING_MASK_BITS] = 1ul << (node % TIMING_MASK_BITS);
+    // best effort: without it, the pages still come from the node of the thread touching them first.
+    // mbind() reads maxnode - 1 bits, hence the + 1.
+    syscall(SYS_mbind,log,bytes,MPOL_PREFERRED,nodemask,TIMING_MAX_NODES + 1,move ? MPOL_MF_MOVE : 0);
+#endif
+}
 
-    if ( posix_memalign(reinterpret_cast<void**>(&_log), std::max(CACHELINE_SIZE,64), capacity_in_bytes) ) {
-        throw std::runtime_error("Failed to allocate memory for log space.");
+// Map a log on the largest pages it fills: 1GB or 2MB pages from the hugetlb pool if it has enough free pages, or
+// regular pages which transparent huge pages may promote. The 1GB pages take a capacity of 16M events or more.
+static uint64_t* timing_map(size_t bytes, uint32_t& page_size) {
+    static const struct {
+        size_t  page_size;
+        int     flag;
+    } huge_pages[] = {{1ull<<30,HUGETLB_FLAG_ENCODE_1GB},{1ull<<21,HUGETLB_FLAG_ENCODE_2MB}};
+    for (const auto& huge: huge_pages) {
+        if (bytes % huge.page_size != 0) {
+            continue;
+        }
+        // the huge pages are reserved by mmap(), so it fails, instead of a later fault, if the pool is short.
+        void* log = mmap(nullptr,bytes,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|huge.flag,-1,0);
+        if (log != MAP_FAILED) {
+            page_size = static_cast<uint32_t>(huge.page_size);
+            return reinterpret_cast<uint64_t*>(log);
+        }
+    }
+    void* log = mmap(nullptr,bytes,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if (log == MAP_FAILED) {
+        throw std::runtime_error(std::string("Failed to allocate memory for log space:") + strerror(errno));
     }
+    madvise(log,bytes,MADV_HUGEPAGE);
+    page_size = static_cast<uint32_t>(sysconf(_SC_PAGESIZE));
+    return reinterpret_cast<uint64_t*>(log);
+}
 
-    // warm it up
-    for (int i=0; i<6; i++) {
-        bzero(_log,capacity_in_bytes);
+// Fault in all the pages of a log, so that no punch takes a page fault.
+static void timing_prefault(uint64_t* log, size_t bytes) {
+    if (madvise(log,bytes,MADV_POPULATE_WRITE) != 0) {
+        // before Linux 5.14
+        memset(log,0,bytes);
     }
+}
+
+static TimingBuffer* allocate_timing_buffer(int node) {
+    const uint64_t capacity = timing_capacity();
+    TimingBuffer* buffer = new TimingBuffer;
+    buffer->log     = timing_map(TIMING_LOG_BYTES(capacity),buffer->page_size);
+    timing_bind(buffer->log,TIMING_LOG_BYTES(capacity),node,false);
+    timing_prefault(buffer->log,TIMING_LOG_BYTES(capacity));
+    buffer->mask    = capacity - 1;
+    buffer->position.store(0,std::memory_order_relaxed);
+    buffer->start   = 0;
+    buffer->retired.store(false,std::memory_order_relaxed);
+    buffer->numa_node = node;
+    return buffer;
+}
 
-    // unlock
-    pthread_spin_unlock(&lck);
+/**
+ * @endcond
+ */
+
+TimingBuffer* timing_thread_buffer() {
+    if (timing_buffer_owner.buffer != nullptr) {
+        return timing_buffer_owner.buffer;
+    }
+    const int node = timing_current_node();
+    TimingBuffer* buffer = nullptr;
+    {
+        std::lock_guard<std::mutex> lck(timing_registry_mutex);
+        if (!timing_free_buffers.empty()) {
+            // a retired buffer of the same node, or the last one.
+            auto it = std::find_if(timing_free_buffers.begin(),timing_free_buffers.end(),
+                                   [node](const TimingBuffer* free_buffer) { return free_buffer->numa_node == node; });
+            if (it == timing_free_buffers.end()) {
+                it = timing_free_buffers.end() - 1;
+            }
+            buffer = *it;
+            timing_free_buffers.erase(it);
+            buffer->retired.store(false,std::memory_order_relaxed);
+        }
+    }
+    // mapping, binding, and prefaulting a whole log take milliseconds: keep them out of the registry lock, which the
+    // other threads take on their first punch and at exit.
+    if (buffer == nullptr) {
+        buffer = allocate_timing_buffer(node);
+        std::lock_guard<std::mutex> lck(timing_registry_mutex);
+        timing_buffers.push_back(buffer);
+    } else if (buffer->numa_node != node) {
+        timing_bind(buffer->log,TIMING_LOG_BYTES(buffer->mask + 1),node,true);
+        buffer->numa_node = node;
+    }
+    timing_buffer_owner.buffer = buffer;
+    return buffer;
 }
 
-void Timestamp::instance_log(uint64_t tag, uint64_t u1, uint64_t u2, uint64_t u3, uint64_t u4) {
-    struct timespec ts;
-    uint64_t ts_ns;
-    clock_gettime(CLOCK_REALTIME,&ts);
-    ts_ns = ts.tv_sec*1e9 + ts.tv_nsec;
-    pthread_spin_lock(&lck);
-
-    _log[((position%capacity)<<3)]      = tag;
-    _log[((position%capacity)<<3)+1]    = ts_ns;
-    _log[((position%capacity)<<3)+2]    = u1;
-    _log[((position%capacity)<<3)+3]    = u2;
-    _log[((position%capacity)<<3)+4]    = u3;
-    _log[((position%capacity)<<3)+5]    = u4;
-    // the 6-th and 6-th 64bit are researved for make each _log fit to a cacheline.
-    position ++;
-
-    pthread_spin_unlock(&lck);
+/**
+ * @cond    DoxygenSuppressed
+ */
+static void timing_clear() {
+    std::lock_guard<std::mutex> lck(timing_registry_mutex);
+    for (auto buffer: timing_buffers) {
+        buffer->start = buffer->position.load(std::memory_order_acquire);
+    }
 }
 
-void Timestamp::instance_save(const std::string& filename, bool clear) {
-    pthread_spin_lock(&lck);
+static void timing_save(const std::string& filename) {
+    std::lock_guard<std::mutex> lck(timing_registry_mutex);
     std::ofstream outfile(filename);
 
-    if (position>capacity) {
-        outfile << "# WARNING: due to the buffer capacity (" << capacity << " entries), "
-                << " the earliest " << (position-capacity) << " events are dropped."
+    // the range of each buffer to save
+    struct range_t {
+        const TimingBuffer* buffer;
+        uint64_t            begin;
+        uint64_t            end;
+    };
+    std::vector<range_t> ranges;
+    uint64_t total = 0;
+    uint64_t dropped = 0;
+    for (auto buffer: timing_buffers) {
+        const uint64_t end = buffer->position.load(std::memory_order_acquire);
+        const uint64_t capacity = buffer->mask + 1;
+        uint64_t begin = buffer->start;
+        if (end - begin > capacity) {
+            dropped += end - begin - capacity;
+            begin = end - capacity;
+        }
+        if (begin < end) {
+            ranges.push_back({buffer,begin,end});
+            total += end - begin;
+        }
+    }
+
+    if (dropped > 0) {
+        outfile << "# WARNING: due to the buffer capacity (" << timing_capacity() << " entries per thread), "
+                << " the earliest " << dropped << " events are dropped."
                 << std::endl;
     }
-    outfile << "# number of entries:" << position << std::endl;
+    outfile << "# number of entries:" << total + dropped << std::endl;
     outfile << "# tag tsns u1 u2 u3 u4" << std::endl;
-    size_t start_position = (position>capacity? (position%capacity):0);
-    for (size_t i=0;i<std::min(position,capacity);i++) {
-        outfile << _log[(((i+start_position)%capacity)<<3)+0] << " "
-                << _log[(((i+start_position)%capacity)<<3)+1] << " "
-                << _log[(((i+start_position)%capacity)<<3)+2] << " "
-                << _log[(((i+start_position)%capacity)<<3)+3] << " "
-                << _log[(((i+start_position)%capacity)<<3)+4] << " "
-                << _log[(((i+start_position)%capacity)<<3)+5] << std::endl;
-    }                                                                 
-    outfile.close();
-    pthread_spin_unlock(&lck);
 
-    if (clear) {
-        _t.clear();
+    // merge the threads by time, the events of a thread are already in order.
+    auto event_of = [](const range_t& range) {
+        return range.buffer->log + (range.begin & range.buffer->mask) * WS_TIMING_EVENT_WORDS;
+    };
+    std::vector<size_t> heap;
+    auto cmp = [&ranges,&event_of](size_t a, size_t b) {
+        return event_of(ranges[a])[1] > event_of(ranges[b])[1];
+    };
+    for (size_t i = 0; i < ranges.size(); i++) {
+        heap.push_back(i);
     }
-}
-
-void Timestamp::instance_clear() {
-    pthread_spin_lock(&lck);
-    position=0;
-    pthread_spin_unlock(&lck);
-}
-
-Timestamp::~Timestamp() {
-    if (_log != nullptr) {
-        free(_log);
+    std::make_heap(heap.begin(),heap.end(),cmp);
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(),heap.end(),cmp);
+        range_t& range = ranges[heap.back()];
+        const uint64_t* event = event_of(range);
+        const uint64_t num_user_data = std::min<uint64_t>(event[6],4);
+        outfile << event[0] << " " << event[1];
+        for (uint64_t i = 0; i < 4; i++) {
+            outfile << " " << (i < num_user_data ? event[2 + i] : 0);
+        }
+        outfile << "\n";
+        if (++ range.begin == range.end) {
+            heap.pop_back();
+        } else {
+            std::push_heap(heap.begin(),heap.end(),cmp);
+        }
     }
+    outfile.close();
 }
+/**
+ * @endcond
+ */
 
-Timestamp Timestamp::_t{};
-
+}//perf
 }//wsong
 
 void ws_timing_punch(const uint64_t tag, const uint64_t user_data1, const uint64_t user_data2, const uint64_t user_data3, const uint64_t user_data4) {
-    wsong::Timestamp::log(tag,user_data1,user_data2,user_data3,user_data4);
+    wsong::perf::timing_punch(tag,user_data1,user_data2,user_data3,user_data4);
 }
 
 void ws_timing_save(const char* filename) {
-    wsong::Timestamp::save(std::string{filename});
+    wsong::perf::timing_save(std::string{filename});
+    wsong::perf::timing_clear();
 }
 
 void ws_timing_clear() {
-    wsong::Timestamp::clear();
+    wsong::perf::timing_clear();
+}
+
+void ws_timing_prepare() {
+    wsong::perf::timing_thread_buffer();
 }